@@ -96,6 +96,8 @@ struct myuser_
   language_t *language;
 
   mowgli_list_t cert_fingerprints;
+
+  mowgli_list_t authcookies; /* see authcookie.c */
 };
 
 /* Keep this synchronized with mu_flags in libathemecore/flags.c */
@@ -170,6 +172,16 @@ struct mychan_
   char *mlock_key;
 
   unsigned int flags;
+
+  unsigned int chanacs_gen;	/* changes whenever chanacs changes */
+  unsigned int dynamic_chanacs;	/* number of exttarget chanacs */
+
+  chanacs_t **chanacs_by_entity;	/* hash chains keyed by entity pointer */
+  unsigned int chanacs_by_entity_size;	/* buckets, a power of two */
+  unsigned int chanacs_entities;	/* entity entries in chanacs_by_entity */
+  mowgli_list_t chanacs_indirect;	/* group and exttarget entries */
+  mowgli_patricia_t *chanacs_by_host;	/* hostmask -> chanacs_t */
+  mowgli_list_t chanacs_hosts;	/* hostmask entries only, linked by unode */
 };
 
 /* Keep this synchronized with mc_flags in libathemecore/flags.c */
@@ -209,6 +221,10 @@ struct chanacs_
 
 	mowgli_node_t    cnode;
 	mowgli_node_t    unode;
+	mowgli_node_t    inode;	/* mychan->chanacs_indirect */
+
+	chanacs_t *hnext;	/* mychan->chanacs_by_entity chain */
+	chanacs_t **hprev;
 
 	stringref setter;
 };
@@ -458,6 +474,8 @@ E bool chanacs_user_has_flag(mychan_t *mychan, user_t *u, unsigned int level);
 E unsigned int chanacs_user_flags(mychan_t *mychan, user_t *u);
 //inline bool chanacs_source_has_flag(mychan_t *mychan, sourceinfo_t *si, unsigned int level);
 E unsigned int chanacs_source_flags(mychan_t *mychan, sourceinfo_t *si);
+E void chanacs_cache_invalidate(mychan_t *mychan);
+E void chanacs_user_release(user_t *u);
 
 E chanacs_t *chanacs_open(mychan_t *mychan, myentity_t *mt, const char *hostmask, bool create, myentity_t *setter);
 //inline void chanacs_close(chanacs_t *ca);
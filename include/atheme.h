@@ -21,6 +21,8 @@
 #include "object.h"
 #include "connection.h"
 #include "res.h"
+#include "metrics.h"
+#include "profile.h"
 #include "hook.h"
 #include "hooktypes.h"
 #include "atheme_string.h"
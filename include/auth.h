@@ -14,6 +14,7 @@ E bool verify_password(myuser_t *mu, const char *password);
 
 E bool auth_module_loaded;
 E bool (*auth_user_custom)(myuser_t *mu, const char *password);
+E bool auth_user_unavailable;
 
 #endif
 
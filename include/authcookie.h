@@ -16,6 +16,8 @@ struct authcookie_ {
 	myuser_t *myuser;
 	time_t expire;
 	mowgli_node_t node;
+	mowgli_node_t unode;	/* myuser->authcookies */
+	char key[33];		/* index key, see authcookie_key() */
 };
 
 E void authcookie_init(void);
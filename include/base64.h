@@ -46,6 +46,17 @@
 extern size_t base64_encode(char const *src, size_t srclength, char *target, size_t targsize);
 extern size_t base64_decode(char const *src, char *target, size_t targsize);
 
+struct base64_codec {
+	const char *name;
+	size_t (*encode)(char const *src, size_t srclength, char *target, size_t targsize);
+	size_t (*decode)(char const *src, char *target, size_t targsize);
+	bool (*usable)(void);
+};
+
+/* available implementations, terminated by an entry with a NULL name */
+extern const struct base64_codec base64_codecs[];
+extern const struct base64_codec *base64_codec_select(const char *name);
+
 #endif /* BASE64_H */
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
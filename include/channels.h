@@ -26,6 +26,7 @@ struct channel_
 
   unsigned int nummembers;
   unsigned int numsvcmembers;
+  user_t **svcmembers; /* internal clients on the channel, in join order */
 
   time_t ts;
 
@@ -39,6 +40,8 @@ struct channel_
   unsigned int flags;
 
   mychan_t *mychan;
+
+  struct modestackdata *modestack; /* pending mode changes, see cmode.c */
 };
 
 /* struct for channel memberships */
@@ -170,6 +173,7 @@ E void channel_delete(channel_t *c);
 
 E chanuser_t *chanuser_add(channel_t *chan, const char *user);
 E void chanuser_delete(channel_t *chan, user_t *user);
+E void chanuser_delete_member(chanuser_t *cu);
 E chanuser_t *chanuser_find(channel_t *chan, user_t *user);
 
 E chanban_t *chanban_add(channel_t *chan, const char *mask, int type);
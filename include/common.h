@@ -165,6 +165,11 @@ void strshare_init(void);
 stringref strshare_get(const char *str);
 stringref strshare_ref(stringref str);
 void strshare_unref(stringref str);
+unsigned int strshare_hash(stringref str);
+unsigned int strshare_foldhash(stringref str);
+size_t strshare_len(stringref str);
+bool strshare_irceq(stringref a, stringref b);
+void strshare_refold(void);
 
 #endif
 
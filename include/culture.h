@@ -10,6 +10,8 @@
 #define CULTURE_H
 
 E const char *translation_get(const char *name);
+E const char *translation_gettext(const char *str);
+E void translation_invalidate(void);
 E void itranslation_create(const char *str, const char *trans);
 E void itranslation_destroy(const char *str);
 E void translation_create(const char *str, const char *trans);
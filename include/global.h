@@ -103,6 +103,9 @@ struct ConfOption
   bool clone_increase;  /* If the clone limit will increase based on # of identified clones */
 
   unsigned int uplink_sendq_limit;
+  unsigned int burst_join_rate;	/* bytes/sec of queued service joins, 0 = unlimited */
+  unsigned int slow_event_threshold;	/* ms before the watchdog reports, 0 = off */
+  char *uplink_capture;		/* file to log received uplink lines to */
 
   char *language;		/* default language */
 
@@ -142,6 +145,8 @@ struct cnt
   unsigned int operclass;
   unsigned int myuser_access;
   unsigned int myuser_name;
+  unsigned int modestack_changes;
+  unsigned int modestack_lines;
 };
 
 E struct cnt cnt;
@@ -14,6 +14,8 @@ typedef void (*hookfn_t)(void *data);
 struct hook_ {
 	stringref name;
 	mowgli_list_t hooks;
+	metric_t *metric;	/* these two are created on the first call */
+	profile_entry_t *profile;	/* with handlers */
 };
 
 E hook_t *hook_add_event(const char *);
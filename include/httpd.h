@@ -9,12 +9,19 @@
 #ifndef HTTPD_H
 #define HTTPD_H
 
+#include "datastream.h"
+
+/* Handlers are hashed by path in misc/httpd's httpd_paths patricia.
+ * POST bodies are passed to the handler once complete; handlers that
+ * set allow_get are also called for GET, with a NULL body.
+ */
 typedef struct path_handler_ path_handler_t;
 
 struct path_handler_
 {
 	const char *path;
 	void (*handler)(connection_t *, void *);
+	bool allow_get;
 };
 
 struct httpddata
@@ -26,11 +33,45 @@ struct httpddata
 	int length;
 	int lengthdone;
 	bool connection_close;
+	bool http11;
 	bool correct_content_type;
 	bool expect_100_continue;
 	bool sent_reply;
+	char if_none_match[128];
+	int file_fd;		/* file still being sent, or -1 */
+	off_t file_offset;
+	off_t file_left;
+	void *reqdata;		/* the path handler's state for this request */
 };
 
+/* Reply helpers, implemented in misc/httpd.  Modules other than
+ * misc/httpd get them through use_httpd_symbols().
+ *
+ * httpd_reply_header() formats the header of a 200 reply into buf and
+ * returns its length.  A negative length means the body is not known up
+ * front and will follow as httpd_reply_chunk() calls: chunked for
+ * HTTP/1.1 clients, delimited by closing the connection for anything
+ * older.  httpd_reply_no_content() is a reply with no body at all, e.g.
+ * to requests that want no answer.
+ */
+#ifndef HTTPD_MAIN
+size_t (*httpd_reply_header)(connection_t *cptr, char *buf, size_t size, const char *content_type, long length);
+void (*httpd_reply_start)(connection_t *cptr, const char *content_type, long length);
+void (*httpd_reply_chunk)(connection_t *cptr, const char *data, size_t len);
+void (*httpd_reply_no_content)(connection_t *cptr);
+void (*httpd_reply_end)(connection_t *cptr, bool chunked);
+
+static inline void use_httpd_symbols(module_t *m)
+{
+	MODULE_TRY_REQUEST_DEPENDENCY(m, "misc/httpd");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_header, "misc/httpd", "httpd_reply_header");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_start, "misc/httpd", "httpd_reply_start");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_chunk, "misc/httpd", "httpd_reply_chunk");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_no_content, "misc/httpd", "httpd_reply_no_content");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_end, "misc/httpd", "httpd_reply_end");
+}
+#endif
+
 #endif
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs ts=8 sw=8 noexpandtab
@@ -12,7 +12,8 @@
 #ifdef ENABLE_NLS
 # include <locale.h>
 # include <libintl.h>
-# define _(String) gettext (String)
+/* gettext() behind a cache keyed by the string's address, see culture.c */
+# define _(String) translation_gettext (String)
 # ifdef gettext_noop
 #  define N_(String) gettext_noop (String)
 # else
@@ -52,9 +52,34 @@ E void irccasecanon(char *);
 E void strcasecanon(char *);
 E void noopcanon(char *);
 
+/* casemapping kernels; the vector ones only handle rfc1459 */
+struct match_kernel {
+	const char *name;
+	int (*cmp)(const char *s1, const char *s2);
+	int (*ncmp)(const char *s1, const char *s2, size_t n);
+	void (*canon)(char *str);
+	const char *(*find)(const char *hay, size_t haylen, const char *needle, size_t len);
+	bool (*usable)(void);
+};
+
+/* available implementations, terminated by an entry with a NULL name */
+E const struct match_kernel match_kernels[];
+E const struct match_kernel *match_kernel_select(const char *name);
+
 E int match(const char *, const char *);
 E char *collapse(char *);
 
+/* matchset.c */
+typedef struct matchset_ matchset_t;
+
+#define MATCHSET_LITERAL	1 /* compare the whole string, not as a mask */
+
+E matchset_t *matchset_create(void);
+E void matchset_add(matchset_t *ms, const char *mask, void *data, unsigned int flags);
+E void *matchset_find(matchset_t *ms, const char *name, bool (*usable)(void *data));
+E void matchset_clear(matchset_t *ms);
+E void matchset_destroy(matchset_t *ms);
+
 /* regex_create() flags */
 #define AREGEX_ICASE	1 /* case insensitive */
 #define AREGEX_PCRE	2 /* use libpcre engine */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Counters, gauges and latency histograms.
+ *
+ */
+
+#ifndef ATHEME_METRICS_H
+#define ATHEME_METRICS_H
+
+typedef enum {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM
+} metric_type_t;
+
+/* upper bounds, in seconds, of the histogram buckets */
+#define METRIC_BUCKETS 13
+E const double metric_buckets[METRIC_BUCKETS];
+
+typedef struct metric_family_ metric_family_t;
+typedef struct metric_ metric_t;
+
+struct metric_ {
+	metric_family_t *family;
+	char *labels;			/* rendered, e.g. service="nickserv" */
+
+	double value;			/* counter/gauge value, histogram sum */
+	double (*fn)(void);		/* gauge read at export time */
+	unsigned long count;
+	unsigned long buckets[METRIC_BUCKETS];
+
+	mowgli_node_t node;
+};
+
+/* Series are found or created by family name and label string; the
+ * same (family, labels) pair always returns the same metric_t, so
+ * callers may either keep the pointer or look it up every time.
+ * Label values are copied verbatim and must not contain '"' or '\\'.
+ */
+E metric_t *metric_counter(const char *family, const char *help, const char *labels);
+E metric_t *metric_gauge(const char *family, const char *help, const char *labels);
+E metric_t *metric_histogram(const char *family, const char *help, const char *labels);
+E metric_t *metric_callback(metric_type_t type, const char *family, const char *help, const char *labels, double (*fn)(void));
+E void metric_delete(metric_t *m);
+
+E double metric_clock(void);
+E void metrics_render(mowgli_string_t *out);
+E void metrics_init(void);
+
+static inline void metric_inc(metric_t *m)
+{
+	m->value++;
+}
+
+static inline void metric_add(metric_t *m, double v)
+{
+	m->value += v;
+}
+
+static inline void metric_set(metric_t *m, double v)
+{
+	m->value = v;
+}
+
+static inline void metric_observe(metric_t *m, double seconds)
+{
+	unsigned int i;
+
+	for (i = 0; i < METRIC_BUCKETS; i++)
+		if (seconds <= metric_buckets[i])
+		{
+			m->buckets[i]++;
+			break;
+		}
+	m->value += seconds;
+	m->count++;
+}
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -99,6 +99,11 @@ E void (*wallops_sts)(const char *text);
  * modes is a convenience argument giving the simple modes with parameters
  * do not rely upon chanuser_find(c,u) */
 E void (*join_sts)(channel_t *c, user_t *u, bool isnew, char *modes);
+/* join a channel with several clients on the services server at once
+ * semantics are as join_sts(); pack as many clients per line as the
+ * protocol allows
+ * generic_join_burst_sts() calls join_sts() for each client */
+E void (*join_burst_sts)(channel_t *c, user_t **users, size_t count, bool isnew, char *modes);
 /* lower the TS of a channel, joining it with the given client on the
  * services server (opped), replacing the current simple modes with the
  * ones stored in the channel_t and clearing all other statuses
@@ -220,7 +225,8 @@ E void (*sasl_sts) (char *target, char mode, char *data);
 E void (*sasl_mechlist_sts)(const char *mechlist);
 /* find next channel ban (or other ban-like mode) matching user */
 E mowgli_node_t *(*next_matching_ban)(channel_t *c, user_t *u, int type, mowgli_node_t *first);
-/* find next host channel access matching user */
+/* find next host channel access matching user; first is a node of either
+ * mc->chanacs or mc->chanacs_hosts (the latter skips account entries) */
 E mowgli_node_t *(*next_matching_host_chanacs)(mychan_t *mc, user_t *u, mowgli_node_t *first);
 /* check a nickname for validity; normally you don't need to override this */
 E bool (*is_valid_nick)(const char *nick);
@@ -248,6 +254,7 @@ E void generic_invite_sts(user_t *source, user_t *target, channel_t *channel);
 E void generic_quit_sts(user_t *u, const char *reason);
 E void generic_wallops_sts(const char *text);
 E void generic_join_sts(channel_t *c, user_t *u, bool isnew, char *modes);
+E void generic_join_burst_sts(channel_t *c, user_t **users, size_t count, bool isnew, char *modes);
 E void generic_chan_lowerts(channel_t *c, user_t *u);
 E void generic_kick(user_t *source, channel_t *c, user_t *u, const char *reason);
 E void generic_msg(const char *from, const char *target, const char *fmt, ...);
@@ -17,6 +17,7 @@ struct pcommand_ {
 	void	(*handler)(sourceinfo_t *si, int parc, char *parv[]);
 	int	minparc;
 	int	sourcetype;
+	profile_entry_t *profile;	/* irc/<token> */
 };
 
 /* values for sourcetype */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Always-on execution profiler for commands, hooks and database rows,
+ * and the slow event watchdog.
+ *
+ */
+
+#ifndef ATHEME_PROFILE_H
+#define ATHEME_PROFILE_H
+
+/* bucket 0 holds durations under 1us, bucket i those in [2^(i-1), 2^i)
+ * microseconds; the last one catches everything longer */
+#define PROFILE_BUCKETS 32
+
+typedef struct profile_entry_ profile_entry_t;
+
+struct profile_entry_ {
+	char *path;			/* e.g. chanserv/flags, hook/user_add */
+	unsigned long count;
+	uint64_t total_us;
+	uint64_t max_us;
+	unsigned int buckets[PROFILE_BUCKETS];
+};
+
+E mowgli_patricia_t *profile_entries;
+
+E uint64_t profile_now(void);
+E profile_entry_t *profile_entry(const char *path);
+E uint64_t profile_percentile(profile_entry_t *pe, unsigned int pct);
+E void profile_reset(void);
+E void profile_init(void);
+
+/* the watchdog reports operations that ran over general::slow_event_threshold;
+ * watchdog_reports counts reports so that an enclosing check can tell an
+ * inner one already named the culprit */
+E unsigned int watchdog_reports;
+E bool watchdog_check(uint64_t us, const char *fmt, ...) PRINTFLIKE(2, 3);
+E void watchdog_turn_begin(void);
+E void watchdog_turn_end(void);
+
+static inline void profile_record(profile_entry_t *pe, uint64_t us)
+{
+	unsigned int i;
+
+#ifdef __GNUC__
+	i = us ? 64 - __builtin_clzll(us) : 0;
+#else
+	uint64_t v;
+
+	for (i = 0, v = us; v != 0; v >>= 1)
+		i++;
+#endif
+	if (i >= PROFILE_BUCKETS)
+		i = PROFILE_BUCKETS - 1;
+
+	pe->buckets[i]++;
+	pe->count++;
+	pe->total_us += us;
+	if (us > pe->max_us)
+		pe->max_us = us;
+}
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
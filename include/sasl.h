@@ -24,6 +24,10 @@ struct sasl_session_ {
   char *username;
   char *certfp;
   char *authzid;
+
+  time_t deadline;
+  mowgli_node_t wnode; /* see session_schedule() in saslserv/main.c */
+  struct timeval started;
 };
 
 struct sasl_message_ {
@@ -55,7 +59,7 @@ typedef struct {
 #define ASASL_MORE 1 /* everything looks good so far, but we're not done yet */
 #define ASASL_DONE 2 /* client successfully authenticated */
 
-#define ASASL_MARKED_FOR_DELETION   1 /* see delete_stale() in saslserv/main.c */
+#define ASASL_MARKED_FOR_DELETION   1 /* unused, sessions expire by deadline */
 #define ASASL_NEED_LOG              2 /* user auth success needs to be logged still */
 
 #endif
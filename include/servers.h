@@ -50,6 +50,17 @@ typedef struct {
 	/* space for reason etc here */
 } hook_server_delete_t;
 
+/* Fired once when a server splits, before anything is torn down, with
+ * every user behind it (all flagged UF_SPLIT).  Modules that handle
+ * the users here may skip split users in their user_delete and
+ * channel_part hooks.
+ */
+typedef struct {
+	server_t *s;
+	user_t **users;
+	unsigned int count;
+} hook_server_split_t;
+
 #define SERVER_NAME(serv)	((serv)->sid ? (serv)->sid : (serv)->name)
 #define ME			(ircd->uses_uid ? me.numeric : me.name)
 
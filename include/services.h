@@ -104,6 +104,9 @@ E void (*try_kick)(user_t *source, channel_t *chan, user_t *target, const char *
 E void kill_user(user_t *source, user_t *victim, const char *fmt, ...) PRINTFLIKE(3, 4);
 E void introduce_enforcer(const char *nick);
 E void join(const char *chan, const char *nick);
+E void join_burst(const char *chan, const char *nick, const char *partnick);
+E void join_burst_clear(void);
+E unsigned int join_burst_pending(void);
 E void joinall(const char *name);
 E void part(const char *chan, const char *nick);
 E void partall(const char *name);
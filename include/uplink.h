@@ -49,6 +49,7 @@ E struct timeval burstime;
 
 E void (*parse)(char *line);
 E void irc_handle_connect(connection_t *cptr);
+E void capture_init(void);
 
 /* send.c */
 E int sts(const char *fmt, ...) PRINTFLIKE(1, 2);
@@ -38,6 +38,12 @@ struct user_
 	mowgli_node_t snode; /* for server_t.userlist */
 
 	char *certfp; /* client certificate fingerprint */
+
+	/* what chanacs_user_flags() last saw of this user, see account.c */
+	unsigned int chanacs_gen;
+	stringref chanacs_seen[6];
+	myuser_t *chanacs_myuser;
+	bool chanacs_waitauth;
 };
 
 #define FLOOD_MSGS_FACTOR 256
@@ -55,6 +61,7 @@ struct user_
 #define UF_WASENFORCED 0x00002000 /* this user was FNCed once already */
 #define UF_DEAF        0x00004000 /* user does not receive channel msgs */
 #define UF_SERVICE     0x00008000 /* user is a service (e.g. +S on charybdis) */
+#define UF_SPLIT       0x00010000 /* being removed as part of a netsplit */
 
 #define CLIENT_NAME(user)	((user)->uid != NULL ? (user)->uid : (user)->nick)
 
@@ -208,6 +208,10 @@ void myuser_delete(myuser_t *mu)
 
 	hook_call_myuser_delete(mu);
 
+	/* a new account could be allocated at this address and logged in
+	 * to by the same users before their cached flags are looked at */
+	chanacs_cache_invalidate(NULL);
+
 	/* log them out */
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, mu->logins.head)
 	{
@@ -978,6 +982,10 @@ static void mychan_delete(mychan_t *mc)
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, mc->chanacs.head)
 		object_unref(n->data);
 
+	free(mc->chanacs_by_entity);
+	if (mc->chanacs_by_host != NULL)
+		mowgli_patricia_destroy(mc->chanacs_by_host, NULL, NULL);
+
 	metadata_delete_all(mc);
 
 	mowgli_patricia_delete(mclist, mc->name);
@@ -1005,6 +1013,7 @@ mychan_t *mychan_add(char *name)
 	mc->name = strshare_get(name);
 	mc->registered = CURRTIME;
 	mc->chan = channel_find(name);
+	chanacs_cache_invalidate(mc);
 
 	if (mc->chan != NULL)
 		mc->chan->mychan = mc;
@@ -1342,6 +1351,133 @@ const char *mychan_get_sts_mlock(mychan_t *mc)
  * C H A N A C S *
  *****************/
 
+/*
+ * Each mychan keeps two lookup indexes next to its chanacs list: a hash
+ * keyed by the entity pointer and a patricia keyed by the (case-folded)
+ * hostmask.  Hostmask entries are additionally linked into
+ * mychan->chanacs_hosts through their otherwise unused unode, so that
+ * mask matching does not have to walk every account entry, and group and
+ * exttarget entries, which can match entities other than their own, into
+ * mychan->chanacs_indirect.
+ *
+ * Every entity entry, duplicates included, is on its bucket's chain, so
+ * entity lookups need no fallback and entries unlink in O(1).  The host
+ * index points at one of any duplicate hostmask entries.
+ */
+#define CHANACS_BY_ENTITY_MIN	8
+
+static unsigned int chanacs_entity_bucket(const mychan_t *mc, const myentity_t *mt)
+{
+	uintptr_t k = (uintptr_t)mt;
+
+	k ^= (k >> 4) ^ (k >> 12) ^ (k >> 20);
+
+	return k & (mc->chanacs_by_entity_size - 1);
+}
+
+static void chanacs_entity_link(mychan_t *mc, chanacs_t *ca)
+{
+	chanacs_t **head = &mc->chanacs_by_entity[chanacs_entity_bucket(mc, ca->entity)];
+
+	ca->hnext = *head;
+	ca->hprev = head;
+	if (*head != NULL)
+		(*head)->hprev = &ca->hnext;
+	*head = ca;
+}
+
+static void chanacs_entity_resize(mychan_t *mc, unsigned int size)
+{
+	chanacs_t **old = mc->chanacs_by_entity;
+	unsigned int i, oldsize = mc->chanacs_by_entity_size;
+	chanacs_t *ca, *next, **tail;
+
+	mc->chanacs_by_entity = scalloc(size, sizeof *mc->chanacs_by_entity);
+	mc->chanacs_by_entity_size = size;
+
+	/* append rather than push, so every chain stays newest first */
+	for (i = 0; i < oldsize; i++)
+		for (ca = old[i]; ca != NULL; ca = next)
+		{
+			next = ca->hnext;
+
+			tail = &mc->chanacs_by_entity[chanacs_entity_bucket(mc, ca->entity)];
+			while (*tail != NULL)
+				tail = &(*tail)->hnext;
+
+			ca->hnext = NULL;
+			ca->hprev = tail;
+			*tail = ca;
+		}
+
+	free(old);
+}
+
+static void chanacs_index_add(chanacs_t *ca)
+{
+	mychan_t *mc = ca->mychan;
+
+	if (ca->entity != NULL)
+	{
+		if (mc->chanacs_entities >= mc->chanacs_by_entity_size)
+			chanacs_entity_resize(mc, mc->chanacs_by_entity_size ? mc->chanacs_by_entity_size * 2 : CHANACS_BY_ENTITY_MIN);
+
+		chanacs_entity_link(mc, ca);
+		mc->chanacs_entities++;
+
+		if (!isuser(ca->entity))
+			mowgli_node_add(ca, &ca->inode, &mc->chanacs_indirect);
+
+		return;
+	}
+
+	if (mc->chanacs_by_host == NULL)
+		mc->chanacs_by_host = mowgli_patricia_create(strcasecanon);
+
+	if (mowgli_patricia_retrieve(mc->chanacs_by_host, ca->host) == NULL)
+		mowgli_patricia_add(mc->chanacs_by_host, ca->host, ca);
+
+	mowgli_node_add(ca, &ca->unode, &mc->chanacs_hosts);
+}
+
+static void chanacs_index_delete(chanacs_t *ca)
+{
+	mychan_t *mc = ca->mychan;
+	mowgli_node_t *n;
+	chanacs_t *ca2;
+
+	if (ca->entity != NULL)
+	{
+		*ca->hprev = ca->hnext;
+		if (ca->hnext != NULL)
+			ca->hnext->hprev = ca->hprev;
+		mc->chanacs_entities--;
+
+		if (!isuser(ca->entity))
+			mowgli_node_delete(&ca->inode, &mc->chanacs_indirect);
+
+		return;
+	}
+
+	mowgli_node_delete(&ca->unode, &mc->chanacs_hosts);
+
+	if (mc->chanacs_by_host == NULL || mowgli_patricia_retrieve(mc->chanacs_by_host, ca->host) != ca)
+		return;
+
+	mowgli_patricia_delete(mc->chanacs_by_host, ca->host);
+
+	MOWGLI_ITER_FOREACH(n, mc->chanacs_hosts.head)
+	{
+		ca2 = n->data;
+
+		if (!strcasecmp(ca2->host, ca->host))
+		{
+			mowgli_patricia_add(mc->chanacs_by_host, ca2->host, ca2);
+			break;
+		}
+	}
+}
+
 /* private destructor for chanacs_t */
 static void chanacs_delete(chanacs_t *ca)
 {
@@ -1352,6 +1488,7 @@ static void chanacs_delete(chanacs_t *ca)
 		slog(LG_DEBUG, "chanacs_delete(): %s -> %s [%s]", ca->mychan->name,
 			ca->entity != NULL ? entity(ca->entity)->name : ca->host,
 			ca->entity != NULL ? "entity" : "hostmask");
+	chanacs_index_delete(ca);
 	mowgli_node_delete(&ca->cnode, &ca->mychan->chanacs);
 
 	if (ca->entity != NULL)
@@ -1359,9 +1496,14 @@ static void chanacs_delete(chanacs_t *ca)
 		mowgli_node_delete(&ca->unode, &ca->entity->chanacs);
 
 		if (isdynamic(ca->entity))
+		{
+			ca->mychan->dynamic_chanacs--;
 			object_unref(ca->entity);
+		}
 	}
 
+	chanacs_cache_invalidate(ca->mychan);
+
 	if (ca->setter != NULL)
 		strshare_unref(ca->setter);
 
@@ -1419,6 +1561,11 @@ chanacs_t *chanacs_add(mychan_t *mychan, myentity_t *mt, unsigned int level, tim
 
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
 	mowgli_node_add(ca, &ca->unode, &mt->chanacs);
+	chanacs_index_add(ca);
+
+	if (isdynamic(mt))
+		mychan->dynamic_chanacs++;
+	chanacs_cache_invalidate(mychan);
 
 	cnt.chanacs++;
 
@@ -1468,6 +1615,9 @@ chanacs_t *chanacs_add_host(mychan_t *mychan, const char *host, unsigned int lev
 	ca->setter = setter != NULL ? strshare_ref(setter->name) : NULL;
 
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
+	chanacs_index_add(ca);
+
+	chanacs_cache_invalidate(mychan);
 
 	cnt.chanacs++;
 
@@ -1484,15 +1634,13 @@ chanacs_t *chanacs_find(mychan_t *mychan, myentity_t *mt, unsigned int level)
 	if ((ca = chanacs_find_literal(mychan, mt, level)) != NULL)
 		return ca;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	/* entries for plain accounts only match themselves */
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_indirect.head)
 	{
 		entity_chanacs_validation_vtable_t *vt;
 
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL)
-			continue;
-
 		vt = myentity_get_chanacs_validator(ca->entity);
 		if (level != 0x0)
 		{
@@ -1514,22 +1662,23 @@ unsigned int chanacs_entity_flags(mychan_t *mychan, myentity_t *mt)
 
 	return_val_if_fail(mychan != NULL && mt != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	if (mychan->chanacs_by_entity != NULL)
+		for (ca = mychan->chanacs_by_entity[chanacs_entity_bucket(mychan, mt)]; ca != NULL; ca = ca->hnext)
+			if (ca->entity == mt)
+				result |= ca->level;
+
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_indirect.head)
 	{
 		entity_chanacs_validation_vtable_t *vt;
 
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL)
-			continue;
 		if (ca->entity == mt)
+			continue;
+
+		vt = myentity_get_chanacs_validator(ca->entity);
+		if (vt->match_entity(ca, mt) != NULL)
 			result |= ca->level;
-		else
-		{
-			vt = myentity_get_chanacs_validator(ca->entity);
-			if (vt->match_entity(ca, mt) != NULL)
-				result |= ca->level;
-		}
 	}
 
 	slog(LG_DEBUG, "chanacs_entity_flags(%s, %s): return %s", mychan->name, mt->name, bitmask_to_flags(result));
@@ -1539,25 +1688,20 @@ unsigned int chanacs_entity_flags(mychan_t *mychan, myentity_t *mt)
 
 chanacs_t *chanacs_find_literal(mychan_t *mychan, myentity_t *mt, unsigned int level)
 {
-	mowgli_node_t *n;
-	chanacs_t *ca;
+	chanacs_t *ca, *found = NULL;
 
 	return_val_if_fail(mychan != NULL && mt != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
-	{
-		ca = (chanacs_t *)n->data;
+	if (mychan->chanacs_by_entity == NULL)
+		return NULL;
 
-		if (level != 0x0)
-		{
-			if (ca->entity == mt && ((ca->level & level) == level))
-				return ca;
-		}
-		else if (ca->entity == mt)
-			return ca;
-	}
+	/* chains are newest first, resizes included; prefer the oldest
+	 * entry like a list walk */
+	for (ca = mychan->chanacs_by_entity[chanacs_entity_bucket(mychan, mt)]; ca != NULL; ca = ca->hnext)
+		if (ca->entity == mt && ((ca->level & level) == level))
+			found = ca;
 
-	return NULL;
+	return found;
 }
 
 chanacs_t *chanacs_find_host(mychan_t *mychan, const char *host, unsigned int level)
@@ -1567,16 +1711,11 @@ chanacs_t *chanacs_find_host(mychan_t *mychan, const char *host, unsigned int le
 
 	return_val_if_fail(mychan != NULL && host != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_hosts.head)
 	{
 		ca = (chanacs_t *)n->data;
 
-		if (level != 0x0)
-		{
-			if ((ca->entity == NULL) && (!match(ca->host, host)) && ((ca->level & level) == level))
-				return ca;
-		}
-		else if ((ca->entity == NULL) && (!match(ca->host, host)))
+		if (!match(ca->host, host) && ((ca->level & level) == level))
 			return ca;
 	}
 
@@ -1591,11 +1730,11 @@ unsigned int chanacs_host_flags(mychan_t *mychan, const char *host)
 
 	return_val_if_fail(mychan != NULL && host != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_hosts.head)
 	{
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL && !match(ca->host, host))
+		if (!match(ca->host, host))
 			result |= ca->level;
 	}
 
@@ -1610,16 +1749,20 @@ chanacs_t *chanacs_find_host_literal(mychan_t *mychan, const char *host, unsigne
 	if ((!mychan) || (!host))
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	if (mychan->chanacs_by_host == NULL)
+		return NULL;
+
+	if ((ca = mowgli_patricia_retrieve(mychan->chanacs_by_host, host)) == NULL)
+		return NULL;
+
+	if ((ca->level & level) == level)
+		return ca;
+
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_hosts.head)
 	{
 		ca = (chanacs_t *)n->data;
 
-		if (level != 0x0)
-		{
-			if ((ca->entity == NULL) && (!strcasecmp(ca->host, host)) && ((ca->level & level) == level))
-				return ca;
-		}
-		else if ((ca->entity == NULL) && (!strcasecmp(ca->host, host)))
+		if (!strcasecmp(ca->host, host) && ((ca->level & level) == level))
 			return ca;
 	}
 
@@ -1633,7 +1776,7 @@ chanacs_t *chanacs_find_host_by_user(mychan_t *mychan, user_t *u, unsigned int l
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs_hosts.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
 		ca = n->data;
 		if ((ca->level & level) == level)
@@ -1651,7 +1794,7 @@ static unsigned int chanacs_host_flags_by_user(mychan_t *mychan, user_t *u)
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs_hosts.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
 		ca = n->data;
 		result |= ca->level;
@@ -1729,13 +1872,109 @@ static unsigned int chanacs_entity_flags_by_user(mychan_t *mychan, user_t *u)
 	return result;
 }
 
+/*
+ * Cache of effective flags for chanacs_user_flags(), which otherwise walks
+ * the access list three times and matches every host entry.  Entries are
+ * keyed by (mychan, user) and stay valid while the channel's access list
+ * (mychan->chanacs_gen), group memberships (chanacs_global_gen) and the
+ * user (u->chanacs_gen) are unchanged; all of these are compared exactly,
+ * the pointers only pick the slot.  Channels with exttarget entries are
+ * not cached, since those can depend on arbitrary state.
+ */
+#define CHANACS_CACHE_SIZE	4096	/* power of two */
+
+static struct chanacs_cache_entry {
+	mychan_t *mychan;
+	user_t *user;
+	unsigned int user_gen;
+	unsigned int chanacs_gen;
+	unsigned int global_gen;
+	unsigned int flags;
+} chanacs_cache[CHANACS_CACHE_SIZE];
+
+static unsigned int chanacs_gen_counter;
+static unsigned int chanacs_global_gen;
+
+/* invalidate cached flags for a channel, or for all channels if NULL
+ * (e.g. because a group membership changed) */
+void chanacs_cache_invalidate(mychan_t *mychan)
+{
+	/* generations come from one counter, so that a mychan_t or user_t
+	 * that is freed and reallocated at the same address never matches */
+	if (mychan != NULL)
+		mychan->chanacs_gen = ++chanacs_gen_counter;
+	else
+		chanacs_global_gen++;
+}
+
+/*
+ * Give the user a new generation if anything chanacs matching looks at
+ * has changed since the last call.  Protocol modules assign these fields
+ * directly, so rather than bumping the generation everywhere they do,
+ * the strings seen last are kept referenced: while they are, no other
+ * string can be allocated at the same address, and an unchanged pointer
+ * means an unchanged string.
+ */
+static void chanacs_user_update(user_t *u)
+{
+	stringref fields[ARRAY_SIZE(u->chanacs_seen)] = { u->nick, u->user, u->host, u->vhost, u->chost, u->ip };
+	bool waitauth = u->myuser != NULL && (u->myuser->flags & MU_WAITAUTH);
+	size_t i;
+
+	if (u->chanacs_gen != 0 && u->chanacs_myuser == u->myuser &&
+			u->chanacs_waitauth == waitauth &&
+			!memcmp(fields, u->chanacs_seen, sizeof fields))
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(fields); i++)
+	{
+		strshare_unref(u->chanacs_seen[i]);
+		u->chanacs_seen[i] = strshare_ref(fields[i]);
+	}
+	u->chanacs_myuser = u->myuser;
+	u->chanacs_waitauth = waitauth;
+	u->chanacs_gen = ++chanacs_gen_counter;
+}
+
+/* drop the strings chanacs_user_update() kept, when the user goes away */
+void chanacs_user_release(user_t *u)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(u->chanacs_seen); i++)
+	{
+		strshare_unref(u->chanacs_seen[i]);
+		u->chanacs_seen[i] = NULL;
+	}
+}
+
+static struct chanacs_cache_entry *chanacs_cache_slot(mychan_t *mychan, user_t *u)
+{
+	uintptr_t k = ((uintptr_t)mychan >> 4) * 31 + ((uintptr_t)u >> 4);
+
+	return &chanacs_cache[(k ^ (k >> 12)) & (CHANACS_CACHE_SIZE - 1)];
+}
+
 unsigned int chanacs_user_flags(mychan_t *mychan, user_t *u)
 {
 	myentity_t *mt;
 	unsigned int result = 0;
+	struct chanacs_cache_entry *ce = NULL;
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
+	if (mychan->dynamic_chanacs == 0)
+	{
+		ce = chanacs_cache_slot(mychan, u);
+		chanacs_user_update(u);
+
+		if (ce->mychan == mychan && ce->user == u &&
+				ce->user_gen == u->chanacs_gen &&
+				ce->chanacs_gen == mychan->chanacs_gen &&
+				ce->global_gen == chanacs_global_gen)
+			return ce->flags;
+	}
+
 	mt = entity(u->myuser);
 	if (mt != NULL)
 		result |= chanacs_entity_flags(mychan, mt);
@@ -1752,6 +1991,16 @@ unsigned int chanacs_user_flags(mychan_t *mychan, user_t *u)
 
 	slog(LG_DEBUG, "chanacs_user_flags(%s, %s): return %s", mychan->name, u->nick, bitmask_to_flags(result));
 
+	if (ce != NULL)
+	{
+		ce->mychan = mychan;
+		ce->user = u;
+		ce->user_gen = u->chanacs_gen;
+		ce->chanacs_gen = mychan->chanacs_gen;
+		ce->global_gen = chanacs_global_gen;
+		ce->flags = result;
+	}
+
 	return result;
 }
 
@@ -1829,6 +2078,7 @@ bool chanacs_modify(chanacs_t *ca, unsigned int *addflags, unsigned int *removef
 		return false;
 	ca->level = (ca->level | *addflags) & ~*removeflags;
 	ca->tmodified = CURRTIME;
+	chanacs_cache_invalidate(ca->mychan);
 
 	return true;
 }
@@ -1892,6 +2142,7 @@ bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsi
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
 			ca->tmodified = CURRTIME;
+			chanacs_cache_invalidate(mychan);
 			if (ca->level == 0)
 				object_unref(ca);
 		}
@@ -1928,6 +2179,7 @@ bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsi
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
 			ca->tmodified = CURRTIME;
+			chanacs_cache_invalidate(mychan);
 			if (ca->level == 0)
 				object_unref(ca);
 		}
@@ -236,6 +236,8 @@ void atheme_setup(void)
 #endif
 
 	base_eventloop = mowgli_eventloop_create();
+	metrics_init();
+	profile_init();
         hooks_init();
 	db_init();
 
@@ -249,6 +251,7 @@ void atheme_setup(void)
 	init_confprocess();
 	init_newconf();
 	servtree_init();
+	capture_init();
 
 	register_email_canonicalizer(canonicalize_email_case, NULL);
 
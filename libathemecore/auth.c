@@ -26,6 +26,10 @@
 bool auth_module_loaded = false;
 bool (*auth_user_custom)(myuser_t *mu, const char *password);
 
+/* set by auth_user_custom when it could not check the password at all,
+ * so bad_password() does not count the attempt against the account */
+bool auth_user_unavailable = false;
+
 void set_password(myuser_t *mu, const char *newpassword)
 {
 	if (mu == NULL || newpassword == NULL)
@@ -46,6 +50,8 @@ void set_password(myuser_t *mu, const char *newpassword)
 
 bool verify_password(myuser_t *mu, const char *password)
 {
+	auth_user_unavailable = false;
+
 	if (mu == NULL || password == NULL)
 		return false;
 
@@ -24,11 +24,23 @@
 #include "atheme.h"
 #include "authcookie.h"
 
+/*
+ * Cookies are kept on authcookie_list in creation order, which is also
+ * expiry order, and on their account's authcookies list.  For lookups
+ * by ticket they are indexed by a salted digest of the ticket rather
+ * than the ticket itself, so the time a lookup takes says nothing about
+ * how much of a guessed ticket matches a real one; the ticket is then
+ * compared in constant time.
+ */
 mowgli_list_t authcookie_list;
 mowgli_heap_t *authcookie_heap;
+static mowgli_patricia_t *authcookie_tree;
+static unsigned char authcookie_salt[16];
 
 void authcookie_init(void)
 {
+	unsigned int i;
+
 	authcookie_heap = sharedheap_get(sizeof(authcookie_t));
 
 	if (!authcookie_heap)
@@ -36,6 +48,44 @@ void authcookie_init(void)
 		slog(LG_ERROR, "authcookie_init(): cannot initialize block allocator.");
 		exit(EXIT_FAILURE);
 	}
+
+	authcookie_tree = mowgli_patricia_create(noopcanon);
+
+	for (i = 0; i < sizeof authcookie_salt; i++)
+		authcookie_salt[i] = arc4random() & 0xFF;
+}
+
+static void authcookie_key(const char *ticket, char key[33])
+{
+	static const char hex[] = "0123456789abcdef";
+	md5_state_t ctx;
+	md5_byte_t digest[16];
+	int i;
+
+	md5_init(&ctx);
+	md5_append(&ctx, authcookie_salt, sizeof authcookie_salt);
+	md5_append(&ctx, (const md5_byte_t *)ticket, strlen(ticket));
+	md5_finish(&ctx, digest);
+
+	for (i = 0; i < 16; i++)
+	{
+		key[i * 2] = hex[digest[i] >> 4];
+		key[i * 2 + 1] = hex[digest[i] & 0xF];
+	}
+	key[32] = '\0';
+}
+
+/* compare two tickets without an early exit on the first mismatch */
+static bool authcookie_ticket_equal(const char *a, const char *b)
+{
+	size_t alen = strlen(a), blen = strlen(b);
+	size_t i;
+	unsigned char diff = alen != blen;
+
+	for (i = 0; i < alen; i++)
+		diff |= (unsigned char)a[i] ^ (unsigned char)b[i % (blen ? blen : 1)];
+
+	return diff == 0;
 }
 
 /*
@@ -54,11 +104,20 @@ authcookie_t *authcookie_create(myuser_t *mu)
 {
 	authcookie_t *au = mowgli_heap_alloc(authcookie_heap);
 
-	au->ticket = random_string(20);
+	au->ticket = NULL;
 	au->myuser = mu;
 	au->expire = CURRTIME + 3600;
 
+	/* tickets are random, but never hand out one that is in use */
+	do
+	{
+		free(au->ticket);
+		au->ticket = random_string(20);
+		authcookie_key(au->ticket, au->key);
+	} while (!mowgli_patricia_add(authcookie_tree, au->key, au));
+
 	mowgli_node_add(au, &au->node, &authcookie_list);
+	mowgli_node_add(au, &au->unode, &mu->authcookies);
 
 	return au;
 }
@@ -77,45 +136,25 @@ authcookie_t *authcookie_create(myuser_t *mu)
  */
 authcookie_t *authcookie_find(char *ticket, myuser_t *myuser)
 {
-	mowgli_node_t *n;
 	authcookie_t *ac;
+	char key[33];
 
 	/* at least one must be specified */
 	return_val_if_fail(ticket != NULL || myuser != NULL, NULL);
 
-	if (!myuser)		/* must have ticket */
-	{
-		MOWGLI_ITER_FOREACH(n, authcookie_list.head)
-		{
-			ac = n->data;
+	if (!ticket)		/* must have myuser */
+		return myuser->authcookies.head != NULL ? myuser->authcookies.head->data : NULL;
 
-			if (!strcmp(ac->ticket, ticket))
-				return ac;
-		}
-	}
-	else if (!ticket)	/* must have myuser */
-	{
-		MOWGLI_ITER_FOREACH(n, authcookie_list.head)
-		{
-			ac = n->data;
+	authcookie_key(ticket, key);
+	ac = mowgli_patricia_retrieve(authcookie_tree, key);
 
-			if (ac->myuser == myuser)
-				return ac;
-		}
-	}
-	else			/* must have both */
-	{
-		MOWGLI_ITER_FOREACH(n, authcookie_list.head)
-		{
-			ac = n->data;
-
-			if (ac->myuser == myuser
-				&& !strcmp(ac->ticket, ticket))
-				return ac;
-		}
-	}
+	if (ac == NULL || !authcookie_ticket_equal(ac->ticket, ticket))
+		return NULL;
 
-	return NULL;
+	if (myuser != NULL && ac->myuser != myuser)
+		return NULL;
+
+	return ac;
 }
 
 /*
@@ -134,7 +173,9 @@ void authcookie_destroy(authcookie_t * ac)
 {
 	return_if_fail(ac != NULL);
 
+	mowgli_patricia_delete(authcookie_tree, ac->key);
 	mowgli_node_delete(&ac->node, &authcookie_list);
+	mowgli_node_delete(&ac->unode, &ac->myuser->authcookies);
 	free(ac->ticket);
 	mowgli_heap_free(authcookie_heap, ac);
 }
@@ -154,15 +195,9 @@ void authcookie_destroy(authcookie_t * ac)
 void authcookie_destroy_all(myuser_t *mu)
 {
 	mowgli_node_t *n, *tn;
-	authcookie_t *ac;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, authcookie_list.head)
-	{
-		ac = n->data;
-
-		if (ac->myuser == mu)
-			authcookie_destroy(ac);
-	}
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, mu->authcookies.head)
+		authcookie_destroy(n->data);
 }
 
 /*
@@ -183,12 +218,15 @@ void authcookie_expire(void *arg)
 	mowgli_node_t *n, *tn;
 
 	(void)arg;
-        MOWGLI_ITER_FOREACH_SAFE(n, tn, authcookie_list.head)
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, authcookie_list.head)
 	{
 		ac = n->data;
 
-		if (ac->expire <= CURRTIME)
-			authcookie_destroy(ac);
+		/* the list is in expiry order */
+		if (ac->expire > CURRTIME)
+			break;
+
+		authcookie_destroy(ac);
 	}
 }
 
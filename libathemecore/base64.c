@@ -109,9 +109,35 @@ static const char Pad64 = '=';
 	   characters followed by one "=" padding character.
    */
 
-size_t base64_encode(char const *src, size_t srclength, char *target, size_t targsize)
+/*
+ * The encoder and decoder come in several flavours: the portable one
+ * below and, where the compiler and CPU allow, SIMD variants that run
+ * over the bulk of the input in full blocks and leave the remainder
+ * (and anything unusual such as whitespace or padding) to the portable
+ * code.  The best usable variant is picked on first use.
+ */
+static const signed char Base64rev[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* encodes src into target, continuing at offset datalength */
+static size_t base64_encode_from(const unsigned char *src, size_t srclength, char *target, size_t targsize, size_t datalength)
 {
-	size_t datalength = 0;
 	unsigned char input[3];
 	unsigned char output[4];
 	size_t i;
@@ -126,10 +152,6 @@ size_t base64_encode(char const *src, size_t srclength, char *target, size_t tar
 		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
 		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
 		output[3] = input[2] & 0x3f;
-		soft_assert(output[0] < 64);
-		soft_assert(output[1] < 64);
-		soft_assert(output[2] < 64);
-		soft_assert(output[3] < 64);
 
 		if (datalength + 4 > targsize)
 			return (-1);
@@ -149,9 +171,6 @@ size_t base64_encode(char const *src, size_t srclength, char *target, size_t tar
 		output[0] = input[0] >> 2;
 		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
 		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
-		soft_assert(output[0] < 64);
-		soft_assert(output[1] < 64);
-		soft_assert(output[2] < 64);
 
 		if (datalength + 4 > targsize)
 			return (-1);
@@ -169,66 +188,68 @@ size_t base64_encode(char const *src, size_t srclength, char *target, size_t tar
 	return (datalength);
 }
 
+static size_t base64_encode_scalar(char const *src, size_t srclength, char *target, size_t targsize)
+{
+	return base64_encode_from((const unsigned char *)src, srclength, target, targsize, 0);
+}
+
 /* skips all whitespace anywhere.
    converts characters, four at a time, starting at (or after)
    src from base - 64 numbers into three 8 bit bytes in the target area.
    it returns the number of data bytes stored at the target, or -1 on error.
+   decoding continues at offset tarindex, on a quantum boundary.
  */
-size_t base64_decode(char const *src, char *target, size_t targsize)
+static size_t base64_decode_from(char const *src, char *target, size_t targsize, size_t tarindex)
 {
-	int tarindex, state, ch;
-	char *pos;
+	int state, ch, val;
 
 	state = 0;
-	tarindex = 0;
 
-	while ((ch = *src++) != '\0') {
-		if (isspace((unsigned char)ch))        /* Skip whitespace anywhere. */
+	while ((ch = (unsigned char)*src++) != '\0') {
+		if (isspace(ch))        /* Skip whitespace anywhere. */
 			continue;
 
 		if (ch == Pad64)
 			break;
 
-		pos = strchr(Base64, ch);
-		if (pos == 0) 		/* A non-base64 character. */
+		val = Base64rev[ch];
+		if (val < 0) 		/* A non-base64 character. */
 			return (-1);
 
 		switch (state) {
 		case 0:
 			if (target) {
-				if ((size_t)tarindex >= targsize)
+				if (tarindex >= targsize)
 					return (-1);
-				target[tarindex] = (pos - Base64) << 2;
+				target[tarindex] = val << 2;
 			}
 			state = 1;
 			break;
 		case 1:
 			if (target) {
-				if ((size_t)tarindex + 1 >= targsize)
+				if (tarindex + 1 >= targsize)
 					return (-1);
-				target[tarindex]   |=  (pos - Base64) >> 4;
-				target[tarindex+1]  = ((pos - Base64) & 0x0f)
-							<< 4 ;
+				target[tarindex]   |=  val >> 4;
+				target[tarindex+1]  = (val & 0x0f) << 4 ;
 			}
 			tarindex++;
 			state = 2;
 			break;
 		case 2:
 			if (target) {
-				if ((size_t)tarindex + 1 >= targsize)
+				if (tarindex + 1 >= targsize)
 					return (-1);
-				target[tarindex]   |=  (pos - Base64) >> 2;
-				target[tarindex+1]  = ((pos - Base64) & 0x03)
-							<< 6;
+				target[tarindex]   |=  val >> 2;
+				target[tarindex+1]  = (val & 0x03) << 6;
 			}
 			tarindex++;
 			state = 3;
 			break;
 		case 3:
 			if (target) {
-				if ((size_t)tarindex >= targsize)
+				if (tarindex >= targsize)
 					return (-1);
-				target[tarindex] |= (pos - Base64);
+				target[tarindex] |= val;
 			}
 			tarindex++;
 			state = 0;
@@ -291,3 +312,389 @@ size_t base64_decode(char const *src, char *target, size_t targsize)
 
 	return (tarindex);
 }
+
+static size_t base64_decode_scalar(char const *src, char *target, size_t targsize)
+{
+	return base64_decode_from(src, target, targsize, 0);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define BASE64_X86
+
+#include <immintrin.h>
+
+/*
+ * SSSE3 and AVX2: see Wojciech Muła's and Daniel Lemire's work on
+ * vectorized base64.  pshufb does all the table lookups, so plain SSE2
+ * is of no use here.
+ */
+#define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+
+static bool base64_have_ssse3(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+static bool base64_have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/* 12 input bytes (of 16 loaded) -> 16 characters */
+static inline BASE64_TARGET_SSSE3 __m128i base64_enc_block_ssse3(__m128i in)
+{
+	const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	__m128i t0, t1, t2, t3, idx, sel;
+
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	idx = _mm_or_si128(t1, t3);
+
+	sel = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	sel = _mm_sub_epi8(sel, _mm_cmpgt_epi8(idx, _mm_set1_epi8(25)));
+
+	return _mm_add_epi8(idx, _mm_shuffle_epi8(lut, sel));
+}
+
+/* 16 characters -> 12 bytes (in the low 12 of 16); *bad is set on any
+ * character outside the alphabet, including whitespace and padding */
+static inline BASE64_TARGET_SSSE3 __m128i base64_dec_block_ssse3(__m128i in, int *bad)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	__m128i hi_nibbles, lo_nibbles, hi, lo, roll, merged;
+
+	hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+	lo_nibbles = _mm_and_si128(in, mask_2f);
+	hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+	lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+
+	*bad = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff;
+
+	roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nibbles));
+	in = _mm_add_epi8(in, roll);
+
+	merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+	return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static BASE64_TARGET_SSSE3 size_t base64_encode_ssse3(char const *src, size_t srclength, char *target, size_t targsize)
+{
+	size_t datalength = 0;
+
+	while (srclength >= 16 && datalength + 16 <= targsize) {
+		__m128i in = _mm_loadu_si128((const __m128i *)src);
+
+		_mm_storeu_si128((__m128i *)(target + datalength), base64_enc_block_ssse3(in));
+		src += 12;
+		srclength -= 12;
+		datalength += 16;
+	}
+
+	return base64_encode_from((const unsigned char *)src, srclength, target, targsize, datalength);
+}
+
+static BASE64_TARGET_SSSE3 size_t base64_decode_ssse3(char const *src, char *target, size_t targsize)
+{
+	size_t len, tarindex = 0;
+	int bad;
+
+	if (target == NULL)
+		return base64_decode_from(src, target, targsize, 0);
+
+	len = strlen(src);
+	while (len >= 16 && tarindex + 16 <= targsize) {
+		__m128i out = base64_dec_block_ssse3(_mm_loadu_si128((const __m128i *)src), &bad);
+
+		if (bad)
+			break;
+
+		_mm_storeu_si128((__m128i *)(target + tarindex), out);
+		src += 16;
+		len -= 16;
+		tarindex += 12;
+	}
+
+	return base64_decode_from(src, target, targsize, tarindex);
+}
+
+static inline BASE64_TARGET_AVX2 __m256i base64_enc_block_avx2(__m256i in)
+{
+	const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+			65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	__m256i t0, t1, t2, t3, idx, sel;
+
+	in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+			10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+	t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+	t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+	t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+	idx = _mm256_or_si256(t1, t3);
+
+	sel = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+	sel = _mm256_sub_epi8(sel, _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)));
+
+	return _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, sel));
+}
+
+static inline BASE64_TARGET_AVX2 __m256i base64_dec_block_avx2(__m256i in, int *bad)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+			0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+			0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	__m256i hi_nibbles, lo_nibbles, hi, lo, roll, merged;
+
+	hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+	lo_nibbles = _mm256_and_si256(in, mask_2f);
+	hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+	lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+
+	*bad = !_mm256_testz_si256(lo, hi);
+
+	roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f), hi_nibbles));
+	in = _mm256_add_epi8(in, roll);
+
+	merged = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+	merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+	merged = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+	/* pack the two 12 byte lanes together */
+	return _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+static BASE64_TARGET_AVX2 size_t base64_encode_avx2(char const *src, size_t srclength, char *target, size_t targsize)
+{
+	size_t datalength = 0, rc;
+
+	/* the high lane is loaded from src + 12, so 28 bytes must be there */
+	while (srclength >= 28 && datalength + 32 <= targsize) {
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+				_mm_loadu_si128((const __m128i *)(src + 12)), 1);
+
+		_mm256_storeu_si256((__m256i *)(target + datalength), base64_enc_block_avx2(in));
+		src += 24;
+		srclength -= 24;
+		datalength += 32;
+	}
+
+	rc = base64_encode_ssse3(src, srclength, target + datalength, targsize - datalength);
+	return rc == (size_t)-1 ? rc : datalength + rc;
+}
+
+static BASE64_TARGET_AVX2 size_t base64_decode_avx2(char const *src, char *target, size_t targsize)
+{
+	size_t len, tarindex = 0;
+	int bad;
+
+	if (target == NULL)
+		return base64_decode_from(src, target, targsize, 0);
+
+	len = strlen(src);
+	while (len >= 32 && tarindex + 32 <= targsize) {
+		__m256i out = base64_dec_block_avx2(_mm256_loadu_si256((const __m256i *)src), &bad);
+
+		if (bad)
+			break;
+
+		_mm256_storeu_si256((__m256i *)(target + tarindex), out);
+		src += 32;
+		len -= 32;
+		tarindex += 24;
+	}
+
+	while (len >= 16 && tarindex + 16 <= targsize) {
+		__m128i out = base64_dec_block_ssse3(_mm_loadu_si128((const __m128i *)src), &bad);
+
+		if (bad)
+			break;
+
+		_mm_storeu_si128((__m128i *)(target + tarindex), out);
+		src += 16;
+		len -= 16;
+		tarindex += 12;
+	}
+
+	return base64_decode_from(src, target, targsize, tarindex);
+}
+#endif /* x86 */
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BASE64_NEON
+
+#include <arm_neon.h>
+
+/* NEON is mandatory on AArch64, so there is nothing to detect. */
+static uint8x16x4_t base64_neon_table(const unsigned char *p)
+{
+	uint8x16x4_t t;
+
+	t.val[0] = vld1q_u8(p);
+	t.val[1] = vld1q_u8(p + 16);
+	t.val[2] = vld1q_u8(p + 32);
+	t.val[3] = vld1q_u8(p + 48);
+
+	return t;
+}
+
+static size_t base64_encode_neon(char const *src, size_t srclength, char *target, size_t targsize)
+{
+	const uint8x16x4_t tbl = base64_neon_table((const unsigned char *)Base64);
+	const uint8x16_t mask = vdupq_n_u8(0x3f);
+	size_t datalength = 0;
+
+	while (srclength >= 48 && datalength + 64 <= targsize) {
+		uint8x16x3_t in = vld3q_u8((const uint8_t *)src);
+		uint8x16x4_t out;
+
+		out.val[0] = vshrq_n_u8(in.val[0], 2);
+		out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+		out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+		out.val[3] = vandq_u8(in.val[2], mask);
+
+		out.val[0] = vqtbl4q_u8(tbl, out.val[0]);
+		out.val[1] = vqtbl4q_u8(tbl, out.val[1]);
+		out.val[2] = vqtbl4q_u8(tbl, out.val[2]);
+		out.val[3] = vqtbl4q_u8(tbl, out.val[3]);
+
+		vst4q_u8((uint8_t *)(target + datalength), out);
+		src += 48;
+		srclength -= 48;
+		datalength += 64;
+	}
+
+	return base64_encode_from((const unsigned char *)src, srclength, target, targsize, datalength);
+}
+
+static size_t base64_decode_neon(char const *src, char *target, size_t targsize)
+{
+	const uint8x16x4_t tbl_lo = base64_neon_table((const unsigned char *)Base64rev);
+	const uint8x16x4_t tbl_hi = base64_neon_table((const unsigned char *)Base64rev + 64);
+	const uint8x16_t flip = vdupq_n_u8(0x40);
+	size_t len, tarindex = 0;
+	int i;
+
+	if (target == NULL)
+		return base64_decode_from(src, target, targsize, 0);
+
+	len = strlen(src);
+	while (len >= 64 && tarindex + 48 <= targsize) {
+		uint8x16x4_t in = vld4q_u8((const uint8_t *)src);
+		uint8x16x3_t out;
+		uint8x16_t err = vdupq_n_u8(0);
+
+		/* invalid characters map to 0xff, and anything >= 0x80 is
+		 * invalid to begin with, so the top bit flags errors */
+		for (i = 0; i < 4; i++) {
+			uint8x16_t c = in.val[i];
+
+			in.val[i] = vqtbx4q_u8(vqtbl4q_u8(tbl_lo, c), tbl_hi, veorq_u8(c, flip));
+			err = vorrq_u8(err, vorrq_u8(in.val[i], c));
+		}
+
+		if (vmaxvq_u8(err) & 0x80)
+			break;
+
+		out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+
+		vst3q_u8((uint8_t *)(target + tarindex), out);
+		src += 64;
+		len -= 64;
+		tarindex += 48;
+	}
+
+	return base64_decode_from(src, target, targsize, tarindex);
+}
+#endif /* aarch64 */
+
+/* ordered from least to most preferred */
+const struct base64_codec base64_codecs[] = {
+	{ "scalar", base64_encode_scalar, base64_decode_scalar, NULL },
+#ifdef BASE64_X86
+	{ "ssse3", base64_encode_ssse3, base64_decode_ssse3, base64_have_ssse3 },
+	{ "avx2", base64_encode_avx2, base64_decode_avx2, base64_have_avx2 },
+#endif
+#ifdef BASE64_NEON
+	{ "neon", base64_encode_neon, base64_decode_neon, NULL },
+#endif
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const struct base64_codec *base64_codec = NULL;
+
+static void base64_codec_init(void)
+{
+	const struct base64_codec *c;
+
+	for (c = base64_codecs; c->name != NULL; c++)
+		if (c->usable == NULL || c->usable())
+			base64_codec = c;
+}
+
+/*
+ * base64_codec_select(const char *name)
+ *
+ * Forces a particular codec, for benchmarks and testing.
+ *
+ * Inputs:
+ *       - name of a codec from base64_codecs[], or NULL for the default
+ *
+ * Outputs:
+ *       - the selected codec, or NULL if the codec is unknown or not
+ *         supported by this CPU
+ */
+const struct base64_codec *base64_codec_select(const char *name)
+{
+	const struct base64_codec *c;
+
+	if (name == NULL) {
+		base64_codec_init();
+		return base64_codec;
+	}
+
+	for (c = base64_codecs; c->name != NULL; c++) {
+		if (strcasecmp(c->name, name))
+			continue;
+		if (c->usable != NULL && !c->usable())
+			return NULL;
+
+		base64_codec = c;
+		return c;
+	}
+
+	return NULL;
+}
+
+size_t base64_encode(char const *src, size_t srclength, char *target, size_t targsize)
+{
+	if (base64_codec == NULL)
+		base64_codec_init();
+
+	return base64_codec->encode(src, srclength, target, targsize);
+}
+
+size_t base64_decode(char const *src, char *target, size_t targsize)
+{
+	if (base64_codec == NULL)
+		base64_codec_init();
+
+	return base64_codec->decode(src, target, targsize);
+}
@@ -108,6 +108,8 @@ channel_t *channel_add(const char *name, time_t ts, server_t *creator)
 
 	c->topic = NULL;
 	c->topic_setter = NULL;
+	c->modestack = NULL;
+	c->svcmembers = NULL;
 
 	if (ignore_mode_list_size != 0)
 		c->extmodes = scalloc(sizeof(char *), ignore_mode_list_size);
@@ -175,6 +177,8 @@ void channel_delete(channel_t *c)
 	}
 	c->nummembers = 0;
 	c->numsvcmembers = 0;
+	free(c->svcmembers);
+	c->svcmembers = NULL;
 
 	hook_call_channel_delete(c);
 
@@ -402,7 +406,10 @@ chanuser_t *chanuser_add(channel_t *chan, const char *nick)
 
 	chan->nummembers++;
 	if (is_internal_client(u))
-		chan->numsvcmembers++;
+	{
+		chan->svcmembers = srealloc(chan->svcmembers, (chan->numsvcmembers + 1) * sizeof(user_t *));
+		chan->svcmembers[chan->numsvcmembers++] = u;
+	}
 
 	mowgli_node_add(cu, &cu->cnode, &chan->members);
 	mowgli_node_add(cu, &cu->unode, &u->channels);
@@ -439,7 +446,6 @@ chanuser_t *chanuser_add(channel_t *chan, const char *nick)
 void chanuser_delete(channel_t *chan, user_t *user)
 {
 	chanuser_t *cu;
-	hook_channel_joinpart_t hdata;
 
 	return_if_fail(chan != NULL);
 	return_if_fail(user != NULL);
@@ -448,11 +454,41 @@ void chanuser_delete(channel_t *chan, user_t *user)
 	if (cu == NULL)
 		return;
 
+	chanuser_delete_member(cu);
+}
+
+/*
+ * chanuser_delete_member(chanuser_t *cu)
+ *
+ * Like chanuser_delete(), for callers that already hold the membership.
+ *
+ * Inputs:
+ *     - the membership to remove
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - the membership is freed, and the channel too if it is now empty
+ */
+void chanuser_delete_member(chanuser_t *cu)
+{
+	channel_t *chan;
+	user_t *user;
+	hook_channel_joinpart_t hdata;
+
+	return_if_fail(cu != NULL);
+
+	chan = cu->chan;
+	user = cu->user;
+
 	/* this is called BEFORE we remove the user */
 	hdata.cu = cu;
 	hook_call_channel_part(&hdata);
 
-	slog(LG_DEBUG, "chanuser_delete(): %s -> %s (%d)", cu->chan->name, cu->user->nick, cu->chan->nummembers - 1);
+	/* a split is logged once by server_delete() */
+	if (!(user->flags & UF_SPLIT))
+		slog(LG_DEBUG, "chanuser_delete(): %s -> %s (%d)", chan->name, user->nick, chan->nummembers - 1);
 
 	mowgli_node_delete(&cu->cnode, &chan->members);
 	mowgli_node_delete(&cu->unode, &user->channels);
@@ -463,7 +499,19 @@ void chanuser_delete(channel_t *chan, user_t *user)
 	cnt.chanuser--;
 
 	if (is_internal_client(user))
-		chan->numsvcmembers--;
+	{
+		unsigned int i;
+
+		for (i = 0; i < chan->numsvcmembers; i++)
+			if (chan->svcmembers[i] == user)
+				break;
+
+		if (i < chan->numsvcmembers)
+		{
+			memmove(&chan->svcmembers[i], &chan->svcmembers[i + 1], (chan->numsvcmembers - i - 1) * sizeof(user_t *));
+			chan->numsvcmembers--;
+		}
+	}
 
 	if (chan->nummembers == 0 && !(chan->modes & ircd->perm_mode))
 	{
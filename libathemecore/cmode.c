@@ -394,22 +394,34 @@ void channel_mode_va(user_t *source, channel_t *chan, int parc, char *parv0, ...
 	channel_mode(source, chan, parc, parv);
 }
 
-static struct modestackdata {
+/*
+ * The modestack collects mode changes made by services and sends them in
+ * as few MODE lines as possible at the end of the event loop turn.
+ * There is one pending record per channel (channel_t.modestack), so mass
+ * operations touching many channels no longer flush on every switch.
+ * A change by a different source on the same channel flushes the record
+ * first, which keeps the order of mode changes within a channel.
+ */
+struct modestackdata {
+	mowgli_node_t node;
 	char source[HOSTLEN]; /* name */
 	channel_t *channel;
 	unsigned int modes_on;
 	unsigned int modes_off;
 	unsigned int limit;
-	char extmodes[256][512];
-	bool limitused, extmodesused[256];
+	char **extmodes; /* NULL or ignore_mode_list_size entries; "" is -mode */
+	bool limitused;
 	char pmodes[2*MAXMODES+2];
-	char params[512]; /* includes leading space */
+	char *params; /* includes leading space */
+	size_t paramssize;
 	int totalparamslen; /* includes leading space */
 	int totallen;
 	int paramcount;
+};
 
-	mowgli_eventloop_timer_t *event;
-} modestackdata;
+static mowgli_heap_t *modestack_heap;
+static mowgli_list_t modestack_pending;
+static mowgli_eventloop_timer_t *modestack_event;
 
 static void modestack_calclen(struct modestackdata *md);
 
@@ -421,10 +433,11 @@ static void modestack_debugprint(struct modestackdata *md)
 	slog(LG_DEBUG, "simple %x/%x", md->modes_on, md->modes_off);
 	if (md->limitused)
 		slog(LG_DEBUG, "limit %u", (unsigned)md->limit);
-	for (i = 0; i < ignore_mode_list_size; i++)
-		if (md->extmodesused[i])
-			slog(LG_DEBUG, "ext %d %s", (int)i, md->extmodes[i]);
-	slog(LG_DEBUG, "pmodes %s%s", md->pmodes, md->params);
+	if (md->extmodes != NULL)
+		for (i = 0; i < ignore_mode_list_size; i++)
+			if (md->extmodes[i] != NULL)
+				slog(LG_DEBUG, "ext %d %s", (int)i, md->extmodes[i]);
+	slog(LG_DEBUG, "pmodes %s%s", md->pmodes, md->params != NULL ? md->params : "");
 	modestack_calclen(md);
 	slog(LG_DEBUG, "totallen %d/%d", md->totalparamslen, md->totallen);
 }
@@ -442,18 +455,22 @@ static void modestack_calclen(struct modestackdata *md)
 	md->paramcount = (md->limitused != 0);
 	if (md->limitused && md->limit != 0)
 		md->totalparamslen += 11;
-	for (i = 0; i < ignore_mode_list_size; i++)
-		if (md->extmodesused[i])
-		{
-			md->paramcount++;
-			if (*md->extmodes[i] != '\0')
-				md->totalparamslen += 1 + strlen(md->extmodes[i]);
-		}
-	md->totalparamslen += strlen(md->params);
-	p = md->params;
-	while (*p != '\0')
-		if (*p++ == ' ')
-			md->paramcount++;
+	if (md->extmodes != NULL)
+		for (i = 0; i < ignore_mode_list_size; i++)
+			if (md->extmodes[i] != NULL)
+			{
+				md->paramcount++;
+				if (*md->extmodes[i] != '\0')
+					md->totalparamslen += 1 + strlen(md->extmodes[i]);
+			}
+	if (md->params != NULL)
+	{
+		md->totalparamslen += strlen(md->params);
+		p = md->params;
+		while (*p != '\0')
+			if (*p++ == ' ')
+				md->paramcount++;
+	}
 	md->totallen += md->totalparamslen;
 }
 
@@ -465,10 +482,16 @@ static void modestack_clear(struct modestackdata *md)
 	md->modes_on = 0;
 	md->modes_off = 0;
 	md->limitused = 0;
-	for (i = 0; i < ignore_mode_list_size; i++)
-		md->extmodesused[i] = 0, *md->extmodes[i] = '\0';
+	if (md->extmodes != NULL)
+	{
+		for (i = 0; i < ignore_mode_list_size; i++)
+			free(md->extmodes[i]);
+		free(md->extmodes);
+		md->extmodes = NULL;
+	}
 	md->pmodes[0] = '\0';
-	md->params[0] = '\0';
+	if (md->params != NULL)
+		md->params[0] = '\0';
 	md->totallen = 0;
 	md->totalparamslen = 0;
 	md->paramcount = 0;
@@ -499,9 +522,9 @@ static void modestack_flush(struct modestackdata *md)
 			dir = MTYPE_DEL, *p++ = '-';
 		*p++ = 'l';
 	}
-	for (i = 0; i < ignore_mode_list_size; i++)
+	for (i = 0; md->extmodes != NULL && i < ignore_mode_list_size; i++)
 	{
-		if (md->extmodesused[i] && *md->extmodes[i] == '\0')
+		if (md->extmodes[i] != NULL && *md->extmodes[i] == '\0')
 		{
 			if (dir != MTYPE_DEL)
 				dir = MTYPE_DEL, *p++ = '-';
@@ -521,9 +544,9 @@ static void modestack_flush(struct modestackdata *md)
 			dir = MTYPE_ADD, *p++ = '+';
 		*p++ = 'l';
 	}
-	for (i = 0; i < ignore_mode_list_size; i++)
+	for (i = 0; md->extmodes != NULL && i < ignore_mode_list_size; i++)
 	{
-		if (md->extmodesused[i] && *md->extmodes[i] != '\0')
+		if (md->extmodes[i] != NULL && *md->extmodes[i] != '\0')
 		{
 			if (dir != MTYPE_ADD)
 				dir = MTYPE_ADD, *p++ = '+';
@@ -539,6 +562,7 @@ static void modestack_flush(struct modestackdata *md)
 		/*slog(LG_DEBUG, "modestack_flush(): nothing to do");*/
 		return;
 	}
+	modestack_calclen(md);
 	if (p + md->totalparamslen >= end)
 	{
 		slog(LG_ERROR, "modestack_flush() overflow: %s", buf);
@@ -553,37 +577,88 @@ static void modestack_flush(struct modestackdata *md)
 		snprintf(p, end - p, " %u", (unsigned)md->limit);
 		p += strlen(p);
 	}
-	for (i = 0; i < ignore_mode_list_size; i++)
+	for (i = 0; md->extmodes != NULL && i < ignore_mode_list_size; i++)
 	{
-		if (md->extmodesused[i] && *md->extmodes[i] != '\0')
+		if (md->extmodes[i] != NULL && *md->extmodes[i] != '\0')
 		{
 			snprintf(p, end - p, " %s", md->extmodes[i]);
 			p += strlen(p);
 		}
 	}
-	if (*md->params)
+	if (md->params != NULL && *md->params)
 	{
 		mowgli_strlcpy(p, md->params, end - p);
 		p += strlen(p);
 	}
 	mode_sts(md->source, md->channel, buf);
+	cnt.modestack_lines++;
 	modestack_clear(md);
 }
 
+/* forgets a record; it must have been flushed or cleared */
+static void modestack_release(struct modestackdata *md)
+{
+	md->channel->modestack = NULL;
+	mowgli_node_delete(&md->node, &modestack_pending);
+	free(md->params);
+	mowgli_heap_free(modestack_heap, md);
+}
+
+static void modestack_flush_all(bool send)
+{
+	mowgli_node_t *n, *tn;
+	struct modestackdata *md;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, modestack_pending.head)
+	{
+		md = n->data;
+		if (send)
+			modestack_flush(md);
+		else
+			modestack_clear(md);
+		modestack_release(md);
+	}
+}
+
+static void modestack_flush_callback(void *arg)
+{
+	modestack_event = NULL;
+	modestack_flush_all(true);
+}
+
 static struct modestackdata *modestack_init(const char *source, channel_t *channel)
 {
+	struct modestackdata *md;
+
 	return_val_if_fail(source != NULL, NULL);
 	return_val_if_fail(channel != NULL, NULL);
 
-	if (irccasecmp(source, modestackdata.source) || channel != modestackdata.channel)
+	md = channel->modestack;
+	if (md == NULL)
 	{
-		/*slog(LG_DEBUG, "modestack_init(): new source/channel, flushing");*/
-		modestack_flush(&modestackdata);
+		if (modestack_heap == NULL)
+			modestack_heap = sharedheap_get(sizeof(struct modestackdata));
+
+		md = mowgli_heap_alloc(modestack_heap);
+		memset(md, 0, sizeof *md);
+		md->channel = channel;
+		channel->modestack = md;
+		mowgli_node_add(md, &md->node, &modestack_pending);
 	}
+	else if (irccasecmp(source, md->source))
+	{
+		/*slog(LG_DEBUG, "modestack_init(): new source, flushing");*/
+		modestack_flush(md);
+	}
+
+	mowgli_strlcpy(md->source, source, sizeof md->source);
 
-	mowgli_strlcpy(modestackdata.source, source, sizeof modestackdata.source);
-	modestackdata.channel = channel;
-	return &modestackdata;
+	if (modestack_event == NULL)
+		modestack_event = mowgli_timer_add_once(base_eventloop, "flush_cmode_callback", modestack_flush_callback, NULL, 0);
+
+	cnt.modestack_changes++;
+
+	return md;
 }
 
 static void modestack_add_simple(struct modestackdata *md, int dir, int flags)
@@ -617,7 +692,11 @@ static void modestack_add_limit(struct modestackdata *md, int dir, unsigned int
 
 static void modestack_add_ext(struct modestackdata *md, int dir, int i, const char *value)
 {
-	md->extmodesused[i] = 0;
+	if (md->extmodes != NULL && md->extmodes[i] != NULL)
+	{
+		free(md->extmodes[i]);
+		md->extmodes[i] = NULL;
+	}
 	modestack_calclen(md);
 	if (md->paramcount >= MAXMODES)
 		modestack_flush(md);
@@ -625,22 +704,25 @@ static void modestack_add_ext(struct modestackdata *md, int dir, int i, const ch
 	{
 		if (md->totallen + 1 + strlen(value) > 512)
 			modestack_flush(md);
-		mowgli_strlcpy(md->extmodes[i], value, sizeof md->extmodes[i]);
 	}
-	else if (dir == MTYPE_DEL)
-		md->extmodes[i][0] = '\0';
-	else
+	else if (dir != MTYPE_DEL)
+	{
 		slog(LG_ERROR, "modestack_add_ext(): invalid direction");
-	md->extmodesused[i] = 1;
+		return;
+	}
+	if (md->extmodes == NULL)
+		md->extmodes = scalloc(sizeof(char *), ignore_mode_list_size);
+	md->extmodes[i] = sstrdup(dir == MTYPE_ADD ? value : "");
 }
 
 static void modestack_add_param(struct modestackdata *md, int dir, char type, const char *value)
 {
 	char *p;
 	int n = 0;
-	size_t i;
+	size_t i, len;
 	char dir2 = MTYPE_NUL;
 	char str[3];
+	bool first;
 
 	p = md->pmodes;
 	while (*p != '\0')
@@ -654,8 +736,8 @@ static void modestack_add_param(struct modestackdata *md, int dir, char type, co
 		p++;
 	}
 	n += (md->limitused != 0);
-	for (i = 0; i < ignore_mode_list_size; i++)
-		n += (md->extmodesused[i] != 0);
+	for (i = 0; md->extmodes != NULL && i < ignore_mode_list_size; i++)
+		n += (md->extmodes[i] != NULL);
 	modestack_calclen(md);
 	if (n >= MAXMODES || md->totallen + (dir != dir2) + 2 + strlen(value) > 512 || (type == 'k' && strchr(md->pmodes, 'k')))
 	{
@@ -674,51 +756,71 @@ static void modestack_add_param(struct modestackdata *md, int dir, char type, co
 		str[1] = '\0';
 	}
 	mowgli_strlcat(md->pmodes, str, sizeof md->pmodes);
-	mowgli_strlcat(md->params, " ", sizeof md->params);
-	mowgli_strlcat(md->params, value, sizeof md->params);
-}
 
-static void modestack_flush_callback(void *arg)
-{
-	modestack_flush((struct modestackdata *)arg);
-	((struct modestackdata *)arg)->event = 0;
+	/* params are allocated as needed, they never exceed a line */
+	len = strlen(value) + 2;
+	if (md->params != NULL)
+		len += strlen(md->params);
+	if (len > md->paramssize)
+	{
+		first = md->params == NULL;
+		md->paramssize = len > 2 * md->paramssize ? len : 2 * md->paramssize;
+		md->params = srealloc(md->params, md->paramssize);
+		if (first)
+			md->params[0] = '\0';
+	}
+	mowgli_strlcat(md->params, " ", md->paramssize);
+	mowgli_strlcat(md->params, value, md->paramssize);
 }
 
 /* flush pending modes for a certain channel */
 void modestack_flush_channel(channel_t *channel)
 {
-	if (channel == NULL || channel == modestackdata.channel)
-		modestack_flush(&modestackdata);
+	if (channel == NULL)
+		modestack_flush_all(true);
+	else if (channel->modestack != NULL)
+	{
+		modestack_flush(channel->modestack);
+		modestack_release(channel->modestack);
+	}
 }
 
 /* forget pending modes for a certain channel */
 void modestack_forget_channel(channel_t *channel)
 {
-	if (channel == NULL || channel == modestackdata.channel)
-		modestack_clear(&modestackdata);
+	if (channel == NULL)
+		modestack_flush_all(false);
+	else if (channel->modestack != NULL)
+	{
+		modestack_clear(channel->modestack);
+		modestack_release(channel->modestack);
+	}
 }
 
 /* handle a channel that is going to be destroyed */
 void modestack_finalize_channel(channel_t *channel)
 {
+	struct modestackdata *md = channel->modestack;
 	user_t *u;
 
-	if (channel == modestackdata.channel)
+	if (md == NULL)
+		return;
+
+	if (md->modes_off & ircd->perm_mode)
 	{
-		if (modestackdata.modes_off & ircd->perm_mode)
-		{
-			/* A mode change is not a good way to destroy a channel */
-			slog(LG_DEBUG, "modestack_finalize_channel(): flushing modes for %s to clear perm mode", channel->name);
-			u = user_find_named(modestackdata.source);
-			if (u != NULL)
-				join_sts(channel, u, false, channel_modes(channel, true));
-			modestack_flush(&modestackdata);
-			if (u != NULL)
-				part_sts(channel, u);
-		}
-		else
-			modestack_clear(&modestackdata);
+		/* A mode change is not a good way to destroy a channel */
+		slog(LG_DEBUG, "modestack_finalize_channel(): flushing modes for %s to clear perm mode", channel->name);
+		u = user_find_named(md->source);
+		if (u != NULL)
+			join_sts(channel, u, false, channel_modes(channel, true));
+		modestack_flush(md);
+		if (u != NULL)
+			part_sts(channel, u);
 	}
+	else
+		modestack_clear(md);
+
+	modestack_release(md);
 }
 
 /* stack simple modes without parameters */
@@ -730,8 +832,6 @@ void modestack_mode_simple_real(const char *source, channel_t *channel, int dir,
 		return;
 	md = modestack_init(source, channel);
 	modestack_add_simple(md, dir, flags);
-	if (!md->event)
-		md->event = mowgli_timer_add_once(base_eventloop, "flush_cmode_callback", modestack_flush_callback, md, 0);
 }
 void (*modestack_mode_simple)(const char *source, channel_t *channel, int dir, int flags) = modestack_mode_simple_real;
 
@@ -742,8 +842,6 @@ void modestack_mode_limit_real(const char *source, channel_t *channel, int dir,
 
 	md = modestack_init(source, channel);
 	modestack_add_limit(md, dir, limit);
-	if (!md->event)
-		md->event = mowgli_timer_add_once(base_eventloop, "flush_cmode_callback", modestack_flush_callback, md, 0);
 }
 void (*modestack_mode_limit)(const char *source, channel_t *channel, int dir, unsigned int limit) = modestack_mode_limit_real;
 
@@ -752,16 +850,14 @@ void modestack_mode_ext_real(const char *source, channel_t *channel, int dir, un
 {
 	struct modestackdata *md;
 
-	md = modestack_init(source, channel);
 	if (i >= ignore_mode_list_size)
 	{
 		slog(LG_ERROR, "modestack_mode_ext(): i=%d out of range (value=\"%s\")",
 				i, value);
 		return;
 	}
+	md = modestack_init(source, channel);
 	modestack_add_ext(md, dir, i, value);
-	if (!md->event)
-		md->event = mowgli_timer_add_once(base_eventloop, "flush_cmode_callback", modestack_flush_callback, md, 0);
 }
 void (*modestack_mode_ext)(const char *source, channel_t *channel, int dir, unsigned int i, const char *value) = modestack_mode_ext_real;
 
@@ -772,15 +868,13 @@ void modestack_mode_param_real(const char *source, channel_t *channel, int dir,
 
 	md = modestack_init(source, channel);
 	modestack_add_param(md, dir, type, value);
-	if (!md->event)
-		md->event = mowgli_timer_add_once(base_eventloop, "flush_cmode_callback", modestack_flush_callback, md, 0);
 }
 void (*modestack_mode_param)(const char *source, channel_t *channel, int dir, char type, const char *value) = modestack_mode_param_real;
 
 /* go ahead and flush now */
 void modestack_flush_now(void)
 {
-	modestack_flush(&modestackdata);
+	modestack_flush_all(true);
 }
 
 /* Clear all simple modes (+imnpstkl etc) on a channel */
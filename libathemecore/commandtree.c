@@ -86,6 +86,9 @@ static inline bool command_verify(service_t *svs, sourceinfo_t *si, command_t *c
 void command_exec(service_t *svs, sourceinfo_t *si, command_t *c, int parc, char *parv[])
 {
 	const char *cmdaccess;
+	char labels[BUFSIZE], path[BUFSIZE], *p;
+	profile_entry_t *pe;
+	uint64_t start, taken;
 
 	if (si->smu != NULL)
 		language_set_active(si->smu->language);
@@ -105,8 +108,21 @@ void command_exec(service_t *svs, sourceinfo_t *si, command_t *c, int parc, char
 		if (si->force_language != NULL)
 			language_set_active(si->force_language);
 
+		/* counted up front, the command may unload its own module */
+		snprintf(labels, sizeof labels, "service=\"%s\",command=\"%s\"", svs->internal_name, c->name);
+		metric_inc(metric_counter("atheme_commands_total", "Commands executed, by service.", labels));
+
+		snprintf(path, sizeof path, "%s/%s", svs->internal_name, c->name);
+		for (p = path; *p != '\0'; p++)
+			*p = ToLower(*p);
+		pe = profile_entry(path);
+
 		si->command = c;
+		start = profile_now();
 		c->cmd(si, parc, parv);
+		taken = profile_now() - start;
+		profile_record(pe, taken);
+		watchdog_check(taken, "command %s", path);
 		language_set_active(NULL);
 		return;
 	}
@@ -248,6 +248,9 @@ void init_newconf(void)
 	add_bool_conf_item("CLONE_IDENTIFIED_INCREASE_LIMIT", &conf_gi_table, 0, &config_options.clone_increase, false);
 
 	add_uint_conf_item("UPLINK_SENDQ_LIMIT", &conf_gi_table, 0, &config_options.uplink_sendq_limit, 10240, INT_MAX, 1048576);
+	add_uint_conf_item("BURST_JOIN_RATE", &conf_gi_table, 0, &config_options.burst_join_rate, 0, INT_MAX, 0);
+	add_uint_conf_item("SLOW_EVENT_THRESHOLD", &conf_gi_table, 0, &config_options.slow_event_threshold, 0, INT_MAX, 1000);
+	add_dupstr_conf_item("UPLINK_CAPTURE", &conf_gi_table, 0, &config_options.uplink_capture, NULL);
 	add_dupstr_conf_item("LANGUAGE", &conf_gi_table, 0, &config_options.language, "en");
 	add_conf_item("EXEMPTS", &conf_gi_table, c_gi_exempts);
 	add_conf_item("IMMUNE_LEVEL", &conf_gi_table, c_gi_immune_level);
@@ -73,16 +73,32 @@ static void connection_trampoline(mowgli_eventloop_t *eventloop, mowgli_eventloo
 	mowgli_eventloop_io_dir_t dir, void *userdata)
 {
 	connection_t *cptr = userdata;
+	char name[HOSTLEN];
+	unsigned int reports;
+	uint64_t start;
 
-	switch (dir) {
-	case MOWGLI_EVENTLOOP_IO_READ:
-		return cptr->read_handler(cptr);
-		break;
-	case MOWGLI_EVENTLOOP_IO_WRITE:
-	default:
-		return cptr->write_handler(cptr);
-		break;
+	if (config_options.slow_event_threshold == 0)
+	{
+		if (dir == MOWGLI_EVENTLOOP_IO_READ)
+			cptr->read_handler(cptr);
+		else
+			cptr->write_handler(cptr);
+		return;
 	}
+
+	/* the handler may close and free the connection */
+	mowgli_strlcpy(name, cptr->name, sizeof name);
+	reports = watchdog_reports;
+	start = profile_now();
+
+	if (dir == MOWGLI_EVENTLOOP_IO_READ)
+		cptr->read_handler(cptr);
+	else
+		cptr->write_handler(cptr);
+
+	if (watchdog_reports == reports)
+		watchdog_check(profile_now() - start, "%s on connection %s",
+				dir == MOWGLI_EVENTLOOP_IO_READ ? "read" : "write", name);
 }
 
 /*
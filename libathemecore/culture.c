@@ -37,6 +37,100 @@ typedef struct translation_ translation_t;
 static mowgli_patricia_t *itranslation_tree; /* internal translations, userserv/nickserv etc */
 static mowgli_patricia_t *translation_tree; /* language translations */
 
+/*
+ * Strings handed to _() and translation_get() are literals or N_()
+ * tables in static storage, so their address is as good a key as their
+ * text and much cheaper to hash.  Each language has an open-addressed
+ * table from that address to the gettext() result, and translation_get()
+ * has one of its own.  Changing the translation trees, or unloading a
+ * module (whose addresses may be reused by the next one), bumps
+ * translation_generation, which makes every cached result stale.
+ */
+
+typedef struct {
+	const char *key;
+	const char *value;
+	unsigned int generation;
+} tcache_slot_t;
+
+typedef struct {
+	tcache_slot_t *slots;
+	unsigned int size;		/* a power of two, or zero */
+	unsigned int count;
+} tcache_t;
+
+#define TCACHE_MIN_SIZE 256
+
+static unsigned int translation_generation = 1;
+static tcache_t translation_cache;
+
+static inline unsigned int tcache_hash(const char *key, unsigned int mask)
+{
+	uintptr_t v = (uintptr_t)key;
+
+	return (unsigned int)((v ^ (v >> 15)) * 2654435761U) & mask;
+}
+
+static tcache_slot_t *tcache_probe(tcache_slot_t *slots, unsigned int size, const char *key)
+{
+	unsigned int i;
+
+	for (i = tcache_hash(key, size - 1); slots[i].key != NULL && slots[i].key != key; i = (i + 1) & (size - 1))
+		;
+
+	return &slots[i];
+}
+
+/* the slot for key, which is empty if key is not cached yet */
+static tcache_slot_t *tcache_slot(tcache_t *tc, const char *key)
+{
+	tcache_slot_t *slots, *slot;
+	unsigned int i, size;
+
+	if ((tc->count + 1) * 2 > tc->size)
+	{
+		size = tc->size ? tc->size * 2 : TCACHE_MIN_SIZE;
+		slots = scalloc(size, sizeof *slots);
+
+		for (i = 0; i < tc->size; i++)
+			if (tc->slots[i].key != NULL)
+				*tcache_probe(slots, size, tc->slots[i].key) = tc->slots[i];
+
+		free(tc->slots);
+		tc->slots = slots;
+		tc->size = size;
+	}
+
+	slot = tcache_probe(tc->slots, tc->size, key);
+	if (slot->key == NULL)
+	{
+		slot->key = key;
+		slot->generation = 0;
+		tc->count++;
+	}
+
+	return slot;
+}
+
+/*
+ * translation_invalidate()
+ *
+ * Inputs:
+ *     - none
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - all cached translations are looked up again on next use
+ */
+void translation_invalidate(void)
+{
+	/* 0 marks a slot that was never filled */
+	if (++translation_generation == 0)
+		translation_generation = 1;
+}
+
 /*
  * translation_init()
  *
@@ -73,16 +167,24 @@ void translation_init(void)
  */
 const char *translation_get(const char *str)
 {
+	tcache_slot_t *slot;
 	translation_t *t;
 
+	slot = tcache_slot(&translation_cache, str);
+	if (slot->generation == translation_generation)
+		return slot->value;
+
+	slot->generation = translation_generation;
+	slot->value = str;
+
 	/* See if an internal substitution is present. */
 	if ((t = mowgli_patricia_retrieve(itranslation_tree, str)) != NULL)
-		str = t->replacement;
+		slot->value = str = t->replacement;
 
 	if ((t = mowgli_patricia_retrieve(translation_tree, str)) != NULL)
-		return t->replacement;
+		slot->value = t->replacement;
 
-	return str;
+	return slot->value;
 }
 
 /*
@@ -105,6 +207,7 @@ void itranslation_create(const char *str, const char *trans)
 	t->replacement = sstrdup(trans);
 
 	mowgli_patricia_add(itranslation_tree, t->name, t);
+	translation_invalidate();
 }
 
 /*
@@ -129,6 +232,7 @@ void itranslation_destroy(const char *str)
 	free(t->name);
 	free(t->replacement);
 	free(t);
+	translation_invalidate();
 }
 
 /*
@@ -159,6 +263,7 @@ void translation_create(const char *str, const char *trans)
 	t->replacement = sstrdup(buf);
 
 	mowgli_patricia_add(translation_tree, t->name, t);
+	translation_invalidate();
 }
 
 /*
@@ -183,6 +288,7 @@ void translation_destroy(const char *str)
 	free(t->name);
 	free(t->replacement);
 	free(t);
+	translation_invalidate();
 }
 
 enum
@@ -195,9 +301,13 @@ struct language_
 	char *name;
 	unsigned int flags; /* LANG_* */
 	mowgli_node_t node;
+	tcache_t cache; /* gettext() results in this language */
 };
 
 static mowgli_list_t language_list;
+#ifdef ENABLE_NLS
+static language_t *currlang;
+#endif
 
 void
 language_init(void)
@@ -237,7 +347,7 @@ language_add(const char *name)
 	if (lang != NULL)
 		return lang;
 	slog(LG_DEBUG, "language_add(): %s", name);
-	lang = smalloc(sizeof(*lang));
+	lang = scalloc(1, sizeof(*lang));
 	lang->name = sstrdup(name);
 	mowgli_node_add(lang, &lang->node, &language_list);
 	return lang;
@@ -307,8 +417,6 @@ void
 language_set_active(language_t *lang)
 {
 #ifdef ENABLE_NLS
-	static language_t *currlang;
-
 	if (lang == NULL)
 	{
 		lang = language_find(config_options.language);
@@ -328,6 +436,39 @@ language_set_active(language_t *lang)
 #endif
 }
 
+#ifdef ENABLE_NLS
+/*
+ * translation_gettext(const char *str)
+ *
+ * Inputs:
+ *     - string to get translation for, in static storage
+ *
+ * Outputs:
+ *     - gettext()'s translation of the string into the active language
+ *
+ * Side Effects:
+ *     - the translation is cached for the active language
+ */
+const char *translation_gettext(const char *str)
+{
+	tcache_slot_t *slot;
+
+	if (str == NULL)
+		return NULL;
+	if (currlang == NULL)
+		return gettext(str);
+
+	slot = tcache_slot(&currlang->cache, str);
+	if (slot->generation != translation_generation)
+	{
+		slot->value = gettext(str);
+		slot->generation = translation_generation;
+	}
+
+	return slot->value;
+}
+#endif
+
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
  * vim:ts=8
  * vim:sw=8
@@ -10,6 +10,13 @@
 database_module_t *db_mod = NULL;
 mowgli_patricia_t *db_types = NULL;
 
+/* row handlers carry their profile entry so loading a large database
+ * costs no extra lookup per row */
+typedef struct {
+	database_handler_f fun;
+	profile_entry_t *profile;
+} db_type_handler_t;
+
 database_handle_t *
 db_open(const char *filename, database_transaction_t txn)
 {
@@ -241,11 +248,21 @@ db_commit_row(database_handle_t *db)
 void
 db_register_type_handler(const char *type, database_handler_f fun)
 {
+	db_type_handler_t *h;
+	char path[BUFSIZE];
+
 	return_if_fail(db_types != NULL);
 	return_if_fail(type != NULL);
 	return_if_fail(fun != NULL);
 
-	mowgli_patricia_add(db_types, type, fun);
+	snprintf(path, sizeof path, "db/%s", type);
+
+	h = smalloc(sizeof *h);
+	h->fun = fun;
+	h->profile = profile_entry(path);
+
+	if (!mowgli_patricia_add(db_types, type, h))
+		free(h);
 }
 
 void
@@ -254,26 +271,29 @@ db_unregister_type_handler(const char *type)
 	return_if_fail(db_types != NULL);
 	return_if_fail(type != NULL);
 
-	mowgli_patricia_delete(db_types, type);
+	free(mowgli_patricia_delete(db_types, type));
 }
 
 void
 db_process(database_handle_t *db, const char *type)
 {
-	database_handler_f fun;
+	db_type_handler_t *h;
+	uint64_t start;
 
 	return_if_fail(db_types != NULL);
 	return_if_fail(db != NULL);
 	return_if_fail(type != NULL);
 
-	fun = mowgli_patricia_retrieve(db_types, type);
+	h = mowgli_patricia_retrieve(db_types, type);
 
-	if (!fun)
+	if (!h)
 	{
-		fun = mowgli_patricia_retrieve(db_types, "???");
+		h = mowgli_patricia_retrieve(db_types, "???");
 	}
 
-	fun(db, type);
+	start = profile_now();
+	h->fun(db, type);
+	profile_record(h->profile, profile_now() - start);
 }
 
 bool
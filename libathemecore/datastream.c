@@ -192,6 +192,20 @@ void sendq_set_limit(connection_t *cptr, size_t len)
 	cptr->sendq_limit = len;
 }
 
+int sendq_length(connection_t *cptr)
+{
+	int l = 0;
+	mowgli_node_t *n;
+	struct sendq *sq;
+
+	MOWGLI_ITER_FOREACH(n, cptr->sendq.head)
+	{
+		sq = n->data;
+		l += sq->firstfree - sq->firstused;
+	}
+	return l;
+}
+
 int recvq_length(connection_t *cptr)
 {
 	int l = 0;
@@ -72,6 +72,8 @@ hook_t *hook_add_event(const char *name)
 
 	nh = mowgli_heap_alloc(hook_heap);
 	nh->name = strshare_get(name);
+	nh->metric = NULL;
+	nh->profile = NULL;
 
 	mowgli_patricia_add(hooks, nh->name, nh);
 
@@ -95,6 +97,9 @@ void hook_del_event(const char *name)
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, h->hooks.head)
 		hook_destroy(h, n->data);
 
+	if (h->metric != NULL)
+		metric_delete(h->metric);
+
 	mowgli_patricia_delete(hooks, h->name);
 	strshare_unref(h->name);
 
@@ -173,13 +178,29 @@ void hook_call_event(const char *event, void *dptr)
 	hook_run_ctx_t ctx;
 	mowgli_node_t *n, *tn;
 	void (*func)(void *data);
+	metric_t *metric;
+	profile_entry_t *profile;
+	char labels[BUFSIZE];
+	uint64_t start, taken;
 
 	return_if_fail(event != NULL);
 
 	ctx.hook = hook_find(event);
-	if (ctx.hook == NULL)
+	if (ctx.hook == NULL || MOWGLI_LIST_LENGTH(&ctx.hook->hooks) == 0)
 		return;
 
+	if (ctx.hook->metric == NULL)
+	{
+		snprintf(labels, sizeof labels, "hook=\"%s\"", ctx.hook->name);
+		ctx.hook->metric = metric_histogram("atheme_hook_duration_seconds",
+				"Time spent running the handlers of a hook.", labels);
+		snprintf(labels, sizeof labels, "hook/%s", ctx.hook->name);
+		ctx.hook->profile = profile_entry(labels);
+	}
+	metric = ctx.hook->metric;
+	profile = ctx.hook->profile;
+	start = profile_now();
+
 	ctx.dptr = dptr;
 	ctx.flags = HF_RUN;
 
@@ -196,6 +217,9 @@ void hook_call_event(const char *event, void *dptr)
 
 out:
 	mowgli_node_delete(&ctx.node, &hook_run_stack);
+	taken = profile_now() - start;
+	profile_record(profile, taken);
+	metric_observe(metric, taken / 1000000.0);
 }
 
 static inline hook_run_ctx_t *hook_run_stack_highest(void)
@@ -120,7 +120,469 @@ int ToUpper(int c)
 
 void set_match_mapping(int type)
 {
+	if (match_mapping == type)
+		return;
+
 	match_mapping = type;
+	strshare_refold();
+}
+
+/*
+ * Casemapping kernels.  The scalar kernel follows match_mapping; the
+ * vector ones implement rfc1459 only (ASCII mode folds through the C
+ * library, whose toupper() depends on the locale) and are picked at
+ * runtime like the base64 codecs.
+ *
+ * The vector loops read whole blocks of NUL-terminated strings, so they
+ * may look at bytes past the terminator; they only do so while the
+ * block stays inside one page and step over page boundaries a byte at a
+ * time, so they can never fault.
+ */
+
+static int irccasecmp_scalar(const char *s1, const char *s2)
+{
+	const unsigned char *str1 = (const unsigned char *)s1;
+	const unsigned char *str2 = (const unsigned char *)s2;
+	int res;
+
+	while ((res = ToUpper(*str1) - ToUpper(*str2)) == 0)
+	{
+		if (*str1 == '\0')
+			return 0;
+		str1++;
+		str2++;
+	}
+	return (res);
+}
+
+static int ircncasecmp_scalar(const char *str1, const char *str2, size_t n)
+{
+	const unsigned char *s1 = (const unsigned char *)str1;
+	const unsigned char *s2 = (const unsigned char *)str2;
+	int res;
+
+	while ((res = ToUpper(*s1) - ToUpper(*s2)) == 0)
+	{
+		s1++;
+		s2++;
+		n--;
+		if (n == 0 || (*s1 == '\0' && *s2 == '\0'))
+			return 0;
+	}
+	return (res);
+}
+
+static void irccasecanon_scalar(char *str)
+{
+	while (*str)
+	{
+		*str = ToUpper(*str);
+		str++;
+	}
+	return;
+}
+
+/* case-insensitive: do len bytes at s1 and s2 match? */
+static bool ircmemeq(const unsigned char *s1, const unsigned char *s2, size_t len)
+{
+	while (len-- > 0)
+		if (ToUpper(*s1++) != ToUpper(*s2++))
+			return false;
+	return true;
+}
+
+static const char *ircmemmem_scalar(const char *hay, size_t haylen, const char *needle, size_t len)
+{
+	const unsigned char *h = (const unsigned char *)hay, *end;
+	int first = ToUpper(*needle);
+
+	if (len > haylen)
+		return NULL;
+
+	for (end = h + haylen - len; h <= end; h++)
+		if (ToUpper(*h) == first && ircmemeq(h + 1, (const unsigned char *)needle + 1, len - 1))
+			return (const char *)h;
+
+	return NULL;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define MATCH_X86
+
+#include <immintrin.h>
+
+#define MATCH_TARGET_SSE2 __attribute__((target("sse2")))
+#define MATCH_TARGET_AVX2 __attribute__((target("avx2")))
+
+#define MATCH_PAGESIZE 4096
+
+static inline bool match_in_page(const char *p, size_t n)
+{
+	return ((uintptr_t)p & (MATCH_PAGESIZE - 1)) <= MATCH_PAGESIZE - n;
+}
+
+static bool match_have_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool match_have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/* rfc1459 ToUpper: 'a'..'~' lose 0x20, everything else stays */
+static inline MATCH_TARGET_SSE2 __m128i match_fold_sse2(__m128i x)
+{
+	__m128i t = _mm_sub_epi8(x, _mm_set1_epi8('a'));
+	__m128i in = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('~' - 'a')), t);
+
+	return _mm_xor_si128(x, _mm_and_si128(in, _mm_set1_epi8(0x20)));
+}
+
+/* bit i set where the folded bytes differ or s1 ends */
+static inline MATCH_TARGET_SSE2 unsigned int match_stop_sse2(const char *s1, const char *s2)
+{
+	__m128i a = _mm_loadu_si128((const __m128i *)s1);
+	__m128i b = _mm_loadu_si128((const __m128i *)s2);
+	unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(match_fold_sse2(a), match_fold_sse2(b)));
+
+	return (~eq & 0xffff) | _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128()));
+}
+
+static MATCH_TARGET_SSE2 int irccasecmp_sse2(const char *s1, const char *s2)
+{
+	unsigned int stop, i;
+	int res;
+
+	for (;;)
+	{
+		if (match_in_page(s1, 16) && match_in_page(s2, 16))
+		{
+			if ((stop = match_stop_sse2(s1, s2)) == 0)
+			{
+				s1 += 16;
+				s2 += 16;
+				continue;
+			}
+			i = __builtin_ctz(stop);
+			return ToUpperTab[(unsigned char)s1[i]] - ToUpperTab[(unsigned char)s2[i]];
+		}
+
+		if ((res = ToUpperTab[(unsigned char)*s1] - ToUpperTab[(unsigned char)*s2]) != 0 || *s1 == '\0')
+			return res;
+		s1++;
+		s2++;
+	}
+}
+
+static MATCH_TARGET_SSE2 int ircncasecmp_sse2(const char *s1, const char *s2, size_t n)
+{
+	unsigned int stop, i;
+	int res;
+
+	while (n > 16)
+	{
+		if (match_in_page(s1, 16) && match_in_page(s2, 16))
+		{
+			if ((stop = match_stop_sse2(s1, s2)) == 0)
+			{
+				s1 += 16;
+				s2 += 16;
+				n -= 16;
+				continue;
+			}
+			i = __builtin_ctz(stop);
+			return ToUpperTab[(unsigned char)s1[i]] - ToUpperTab[(unsigned char)s2[i]];
+		}
+
+		if ((res = ToUpperTab[(unsigned char)*s1] - ToUpperTab[(unsigned char)*s2]) != 0 || *s1 == '\0')
+			return res;
+		s1++;
+		s2++;
+		n--;
+	}
+
+	/* the scalar loop checks for the end after each step, not before */
+	if (*s1 == '\0' && *s2 == '\0')
+		return 0;
+
+	return ircncasecmp_scalar(s1, s2, n);
+}
+
+static MATCH_TARGET_SSE2 void irccasecanon_sse2(char *str)
+{
+	__m128i x;
+
+	for (;;)
+	{
+		if (match_in_page(str, 16))
+		{
+			x = _mm_loadu_si128((const __m128i *)str);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0)
+				break;
+			_mm_storeu_si128((__m128i *)str, match_fold_sse2(x));
+			str += 16;
+			continue;
+		}
+
+		if (*str == '\0')
+			return;
+		*str = ToUpperTab[(unsigned char)*str];
+		str++;
+	}
+
+	irccasecanon_scalar(str);
+}
+
+/* look for the first and last needle byte 16 positions at a time, then
+ * check the candidates (Wojciech Muła's SIMD-friendly substring search) */
+static MATCH_TARGET_SSE2 const char *ircmemmem_sse2(const char *hay, size_t haylen, const char *needle, size_t len)
+{
+	__m128i first = _mm_set1_epi8(ToUpperTab[(unsigned char)needle[0]]);
+	__m128i last = _mm_set1_epi8(ToUpperTab[(unsigned char)needle[len - 1]]);
+	__m128i f, l;
+	unsigned int cand, j;
+	size_t i;
+
+	if (len > haylen)
+		return NULL;
+
+	for (i = 0; i + len - 1 + 16 <= haylen; i += 16)
+	{
+		f = match_fold_sse2(_mm_loadu_si128((const __m128i *)(hay + i)));
+		l = match_fold_sse2(_mm_loadu_si128((const __m128i *)(hay + i + len - 1)));
+		cand = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+
+		for (; cand != 0; cand &= cand - 1)
+		{
+			j = __builtin_ctz(cand);
+			if (ircmemeq((const unsigned char *)hay + i + j + 1, (const unsigned char *)needle + 1, len - 1))
+				return hay + i + j;
+		}
+	}
+
+	return ircmemmem_scalar(hay + i, haylen - i, needle, len);
+}
+
+static inline MATCH_TARGET_AVX2 __m256i match_fold_avx2(__m256i x)
+{
+	__m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('a'));
+	__m256i in = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('~' - 'a')), t);
+
+	return _mm256_xor_si256(x, _mm256_and_si256(in, _mm256_set1_epi8(0x20)));
+}
+
+static inline MATCH_TARGET_AVX2 unsigned int match_stop_avx2(const char *s1, const char *s2)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i *)s1);
+	__m256i b = _mm256_loadu_si256((const __m256i *)s2);
+	unsigned int eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(match_fold_avx2(a), match_fold_avx2(b)));
+
+	return ~eq | (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, _mm256_setzero_si256()));
+}
+
+static MATCH_TARGET_AVX2 int irccasecmp_avx2(const char *s1, const char *s2)
+{
+	unsigned int stop, i;
+	int res;
+
+	for (;;)
+	{
+		if (match_in_page(s1, 32) && match_in_page(s2, 32))
+		{
+			if ((stop = match_stop_avx2(s1, s2)) == 0)
+			{
+				s1 += 32;
+				s2 += 32;
+				continue;
+			}
+			i = __builtin_ctz(stop);
+			return ToUpperTab[(unsigned char)s1[i]] - ToUpperTab[(unsigned char)s2[i]];
+		}
+
+		if ((res = ToUpperTab[(unsigned char)*s1] - ToUpperTab[(unsigned char)*s2]) != 0 || *s1 == '\0')
+			return res;
+		s1++;
+		s2++;
+	}
+}
+
+static MATCH_TARGET_AVX2 int ircncasecmp_avx2(const char *s1, const char *s2, size_t n)
+{
+	unsigned int stop, i;
+	int res;
+
+	while (n > 32)
+	{
+		if (match_in_page(s1, 32) && match_in_page(s2, 32))
+		{
+			if ((stop = match_stop_avx2(s1, s2)) == 0)
+			{
+				s1 += 32;
+				s2 += 32;
+				n -= 32;
+				continue;
+			}
+			i = __builtin_ctz(stop);
+			return ToUpperTab[(unsigned char)s1[i]] - ToUpperTab[(unsigned char)s2[i]];
+		}
+
+		if ((res = ToUpperTab[(unsigned char)*s1] - ToUpperTab[(unsigned char)*s2]) != 0 || *s1 == '\0')
+			return res;
+		s1++;
+		s2++;
+		n--;
+	}
+
+	/* the scalar loop checks for the end after each step, not before */
+	if (*s1 == '\0' && *s2 == '\0')
+		return 0;
+
+	return ircncasecmp_sse2(s1, s2, n);
+}
+
+static MATCH_TARGET_AVX2 void irccasecanon_avx2(char *str)
+{
+	__m256i x;
+
+	for (;;)
+	{
+		if (match_in_page(str, 32))
+		{
+			x = _mm256_loadu_si256((const __m256i *)str);
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_setzero_si256())) != 0)
+				break;
+			_mm256_storeu_si256((__m256i *)str, match_fold_avx2(x));
+			str += 32;
+			continue;
+		}
+
+		if (*str == '\0')
+			return;
+		*str = ToUpperTab[(unsigned char)*str];
+		str++;
+	}
+
+	irccasecanon_sse2(str);
+}
+
+static MATCH_TARGET_AVX2 const char *ircmemmem_avx2(const char *hay, size_t haylen, const char *needle, size_t len)
+{
+	__m256i first = _mm256_set1_epi8(ToUpperTab[(unsigned char)needle[0]]);
+	__m256i last = _mm256_set1_epi8(ToUpperTab[(unsigned char)needle[len - 1]]);
+	__m256i f, l;
+	unsigned int cand, j;
+	size_t i;
+
+	if (len > haylen)
+		return NULL;
+
+	for (i = 0; i + len - 1 + 32 <= haylen; i += 32)
+	{
+		f = match_fold_avx2(_mm256_loadu_si256((const __m256i *)(hay + i)));
+		l = match_fold_avx2(_mm256_loadu_si256((const __m256i *)(hay + i + len - 1)));
+		cand = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+
+		for (; cand != 0; cand &= cand - 1)
+		{
+			j = __builtin_ctz(cand);
+			if (ircmemeq((const unsigned char *)hay + i + j + 1, (const unsigned char *)needle + 1, len - 1))
+				return hay + i + j;
+		}
+	}
+
+	return ircmemmem_sse2(hay + i, haylen - i, needle, len);
+}
+#endif /* x86 */
+
+/* ordered from least to most preferred */
+const struct match_kernel match_kernels[] = {
+	{ "scalar", irccasecmp_scalar, ircncasecmp_scalar, irccasecanon_scalar, ircmemmem_scalar, NULL },
+#ifdef MATCH_X86
+	{ "sse2", irccasecmp_sse2, ircncasecmp_sse2, irccasecanon_sse2, ircmemmem_sse2, match_have_sse2 },
+	{ "avx2", irccasecmp_avx2, ircncasecmp_avx2, irccasecanon_avx2, ircmemmem_avx2, match_have_avx2 },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+static const struct match_kernel *match_kernel = NULL;
+
+static void match_kernel_init(void)
+{
+	const struct match_kernel *k;
+
+	for (k = match_kernels; k->name != NULL; k++)
+		if (k->usable == NULL || k->usable())
+			match_kernel = k;
+}
+
+/*
+ * match_kernel_select(const char *name)
+ *
+ * Forces a particular casemapping kernel, for benchmarks and testing.
+ *
+ * Inputs:
+ *       - name of a kernel from match_kernels[], or NULL for the default
+ *
+ * Outputs:
+ *       - the selected kernel, or NULL if the kernel is unknown or not
+ *         supported by this CPU
+ */
+const struct match_kernel *match_kernel_select(const char *name)
+{
+	const struct match_kernel *k;
+
+	if (name == NULL)
+	{
+		match_kernel_init();
+		return match_kernel;
+	}
+
+	for (k = match_kernels; k->name != NULL; k++)
+	{
+		if (strcasecmp(k->name, name))
+			continue;
+		if (k->usable != NULL && !k->usable())
+			return NULL;
+
+		match_kernel = k;
+		return k;
+	}
+
+	return NULL;
+}
+
+static inline const struct match_kernel *match_kernel_get(void)
+{
+	if (match_mapping == MATCH_ASCII)
+		return &match_kernels[0];
+
+	if (match_kernel == NULL)
+		match_kernel_init();
+
+	return match_kernel;
+}
+
+/*
+ * After a '*', the run of plain characters up to the next wildcard must
+ * occur somewhere in the rest of the name, and trying any position
+ * before its first occurrence fails.  Jump straight there, or give up if
+ * there is none.
+ */
+static const u_char *match_skip(const u_char *m, const u_char *n, const u_char *nend)
+{
+	size_t len;
+
+	for (len = 0; m[len] != '\0' && strchr("*?&#%\\", m[len]) == NULL; len++)
+		;
+	if (len == 0)
+		return n;
+
+	return (const u_char *)match_kernel_get()->find((const char *)n, nend - n, (const char *)m, len);
 }
 
 #define MAX_ITERATIONS  512
@@ -141,7 +603,7 @@ void set_match_mapping(int type)
 
 int match(const char *mask, const char *name)
 {
-	const u_char *m = (const u_char *)mask, *n = (const u_char *)name;
+	const u_char *m = (const u_char *)mask, *n = (const u_char *)name, *nend = NULL;
 	const char *ma = mask, *na = name;
 	int wild = 0, q = 0, calls = 0;
 
@@ -164,6 +626,10 @@ int match(const char *mask, const char *name)
 			while (*m == '*')
 				m++;
 			wild = 1;
+			if (nend == NULL)
+				nend = n + strlen((const char *)n);
+			if ((n = match_skip(m, n, nend)) == NULL)
+				return 1;
 			ma = (const char *)m;
 			na = (const char *)n;
 		}
@@ -179,7 +645,9 @@ int match(const char *mask, const char *name)
 			if (!wild)
 				return 1;
 			m = (const u_char *) ma;
-			n = (const u_char *)++ na;
+			if ((n = match_skip(m, (const u_char *)++ na, nend)) == NULL)
+				return 1;
+			na = (const char *)n;
 		}
 		else if (!*n)
 			return 1;
@@ -196,7 +664,9 @@ int match(const char *mask, const char *name)
 			if (!wild)
 				return 1;
 			m = (const u_char *) ma;
-			n = (const u_char *)++ na;
+			if ((n = match_skip(m, (const u_char *)++ na, nend)) == NULL)
+				return 1;
+			na = (const char *)n;
 		}
 		else
 		{
@@ -255,54 +725,26 @@ char *collapse(char *pattern)
 */
 int irccasecmp(const char *s1, const char *s2)
 {
-	const unsigned char *str1 = (const unsigned char *)s1;
-	const unsigned char *str2 = (const unsigned char *)s2;
-	int res;
-
 	if (!s1 || !s2)
 		return -1;
 
 	if (match_mapping == MATCH_ASCII)
 		return strcasecmp(s1, s2);
 
-	while ((res = ToUpper(*str1) - ToUpper(*str2)) == 0)
-	{
-		if (*str1 == '\0')
-			return 0;
-		str1++;
-		str2++;
-	}
-	return (res);
+	return match_kernel_get()->cmp(s1, s2);
 }
 
 int ircncasecmp(const char *str1, const char *str2, size_t n)
 {
-	const unsigned char *s1 = (const unsigned char *)str1;
-	const unsigned char *s2 = (const unsigned char *)str2;
-	int res;
-
 	if (match_mapping == MATCH_ASCII)
 		return strncasecmp(str1, str2, n);
 
-	while ((res = ToUpper(*s1) - ToUpper(*s2)) == 0)
-	{
-		s1++;
-		s2++;
-		n--;
-		if (n == 0 || (*s1 == '\0' && *s2 == '\0'))
-			return 0;
-	}
-	return (res);
+	return match_kernel_get()->ncmp(str1, str2, n);
 }
 
 void irccasecanon(char *str)
 {
-	while (*str)
-	{
-		*str = ToUpper(*str);
-		str++;
-	}
-	return;
+	match_kernel_get()->canon(str);
 }
 
 void strcasecanon(char *str)
@@ -0,0 +1,508 @@
+/*
+ * atheme-services: A collection of minimalist IRC services
+ * matchset.c: Compiled sets of match() masks.
+ *
+ * Copyright (c) 2026 Atheme Development Group (http://atheme.org)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "atheme.h"
+
+/*
+ * A matchset answers "which is the first of these masks, in the order
+ * they were added, that matches this name" without trying every mask.
+ * Masks are sorted into four kinds when the set is compiled:
+ *
+ *   - literals, which go in a patricia keyed by the lowercased mask;
+ *   - "text*" and "*text", which go in patricias keyed by the text, and
+ *     are found by looking up each prefix or suffix of the name whose
+ *     length some mask in the set has;
+ *   - other masks with some literal text, which are found by running
+ *     one Aho-Corasick automaton built from their longest literal
+ *     fragment over the name, and confirmed with match();
+ *   - masks without any literal text, which are just tried in order.
+ *
+ * Every kind yields at most one candidate per mask, and a candidate is
+ * only confirmed if it comes before the best one found so far, so the
+ * result is the same as walking the list with match().
+ */
+
+#define MATCHSET_MAXLEN		BUFSIZE
+
+typedef struct matchset_entry_ matchset_entry_t;
+
+struct matchset_entry_ {
+	const char *mask;
+	void *data;
+	unsigned int flags;
+	unsigned int order;
+	unsigned int stamp;		/* last lookup that tried it */
+	matchset_entry_t *next;		/* same key, or same automaton state */
+};
+
+typedef struct {
+	unsigned int child;		/* first child */
+	unsigned int sibling;
+	unsigned int fail;
+	unsigned int dict;		/* nearest state down the fail chain with output */
+	matchset_entry_t *out;
+	unsigned char c;
+} matchset_state_t;
+
+struct matchset_ {
+	matchset_entry_t *entries;
+	unsigned int count, size;
+
+	bool compiled;
+	int mapping;			/* match_mapping it was compiled for */
+	unsigned int stamp;
+
+	mowgli_patricia_t *exact, *prefix, *suffix;
+	unsigned int *prefix_lens, nprefix_lens;	/* longest first */
+	unsigned int *suffix_lens, nsuffix_lens;
+
+	matchset_state_t *states;
+	unsigned int nstates, states_size;
+	unsigned int root[256];
+
+	matchset_entry_t **always;
+	unsigned int nalways;
+};
+
+static inline bool matchset_special(unsigned char c)
+{
+	return c == '*' || c == '?' || c == '&' || c == '#' || c == '%' || c == '\\';
+}
+
+static void matchset_lower(char *dst, const char *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = ToLower((unsigned char)src[i]);
+	dst[len] = '\0';
+}
+
+matchset_t *matchset_create(void)
+{
+	return scalloc(1, sizeof(matchset_t));
+}
+
+static void matchset_uncompile(matchset_t *ms)
+{
+	if (!ms->compiled)
+		return;
+
+	mowgli_patricia_destroy(ms->exact, NULL, NULL);
+	mowgli_patricia_destroy(ms->prefix, NULL, NULL);
+	mowgli_patricia_destroy(ms->suffix, NULL, NULL);
+	free(ms->prefix_lens);
+	free(ms->suffix_lens);
+	free(ms->states);
+	free(ms->always);
+
+	ms->exact = ms->prefix = ms->suffix = NULL;
+	ms->prefix_lens = ms->suffix_lens = NULL;
+	ms->nprefix_lens = ms->nsuffix_lens = 0;
+	ms->states = NULL;
+	ms->nstates = ms->states_size = 0;
+	ms->always = NULL;
+	ms->nalways = 0;
+	ms->compiled = false;
+}
+
+/* forget every mask; the set is refilled with matchset_add() */
+void matchset_clear(matchset_t *ms)
+{
+	return_if_fail(ms != NULL);
+
+	matchset_uncompile(ms);
+	ms->count = 0;
+}
+
+void matchset_destroy(matchset_t *ms)
+{
+	return_if_fail(ms != NULL);
+
+	matchset_uncompile(ms);
+	free(ms->entries);
+	free(ms);
+}
+
+/* mask must stay valid until the set is cleared; with MATCHSET_LITERAL
+ * it is compared case insensitively as a whole instead of as a mask */
+void matchset_add(matchset_t *ms, const char *mask, void *data, unsigned int flags)
+{
+	matchset_entry_t *e;
+
+	return_if_fail(ms != NULL);
+	return_if_fail(mask != NULL);
+
+	matchset_uncompile(ms);
+
+	if (ms->count == ms->size)
+	{
+		ms->size = ms->size ? ms->size * 2 : 64;
+		ms->entries = srealloc(ms->entries, ms->size * sizeof(matchset_entry_t));
+	}
+
+	e = &ms->entries[ms->count];
+	e->mask = mask;
+	e->data = data;
+	e->flags = flags;
+	e->order = ms->count++;
+	e->stamp = 0;
+	e->next = NULL;
+}
+
+static void matchset_bucket_add(mowgli_patricia_t *dict, const char *key, matchset_entry_t *e)
+{
+	matchset_entry_t *head;
+
+	if ((head = mowgli_patricia_retrieve(dict, key)) == NULL)
+	{
+		mowgli_patricia_add(dict, key, e);
+		return;
+	}
+
+	/* entries are added in order, so the chain stays sorted */
+	while (head->next != NULL)
+		head = head->next;
+	head->next = e;
+}
+
+static unsigned int *matchset_lengths(const bool *seen, unsigned int *count)
+{
+	unsigned int *lens, i, n = 0;
+
+	for (i = 0; i < MATCHSET_MAXLEN; i++)
+		if (seen[i])
+			n++;
+
+	lens = smalloc((n ? n : 1) * sizeof(unsigned int));
+	for (i = MATCHSET_MAXLEN, n = 0; i-- > 0; )
+		if (seen[i])
+			lens[n++] = i;
+
+	*count = n;
+	return lens;
+}
+
+static unsigned int matchset_state_new(matchset_t *ms, unsigned char c)
+{
+	matchset_state_t *s;
+
+	if (ms->nstates == ms->states_size)
+	{
+		ms->states_size = ms->states_size ? ms->states_size * 2 : 256;
+		ms->states = srealloc(ms->states, ms->states_size * sizeof(matchset_state_t));
+	}
+
+	s = &ms->states[ms->nstates];
+	memset(s, 0, sizeof *s);
+	s->c = c;
+
+	return ms->nstates++;
+}
+
+/* the state reached from s on c, or 0 */
+static inline unsigned int matchset_goto(matchset_t *ms, unsigned int s, unsigned char c)
+{
+	unsigned int t;
+
+	if (s == 0)
+		return ms->root[c];
+
+	for (t = ms->states[s].child; t != 0; t = ms->states[t].sibling)
+		if (ms->states[t].c == c)
+			return t;
+
+	return 0;
+}
+
+static void matchset_automaton_add(matchset_t *ms, const char *frag, size_t len, matchset_entry_t *e)
+{
+	unsigned int s = 0, t;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = frag[i];
+
+		if ((t = matchset_goto(ms, s, c)) == 0)
+		{
+			t = matchset_state_new(ms, c);
+			if (s == 0)
+				ms->root[c] = t;
+			else
+			{
+				ms->states[t].sibling = ms->states[s].child;
+				ms->states[s].child = t;
+			}
+		}
+		s = t;
+	}
+
+	e->next = ms->states[s].out;
+	ms->states[s].out = e;
+}
+
+/* breadth first, so a state's fail target is done before it is */
+static void matchset_automaton_link(matchset_t *ms)
+{
+	unsigned int *queue, head = 0, tail = 0, s, t, f, c;
+
+	queue = smalloc(ms->nstates * sizeof(unsigned int));
+
+	for (c = 0; c < 256; c++)
+		if ((t = ms->root[c]) != 0)
+			queue[tail++] = t;
+
+	while (head < tail)
+	{
+		s = queue[head++];
+
+		for (t = ms->states[s].child; t != 0; t = ms->states[t].sibling)
+		{
+			c = ms->states[t].c;
+
+			for (f = ms->states[s].fail; f != 0 && matchset_goto(ms, f, c) == 0; f = ms->states[f].fail)
+				;
+			f = matchset_goto(ms, f, c);
+
+			ms->states[t].fail = f;
+			ms->states[t].dict = ms->states[f].out != NULL ? f : ms->states[f].dict;
+			queue[tail++] = t;
+		}
+	}
+
+	free(queue);
+}
+
+static void matchset_compile(matchset_t *ms)
+{
+	bool *prefix_seen, *suffix_seen;
+	char key[MATCHSET_MAXLEN];
+	unsigned int i;
+
+	ms->exact = mowgli_patricia_create(noopcanon);
+	ms->prefix = mowgli_patricia_create(noopcanon);
+	ms->suffix = mowgli_patricia_create(noopcanon);
+	ms->always = smalloc((ms->count ? ms->count : 1) * sizeof(matchset_entry_t *));
+	ms->nalways = 0;
+	memset(ms->root, 0, sizeof ms->root);
+	matchset_state_new(ms, 0);
+
+	prefix_seen = scalloc(MATCHSET_MAXLEN, sizeof(bool));
+	suffix_seen = scalloc(MATCHSET_MAXLEN, sizeof(bool));
+
+	for (i = 0; i < ms->count; i++)
+	{
+		matchset_entry_t *e = &ms->entries[i];
+		const char *m = e->mask, *p, *frag = NULL;
+		size_t len = strlen(m), lead, trail, fraglen = 0, run;
+
+		e->next = NULL;
+		e->stamp = 0;
+
+		if (len >= MATCHSET_MAXLEN)
+		{
+			ms->always[ms->nalways++] = e;
+			continue;
+		}
+
+		if (e->flags & MATCHSET_LITERAL)
+		{
+			matchset_lower(key, m, len);
+			matchset_bucket_add(ms->exact, key, e);
+			continue;
+		}
+
+		for (lead = 0; m[lead] == '*'; lead++)
+			;
+		for (trail = 0; trail < len - lead && m[len - 1 - trail] == '*'; trail++)
+			;
+
+		/* the longest run of literal text, and whether that is all
+		 * there is between the leading and trailing stars */
+		for (p = m + lead, run = 0; p <= m + len - trail; p++)
+		{
+			if (p < m + len - trail && !matchset_special(*p))
+			{
+				run++;
+				continue;
+			}
+			if (run > fraglen)
+			{
+				fraglen = run;
+				frag = p - run;
+			}
+			run = 0;
+		}
+
+		if (fraglen != 0 && fraglen == len - lead - trail && !(lead && trail))
+		{
+			matchset_lower(key, frag, fraglen);
+
+			if (!lead && !trail)
+				matchset_bucket_add(ms->exact, key, e);
+			else if (!lead)
+			{
+				matchset_bucket_add(ms->prefix, key, e);
+				prefix_seen[fraglen] = true;
+			}
+			else
+			{
+				matchset_bucket_add(ms->suffix, key, e);
+				suffix_seen[fraglen] = true;
+			}
+		}
+		else if (fraglen != 0)
+		{
+			matchset_lower(key, frag, fraglen);
+			matchset_automaton_add(ms, key, fraglen, e);
+		}
+		else
+			ms->always[ms->nalways++] = e;
+	}
+
+	ms->prefix_lens = matchset_lengths(prefix_seen, &ms->nprefix_lens);
+	ms->suffix_lens = matchset_lengths(suffix_seen, &ms->nsuffix_lens);
+	free(prefix_seen);
+	free(suffix_seen);
+
+	matchset_automaton_link(ms);
+
+	ms->mapping = match_mapping;
+	ms->compiled = true;
+}
+
+/* the first entry of a bucket chain that comes before best and is usable */
+static matchset_entry_t *matchset_chain(matchset_entry_t *e, matchset_entry_t *best, bool (*usable)(void *data))
+{
+	for (; e != NULL && (best == NULL || e->order < best->order); e = e->next)
+		if (usable == NULL || usable(e->data))
+			return e;
+
+	return best;
+}
+
+/* try e against name, keeping whichever of it and best comes first */
+static inline matchset_entry_t *matchset_try(matchset_t *ms, matchset_entry_t *e, matchset_entry_t *best, const char *name, bool (*usable)(void *data))
+{
+	if (best != NULL && e->order >= best->order)
+		return best;
+	if (e->stamp == ms->stamp)
+		return best;
+	e->stamp = ms->stamp;
+
+	if (usable != NULL && !usable(e->data))
+		return best;
+	if (e->flags & MATCHSET_LITERAL ? irccasecmp(e->mask, name) : match(e->mask, name))
+		return best;
+
+	return e;
+}
+
+/* the data of the first mask, in the order they were added, matching
+ * name for which usable (if not NULL) returns true */
+void *matchset_find(matchset_t *ms, const char *name, bool (*usable)(void *data))
+{
+	matchset_entry_t *best = NULL, *e;
+	char buf[MATCHSET_MAXLEN];
+	size_t len;
+	unsigned int i, s, t;
+
+	return_val_if_fail(ms != NULL, NULL);
+	return_val_if_fail(name != NULL, NULL);
+
+	if (ms->count == 0)
+		return NULL;
+
+	len = strlen(name);
+	if (len >= sizeof buf)
+	{
+		/* too long to have been indexed for; do it the slow way */
+		for (i = 0; i < ms->count; i++)
+		{
+			e = &ms->entries[i];
+			if (usable != NULL && !usable(e->data))
+				continue;
+			if (e->flags & MATCHSET_LITERAL ? !irccasecmp(e->mask, name) : !match(e->mask, name))
+				return e->data;
+		}
+		return NULL;
+	}
+
+	if (ms->compiled && ms->mapping != match_mapping)
+		matchset_uncompile(ms);
+	if (!ms->compiled)
+		matchset_compile(ms);
+
+	if (++ms->stamp == 0)
+	{
+		for (i = 0; i < ms->count; i++)
+			ms->entries[i].stamp = 0;
+		ms->stamp = 1;
+	}
+
+	matchset_lower(buf, name, len);
+
+	best = matchset_chain(mowgli_patricia_retrieve(ms->exact, buf), best, usable);
+
+	for (i = 0; i < ms->nsuffix_lens; i++)
+		if (ms->suffix_lens[i] <= len)
+			best = matchset_chain(mowgli_patricia_retrieve(ms->suffix, buf + len - ms->suffix_lens[i]), best, usable);
+
+	/* longest first, so the name can be cut down in place */
+	for (i = 0; i < ms->nprefix_lens; i++)
+		if (ms->prefix_lens[i] <= len)
+		{
+			buf[ms->prefix_lens[i]] = '\0';
+			best = matchset_chain(mowgli_patricia_retrieve(ms->prefix, buf), best, usable);
+		}
+
+	for (i = 0; i < ms->nalways; i++)
+		best = matchset_try(ms, ms->always[i], best, name, usable);
+
+	if (ms->nstates > 1)
+	{
+		matchset_lower(buf, name, len);
+
+		for (i = 0, s = 0; i < len; i++)
+		{
+			unsigned char c = buf[i];
+
+			while ((t = matchset_goto(ms, s, c)) == 0 && s != 0)
+				s = ms->states[s].fail;
+			s = t;
+
+			for (t = ms->states[s].out != NULL ? s : ms->states[s].dict; t != 0; t = ms->states[t].dict)
+				for (e = ms->states[t].out; e != NULL; e = e->next)
+					best = matchset_try(ms, e, best, name, usable);
+		}
+	}
+
+	return best != NULL ? best->data : NULL;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -0,0 +1,275 @@
+/*
+ * atheme-services: A collection of minimalist IRC services
+ * metrics.c: Counters, gauges and latency histograms.
+ *
+ * Copyright (c) 2026 Atheme Development Group (http://atheme.org)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "atheme.h"
+#include "datastream.h"
+#include "uplink.h"
+
+/*
+ * Metrics are grouped into families sharing a name, help text and type;
+ * each family holds one series per distinct label string.  Both levels
+ * are patricias so an update site can look its series up by name on
+ * every call without keeping pointers around, and so the export comes
+ * out sorted.  Series are keyed by their labels wrapped in braces, which
+ * keeps the unlabelled series from needing an empty key.
+ */
+
+struct metric_family_ {
+	char *name;
+	char *help;
+	metric_type_t type;
+	mowgli_patricia_t *series;
+};
+
+const double metric_buckets[METRIC_BUCKETS] = {
+	0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+	0.1, 0.25, 0.5, 1, 2.5, 5
+};
+
+static mowgli_patricia_t *metric_families;
+static mowgli_heap_t *metric_heap;
+
+static const char *metric_typenames[] = { "counter", "gauge", "histogram" };
+
+static metric_t *metric_find_or_add(metric_type_t type, const char *family, const char *help, const char *labels)
+{
+	metric_family_t *mf;
+	metric_t *m;
+	char key[BUFSIZE];
+
+	return_val_if_fail(family != NULL, NULL);
+
+	if (labels == NULL)
+		labels = "";
+	snprintf(key, sizeof key, "{%s}", labels);
+
+	mf = mowgli_patricia_retrieve(metric_families, family);
+	if (mf == NULL)
+	{
+		mf = smalloc(sizeof *mf);
+		mf->name = sstrdup(family);
+		mf->help = sstrdup(help != NULL ? help : family);
+		mf->type = type;
+		mf->series = mowgli_patricia_create(noopcanon);
+		mowgli_patricia_add(metric_families, mf->name, mf);
+	}
+	else if (mf->type != type)
+		slog(LG_DEBUG, "metric_find_or_add(): %s is a %s, not a %s", family,
+				metric_typenames[mf->type], metric_typenames[type]);
+
+	m = mowgli_patricia_retrieve(mf->series, key);
+	if (m != NULL)
+		return m;
+
+	m = mowgli_heap_alloc(metric_heap);
+	m->family = mf;
+	m->labels = sstrdup(labels);
+	mowgli_patricia_add(mf->series, key, m);
+
+	return m;
+}
+
+metric_t *metric_counter(const char *family, const char *help, const char *labels)
+{
+	return metric_find_or_add(METRIC_COUNTER, family, help, labels);
+}
+
+metric_t *metric_gauge(const char *family, const char *help, const char *labels)
+{
+	return metric_find_or_add(METRIC_GAUGE, family, help, labels);
+}
+
+metric_t *metric_histogram(const char *family, const char *help, const char *labels)
+{
+	return metric_find_or_add(METRIC_HISTOGRAM, family, help, labels);
+}
+
+/* a counter or gauge whose value is read from fn when exported */
+metric_t *metric_callback(metric_type_t type, const char *family, const char *help, const char *labels, double (*fn)(void))
+{
+	metric_t *m;
+
+	return_val_if_fail(type != METRIC_HISTOGRAM, NULL);
+
+	m = metric_find_or_add(type, family, help, labels);
+	if (m != NULL)
+		m->fn = fn;
+
+	return m;
+}
+
+void metric_delete(metric_t *m)
+{
+	metric_family_t *mf;
+	char key[BUFSIZE];
+
+	return_if_fail(m != NULL);
+
+	mf = m->family;
+	snprintf(key, sizeof key, "{%s}", m->labels);
+	mowgli_patricia_delete(mf->series, key);
+	free(m->labels);
+	mowgli_heap_free(metric_heap, m);
+
+	if (mowgli_patricia_size(mf->series) == 0)
+	{
+		mowgli_patricia_delete(metric_families, mf->name);
+		mowgli_patricia_destroy(mf->series, NULL, NULL);
+		free(mf->name);
+		free(mf->help);
+		free(mf);
+	}
+}
+
+/* wall clock in seconds, for timing things to pass to metric_observe() */
+double metric_clock(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#else
+	return time(NULL);
+#endif
+}
+
+static void metric_line(mowgli_string_t *out, const char *name, const char *suffix, const char *labels, const char *extra, double value)
+{
+	char buf[BUFSIZE];
+
+	if (*labels != '\0' && extra != NULL)
+		snprintf(buf, sizeof buf, "%s%s{%s,%s} %.15g\n", name, suffix, labels, extra, value);
+	else if (*labels != '\0' || extra != NULL)
+		snprintf(buf, sizeof buf, "%s%s{%s} %.15g\n", name, suffix, extra != NULL ? extra : labels, value);
+	else
+		snprintf(buf, sizeof buf, "%s%s %.15g\n", name, suffix, value);
+
+	out->append(out, buf, strlen(buf));
+}
+
+static void metric_render_histogram(mowgli_string_t *out, metric_t *m)
+{
+	unsigned long cumulative = 0;
+	unsigned int i;
+	char le[32];
+
+	for (i = 0; i < METRIC_BUCKETS; i++)
+	{
+		cumulative += m->buckets[i];
+		snprintf(le, sizeof le, "le=\"%g\"", metric_buckets[i]);
+		metric_line(out, m->family->name, "_bucket", m->labels, le, cumulative);
+	}
+	metric_line(out, m->family->name, "_bucket", m->labels, "le=\"+Inf\"", m->count);
+	metric_line(out, m->family->name, "_sum", m->labels, NULL, m->value);
+	metric_line(out, m->family->name, "_count", m->labels, NULL, m->count);
+}
+
+/* append every metric to out in the Prometheus text exposition format */
+void metrics_render(mowgli_string_t *out)
+{
+	mowgli_patricia_iteration_state_t state, state2;
+	metric_family_t *mf;
+	metric_t *m;
+	char buf[BUFSIZE];
+
+	MOWGLI_PATRICIA_FOREACH(mf, &state, metric_families)
+	{
+		snprintf(buf, sizeof buf, "# HELP %s %s\n# TYPE %s %s\n",
+				mf->name, mf->help, mf->name, metric_typenames[mf->type]);
+		out->append(out, buf, strlen(buf));
+
+		MOWGLI_PATRICIA_FOREACH(m, &state2, mf->series)
+		{
+			if (mf->type == METRIC_HISTOGRAM)
+				metric_render_histogram(out, m);
+			else
+				metric_line(out, mf->name, "", m->labels, NULL,
+						m->fn != NULL ? m->fn() : m->value);
+		}
+	}
+}
+
+static double metric_users(void)
+{
+	return cnt.user;
+}
+
+static double metric_channels(void)
+{
+	return cnt.chan;
+}
+
+static double metric_accounts(void)
+{
+	return cnt.myuser;
+}
+
+static double metric_servers(void)
+{
+	return mowgli_patricia_size(servlist);
+}
+
+static double metric_bytes_in(void)
+{
+	return cnt.bin;
+}
+
+static double metric_bytes_out(void)
+{
+	return cnt.bout;
+}
+
+static double metric_uplink_sendq(void)
+{
+	if (curr_uplink == NULL || curr_uplink->conn == NULL)
+		return 0;
+
+	return sendq_length(curr_uplink->conn);
+}
+
+void metrics_init(void)
+{
+	metric_families = mowgli_patricia_create(noopcanon);
+	metric_heap = sharedheap_get(sizeof(metric_t));
+
+	if (metric_heap == NULL)
+	{
+		slog(LG_ERROR, "metrics_init(): block allocator failed.");
+		exit(EXIT_FAILURE);
+	}
+
+	metric_callback(METRIC_GAUGE, "atheme_users", "Users on the network.", NULL, metric_users);
+	metric_callback(METRIC_GAUGE, "atheme_channels", "Channels on the network.", NULL, metric_channels);
+	metric_callback(METRIC_GAUGE, "atheme_accounts", "Registered accounts.", NULL, metric_accounts);
+	metric_callback(METRIC_GAUGE, "atheme_servers", "Servers on the network.", NULL, metric_servers);
+	metric_callback(METRIC_COUNTER, "atheme_uplink_received_bytes_total", "Bytes read from the uplink and other connections.", NULL, metric_bytes_in);
+	metric_callback(METRIC_COUNTER, "atheme_uplink_sent_bytes_total", "Bytes written to the uplink and other connections.", NULL, metric_bytes_out);
+	metric_callback(METRIC_GAUGE, "atheme_uplink_sendq_bytes", "Bytes queued for the uplink.", NULL, metric_uplink_sendq);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -361,6 +361,9 @@ void module_unload(module_t *m, module_unload_intent_t intent)
 		 */
 		m->unload_handler(m, intent);
 	}
+
+	/* the next module may be loaded where this one's strings were */
+	translation_invalidate();
 }
 
 /*
@@ -33,6 +33,10 @@ mowgli_heap_t *kline_heap;	/* 16 */
 mowgli_heap_t *xline_heap;	/* 16 */
 mowgli_heap_t *qline_heap;	/* 16 */
 
+/* compiled from xlnlist and qlnlist when next needed after a change */
+static matchset_t *xline_set, *qline_nick_set, *qline_chan_set;
+static bool xline_set_stale = true, qline_set_stale = true;
+
 /*************
  * L I S T S *
  *************/
@@ -293,6 +297,7 @@ xline_t *xline_add(const char *realname, const char *reason, long duration, cons
 	x->number = ++xcnt;
 
 	cnt.xline++;
+	xline_set_stale = true;
 
 	if (me.connected)
 		xline_sts("*", realname, duration, reason);
@@ -328,6 +333,7 @@ void xline_delete(const char *realname)
 	mowgli_heap_free(xline_heap, x);
 
 	cnt.xline--;
+	xline_set_stale = true;
 }
 
 xline_t *xline_find(const char *realname)
@@ -362,23 +368,33 @@ xline_t *xline_find_num(unsigned int number)
 	return NULL;
 }
 
+static bool xline_active(void *data)
+{
+	xline_t *x = data;
+
+	return x->duration == 0 || x->expires > CURRTIME;
+}
+
 xline_t *xline_find_user(user_t *u)
 {
 	xline_t *x;
 	mowgli_node_t *n;
 
-	MOWGLI_ITER_FOREACH(n, xlnlist.head)
-	{
-		x = (xline_t *)n->data;
+	if (xline_set == NULL)
+		xline_set = matchset_create();
 
-		if (x->duration != 0 && x->expires <= CURRTIME)
-			continue;
-
-		if (!match(x->realname, u->gecos))
-			return x;
+	if (xline_set_stale)
+	{
+		matchset_clear(xline_set);
+		MOWGLI_ITER_FOREACH(n, xlnlist.head)
+		{
+			x = (xline_t *)n->data;
+			matchset_add(xline_set, x->realname, x, 0);
+		}
+		xline_set_stale = false;
 	}
 
-	return NULL;
+	return matchset_find(xline_set, u->gecos, xline_active);
 }
 
 void xline_expire(void *arg)
@@ -430,6 +446,7 @@ qline_t *qline_add(const char *mask, const char *reason, long duration, const ch
 	q->number = ++qcnt;
 
 	cnt.qline++;
+	qline_set_stale = true;
 
 	if (me.connected)
 		qline_sts("*", mask, duration, reason);
@@ -465,6 +482,7 @@ void qline_delete(const char *mask)
 	mowgli_heap_free(qline_heap, q);
 
 	cnt.qline--;
+	qline_set_stale = true;
 }
 
 qline_t *qline_find(const char *mask)
@@ -499,42 +517,53 @@ qline_t *qline_find_num(unsigned int number)
 	return NULL;
 }
 
-qline_t *qline_find_user(user_t *u)
+static bool qline_active(void *data)
+{
+	qline_t *q = data;
+
+	return q->duration == 0 || q->expires > CURRTIME;
+}
+
+static void qline_compile(void)
 {
 	qline_t *q;
 	mowgli_node_t *n;
 
-	MOWGLI_ITER_FOREACH(n, qlnlist.head)
+	if (qline_nick_set == NULL)
 	{
-		q = (qline_t *)n->data;
-
-		if (q->duration != 0 && q->expires <= CURRTIME)
-			continue;
-		if (q->mask[0] == '#' || q->mask[0] == '&')
-			continue;
-		if (!match(q->mask, u->nick))
-			return q;
+		qline_nick_set = matchset_create();
+		qline_chan_set = matchset_create();
 	}
 
-	return NULL;
-}
+	if (!qline_set_stale)
+		return;
 
-qline_t *qline_find_channel(channel_t *c)
-{
-	qline_t *q;
-	mowgli_node_t *n;
+	matchset_clear(qline_nick_set);
+	matchset_clear(qline_chan_set);
 
 	MOWGLI_ITER_FOREACH(n, qlnlist.head)
 	{
 		q = (qline_t *)n->data;
 
-		if (q->duration != 0 && q->expires <= CURRTIME)
-			continue;
-		if (!irccasecmp(q->mask, c->name))
-			return q;
+		/* channels are only ever compared exactly */
+		matchset_add(qline_chan_set, q->mask, q, MATCHSET_LITERAL);
+		if (q->mask[0] != '#' && q->mask[0] != '&')
+			matchset_add(qline_nick_set, q->mask, q, 0);
 	}
 
-	return NULL;
+	qline_set_stale = false;
+}
+
+qline_t *qline_find_user(user_t *u)
+{
+	qline_compile();
+	return matchset_find(qline_nick_set, u->nick, qline_active);
+}
+
+qline_t *qline_find_channel(channel_t *c)
+{
+	qline_compile();
+	return matchset_find(qline_chan_set, c->name, qline_active);
 }
 
 void qline_expire(void *arg)
@@ -32,11 +32,75 @@ struct timeval burstime;
 
 mowgli_eventloop_timer_t *ping_uplink_timer = NULL;
 
+/*
+ * Uplink capture: with general::uplink_capture set, every line received
+ * from the uplink is appended to that file, prefixed with the time it
+ * was read, so that src/replay can feed it to another instance later.
+ * Each connection starts with a "# connect" line.
+ */
+static FILE *capture_fp;
+static char *capture_path;
+static mowgli_eventloop_timer_t *capture_timer;
+
+static void capture_flush(void *unused)
+{
+	if (capture_fp != NULL)
+		fflush(capture_fp);
+}
+
+static void capture_close(void)
+{
+	if (capture_fp == NULL)
+		return;
+
+	fclose(capture_fp);
+	capture_fp = NULL;
+	free(capture_path);
+	capture_path = NULL;
+	mowgli_timer_destroy(base_eventloop, capture_timer);
+	capture_timer = NULL;
+}
+
+static void capture_update(void *unused)
+{
+	const char *path = config_options.uplink_capture;
+
+	if (path != NULL && capture_path != NULL && !strcmp(path, capture_path))
+		return;
+
+	capture_close();
+	if (path == NULL || *path == '\0')
+		return;
+
+	capture_fp = fopen(path, "a");
+	if (capture_fp == NULL)
+	{
+		slog(LG_ERROR, "capture_update(): unable to open uplink capture %s: %s", path, strerror(errno));
+		return;
+	}
+	setvbuf(capture_fp, NULL, _IOFBF, 65536);
+	capture_path = sstrdup(path);
+	capture_timer = mowgli_timer_add(base_eventloop, "capture_flush", capture_flush, NULL, 1);
+
+	slog(LG_INFO, "capture_update(): capturing uplink traffic to %s", path);
+}
+
+void capture_init(void)
+{
+	hook_add_event("config_ready");
+	hook_add_config_ready(capture_update);
+}
+
 static void irc_recvq_handler(connection_t *cptr)
 {
 	bool wasnonl;
 	char parsebuf[BUFSIZE + 1];
 	int count;
+	int i, words, keep;
+	char *cmd;
+	unsigned int reports;
+	uint64_t start, taken;
+	struct timeval tv;
 
 	wasnonl = cptr->flags & CF_NONEWLINE ? true : false;
 	count = recvq_getline(cptr, parsebuf, sizeof parsebuf - 1);
@@ -52,7 +116,49 @@ static void irc_recvq_handler(connection_t *cptr)
 	if (count > 0 && parsebuf[count - 1] == '\r')
 		count--;
 	parsebuf[count] = '\0';
+
+	if (capture_fp != NULL)
+	{
+#ifdef HAVE_GETTIMEOFDAY
+		s_time(&tv);
+#else
+		tv.tv_sec = time(NULL);
+		tv.tv_usec = 0;
+#endif
+		fprintf(capture_fp, "%lu.%06lu %s\n", (unsigned long)tv.tv_sec, (unsigned long)tv.tv_usec, parsebuf);
+	}
+
+	reports = watchdog_reports;
+	start = profile_now();
 	parse(parsebuf);
+	taken = profile_now() - start;
+
+	if (watchdog_reports == reports && config_options.slow_event_threshold != 0 &&
+			taken >= (uint64_t)config_options.slow_event_threshold * 1000)
+	{
+		/* parse() split the line up in place; put the source (if any),
+		 * command and first parameter back together, but leave out the
+		 * rest, which may carry passwords or SASL data.  Commands that
+		 * carry them in the first parameter keep only their name. */
+		cmd = parsebuf;
+		keep = 2;
+		if (*parsebuf == ':' && (int)strlen(parsebuf) < count)
+		{
+			cmd = parsebuf + strlen(parsebuf) + 1;
+			keep = 3;
+		}
+		if (!strcasecmp(cmd, "PASS") || !strcasecmp(cmd, "AUTHENTICATE") || !strcasecmp(cmd, "SVSLOGIN"))
+			keep--;
+
+		for (i = 0, words = 0; i < count; i++)
+			if (parsebuf[i] == '\0')
+			{
+				if (++words == keep)
+					break;
+				parsebuf[i] = ' ';
+			}
+		watchdog_check(taken, "IRC line \"%.300s%s\"", parsebuf, i < count ? " ..." : "");
+	}
 }
 
 static void ping_uplink(void *arg)
@@ -94,6 +200,10 @@ void irc_handle_connect(connection_t *cptr)
 		/* no SERVER message received */
 		me.recvsvr = false;
 
+		capture_update(NULL);
+		if (capture_fp != NULL)
+			fprintf(capture_fp, "# connect %s %s %s %lu\n", curr_uplink != NULL ? curr_uplink->name : "*",
+					me.name, ircd != NULL ? ircd->ircdname : "*", (unsigned long)time(NULL));
 
 		server_login();
 
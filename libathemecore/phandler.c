@@ -28,6 +28,7 @@ unsigned int(*server_login) (void) = generic_server_login;
 void (*introduce_nick) (user_t *u) = generic_introduce_nick;
 void (*wallops_sts) (const char *text) = generic_wallops_sts;
 void (*join_sts) (channel_t *c, user_t *u, bool isnew, char *modes) = generic_join_sts;
+void (*join_burst_sts) (channel_t *c, user_t **users, size_t count, bool isnew, char *modes) = generic_join_burst_sts;
 void (*chan_lowerts) (channel_t *c, user_t *u) = generic_chan_lowerts;
 void (*kick) (user_t *source, channel_t *c, user_t *u, const char *reason) = generic_kick;
 void (*msg) (const char *from, const char *target, const char *fmt, ...) = generic_msg;
@@ -100,6 +101,15 @@ void generic_join_sts(channel_t *c, user_t *u, bool isnew, char *modes)
 	/* We can't do anything here. Bail. */
 }
 
+void generic_join_burst_sts(channel_t *c, user_t **users, size_t count, bool isnew, char *modes)
+{
+	size_t i;
+
+	/* only the first join may burst the modes */
+	for (i = 0; i < count; i++)
+		join_sts(c, users[i], isnew && i == 0, modes);
+}
+
 void generic_chan_lowerts(channel_t *c, user_t *u)
 {
 	slog(LG_ERROR, "chan_lowerts() called but not supported!");
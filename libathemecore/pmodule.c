@@ -55,6 +55,7 @@ void pcommand_init(void)
 void pcommand_add(const char *token, void (*handler) (sourceinfo_t *si, int parc, char *parv[]), int minparc, int sourcetype)
 {
 	pcommand_t *pcmd;
+	char path[BUFSIZE];
 
 	if (pcommand_find(token))
 	{
@@ -68,6 +69,9 @@ void pcommand_add(const char *token, void (*handler) (sourceinfo_t *si, int parc
 	pcmd->minparc = minparc;
 	pcmd->sourcetype = sourcetype;
 
+	snprintf(path, sizeof path, "irc/%s", token);
+	pcmd->profile = profile_entry(path);
+
 	mowgli_patricia_add(pcommands, pcmd->token, pcmd);
 }
 
@@ -0,0 +1,212 @@
+/*
+ * atheme-services: A collection of minimalist IRC services
+ * profile.c: Always-on execution profiler and slow event watchdog.
+ *
+ * Copyright (c) 2026 Atheme Development Group (http://atheme.org)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "atheme.h"
+
+/*
+ * Each profiled path gets a log2 histogram of its run times, which
+ * keeps recording down to a clock read, an index computation and a few
+ * additions while still giving percentiles good to within a factor of
+ * two (narrowed further by interpolating inside the bucket).  Entries
+ * are never freed while services run, so callers may keep pointers to
+ * them; profile_reset() only zeroes them.
+ */
+
+mowgli_patricia_t *profile_entries;
+
+uint64_t profile_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#elif defined(HAVE_GETTIMEOFDAY)
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+	return (uint64_t)time(NULL) * 1000000;
+#endif
+}
+
+profile_entry_t *profile_entry(const char *path)
+{
+	profile_entry_t *pe;
+
+	pe = mowgli_patricia_retrieve(profile_entries, path);
+	if (pe != NULL)
+		return pe;
+
+	pe = scalloc(1, sizeof *pe);
+	pe->path = sstrdup(path);
+	mowgli_patricia_add(profile_entries, pe->path, pe);
+
+	return pe;
+}
+
+/* estimate the pct'th percentile, in microseconds */
+uint64_t profile_percentile(profile_entry_t *pe, unsigned int pct)
+{
+	unsigned long rank, seen = 0;
+	uint64_t lo, hi, est;
+	unsigned int i;
+
+	if (pe->count == 0)
+		return 0;
+
+	rank = (pe->count * pct + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < PROFILE_BUCKETS; i++)
+	{
+		if (seen + pe->buckets[i] >= rank)
+			break;
+		seen += pe->buckets[i];
+	}
+	if (i == PROFILE_BUCKETS)
+		return pe->max_us;
+
+	lo = i == 0 ? 0 : (uint64_t)1 << (i - 1);
+	hi = (uint64_t)1 << i;
+	est = lo + (hi - lo) * (rank - seen) / pe->buckets[i];
+
+	return est < pe->max_us ? est : pe->max_us;
+}
+
+void profile_reset(void)
+{
+	mowgli_patricia_iteration_state_t state;
+	profile_entry_t *pe;
+
+	MOWGLI_PATRICIA_FOREACH(pe, &state, profile_entries)
+	{
+		pe->count = 0;
+		pe->total_us = 0;
+		pe->max_us = 0;
+		memset(pe->buckets, 0, sizeof pe->buckets);
+	}
+}
+
+/*
+ * The watchdog is told about every IRC line, command and I/O callback
+ * as it finishes, and about every event loop turn.  Timers cannot be
+ * timed one by one since libmowgli runs them itself, so a turn is
+ * charged by the CPU time it used (waiting in poll() costs none) and
+ * blamed on the last timer it ran.  Reports are logged; wallops about
+ * them are sent at most once a minute.
+ */
+
+#define WATCHDOG_WALLOPS_INTERVAL	60
+
+unsigned int watchdog_reports;
+
+static time_t watchdog_last_wallops;
+static unsigned int watchdog_suppressed;
+static uint64_t watchdog_turn_cpu;
+static unsigned int watchdog_turn_reports;
+
+static uint64_t watchdog_cpu_now(void)
+{
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return 0;
+#endif
+}
+
+bool watchdog_check(uint64_t us, const char *fmt, ...)
+{
+	va_list args;
+	char buf[BUFSIZE];
+
+	if (config_options.slow_event_threshold == 0 ||
+			us < (uint64_t)config_options.slow_event_threshold * 1000)
+		return false;
+
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof buf, fmt, args);
+	va_end(args);
+
+	watchdog_reports++;
+	slog(LG_INFO, "watchdog: %s took %lu ms", buf, (unsigned long)(us / 1000));
+
+	if (CURRTIME - watchdog_last_wallops < WATCHDOG_WALLOPS_INTERVAL)
+	{
+		watchdog_suppressed++;
+		return true;
+	}
+
+	if (watchdog_suppressed != 0)
+		wallops("Slow event: %s took %lu ms (%u more since the last notice, see the log)",
+				buf, (unsigned long)(us / 1000), watchdog_suppressed);
+	else
+		wallops("Slow event: %s took %lu ms", buf, (unsigned long)(us / 1000));
+
+	watchdog_last_wallops = CURRTIME;
+	watchdog_suppressed = 0;
+
+	return true;
+}
+
+void watchdog_turn_begin(void)
+{
+	if (config_options.slow_event_threshold == 0)
+		return;
+
+	base_eventloop->last_ran = NULL;
+	watchdog_turn_reports = watchdog_reports;
+	watchdog_turn_cpu = watchdog_cpu_now();
+}
+
+void watchdog_turn_end(void)
+{
+	const char *timer;
+
+	if (config_options.slow_event_threshold == 0 || watchdog_turn_cpu == 0)
+		return;
+
+	/* someone was already named for this turn */
+	if (watchdog_reports != watchdog_turn_reports)
+		return;
+
+	timer = base_eventloop->last_ran;
+	watchdog_check(watchdog_cpu_now() - watchdog_turn_cpu, "event loop turn (last timer run: %s)",
+			timer != NULL ? timer : "none");
+}
+
+void profile_init(void)
+{
+	profile_entries = mowgli_patricia_create(strcasecanon);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
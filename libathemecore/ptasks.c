@@ -243,6 +243,7 @@ void handle_stats(user_t *u, char req)
 		  numeric_sts(me.me, 249, u, "T :myuser_nam %7d", cnt.myuser_name);
 		  numeric_sts(me.me, 249, u, "T :mychan     %7d", cnt.mychan);
 		  numeric_sts(me.me, 249, u, "T :chanacs    %7d", cnt.chanacs);
+		  numeric_sts(me.me, 249, u, "T :modes      %7d in %d lines", cnt.modestack_changes, cnt.modestack_lines);
 
 #ifdef OBJECT_DEBUG
 		  numeric_sts(me.me, 249, u, "T :objects    %7zu", MOWGLI_LIST_LENGTH(&object_list));
@@ -468,9 +469,9 @@ handle_channel_message(sourceinfo_t *si, char *target, bool is_notice, char *mes
 {
 	char *vec[3];
 	hook_cmessage_data_t cdata;
-	mowgli_node_t *n, *tn;
-	mowgli_list_t l = { NULL, NULL, 0 };
+	service_t *svsbuf[16], **svslist;
 	service_t *svs;
+	unsigned int i, count;
 
 	/* Call hook here */
 	cdata.u = si->su;
@@ -487,14 +488,17 @@ handle_channel_message(sourceinfo_t *si, char *target, bool is_notice, char *mes
 	vec[1] = message;
 	vec[2] = NULL;
 
-	MOWGLI_ITER_FOREACH(n, cdata.c->members.head)
-	{
-		chanuser_t *cu = (chanuser_t *) n->data;
-
-		if (!is_internal_client(cu->user))
-			continue;
+	/* Take a snapshot first, the handlers may part services or even
+	 * cause the channel to go away.
+	 */
+	svslist = svsbuf;
+	if (cdata.c->numsvcmembers > ARRAY_SIZE(svsbuf))
+		svslist = smalloc(cdata.c->numsvcmembers * sizeof(service_t *));
 
-		svs = service_find_nick(cu->user->nick);
+	count = 0;
+	for (i = 0; i < cdata.c->numsvcmembers; i++)
+	{
+		svs = service_find_nick(cdata.c->svcmembers[i]->nick);
 
 		if (svs == NULL)
 			continue;
@@ -502,21 +506,23 @@ handle_channel_message(sourceinfo_t *si, char *target, bool is_notice, char *mes
 		if (svs->chanmsg == false)
 			continue;
 
-		mowgli_node_add(svs, mowgli_node_create(), &l);
+		svslist[count++] = svs;
 	}
+
 	/* Note: this assumes a fantasy command will not remove another
 	 * service.
 	 */
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, l.head)
+	for (i = 0; i < count; i++)
 	{
-		si->service = n->data;
+		si->service = svslist[i];
 		if (is_notice)
 			si->service->notice_handler(si, 2, vec);
 		else
 			si->service->handler(si, 2, vec);
-		mowgli_node_delete(n, &l);
-		mowgli_node_free(n);
 	}
+
+	if (svslist != svsbuf)
+		free(svslist);
 }
 
 void handle_message(sourceinfo_t *si, char *target, bool is_notice, char *message)
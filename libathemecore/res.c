@@ -65,6 +65,7 @@ struct reslist
 	char sends;		/* number of sends (>1 means resent) */
 	time_t sentat;
 	time_t timeout;
+	double started;		/* for the lookup latency metric */
 	unsigned int lastns;	/* index of last server sent to */
 	sockaddr_any_t addr;
 	char *name;
@@ -76,6 +77,7 @@ static mowgli_list_t request_list = { NULL, NULL, 0 };
 static int ns_timeout_count[IRCD_MAXNS];
 
 static void rem_request(struct reslist *request);
+static void res_observe(struct reslist *request, const char *result);
 static struct reslist *make_request(dns_query_t *query);
 static void do_query_name(dns_query_t *query, const char *name, struct reslist *request, int);
 static void do_query_number(dns_query_t *query, const sockaddr_any_t *,
@@ -175,6 +177,7 @@ static time_t timeout_query_list(time_t now)
 		{
 			if (--request->retries <= 0)
 			{
+				res_observe(request, "timeout");
 				(*request->query->callback) (request->query->ptr, NULL);
 				rem_request(request);
 				continue;
@@ -296,6 +299,19 @@ static void rem_request(struct reslist *request)
 	free(request);
 }
 
+/*
+ * res_observe - account the time a request took to its outcome.
+ */
+static void res_observe(struct reslist *request, const char *result)
+{
+	char labels[BUFSIZE];
+
+	snprintf(labels, sizeof labels, "result=\"%s\"", result);
+	metric_observe(metric_histogram("atheme_dns_lookup_duration_seconds",
+				"Time taken by DNS lookups, by outcome.", labels),
+			metric_clock() - request->started);
+}
+
 /*
  * make_request - Create a DNS request record for the server.
  */
@@ -304,6 +320,7 @@ static struct reslist *make_request(dns_query_t *query)
 	struct reslist *request = smalloc(sizeof(struct reslist));
 
 	request->sentat = CURRTIME;
+	request->started = metric_clock();
 	request->retries = 3;
 	request->timeout = 4;	/* start at 4 and exponential inc. */
 	request->query = query;
@@ -797,6 +814,7 @@ static int res_read_single_reply(connection_t *F)
 	{
 		if (NXDOMAIN == header->rcode)
 		{
+			res_observe(request, "nxdomain");
 			(*request->query->callback) (request->query->ptr, NULL);
 			rem_request(request);
 		}
@@ -806,6 +824,7 @@ static int res_read_single_reply(connection_t *F)
 			 * If a bad error was returned, we stop here and dont send
 			 * send any more (no retries granted).
 			 */
+			res_observe(request, "error");
 			(*request->query->callback) (request->query->ptr, NULL);
 			rem_request(request);
 		}
@@ -827,6 +846,7 @@ static int res_read_single_reply(connection_t *F)
 				 * got a PTR response with no name, something bogus is happening
 				 * don't bother trying again, the client address doesn't resolve
 				 */
+				res_observe(request, "error");
 				(*request->query->callback) (request->query->ptr, reply);
 				rem_request(request);
 				return 1;
@@ -843,6 +863,10 @@ static int res_read_single_reply(connection_t *F)
 			else
 #endif
 				gethost_byname_type(request->name, request->query, T_A);
+
+			/* time the forward lookup from the original query */
+			if (request_list.tail != NULL && request_list.tail->data != request)
+				((struct reslist *)request_list.tail->data)->started = request->started;
 			rem_request(request);
 		}
 		else
@@ -851,6 +875,7 @@ static int res_read_single_reply(connection_t *F)
 			 * got a name and address response, client resolved
 			 */
 			reply = make_dnsreply(request);
+			res_observe(request, "success");
 			(*request->query->callback) (request->query->ptr, reply);
 			free(reply);
 			rem_request(request);
@@ -859,6 +884,7 @@ static int res_read_single_reply(connection_t *F)
 	else
 	{
 		/* couldn't decode, give up -- jilles */
+		res_observe(request, "error");
 		(*request->query->callback) (request->query->ptr, NULL);
 		rem_request(request);
 	}
@@ -74,7 +74,9 @@ void io_loop(void)
 	while (!(runflags & (RF_SHUTDOWN | RF_RESTART)))
 	{
 		CURRTIME = mowgli_eventloop_get_time(base_eventloop);
+		watchdog_turn_begin();
 		mowgli_eventloop_run_once(base_eventloop);
+		watchdog_turn_end();
 		check_signals();
 	}
 }
@@ -31,6 +31,7 @@ mowgli_heap_t *serv_heap;
 mowgli_heap_t *tld_heap;
 
 static void server_delete_serv(server_t *s);
+static unsigned int server_split_collect(server_t *s, user_t **users, unsigned int count);
 
 /*
  * init_servers()
@@ -165,10 +166,13 @@ server_t *server_add(const char *name, unsigned int hops, server_t *uplink, cons
  *
  * Side Effects:
  *     - all users and servers attached to the target are recursively deleted
+ *     - the server_split hook is called once with all the users beforehand
  */
 void server_delete(const char *name)
 {
 	server_t *s = server_find(name);
+	user_t **users;
+	unsigned int count;
 
 	if (!s)
 	{
@@ -176,7 +180,43 @@ void server_delete(const char *name)
 
 		return;
 	}
+
+	if (s == me.me)
+	{
+		server_delete_serv(s);
+		return;
+	}
+
+	count = server_split_collect(s, NULL, 0);
+	users = smalloc(sizeof(user_t *) * (count + 1));
+	server_split_collect(s, users, 0);
+
+	hook_call_server_split((&(hook_server_split_t){ .s = s, .users = users, .count = count }));
+
 	server_delete_serv(s);
+
+	free(users);
+}
+
+/* flag every user behind s as splitting, and optionally list them */
+static unsigned int server_split_collect(server_t *s, user_t **users, unsigned int count)
+{
+	mowgli_node_t *n;
+	user_t *u;
+
+	MOWGLI_ITER_FOREACH(n, s->userlist.head)
+	{
+		u = n->data;
+		u->flags |= UF_SPLIT;
+		if (users != NULL)
+			users[count] = u;
+		count++;
+	}
+
+	MOWGLI_ITER_FOREACH(n, s->children.head)
+		count = server_split_collect(n->data, users, count);
+
+	return count;
 }
 
 static void server_delete_serv(server_t *s)
@@ -170,45 +170,57 @@ void introduce_enforcer(const char *nick)
 	introduce_nick(u);
 }
 
-/* join a channel, creating it if necessary */
-void join(const char *chan, const char *nick)
+/* find a channel for a service to join, creating it if necessary */
+static channel_t *join_find_or_add(const char *chan, bool *isnew)
 {
 	channel_t *c;
-	user_t *u;
-	chanuser_t *cu;
-	bool isnew = false;
 	mychan_t *mc;
 	metadata_t *md;
 	time_t ts;
 
-	u = user_find_named(nick);
-	if (!u)
-		return;
+	*isnew = false;
+
 	c = channel_find(chan);
-	if (c == NULL)
+	if (c != NULL)
+		return c;
+
+	mc = mychan_find(chan);
+	if (chansvs.changets && mc != NULL)
 	{
-		mc = mychan_find(chan);
-		if (chansvs.changets && mc != NULL)
-		{
-			/* Use the previous TS if known, registration
-			 * time otherwise, but never ever create a channel
-			 * with TS 0 -- jilles */
-			ts = mc->registered;
-			md = metadata_find(mc, "private:channelts");
-			if (md != NULL)
-				ts = atol(md->value);
-			if (ts == 0)
-				ts = CURRTIME;
-		}
-		else
+		/* Use the previous TS if known, registration
+		 * time otherwise, but never ever create a channel
+		 * with TS 0 -- jilles */
+		ts = mc->registered;
+		md = metadata_find(mc, "private:channelts");
+		if (md != NULL)
+			ts = atol(md->value);
+		if (ts == 0)
 			ts = CURRTIME;
-		c = channel_add(chan, ts, me.me);
-		c->modes |= CMODE_NOEXT | CMODE_TOPIC;
-		if (mc != NULL)
-			check_modes(mc, false);
-		isnew = true;
 	}
-	else if (chanuser_find(c, u))
+	else
+		ts = CURRTIME;
+	c = channel_add(chan, ts, me.me);
+	c->modes |= CMODE_NOEXT | CMODE_TOPIC;
+	if (mc != NULL)
+		check_modes(mc, false);
+	*isnew = true;
+
+	return c;
+}
+
+/* join a channel, creating it if necessary */
+void join(const char *chan, const char *nick)
+{
+	channel_t *c;
+	user_t *u;
+	chanuser_t *cu;
+	bool isnew;
+
+	u = user_find_named(nick);
+	if (!u)
+		return;
+	c = join_find_or_add(chan, &isnew);
+	if (!isnew && chanuser_find(c, u))
 	{
 		slog(LG_DEBUG, "join(): i'm already in `%s'", c->name);
 		return;
@@ -222,6 +234,175 @@ void join(const char *chan, const char *nick)
 	}
 }
 
+/*
+ * Burst joins: instead of sending one SJOIN/FJOIN per service per channel
+ * as join() does, queue the joins, pack all services joining the same
+ * channel into as few lines as the protocol module allows, and send them
+ * from a timer at no more than general::burst_join_rate bytes per second.
+ * This keeps mass joins (e.g. guarded channels on uplink connect) from
+ * flooding the uplink. The queue is dropped when the uplink goes away.
+ */
+typedef struct {
+	mowgli_node_t node;
+	char *name;
+	mowgli_list_t nicks;
+	char *partnick;
+} burstjoin_t;
+
+static mowgli_list_t burstjoin_queue;
+static mowgli_patricia_t *burstjoin_dict;
+static mowgli_eventloop_timer_t *burstjoin_timer;
+
+unsigned int join_burst_pending(void)
+{
+	return MOWGLI_LIST_LENGTH(&burstjoin_queue);
+}
+
+static void join_burst_free(burstjoin_t *bj)
+{
+	mowgli_node_t *n, *tn;
+
+	mowgli_patricia_delete(burstjoin_dict, bj->name);
+	mowgli_node_delete(&bj->node, &burstjoin_queue);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, bj->nicks.head)
+	{
+		free(n->data);
+		mowgli_node_delete(n, &bj->nicks);
+		mowgli_node_free(n);
+	}
+
+	free(bj->partnick);
+	free(bj->name);
+	free(bj);
+}
+
+static void join_burst_channel(burstjoin_t *bj)
+{
+	channel_t *c;
+	user_t *u, **users;
+	chanuser_t *cu;
+	mowgli_node_t *n;
+	size_t i, count = 0;
+	bool isnew;
+
+	users = smalloc(sizeof(user_t *) * MOWGLI_LIST_LENGTH(&bj->nicks));
+
+	c = join_find_or_add(bj->name, &isnew);
+	MOWGLI_ITER_FOREACH(n, bj->nicks.head)
+	{
+		u = user_find_named(n->data);
+		if (u == NULL)
+			continue;
+		if (!isnew && chanuser_find(c, u))
+			continue;
+		users[count++] = u;
+	}
+
+	if (count != 0)
+	{
+		join_burst_sts(c, users, count, isnew, channel_modes(c, true));
+		for (i = 0; i < count; i++)
+		{
+			cu = chanuser_add(c, CLIENT_NAME(users[i]));
+			cu->modes |= CSTATUS_OP;
+		}
+		if (isnew)
+			hook_call_channel_add(c);
+	}
+	else if (isnew)
+	{
+		/* all of the services went away meanwhile */
+		channel_delete(c);
+	}
+
+	free(users);
+
+	if (bj->partnick != NULL)
+		part(bj->name, bj->partnick);
+}
+
+static void join_burst_run(void *unused)
+{
+	unsigned int start = cnt.bout;
+	burstjoin_t *bj;
+
+	burstjoin_timer = NULL;
+
+	while (burstjoin_queue.head != NULL)
+	{
+		if (!me.connected)
+		{
+			join_burst_clear();
+			return;
+		}
+
+		if (config_options.burst_join_rate != 0 &&
+				cnt.bout - start >= config_options.burst_join_rate)
+			break;
+
+		bj = burstjoin_queue.head->data;
+		join_burst_channel(bj);
+		join_burst_free(bj);
+	}
+
+	if (burstjoin_queue.head != NULL)
+		burstjoin_timer = mowgli_timer_add_once(base_eventloop, "join_burst_run", join_burst_run, NULL, 1);
+	else
+		slog(LG_DEBUG, "join_burst_run(): burst join queue drained");
+}
+
+/* queue a join of a channel, creating it if necessary; if partnick is
+ * not NULL, that service leaves the channel after the join is sent */
+void join_burst(const char *chan, const char *nick, const char *partnick)
+{
+	burstjoin_t *bj;
+
+	return_if_fail(chan != NULL);
+	return_if_fail(nick != NULL);
+
+	if (!me.connected)
+		return;
+
+	if (burstjoin_dict == NULL)
+		burstjoin_dict = mowgli_patricia_create(irccasecanon);
+
+	bj = mowgli_patricia_retrieve(burstjoin_dict, chan);
+	if (bj == NULL)
+	{
+		bj = scalloc(sizeof(burstjoin_t), 1);
+		bj->name = sstrdup(chan);
+		mowgli_patricia_add(burstjoin_dict, bj->name, bj);
+		mowgli_node_add(bj, &bj->node, &burstjoin_queue);
+	}
+
+	mowgli_node_add(sstrdup(nick), mowgli_node_create(), &bj->nicks);
+
+	if (partnick != NULL)
+	{
+		free(bj->partnick);
+		bj->partnick = sstrdup(partnick);
+	}
+
+	/* run from the event loop, so that all joins queued during
+	 * this turn are packed together */
+	if (burstjoin_timer == NULL)
+		burstjoin_timer = mowgli_timer_add_once(base_eventloop, "join_burst_run", join_burst_run, NULL, 0);
+}
+
+/* drop all queued burst joins, e.g. because the uplink went away */
+void join_burst_clear(void)
+{
+	if (burstjoin_timer != NULL)
+	{
+		mowgli_timer_destroy(base_eventloop, burstjoin_timer);
+		burstjoin_timer = NULL;
+	}
+
+	while (burstjoin_queue.head != NULL)
+		join_burst_free(burstjoin_queue.head->data);
+}
+
 /* part a channel */
 void part(const char *chan, const char *nick)
 {
@@ -762,6 +943,8 @@ void change_notify(const char *from, user_t *to, const char *fmt, ...)
  *
  * Note:
  *       - kills are currently not done
+ *       - nothing is registered if the auth module could not check
+ *         the password (auth_user_unavailable)
  */
 bool bad_password(sourceinfo_t *si, myuser_t *mu)
 {
@@ -778,6 +961,15 @@ bool bad_password(sourceinfo_t *si, myuser_t *mu)
 	if (si->smu == mu)
 		return false;
 
+	/* the authentication backend never looked at the password */
+	if (auth_user_unavailable)
+	{
+		auth_user_unavailable = false;
+		slog(LG_INFO, "bad_password(): could not check password for \2%s\2 from \2%s\2", entity(mu)->name, get_source_name(si));
+		command_fail(si, fault_authfail, _("Your password could not be checked right now, please try again later."));
+		return false;
+	}
+
 	command_add_flood(si, FLOOD_MODERATE);
 
 	mask = get_source_mask(si);
@@ -23,48 +23,118 @@
 
 #include "atheme.h"
 
-mowgli_patricia_t *strshare_dict;
+/*
+ * Shared strings live in an open-addressed hash table with linear
+ * probing.  Each string carries a header with its length, its hash and a
+ * hash of its irccase-folded form, so probing and resizing compare
+ * headers before touching the text, and strshare_irceq() can tell most
+ * unequal names apart without irccasecmp().  Deletion shifts the rest of
+ * the probe run back, so there are no tombstones.
+ */
 
 typedef struct
 {
-	int refcount;
+	unsigned int refcount;
+	unsigned int hash;
+	unsigned int foldhash;
+	unsigned int len;
 } strshare_t;
 
+#define STRSHARE_MIN_SIZE 1024
+
+static strshare_t **strshare_table;
+static unsigned int strshare_size, strshare_count;
+
+static inline strshare_t *strshare_header(stringref str)
+{
+	/* intermediate cast to suppress gcc -Wcast-qual */
+	return (strshare_t *)(uintptr_t)str - 1;
+}
+
+/* FNV-1a, over the bytes and over their irccase-folded form */
+static void strshare_hash_string(const char *str, unsigned int *len, unsigned int *hash, unsigned int *foldhash)
+{
+	const unsigned char *p;
+	unsigned int h = 2166136261U, fh = 2166136261U;
+
+	for (p = (const unsigned char *)str; *p != '\0'; p++)
+	{
+		h = (h ^ *p) * 16777619U;
+		fh = (fh ^ (unsigned char)ToUpper(*p)) * 16777619U;
+	}
+
+	*len = p - (const unsigned char *)str;
+	*hash = h;
+	*foldhash = fh;
+}
+
+static void strshare_resize(unsigned int size)
+{
+	strshare_t **table;
+	unsigned int i, j;
+
+	table = scalloc(size, sizeof *table);
+
+	for (i = 0; i < strshare_size; i++)
+	{
+		if (strshare_table[i] == NULL)
+			continue;
+
+		for (j = strshare_table[i]->hash & (size - 1); table[j] != NULL; j = (j + 1) & (size - 1))
+			;
+		table[j] = strshare_table[i];
+	}
+
+	free(strshare_table);
+	strshare_table = table;
+	strshare_size = size;
+}
+
 void strshare_init(void)
 {
-	strshare_dict = mowgli_patricia_create(noopcanon);
+	strshare_resize(STRSHARE_MIN_SIZE);
 }
 
 stringref strshare_get(const char *str)
 {
 	strshare_t *ss;
+	unsigned int len, hash, foldhash, i, mask;
 
 	if (str == NULL)
 		return NULL;
 
-	ss = mowgli_patricia_retrieve(strshare_dict, str);
-	if (ss != NULL)
-		ss->refcount++;
-	else
+	strshare_hash_string(str, &len, &hash, &foldhash);
+
+	mask = strshare_size - 1;
+	for (i = hash & mask; (ss = strshare_table[i]) != NULL; i = (i + 1) & mask)
 	{
-		ss = smalloc(sizeof(strshare_t) + strlen(str) + 1);
-		ss->refcount = 1;
-		strcpy((char *)(ss + 1), str);
-		mowgli_patricia_add(strshare_dict, (char *)(ss + 1), ss);
+		if (ss->hash == hash && ss->len == len && !memcmp(ss + 1, str, len))
+		{
+			ss->refcount++;
+			return (char *)(ss + 1);
+		}
 	}
+
+	ss = smalloc(sizeof(strshare_t) + len + 1);
+	ss->refcount = 1;
+	ss->hash = hash;
+	ss->foldhash = foldhash;
+	ss->len = len;
+	memcpy(ss + 1, str, len + 1);
+
+	strshare_table[i] = ss;
+	if (++strshare_count * 2 > strshare_size)
+		strshare_resize(strshare_size * 2);
+
 	return (char *)(ss + 1);
 }
 
 stringref strshare_ref(stringref str)
 {
-	strshare_t *ss;
-
 	if (str == NULL)
 		return NULL;
 
-	/* intermediate cast to suppress gcc -Wcast-qual */
-	ss = (strshare_t *)(uintptr_t)str - 1;
-	ss->refcount++;
+	strshare_header(str)->refcount++;
 
 	return str;
 }
@@ -72,18 +142,83 @@ stringref strshare_ref(stringref str)
 void strshare_unref(stringref str)
 {
 	strshare_t *ss;
+	unsigned int i, j, k, mask;
 
 	if (str == NULL)
 		return;
 
-	/* intermediate cast to suppress gcc -Wcast-qual */
-	ss = (strshare_t *)(uintptr_t)str - 1;
-	ss->refcount--;
-	if (ss->refcount == 0)
+	ss = strshare_header(str);
+	if (--ss->refcount != 0)
+		return;
+
+	mask = strshare_size - 1;
+	for (i = ss->hash & mask; strshare_table[i] != ss; i = (i + 1) & mask)
+		;
+
+	/* move back whatever can no longer be reached past the hole */
+	strshare_table[i] = NULL;
+	for (j = (i + 1) & mask; strshare_table[j] != NULL; j = (j + 1) & mask)
 	{
-		mowgli_patricia_delete(strshare_dict, str);
-		free(ss);
+		k = strshare_table[j]->hash & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		strshare_table[i] = strshare_table[j];
+		strshare_table[j] = NULL;
+		i = j;
 	}
+
+	free(ss);
+
+	if (--strshare_count * 8 < strshare_size && strshare_size > STRSHARE_MIN_SIZE)
+		strshare_resize(strshare_size / 2);
+}
+
+unsigned int strshare_hash(stringref str)
+{
+	return_val_if_fail(str != NULL, 0);
+
+	return strshare_header(str)->hash;
+}
+
+unsigned int strshare_foldhash(stringref str)
+{
+	return_val_if_fail(str != NULL, 0);
+
+	return strshare_header(str)->foldhash;
+}
+
+size_t strshare_len(stringref str)
+{
+	return_val_if_fail(str != NULL, 0);
+
+	return strshare_header(str)->len;
+}
+
+/* irccasecmp() == 0 for two shared strings; equal strings are the same
+ * pointer, and different folded hashes rule out the rest cheaply */
+bool strshare_irceq(stringref a, stringref b)
+{
+	if (a == b)
+		return a != NULL;
+	if (a == NULL || b == NULL)
+		return false;
+
+	if (strshare_header(a)->foldhash != strshare_header(b)->foldhash)
+		return false;
+
+	return !irccasecmp(a, b);
+}
+
+/* the folded hashes depend on the casemapping */
+void strshare_refold(void)
+{
+	strshare_t *ss;
+	unsigned int i, len, hash;
+
+	for (i = 0; i < strshare_size; i++)
+		if ((ss = strshare_table[i]) != NULL)
+			strshare_hash_string((char *)(ss + 1), &len, &hash, &ss->foldhash);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -186,6 +186,7 @@ static void uplink_close(connection_t *cptr)
 	mowgli_timer_add_once(base_eventloop, "reconn", reconn, NULL, me.recontime);
 
 	me.connected = false;
+	join_burst_clear();
 
 	if (curr_uplink->flags & UPF_ILLEGAL)
 	{
@@ -221,7 +221,9 @@ void user_delete(user_t *u, const char *comment)
 	if (!comment)
 		comment = "";
 
-	slog(LG_DEBUG, "user_delete(): removing user: %s -> %s (%s)", u->nick, u->server->name, comment);
+	/* a split is logged once by server_delete() */
+	if (!(u->flags & UF_SPLIT))
+		slog(LG_DEBUG, "user_delete(): removing user: %s -> %s (%s)", u->nick, u->server->name, comment);
 
 	hook_call_user_delete_info((&(hook_user_delete_t){ .u = u,
 				.comment = comment}));
@@ -241,7 +243,7 @@ void user_delete(user_t *u, const char *comment)
 	{
 		cu = (chanuser_t *)n->data;
 
-		chanuser_delete(cu->chan, u);
+		chanuser_delete_member(cu);
 	}
 
 	mowgli_patricia_delete(userlist, u->nick);
@@ -277,6 +279,7 @@ void user_delete(user_t *u, const char *comment)
 	strshare_unref(u->vhost);
 	strshare_unref(u->chost);
 	strshare_unref(u->ip);
+	chanacs_user_release(u);
 
 	mowgli_heap_free(user_heap, u);
 
@@ -434,7 +437,7 @@ bool user_changenick(user_t *u, const char *nick, time_t ts)
 				user_delete(u, "Nick change collision with services");
 				return true;
 			}
-			if (ts == u2->ts || ((ts < u2->ts) ^ (!irccasecmp(u->user, u2->user) && !irccasecmp(u->host, u2->host))))
+			if (ts == u2->ts || ((ts < u2->ts) ^ (strshare_irceq(u->user, u2->user) && strshare_irceq(u->host, u2->host))))
 			{
 				/* If the TSes are equal, or if their TS
 				 * is less than our TS and the u@h differs,
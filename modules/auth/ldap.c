@@ -22,14 +22,91 @@
    binddn -- distinguished name to bind to for searching (optional)
    bindauth -- password for the distinguished name (optional, must specify if binddn given)
 
+ and optionally:
+
+   poolsize -- number of connections kept open to the server (default 2)
+   timeout -- milliseconds to wait for an answer (default 1000)
+   cachetime -- how long a successful bind is remembered (default 5 minutes, 0 disables)
+
 */
 
+/*
+ * All LDAP operations use the asynchronous API.  Each connection of the
+ * pool is opened in the background and watched by a pollable on its
+ * socket, so connecting, binding as binddn and reconnecting (with
+ * backoff) after the server goes away never block services.
+ *
+ * verify_password() still wants an answer right away, so ldap_auth_user()
+ * sends its request on an idle connection and waits for that connection
+ * alone for at most ldap::timeout.  In search mode a connection rebinds
+ * as binddn after every request, so if none is idle, one that is still
+ * rebinding is waited for within the same deadline; if no connection is
+ * up at all, it fails at once instead of waiting for a connect.  A
+ * connection that does not answer in time is closed and reconnected
+ * with backoff, as the server may have stalled with the socket still
+ * open.  Either way the password was never checked, which is reported
+ * through auth_user_unavailable rather than as a bad password.
+ *
+ * The cache only holds successful binds, keyed by account name, and
+ * stores a salted MD5 of the password, never the password itself.  A
+ * password changed in the directory keeps working for ldap::cachetime.
+ *
+ * To try this out, any slapd will do, e.g. one listening on
+ * ldap://127.0.0.1:3389/ with a few posixAccount entries; stopping it
+ * (SIGSTOP makes a good slow server) must not stall services.
+ */
+
 #include "atheme.h"
 
 #include <ldap.h>
 
 DECLARE_MODULE_V1("auth/ldap", false, _modinit, _moddeinit, PACKAGE_STRING, "Atheme Development Group <http://www.atheme.org>");
 
+#define LDAP_MAX_POOL		16
+#define LDAP_MAX_ENTRIES	16	/* DNs tried per search */
+#define LDAP_MAX_BACKOFF	60
+
+typedef enum {
+	LCONN_DOWN,
+	LCONN_CONNECTING,		/* waiting for the socket to become writable */
+	LCONN_BINDING,			/* service bind in progress */
+	LCONN_IDLE,
+	LCONN_BUSY			/* request in progress */
+} ldap_conn_state_t;
+
+typedef struct ldap_request_ ldap_request_t;
+typedef struct ldap_conn_ ldap_conn_t;
+
+struct ldap_request_ {
+	char *name;
+	unsigned char key[16];
+	struct berval cred;
+
+	char *dns[LDAP_MAX_ENTRIES];
+	unsigned int ndns, nextdn;
+
+	bool done, success;
+	bool unavailable;		/* the connection went away first */
+};
+
+struct ldap_conn_ {
+	unsigned int index;
+	LDAP *ld;
+	mowgli_eventloop_pollable_t *pollable;
+	ldap_conn_state_t state;
+	int msgid;
+	ldap_request_t *req;		/* NULL during the service bind */
+	bool bound;			/* bound as binddn rather than as a user */
+	unsigned int failures;
+	mowgli_eventloop_timer_t *retry_timer;
+};
+
+typedef struct {
+	char *name;
+	unsigned char key[16];
+	time_t expires;
+} ldap_cache_entry_t;
+
 mowgli_list_t conf_ldap_table;
 struct
 {
@@ -40,18 +117,548 @@ struct
 	char *binddn;
 	char *bindauth;
 	bool useDN;
+	unsigned int poolsize;
+	unsigned int timeout;
+	unsigned int cachetime;
 } ldap_config;
-LDAP *ldap_conn;
 
-static void ldap_config_ready(void *unused)
+static ldap_conn_t ldap_pool[LDAP_MAX_POOL];
+static unsigned int ldap_pool_size;
+static bool ldap_configured;
+
+static mowgli_patricia_t *ldap_cache;
+static unsigned char ldap_cache_salt[16];
+static mowgli_eventloop_timer_t *ldap_cache_timer;
+
+static void ldap_conn_open(ldap_conn_t *c);
+static void ldap_conn_service_bind(ldap_conn_t *c);
+
+/* the cache */
+
+static void ldap_cache_key(const char *name, const char *password, unsigned char *key)
+{
+	md5_state_t ctx;
+
+	md5_init(&ctx);
+	md5_append(&ctx, ldap_cache_salt, sizeof ldap_cache_salt);
+	md5_append(&ctx, (const unsigned char *)name, strlen(name) + 1);
+	md5_append(&ctx, (const unsigned char *)password, strlen(password));
+	md5_finish(&ctx, key);
+}
+
+static bool ldap_cache_check(const char *name, const unsigned char *key)
+{
+	ldap_cache_entry_t *ce;
+	unsigned char diff = 0;
+	unsigned int i;
+
+	ce = mowgli_patricia_retrieve(ldap_cache, name);
+	if (ce == NULL || ce->expires <= CURRTIME)
+		return false;
+
+	for (i = 0; i < sizeof ce->key; i++)
+		diff |= ce->key[i] ^ key[i];
+
+	return diff == 0;
+}
+
+static void ldap_cache_add(const char *name, const unsigned char *key)
+{
+	ldap_cache_entry_t *ce;
+
+	if (ldap_config.cachetime == 0)
+		return;
+
+	ce = mowgli_patricia_retrieve(ldap_cache, name);
+	if (ce == NULL)
+	{
+		ce = smalloc(sizeof *ce);
+		ce->name = sstrdup(name);
+		mowgli_patricia_add(ldap_cache, ce->name, ce);
+	}
+
+	memcpy(ce->key, key, sizeof ce->key);
+	ce->expires = CURRTIME + ldap_config.cachetime;
+}
+
+static void ldap_cache_expire(void *unused)
+{
+	mowgli_patricia_iteration_state_t state;
+	ldap_cache_entry_t *ce;
+
+	MOWGLI_PATRICIA_FOREACH(ce, &state, ldap_cache)
+	{
+		if (ce->expires > CURRTIME)
+			continue;
+
+		mowgli_patricia_delete(ldap_cache, ce->name);
+		free(ce->name);
+		free(ce);
+	}
+}
+
+static void ldap_cache_free(const char *key, void *data, void *privdata)
+{
+	ldap_cache_entry_t *ce = data;
+
+	free(ce->name);
+	free(ce);
+}
+
+static void ldap_myuser_delete(myuser_t *mu)
+{
+	ldap_cache_entry_t *ce;
+
+	ce = mowgli_patricia_delete(ldap_cache, entity(mu)->name);
+	if (ce != NULL)
+		ldap_cache_free(NULL, ce, NULL);
+}
+
+/* requests */
+
+static ldap_request_t *ldap_request_create(const char *name, const char *password, const unsigned char *key)
+{
+	ldap_request_t *req;
+
+	req = scalloc(1, sizeof *req);
+	req->name = sstrdup(name);
+	memcpy(req->key, key, sizeof req->key);
+	req->cred.bv_val = sstrdup(password);
+	req->cred.bv_len = strlen(password);
+
+	return req;
+}
+
+static void ldap_request_free(ldap_request_t *req)
+{
+	unsigned int i;
+
+	for (i = 0; i < req->ndns; i++)
+		ldap_memfree(req->dns[i]);
+
+	memset(req->cred.bv_val, 0, req->cred.bv_len);
+	free(req->cred.bv_val);
+	free(req->name);
+	free(req);
+}
+
+/* detaches the request from its connection and records the outcome;
+ * ldap_auth_user() frees it */
+static void ldap_request_done(ldap_conn_t *c, bool success)
+{
+	ldap_request_t *req = c->req;
+
+	c->req = NULL;
+	req->done = true;
+	req->success = success;
+
+	if (success)
+		ldap_cache_add(req->name, req->key);
+}
+
+/* connections */
+
+static void ldap_conn_close(ldap_conn_t *c)
+{
+	if (c->req != NULL)
+	{
+		c->req->unavailable = true;
+		ldap_request_done(c, false);
+	}
+
+	if (c->pollable != NULL)
+	{
+		mowgli_pollable_destroy(base_eventloop, c->pollable);
+		c->pollable = NULL;
+	}
+
+	if (c->ld != NULL)
+	{
+		ldap_unbind_ext(c->ld, NULL, NULL);
+		c->ld = NULL;
+	}
+
+	c->state = LCONN_DOWN;
+	c->bound = false;
+}
+
+static void ldap_conn_retry(void *arg)
+{
+	ldap_conn_t *c = arg;
+
+	c->retry_timer = NULL;
+	ldap_conn_open(c);
+}
+
+static void ldap_conn_fail(ldap_conn_t *c, int err)
+{
+	static time_t lastwarning;
+	unsigned int delay;
+
+	slog(LG_INFO, "ldap_conn_fail(): connection %u to %s: %s", c->index, ldap_config.url, ldap_err2string(err));
+	if (CURRTIME > lastwarning + 300)
+	{
+		slog(LG_INFO, "LDAP:ERROR: \2%s\2", ldap_err2string(err));
+		wallops("Problem with LDAP server: %s", ldap_err2string(err));
+		lastwarning = CURRTIME;
+	}
+
+	ldap_conn_close(c);
+
+	delay = c->failures < 6 ? 1u << c->failures : LDAP_MAX_BACKOFF;
+	c->failures++;
+
+	if (c->retry_timer == NULL)
+		c->retry_timer = mowgli_timer_add_once(base_eventloop, "ldap_conn_retry", ldap_conn_retry, c, delay);
+}
+
+static void ldap_conn_process(ldap_conn_t *c, LDAPMessage *msg);
+
+/* read one complete result; returns 0 on timeout, -1 if the connection died */
+static int ldap_conn_poll(ldap_conn_t *c, struct timeval *tv)
+{
+	LDAPMessage *msg = NULL;
+	int rc, err;
+
+	rc = ldap_result(c->ld, LDAP_RES_ANY, LDAP_MSG_ALL, tv, &msg);
+	if (rc == 0)
+		return 0;
+	if (rc < 0)
+	{
+		if (ldap_get_option(c->ld, LDAP_OPT_RESULT_CODE, &err) != LDAP_OPT_SUCCESS)
+			err = LDAP_SERVER_DOWN;
+		ldap_conn_fail(c, err);
+		return -1;
+	}
+
+	ldap_conn_process(c, msg);
+	ldap_msgfree(msg);
+
+	return 1;
+}
+
+/* like ldap_conn_poll(), but gives up at deadline (in profile_now() time) */
+static int ldap_conn_wait(ldap_conn_t *c, uint64_t deadline)
+{
+	struct timeval tv;
+	uint64_t now;
+
+	now = profile_now();
+	if (now >= deadline)
+		return 0;
+
+	tv.tv_sec = (deadline - now) / 1000000;
+	tv.tv_usec = (deadline - now) % 1000000;
+
+	return ldap_conn_poll(c, &tv);
+}
+
+static void ldap_conn_readable(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata)
+{
+	ldap_conn_t *c = userdata;
+	struct timeval zero = { 0, 0 };
+
+	while (c->ld != NULL && ldap_conn_poll(c, &zero) > 0)
+		;
+}
+
+static void ldap_conn_writable(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata)
+{
+	ldap_conn_t *c = userdata;
+
+	/* retrying the bind either completes the connect or fails it */
+	mowgli_pollable_setselect(base_eventloop, c->pollable, MOWGLI_EVENTLOOP_IO_WRITE, NULL);
+	ldap_conn_service_bind(c);
+}
+
+static bool ldap_conn_watch(ldap_conn_t *c)
+{
+	int fd = -1;
+
+	if (c->pollable != NULL)
+		return true;
+
+	if (ldap_get_option(c->ld, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS || fd < 0)
+		return false;
+
+	/* only one direction is ever selected, so a callback may always
+	 * tear the pollable down */
+	c->pollable = mowgli_pollable_create(base_eventloop, fd, c);
+
+	return true;
+}
+
+/* (re)bind as binddn, or anonymously; this also opens the connection */
+static void ldap_conn_service_bind(ldap_conn_t *c)
+{
+	struct berval cred = { 0, NULL };
+	char *binddn = NULL;
+	int rc;
+
+	if (ldap_config.binddn != NULL && ldap_config.bindauth != NULL)
+	{
+		binddn = ldap_config.binddn;
+		cred.bv_val = ldap_config.bindauth;
+		cred.bv_len = strlen(ldap_config.bindauth);
+	}
+
+	rc = ldap_sasl_bind(c->ld, binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &c->msgid);
+#ifdef LDAP_X_CONNECTING
+	if (rc == LDAP_X_CONNECTING)
+	{
+		if (!ldap_conn_watch(c))
+		{
+			ldap_conn_fail(c, LDAP_CONNECT_ERROR);
+			return;
+		}
+		c->state = LCONN_CONNECTING;
+		mowgli_pollable_setselect(base_eventloop, c->pollable, MOWGLI_EVENTLOOP_IO_WRITE, ldap_conn_writable);
+		return;
+	}
+#endif
+	if (rc != LDAP_SUCCESS)
+	{
+		ldap_conn_fail(c, rc);
+		return;
+	}
+	if (!ldap_conn_watch(c))
+	{
+		ldap_conn_fail(c, LDAP_CONNECT_ERROR);
+		return;
+	}
+
+	/* a rebind reuses the connection, which is already being read */
+	if (c->state == LCONN_DOWN || c->state == LCONN_CONNECTING)
+		mowgli_pollable_setselect(base_eventloop, c->pollable, MOWGLI_EVENTLOOP_IO_READ, ldap_conn_readable);
+	c->state = LCONN_BINDING;
+}
+
+static void ldap_conn_open(ldap_conn_t *c)
 {
 	int res;
+
+	res = ldap_initialize(&c->ld, ldap_config.url);
+	if (res != LDAP_SUCCESS)
+	{
+		c->ld = NULL;
+		ldap_conn_fail(c, res);
+		return;
+	}
+
+	ldap_set_option(c->ld, LDAP_OPT_PROTOCOL_VERSION, &(const int){3});
+	ldap_set_option(c->ld, LDAP_OPT_NETWORK_TIMEOUT, &(const struct timeval){1, 0});
+	ldap_set_option(c->ld, LDAP_OPT_DEREF, &(const int){false});
+	ldap_set_option(c->ld, LDAP_OPT_REFERRALS, &(const int){false});
+#ifdef LDAP_OPT_CONNECT_ASYNC
+	ldap_set_option(c->ld, LDAP_OPT_CONNECT_ASYNC, LDAP_OPT_ON);
+#endif
+
+	ldap_conn_service_bind(c);
+}
+
+/* the connection finished a request; get it ready for the next one */
+static void ldap_conn_release(ldap_conn_t *c)
+{
+	if (!ldap_config.useDN && !c->bound)
+		ldap_conn_service_bind(c);
+	else
+		c->state = LCONN_IDLE;
+}
+
+static void ldap_request_bind_next(ldap_conn_t *c)
+{
+	ldap_request_t *req = c->req;
+	int rc;
+
+	if (req->nextdn >= req->ndns)
+	{
+		slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", req->name,
+				req->ndns == 0 ? "no such entry" : ldap_err2string(LDAP_INVALID_CREDENTIALS));
+		ldap_request_done(c, false);
+		ldap_conn_release(c);
+		return;
+	}
+
+	c->bound = false;
+	rc = ldap_sasl_bind(c->ld, req->dns[req->nextdn++], LDAP_SASL_SIMPLE, &req->cred, NULL, NULL, &c->msgid);
+	if (rc != LDAP_SUCCESS)
+		ldap_conn_fail(c, rc);
+}
+
+static void ldap_request_search_done(ldap_conn_t *c, LDAPMessage *msg)
+{
+	ldap_request_t *req = c->req;
+	LDAPMessage *m;
+	int err = LDAP_OTHER;
+
+	for (m = ldap_first_message(c->ld, msg); m != NULL; m = ldap_next_message(c->ld, m))
+	{
+		if (ldap_msgtype(m) == LDAP_RES_SEARCH_ENTRY && req->ndns < LDAP_MAX_ENTRIES)
+		{
+			char *dn = ldap_get_dn(c->ld, m);
+
+			if (dn != NULL)
+				req->dns[req->ndns++] = dn;
+		}
+		else if (ldap_msgtype(m) == LDAP_RES_SEARCH_RESULT)
+			ldap_parse_result(c->ld, m, &err, NULL, NULL, NULL, NULL, 0);
+	}
+
+	if (err != LDAP_SUCCESS && req->ndns == 0)
+	{
+		slog(LG_INFO, "ldap_auth_user(%s): ldap search failed: %s", req->name, ldap_err2string(err));
+		ldap_request_done(c, false);
+		ldap_conn_release(c);
+		return;
+	}
+
+	ldap_request_bind_next(c);
+}
+
+static void ldap_conn_process(ldap_conn_t *c, LDAPMessage *msg)
+{
+	int err = LDAP_OTHER;
+
+	if (ldap_msgtype(msg) == LDAP_RES_SEARCH_ENTRY || ldap_msgtype(msg) == LDAP_RES_SEARCH_RESULT)
+	{
+		if (c->req != NULL && c->state == LCONN_BUSY)
+			ldap_request_search_done(c, msg);
+		return;
+	}
+
+	if (ldap_msgtype(msg) != LDAP_RES_BIND)
+		return;
+
+	ldap_parse_result(c->ld, msg, &err, NULL, NULL, NULL, NULL, 0);
+
+	/* our own bind as binddn */
+	if (c->req == NULL)
+	{
+		if (err != LDAP_SUCCESS)
+		{
+			ldap_conn_fail(c, err);
+			return;
+		}
+
+		if (c->failures != 0)
+			slog(LG_INFO, "ldap_conn_process(): connection %u to %s is back up", c->index, ldap_config.url);
+		c->failures = 0;
+		c->bound = true;
+		c->state = LCONN_IDLE;
+		return;
+	}
+
+	if (err == LDAP_SUCCESS)
+	{
+		ldap_request_done(c, true);
+		ldap_conn_release(c);
+	}
+	else if (err == LDAP_INVALID_CREDENTIALS && !ldap_config.useDN)
+		ldap_request_bind_next(c);
+	else
+	{
+		slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", c->req->name, ldap_err2string(err));
+		ldap_request_done(c, false);
+		ldap_conn_release(c);
+	}
+}
+
+static void ldap_request_start(ldap_conn_t *c, ldap_request_t *req)
+{
+	static char *attrs[] = { LDAP_NO_ATTRS, NULL };
+	int rc;
+
+	c->req = req;
+	c->state = LCONN_BUSY;
+
+	if (ldap_config.useDN)
+	{
+		char dn[512];
+
+		snprintf(dn, sizeof dn, ldap_config.dnformat, req->name);
+		c->bound = false;
+		rc = ldap_sasl_bind(c->ld, dn, LDAP_SASL_SIMPLE, &req->cred, NULL, NULL, &c->msgid);
+	}
+	else
+	{
+		char what[512];
+
+		snprintf(what, sizeof what, "%s=%s", ldap_config.attribute, req->name);
+		rc = ldap_search_ext(c->ld, ldap_config.base, LDAP_SCOPE_SUBTREE, what, attrs, 0, NULL, NULL, NULL, LDAP_MAX_ENTRIES, &c->msgid);
+	}
+
+	if (rc != LDAP_SUCCESS)
+		ldap_conn_fail(c, rc);
+}
+
+/* the pool */
+
+static void ldap_pool_close(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ldap_pool_size; i++)
+	{
+		ldap_conn_t *c = &ldap_pool[i];
+
+		if (c->retry_timer != NULL)
+		{
+			mowgli_timer_destroy(base_eventloop, c->retry_timer);
+			c->retry_timer = NULL;
+		}
+		ldap_conn_close(c);
+	}
+
+	ldap_pool_size = 0;
+}
+
+static ldap_conn_t *ldap_pool_idle(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ldap_pool_size; i++)
+		if (ldap_pool[i].state == LCONN_IDLE)
+			return &ldap_pool[i];
+
+	return NULL;
+}
+
+/* an idle connection, or one that finishes rebinding before the deadline */
+static ldap_conn_t *ldap_pool_get(uint64_t deadline)
+{
+	ldap_conn_t *c;
+	unsigned int i;
+
+	while ((c = ldap_pool_idle()) == NULL)
+	{
+		for (i = 0; i < ldap_pool_size; i++)
+			if (ldap_pool[i].state == LCONN_BINDING)
+				break;
+		if (i == ldap_pool_size)
+			return NULL;
+
+		c = &ldap_pool[i];
+		if (ldap_conn_wait(c, deadline) == 0)
+		{
+			slog(LG_INFO, "ldap_pool_get(): connection %u to %s did not finish binding within %u ms", c->index, ldap_config.url, ldap_config.timeout);
+			ldap_conn_fail(c, LDAP_TIMEOUT);
+			return NULL;
+		}
+	}
+
+	return c;
+}
+
+static void ldap_config_ready(void *unused)
+{
+	unsigned int i;
 	char *p;
-	static time_t lastwarning;
 
-	if (ldap_conn != NULL)
-		ldap_unbind_ext_s(ldap_conn, NULL, NULL);
-	ldap_conn = NULL;
+	ldap_pool_close();
+	ldap_configured = false;
+
 	if (ldap_config.url == NULL)
 	{
 		slog(LG_ERROR, "ldap_config_ready(): ldap {} missing url definition");
@@ -81,42 +688,29 @@ static void ldap_config_ready(void *unused)
 	else
 		ldap_config.useDN = false;
 
-	ldap_set_option(NULL, LDAP_OPT_PROTOCOL_VERSION, &(const int)
-			{
-			3});
-	res = ldap_initialize(&ldap_conn, ldap_config.url);
-	if (res != LDAP_SUCCESS)
+	ldap_configured = true;
+
+	ldap_pool_size = ldap_config.poolsize;
+	for (i = 0; i < ldap_pool_size; i++)
 	{
-		slog(LG_ERROR, "ldap_config_ready(): ldap_initialize(%s) failed: %s", ldap_config.url, ldap_err2string(res));
-		if (CURRTIME > lastwarning + 300)
-		{
-			slog(LG_INFO, "LDAP:ERROR: \2%s\2", ldap_err2string(res));
-			wallops("Problem with LDAP server: %s", ldap_err2string(res));
-			lastwarning = CURRTIME;
-		}
-		return;
+		ldap_pool[i].index = i;
+		ldap_pool[i].failures = 0;
+		ldap_conn_open(&ldap_pool[i]);
 	}
-
-	/* short timeouts, because this blocks atheme as a whole */
-	ldap_set_option(ldap_conn, LDAP_OPT_TIMEOUT, &(const struct timeval){1, 0});
-	ldap_set_option(ldap_conn, LDAP_OPT_NETWORK_TIMEOUT, &(const struct timeval){1, 0});
-	ldap_set_option(ldap_conn, LDAP_OPT_DEREF, &(const int){false});
-	ldap_set_option(ldap_conn, LDAP_OPT_REFERRALS, &(const int){false});
 }
 
 static bool ldap_auth_user(myuser_t *mu, const char *password)
 {
-	int res;
-	struct berval cred;
-	LDAPMessage *message, *entry;
+	unsigned char key[16];
+	ldap_request_t *req;
+	ldap_conn_t *c;
+	uint64_t deadline;
+	bool success;
 
-	if (ldap_conn == NULL)
-	{
-		ldap_config_ready(NULL);
-	}
-	if (ldap_conn == NULL)
+	if (!ldap_configured)
 	{
-		slog(LG_INFO, "ldap_auth_user(): no connection");
+		slog(LG_INFO, "ldap_auth_user(): not configured");
+		auth_user_unavailable = true;
 		return false;
 	}
 
@@ -136,93 +730,58 @@ static bool ldap_auth_user(myuser_t *mu, const char *password)
 		return false;
 	}
 
-/* Use DN to find exact match */
-	if (ldap_config.useDN)
-	{
-		char dn[512];
-		cred.bv_len = strlen(password);
-		/* sstrdup it to remove the const */
-		cred.bv_val = sstrdup(password);
-
-		snprintf(dn, sizeof dn, ldap_config.dnformat, entity(mu)->name);
-		res = ldap_sasl_bind_s(ldap_conn, dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		if (res == LDAP_SERVER_DOWN)
-		{
-			ldap_config_ready(NULL);
-			res = ldap_sasl_bind_s(ldap_conn, dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		}
-		if (res == LDAP_SUCCESS)
-			return true;
-		else if (res == LDAP_INVALID_CREDENTIALS)
-		{
-			slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", entity(mu)->name, ldap_err2string(res));
-			return false;
-		}
-		slog(LG_INFO, "ldap_auth_user(): ldap_bind_s failed: %s", ldap_err2string(res));
-		return false;
+	ldap_cache_key(entity(mu)->name, password, key);
+	if (ldap_cache_check(entity(mu)->name, key))
+		return true;
 
+	deadline = profile_now() + (uint64_t)ldap_config.timeout * 1000;
 
-/* Use base + attribute search for Auth */
-	}
-	else
+	c = ldap_pool_get(deadline);
+	if (c == NULL)
 	{
-		char what[512];
-		char *binddn = NULL;
+		slog(LG_INFO, "ldap_auth_user(%s): no idle connection to %s", entity(mu)->name, ldap_config.url);
+		auth_user_unavailable = true;
+		return false;
+	}
 
-		cred.bv_len = 0;
+	req = ldap_request_create(entity(mu)->name, password, key);
+	ldap_request_start(c, req);
 
-		if (ldap_config.binddn != NULL && ldap_config.bindauth != NULL)
-		{
-			binddn = ldap_config.binddn;
-			cred.bv_val = ldap_config.bindauth;
-			cred.bv_len = strlen(ldap_config.bindauth);
-		}
+	while (!req->done && ldap_conn_wait(c, deadline) != 0)
+		;
 
-		res = ldap_sasl_bind_s(ldap_conn, binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		if (res == LDAP_SERVER_DOWN)
-		{
-			ldap_config_ready(NULL);
-			res = ldap_sasl_bind_s(ldap_conn, binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		}
-		if (res != LDAP_SUCCESS)
-		{
-			slog(LG_INFO, "ldap_auth_user(): ldap_bind_s failed: %s", ldap_err2string(res));
-			return false;
-		}
+	if (!req->done)
+	{
+		slog(LG_INFO, "ldap_auth_user(%s): no answer from %s within %u ms", entity(mu)->name, ldap_config.url, ldap_config.timeout);
+		ldap_conn_fail(c, LDAP_TIMEOUT);
+	}
 
-		sprintf(what, "%s=%s", ldap_config.attribute, entity(mu)->name);
-		if ((res = ldap_search_ext_s(ldap_conn, ldap_config.base, LDAP_SCOPE_SUBTREE, what, NULL, 0, NULL, NULL, NULL, 0, &message)) != LDAP_SUCCESS)
-		{
-			slog(LG_INFO, "ldap_auth_user(%s): ldap search failed: %s", entity(mu)->name, ldap_err2string(res));
-			return false;
-		}
+	success = req->success;
+	if (req->unavailable)
+		auth_user_unavailable = true;
+	ldap_request_free(req);
 
-		cred.bv_len = strlen(password);
-		/* sstrdup it to remove the const */
-		cred.bv_val = sstrdup(password);
+	return success;
+}
 
-		for (entry = ldap_first_message(ldap_conn, message); entry && ldap_msgtype(entry) == LDAP_RES_SEARCH_ENTRY; entry = ldap_next_message(ldap_conn, entry))
-		{
+void _modinit(module_t * m)
+{
+	unsigned int i;
 
-			res = ldap_sasl_bind_s(ldap_conn, ldap_get_dn(ldap_conn, entry), LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-			if (res == LDAP_SUCCESS)
-			{
-				ldap_msgfree(message);
-				return true;
-			}
-		}
+	for (i = 0; i < sizeof ldap_cache_salt; i += sizeof(unsigned int))
+	{
+		unsigned int r = arc4random();
 
-		ldap_msgfree(message);
+		memcpy(ldap_cache_salt + i, &r, sizeof r);
 	}
 
-	slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", entity(mu)->name, ldap_err2string(res));
-	return false;
-}
+	ldap_cache = mowgli_patricia_create(noopcanon);
+	ldap_cache_timer = mowgli_timer_add(base_eventloop, "ldap_cache_expire", ldap_cache_expire, NULL, 60);
 
-void _modinit(module_t * m)
-{
 	hook_add_event("config_ready");
 	hook_add_config_ready(ldap_config_ready);
+	hook_add_event("myuser_delete");
+	hook_add_myuser_delete(ldap_myuser_delete);
 
 	add_subblock_top_conf("LDAP", &conf_ldap_table);
 	add_dupstr_conf_item("URL", &conf_ldap_table, 0, &ldap_config.url, NULL);
@@ -231,6 +790,9 @@ void _modinit(module_t * m)
 	add_dupstr_conf_item("ATTRIBUTE", &conf_ldap_table, 0, &ldap_config.attribute, NULL);
 	add_dupstr_conf_item("BINDDN", &conf_ldap_table, 0, &ldap_config.binddn, NULL);
 	add_dupstr_conf_item("BINDAUTH", &conf_ldap_table, 0, &ldap_config.bindauth, NULL);
+	add_uint_conf_item("POOLSIZE", &conf_ldap_table, 0, &ldap_config.poolsize, 1, LDAP_MAX_POOL, 2);
+	add_uint_conf_item("TIMEOUT", &conf_ldap_table, 0, &ldap_config.timeout, 10, 30000, 1000);
+	add_duration_conf_item("CACHETIME", &conf_ldap_table, 0, &ldap_config.cachetime, "m", 300);
 
 	auth_user_custom = &ldap_auth_user;
 
@@ -243,16 +805,22 @@ void _moddeinit(module_unload_intent_t intent)
 
 	auth_module_loaded = false;
 
-	if (ldap_conn != NULL)
-		ldap_unbind_ext_s(ldap_conn, NULL, NULL);
+	ldap_pool_close();
+
+	mowgli_timer_destroy(base_eventloop, ldap_cache_timer);
+	mowgli_patricia_destroy(ldap_cache, ldap_cache_free, NULL);
 
 	hook_del_config_ready(ldap_config_ready);
+	hook_del_myuser_delete(ldap_myuser_delete);
 	del_conf_item("URL", &conf_ldap_table);
 	del_conf_item("DNFORMAT", &conf_ldap_table);
 	del_conf_item("BASE", &conf_ldap_table);
 	del_conf_item("ATTRIBUTE", &conf_ldap_table);
 	del_conf_item("BINDDN", &conf_ldap_table);
 	del_conf_item("BINDAUTH", &conf_ldap_table);
+	del_conf_item("POOLSIZE", &conf_ldap_table);
+	del_conf_item("TIMEOUT", &conf_ldap_table);
+	del_conf_item("CACHETIME", &conf_ldap_table);
 	del_top_conf("LDAP");
 }
 
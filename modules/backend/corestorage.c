@@ -928,6 +928,7 @@ static void corestorage_db_load(const char *filename)
 static void corestorage_db_write(void *filename)
 {
 	database_handle_t *db;
+	double start = metric_clock();
 
 	db = db_open(filename, DB_WRITE);
 
@@ -935,6 +936,10 @@ static void corestorage_db_write(void *filename)
 	hook_call_db_write(db);
 
 	db_close(db);
+
+	metric_observe(metric_histogram("atheme_db_save_duration_seconds",
+				"Time taken to write out the database.", NULL),
+			metric_clock() - start);
 }
 
 void _modinit(module_t *m)
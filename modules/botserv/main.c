@@ -273,18 +273,15 @@ bs_join_registered(bool all)
 		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
 			continue;
 
+		/* ChanServ leaves once the bot has joined */
 		if (all)
 		{
-			join(mc->name, md->value);
-			if (mc->chan && cs && chanuser_find(mc->chan, chansvs.me->me))
-				part(mc->name, chansvs.nick);
+			join_burst(mc->name, md->value, cs ? chansvs.nick : NULL);
 			continue;
 		}
 		else if (mc->chan != NULL && mc->chan->members.count != 0)
 		{
-			join(mc->name, md->value);
-			if (mc->chan && cs && chanuser_find(mc->chan, chansvs.me->me))
-				part(mc->name, chansvs.nick);
+			join_burst(mc->name, md->value, cs ? chansvs.nick : NULL);
 			continue;
 		}
 	}
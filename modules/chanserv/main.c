@@ -45,12 +45,12 @@ static void join_registered(bool all)
 
 		if (all)
 		{
-			join(mc->name, chansvs.nick);
+			join_burst(mc->name, chansvs.nick, NULL);
 			continue;
 		}
 		else if (mc->chan != NULL && mc->chan->members.count != 0)
 		{
-			join(mc->name, chansvs.nick);
+			join_burst(mc->name, chansvs.nick, NULL);
 			continue;
 		}
 	}
@@ -601,7 +601,10 @@ static void cs_part(hook_channel_joinpart_t *hdata)
 	if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
 		return;
 
-	if (CURRTIME - mc->used >= 3600)
+	/* a netsplit is not use of the channel, and checking the access
+	 * list for every split user of a busy channel is what makes
+	 * splits slow */
+	if (CURRTIME - mc->used >= 3600 && !(cu->user->flags & UF_SPLIT))
 		if (chanacs_user_flags(mc, cu->user) & CA_USEDUPDATE)
 			mc->used = CURRTIME;
 
@@ -370,7 +370,7 @@ static void cs_xop_do_del(sourceinfo_t *si, mychan_t *mc, myentity_t *mt, char *
 		req.ca = ca;
 		req.oldlevel = ca->level;
 
-		ca->level = 0;
+		chanacs_modify_simple(ca, 0, ca->level);
 
 		req.newlevel = ca->level;
 
@@ -392,7 +392,7 @@ static void cs_xop_do_del(sourceinfo_t *si, mychan_t *mc, myentity_t *mt, char *
 	req.ca = ca;
 	req.oldlevel = ca->level;
 
-	ca->level = 0;
+	chanacs_modify_simple(ca, 0, ca->level);
 
 	req.newlevel = ca->level;
 
@@ -75,7 +75,9 @@ static void gs_cmd_fflags(sourceinfo_t *si, int parc, char *parv[])
 	}
 
 	if (ga != NULL && flags != 0)
-		ga->flags = flags;
+	{
+		groupacs_modify(ga, flags);
+	}
 	else if (ga != NULL)
 	{
 		groupacs_delete(mg, mt);
@@ -103,7 +103,7 @@ static void gs_cmd_flags(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	if (isuser(mt) && (MU_NEVERGROUP & user(mt)->flags) && (groupacs_find(mg, mt, 0, true) == NULL))
+	if (isuser(mt) && (MU_NEVERGROUP & user(mt)->flags) && !mygroup_has_member(mg, mt, 0))
 	{
 		command_fail(si, fault_noprivs, _("\2%s\2 does not wish to have flags in any groups."), parv[1]);
 		return;
@@ -161,7 +161,9 @@ no_founder:
 	if (ga != NULL && flags != 0)
 	{
 		if (ga->flags != flags)
-			ga->flags = flags;
+		{
+			groupacs_modify(ga, flags);
+		}
 		else
 		{
 			command_fail(si, fault_nochange, _("Group \2%s\2 access for \2%s\2 unchanged."), entity(mg)->name, mt->name);
@@ -21,6 +21,8 @@ unsigned int (*myentity_count_group_flag)(myentity_t *mu, unsigned int flagset);
 groupacs_t * (*groupacs_add)(mygroup_t *mg, myentity_t *mt, unsigned int flags);
 groupacs_t * (*groupacs_find)(mygroup_t *mg, myentity_t *mt, unsigned int flags, bool allow_recurse);
 void (*groupacs_delete)(mygroup_t *mg, myentity_t *mt);
+void (*groupacs_modify)(groupacs_t *ga, unsigned int flags);
+bool (*mygroup_has_member)(mygroup_t *mg, myentity_t *mt, unsigned int flags);
 
 bool (*groupacs_sourceinfo_has_flag)(mygroup_t *mg, sourceinfo_t *si, unsigned int flag);
 unsigned int (*groupacs_sourceinfo_flags)(mygroup_t *mg, sourceinfo_t *si);
@@ -44,6 +46,8 @@ static inline void use_groupserv_main_symbols(module_t *m)
     MODULE_TRY_REQUEST_SYMBOL(m, groupacs_add, "groupserv/main", "groupacs_add");
     MODULE_TRY_REQUEST_SYMBOL(m, groupacs_find, "groupserv/main", "groupacs_find");
     MODULE_TRY_REQUEST_SYMBOL(m, groupacs_delete, "groupserv/main", "groupacs_delete");
+    MODULE_TRY_REQUEST_SYMBOL(m, groupacs_modify, "groupserv/main", "groupacs_modify");
+    MODULE_TRY_REQUEST_SYMBOL(m, mygroup_has_member, "groupserv/main", "mygroup_has_member");
     MODULE_TRY_REQUEST_SYMBOL(m, groupacs_sourceinfo_has_flag, "groupserv/main", "groupacs_sourceinfo_has_flag");
     MODULE_TRY_REQUEST_SYMBOL(m, groupacs_sourceinfo_flags, "groupserv/main", "groupacs_sourceinfo_flags");
 
@@ -30,6 +30,213 @@ groupserv_config_t gs_config;
 
 mowgli_heap_t *mygroup_heap, *groupacs_heap;
 
+/*
+ * Every account that is asked about keeps a flattened view of the
+ * groups it belongs to, including through nested groups, as an array
+ * sorted by group pointer; each entry carries the union of the flags
+ * held in any of the groups underneath.  Membership changes of an
+ * account only stale that account's view; changes that involve a
+ * group as member (or a group going away) stale everyone's through
+ * mygroup_closure_gen.
+ */
+typedef struct {
+	mygroup_t *mg;
+	unsigned int flags;
+} mygroup_closure_entry_t;
+
+typedef struct {
+	unsigned int gen;
+	mygroup_closure_entry_t *groups;	/* sorted by group pointer */
+	unsigned int count, size;
+} mygroup_closure_t;
+
+static unsigned int mygroup_closure_gen = 1;
+
+/* index of mg in the view, or where it would be inserted */
+static unsigned int mygroup_closure_search(const mygroup_closure_t *cl, const mygroup_t *mg)
+{
+	unsigned int lo = 0, hi = cl->count, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if ((uintptr_t) cl->groups[mid].mg < (uintptr_t) mg)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static mygroup_closure_entry_t *mygroup_closure_find(const mygroup_closure_t *cl, const mygroup_t *mg)
+{
+	unsigned int i;
+
+	i = mygroup_closure_search(cl, mg);
+	if (i < cl->count && cl->groups[i].mg == mg)
+		return &cl->groups[i];
+
+	return NULL;
+}
+
+static void mygroup_closure_invalidate(myentity_t *mt)
+{
+	mygroup_closure_t *cl;
+
+	if (mt == NULL || isgroup(mt))
+	{
+		mygroup_closure_gen++;
+		return;
+	}
+
+	cl = privatedata_get(mt, "groupserv:closure");
+	if (cl != NULL)
+		cl->gen = 0;
+}
+
+/* merge flags into the view for mg, returns true if anything changed */
+static bool mygroup_closure_merge(mygroup_closure_t *cl, mygroup_t *mg, unsigned int flags)
+{
+	mygroup_closure_entry_t *ce;
+	unsigned int i;
+
+	i = mygroup_closure_search(cl, mg);
+	if (i < cl->count && cl->groups[i].mg == mg)
+	{
+		ce = &cl->groups[i];
+		if ((ce->flags | flags) == ce->flags)
+			return false;
+
+		ce->flags |= flags;
+		return true;
+	}
+
+	if (cl->count == cl->size)
+	{
+		cl->size = cl->size != 0 ? cl->size * 2 : 8;
+		cl->groups = srealloc(cl->groups, cl->size * sizeof *cl->groups);
+	}
+
+	memmove(&cl->groups[i + 1], &cl->groups[i], (cl->count - i) * sizeof *cl->groups);
+	cl->groups[i].mg = mg;
+	cl->groups[i].flags = flags;
+	cl->count++;
+
+	return true;
+}
+
+static void mygroup_closure_rebuild(myentity_t *mt, mygroup_closure_t *cl)
+{
+	mowgli_list_t pending = { NULL, NULL, 0 };
+	mowgli_list_t *l;
+	mowgli_node_t *n;
+	unsigned int flags;
+
+	cl->count = 0;
+	cl->gen = mygroup_closure_gen;
+
+	l = myentity_get_membership_list(mt);
+	MOWGLI_ITER_FOREACH(n, l->head)
+	{
+		groupacs_t *ga = n->data;
+
+		if (ga->mt == mt && mygroup_closure_merge(cl, ga->mg, ga->flags))
+			mowgli_node_add(ga->mg, mowgli_node_create(), &pending);
+	}
+
+	/* walk upwards until nothing changes; cycles terminate since flags only grow */
+	while ((n = pending.head) != NULL)
+	{
+		mygroup_t *mg = n->data;
+
+		mowgli_node_delete(n, &pending);
+		mowgli_node_free(n);
+
+		/* merging may move the entries, so keep a copy */
+		flags = mygroup_closure_find(cl, mg)->flags;
+
+		l = myentity_get_membership_list(entity(mg));
+		MOWGLI_ITER_FOREACH(n, l->head)
+		{
+			groupacs_t *ga = n->data;
+
+			if (ga->mt == entity(mg) && mygroup_closure_merge(cl, ga->mg, flags))
+				mowgli_node_add(ga->mg, mowgli_node_create(), &pending);
+		}
+	}
+}
+
+static mygroup_closure_t *mygroup_closure_get(myentity_t *mt)
+{
+	mygroup_closure_t *cl;
+
+	cl = privatedata_get(mt, "groupserv:closure");
+	if (cl == NULL)
+	{
+		cl = scalloc(1, sizeof *cl);
+		privatedata_set(mt, "groupserv:closure", cl);
+	}
+
+	if (cl->gen != mygroup_closure_gen)
+		mygroup_closure_rebuild(mt, cl);
+
+	return cl;
+}
+
+/* for entities that are going away, and when unloading */
+void myentity_free_group_closure(myentity_t *mt)
+{
+	mygroup_closure_t *cl;
+
+	cl = privatedata_get(mt, "groupserv:closure");
+	if (cl == NULL)
+		return;
+
+	mowgli_patricia_delete(object(mt)->privatedata, "groupserv:closure");
+
+	free(cl->groups);
+	free(cl);
+}
+
+/* mygroup_closure_gen starts over when the module is reloaded, so views
+ * left behind would look current; drop them all instead */
+void mygroup_closures_clear(void)
+{
+	myentity_iteration_state_t iter;
+	myentity_t *mt;
+
+	MYENTITY_FOREACH_T(mt, &iter, ENT_USER)
+		myentity_free_group_closure(mt);
+}
+
+/*
+ * Returns a new list of the groups mt belongs to, directly or through
+ * nested groups, holding any of the given flags (or all of them when
+ * flags is 0).  The caller frees it with mowgli_list_free().
+ */
+mowgli_list_t *myentity_get_group_closure(myentity_t *mt, unsigned int flags)
+{
+	mygroup_closure_t *cl;
+	mowgli_list_t *l;
+	unsigned int i;
+
+	l = mowgli_list_create();
+
+	return_val_if_fail(mt != NULL, l);
+	return_val_if_fail(!isgroup(mt), l);
+
+	cl = mygroup_closure_get(mt);
+
+	for (i = 0; i < cl->count; i++)
+	{
+		if (flags == 0 || (cl->groups[i].flags & flags) != 0)
+			mowgli_node_add(cl->groups[i].mg, mowgli_node_create(), l);
+	}
+
+	return l;
+}
+
 void mygroups_init(void)
 {
 	mygroup_heap = mowgli_heap_create(sizeof(mygroup_t), HEAP_USER, BH_NOW);
@@ -57,6 +264,9 @@ static void mygroup_delete(mygroup_t *mg)
 		object_unref(ga);
 	}
 
+	mygroup_closure_invalidate(NULL);
+	chanacs_cache_invalidate(NULL);
+
 	metadata_delete_all(mg);
 	strshare_unref(entity(mg)->name);
 	mowgli_heap_free(mygroup_heap, mg);
@@ -132,9 +342,25 @@ groupacs_t *groupacs_add(mygroup_t *mg, myentity_t *mt, unsigned int flags)
 	mowgli_node_add(ga, &ga->gnode, &mg->acs);
 	mowgli_node_add(ga, &ga->unode, myentity_get_membership_list(mt));
 
+	mygroup_closure_invalidate(mt);
+	chanacs_cache_invalidate(NULL);
+
 	return ga;
 }
 
+void groupacs_modify(groupacs_t *ga, unsigned int flags)
+{
+	return_if_fail(ga != NULL);
+
+	if (ga->flags == flags)
+		return;
+
+	ga->flags = flags;
+
+	mygroup_closure_invalidate(ga->mt);
+	chanacs_cache_invalidate(NULL);
+}
+
 groupacs_t *groupacs_find(mygroup_t *mg, myentity_t *mt, unsigned int flags, bool allow_recurse)
 {
 	mowgli_node_t *n;
@@ -188,12 +414,43 @@ void groupacs_delete(mygroup_t *mg, myentity_t *mt)
 		mowgli_node_delete(&ga->gnode, &mg->acs);
 		mowgli_node_delete(&ga->unode, myentity_get_membership_list(mt));
 		object_unref(ga);
+
+		mygroup_closure_invalidate(mt);
+		chanacs_cache_invalidate(NULL);
 	}
 }
 
+/*
+ * mygroup_has_member(mygroup_t *mg, myentity_t *mt, unsigned int flags)
+ *
+ * Checks whether mt is a member of mg, directly or through nested groups,
+ * holding any of the given flags (or just membership when flags is 0).
+ * This gives the same answer as groupacs_find(mg, mt, flags, true) but
+ * uses the flattened membership view for accounts.
+ */
+bool mygroup_has_member(mygroup_t *mg, myentity_t *mt, unsigned int flags)
+{
+	mygroup_closure_t *cl;
+	mygroup_closure_entry_t *ce;
+
+	return_val_if_fail(mg != NULL, false);
+	return_val_if_fail(mt != NULL, false);
+
+	if (isgroup(mt))
+		return groupacs_find(mg, mt, flags, true) != NULL;
+
+	cl = mygroup_closure_get(mt);
+
+	ce = mygroup_closure_find(cl, mg);
+	if (ce == NULL)
+		return false;
+
+	return flags == 0 || (ce->flags & flags) != 0;
+}
+
 bool groupacs_sourceinfo_has_flag(mygroup_t *mg, sourceinfo_t *si, unsigned int flag)
 {
-	return groupacs_find(mg, entity(si->smu), flag, true) != NULL;
+	return mygroup_has_member(mg, entity(si->smu), flag);
 }
 
 unsigned int groupacs_sourceinfo_flags(mygroup_t *mg, sourceinfo_t *si)
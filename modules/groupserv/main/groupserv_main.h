@@ -19,6 +19,8 @@ E mygroup_t *mygroup_find(const char *name);
 E groupacs_t *groupacs_add(mygroup_t *mg, myentity_t *mt, unsigned int flags);
 E groupacs_t *groupacs_find(mygroup_t *mg, myentity_t *mt, unsigned int flags, bool allow_recurse);
 E void groupacs_delete(mygroup_t *mg, myentity_t *mt);
+E void groupacs_modify(groupacs_t *ga, unsigned int flags);
+E bool mygroup_has_member(mygroup_t *mg, myentity_t *mt, unsigned int flags);
 
 E bool groupacs_sourceinfo_has_flag(mygroup_t *mg, sourceinfo_t *si, unsigned int flag);
 
@@ -35,6 +37,9 @@ E void remove_group_chanacs(mygroup_t *mg);
 
 E mowgli_list_t *myentity_get_membership_list(myentity_t *mt);
 E unsigned int myentity_count_group_flag(myentity_t *mt, unsigned int flagset);
+E void myentity_free_group_closure(myentity_t *mt);
+E void mygroup_closures_clear(void);
+E mowgli_list_t *myentity_get_group_closure(myentity_t *mt, unsigned int flags);
 
 E const char *mygroup_founder_names(mygroup_t *mg);
 
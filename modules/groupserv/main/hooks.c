@@ -26,26 +26,24 @@ static void mygroup_expire(void *unused)
 
 static void grant_channel_access_hook(user_t *u)
 {
-	mowgli_node_t *n, *tn;
+	mowgli_node_t *n, *n2;
 	mowgli_list_t *l;
 
 	return_if_fail(u->myuser != NULL);
 
-	l = myentity_get_membership_list(entity(u->myuser));
+	/* every group whose channel access the account gets, nested ones included */
+	l = myentity_get_group_closure(entity(u->myuser), GA_CHANACS);
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, l->head)
+	MOWGLI_ITER_FOREACH(n, l->head)
 	{
-		groupacs_t *ga = n->data;
+		mygroup_t *mg = n->data;
 
-		if (!(ga->flags & GA_CHANACS))
-			continue;
-
-		MOWGLI_ITER_FOREACH(n, entity(ga->mg)->chanacs.head)
+		MOWGLI_ITER_FOREACH(n2, entity(mg)->chanacs.head)
 		{
 			chanacs_t *ca;
 			chanuser_t *cu;
 
-			ca = (chanacs_t *)n->data;
+			ca = (chanacs_t *)n2->data;
 
 			if (ca->mychan->chan == NULL)
 				continue;
@@ -106,6 +104,8 @@ static void grant_channel_access_hook(user_t *u)
 			}
 		}
 	}
+
+	mowgli_list_free(l);
 }
 
 static void user_info_hook(hook_user_req_t *req)
@@ -179,6 +179,8 @@ static void myuser_delete_hook(myuser_t *mu)
 	}
 
 	mowgli_list_free(l);
+
+	myentity_free_group_closure(entity(mu));
 }
 
 static void osinfo_hook(sourceinfo_t *si)
@@ -62,6 +62,7 @@ void _moddeinit(module_unload_intent_t intent)
 {
 	gs_db_deinit();
 	gs_hooks_deinit();
+	mygroup_closures_clear();
 	del_conf_item("MAXGROUPS", &groupsvs->conf_table);
 	del_conf_item("MAXGROUPACS", &groupsvs->conf_table);
 	del_conf_item("ENABLE_OPEN_GROUPS", &groupsvs->conf_table);
@@ -7,10 +7,18 @@
  */
 
 #include "atheme.h"
+#define HTTPD_MAIN
 #include "httpd.h"
 #include "datastream.h"
 
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+
 #define REQUEST_MAX 65536 /* maximum size of one call */
+#define CACHE_FILE_MAX 32768 /* larger files are not kept in memory */
+#define CACHE_MAX 1048576 /* total size of cached files */
+#define SENDFILE_CHUNK 262144 /* most sent per writable event */
 
 DECLARE_MODULE_V1
 (
@@ -20,7 +28,21 @@ DECLARE_MODULE_V1
 );
 
 connection_t *listener;
-mowgli_list_t httpd_path_handlers;
+mowgli_patricia_t *httpd_paths;
+
+/* small static files, most recently used first */
+typedef struct
+{
+	char *filename;
+	char etag[64];
+	char *data;
+	size_t len;
+	mowgli_node_t node;
+} cached_file_t;
+
+static mowgli_patricia_t *file_cache;
+static mowgli_list_t file_cache_lru;
+static size_t file_cache_bytes;
 
 /* conf stuff */
 mowgli_list_t conf_httpd_table;
@@ -50,18 +72,53 @@ static void clear_httpddata(struct httpddata *hd)
 	hd->correct_content_type = false;
 	hd->expect_100_continue = false;
 	hd->sent_reply = false;
+	hd->http11 = false;
+	hd->if_none_match[0] = '\0';
+	hd->reqdata = NULL;
+}
+
+static void cache_drop(cached_file_t *cf)
+{
+	mowgli_patricia_delete(file_cache, cf->filename);
+	mowgli_node_delete(&cf->node, &file_cache_lru);
+	file_cache_bytes -= cf->len;
+	free(cf->filename);
+	free(cf->data);
+	free(cf);
+}
+
+static void cache_clear(void)
+{
+	while (file_cache_lru.head != NULL)
+		cache_drop(file_cache_lru.head->data);
 }
 
-static int open_file(const char *filename)
+static cached_file_t *cache_add(const char *filename, const char *etag, char *data, size_t len)
 {
-	char fname[256];
+	cached_file_t *cf;
+
+	while (file_cache_bytes + len > CACHE_MAX && file_cache_lru.tail != NULL)
+		cache_drop(file_cache_lru.tail->data);
+
+	cf = smalloc(sizeof *cf);
+	cf->filename = sstrdup(filename);
+	mowgli_strlcpy(cf->etag, etag, sizeof cf->etag);
+	cf->data = data;
+	cf->len = len;
+	mowgli_patricia_add(file_cache, cf->filename, cf);
+	mowgli_node_add_head(cf, &cf->node, &file_cache_lru);
+	file_cache_bytes += len;
+	return cf;
+}
 
+static bool file_path(const char *filename, char *fname, size_t size)
+{
 	if (strstr(filename, ".."))
-		return -1;
+		return false;
 	if (!strcmp(filename, "/"))
 		filename = "/index.html";
-	snprintf(fname, sizeof fname, "%s/%s", httpd_config.www_root, filename);
-	return open(fname, O_RDONLY);
+	snprintf(fname, size, "%s/%s", httpd_config.www_root, filename);
+	return true;
 }
 
 static void process_header(connection_t *cptr, char *line)
@@ -103,6 +160,10 @@ static void process_header(connection_t *cptr, char *line)
 	{
 		hd->expect_100_continue = !strcasecmp(p, "100-continue");
 	}
+	else if (!strcasecmp(line, "If-None-Match"))
+	{
+		mowgli_strlcpy(hd->if_none_match, p, sizeof hd->if_none_match);
+	}
 }
 
 static void check_close(connection_t *cptr)
@@ -131,6 +192,81 @@ static void send_error(connection_t *cptr, int errorcode, const char *text, bool
 	sendq_add(cptr, buf1, strlen(buf1));
 }
 
+/* reply helpers for path handlers, see httpd.h */
+
+size_t httpd_reply_header(connection_t *cptr, char *buf, size_t size, const char *content_type, long length)
+{
+	struct httpddata *hd = cptr->userdata;
+	char lenbuf[64];
+
+	if (length < 0 && !hd->http11)
+		hd->connection_close = true;
+	if (length >= 0)
+		snprintf(lenbuf, sizeof lenbuf, "Content-Length: %ld\r\n", length);
+	else if (hd->http11)
+		mowgli_strlcpy(lenbuf, "Transfer-Encoding: chunked\r\n", sizeof lenbuf);
+	else
+		lenbuf[0] = '\0';
+	snprintf(buf, size, "HTTP/1.1 200 OK\r\n"
+			"%s"
+			"Server: Atheme/%s\r\n"
+			"Content-Type: %s\r\n"
+			"%s\r\n",
+			hd->connection_close ? "Connection: close\r\n" : "",
+			PACKAGE_VERSION, content_type, lenbuf);
+	return strlen(buf);
+}
+
+void httpd_reply_start(connection_t *cptr, const char *content_type, long length)
+{
+	char buf[300];
+	size_t len;
+
+	len = httpd_reply_header(cptr, buf, sizeof buf, content_type, length);
+	sendq_add(cptr, buf, len);
+}
+
+void httpd_reply_chunk(connection_t *cptr, const char *data, size_t len)
+{
+	struct httpddata *hd = cptr->userdata;
+	char buf[32];
+
+	/* an empty chunk would end the body */
+	if (len == 0)
+		return;
+	if (hd->http11)
+	{
+		snprintf(buf, sizeof buf, "%lx\r\n", (unsigned long)len);
+		sendq_add(cptr, buf, strlen(buf));
+	}
+	sendq_add(cptr, (char *)data, len);
+	if (hd->http11)
+		sendq_add(cptr, "\r\n", 2);
+}
+
+void httpd_reply_no_content(connection_t *cptr)
+{
+	struct httpddata *hd = cptr->userdata;
+	char buf[300];
+
+	snprintf(buf, sizeof buf, "HTTP/1.1 204 No Content\r\n"
+			"%s"
+			"Server: Atheme/%s\r\n\r\n",
+			hd->connection_close ? "Connection: close\r\n" : "",
+			PACKAGE_VERSION);
+	sendq_add(cptr, buf, strlen(buf));
+	check_close(cptr);
+}
+
+void httpd_reply_end(connection_t *cptr, bool chunked)
+{
+	struct httpddata *hd = cptr->userdata;
+
+	if (chunked && hd->http11)
+		sendq_add(cptr, "0\r\n\r\n", 5);
+	check_close(cptr);
+}
+
 static const char *content_type(const char *filename)
 {
 	const char *p;
@@ -155,32 +291,225 @@ static const char *content_type(const char *filename)
 	return "application/octet-stream";
 }
 
-static void httpd_recvqhandler(connection_t *cptr)
+static void httpd_recvqhandler(connection_t *cptr);
+
+static void finish_file(connection_t *cptr)
+{
+	struct httpddata *hd;
+	int l, ll;
+
+	hd = cptr->userdata;
+	check_close(cptr);
+	clear_httpddata(hd);
+
+	/* requests pipelined behind the file waited in the recvq */
+	l = recvq_length(cptr);
+	while (l != 0 && !(cptr->flags & CF_DEAD))
+	{
+		httpd_recvqhandler(cptr);
+		ll = l;
+		l = recvq_length(cptr);
+		if (ll == l)
+			break;
+	}
+}
+
+#ifdef __linux__
+/* write handler while a file goes out with sendfile(); the header in the
+ * sendq has to be flushed first */
+static void send_file(connection_t *cptr)
+{
+	struct httpddata *hd;
+	ssize_t l;
+	size_t count;
+
+	hd = cptr->userdata;
+	if (sendq_nonempty(cptr))
+	{
+		sendq_flush(cptr);
+		if (sendq_nonempty(cptr) || (cptr->flags & CF_DEAD))
+			return;
+	}
+
+	count = hd->file_left > SENDFILE_CHUNK ? SENDFILE_CHUNK : hd->file_left;
+	l = sendfile(cptr->fd, hd->file_fd, &hd->file_offset, count);
+	if (l <= 0)
+	{
+		if (l < 0 && mowgli_eventloop_ignore_errno(ioerrno()))
+		{
+			connection_setselect_write(cptr, send_file);
+			return;
+		}
+		slog(LG_INFO, "send_file(): disconnecting fd %d (%s), sendfile failed on %s", cptr->fd, cptr->hbuf, hd->filename);
+		close(hd->file_fd);
+		hd->file_fd = -1;
+		cptr->flags |= CF_DEAD;
+		connection_setselect_write(cptr, NULL);
+		return;
+	}
+
+	hd->file_left -= l;
+	if (hd->file_left > 0)
+	{
+		connection_setselect_write(cptr, send_file);
+		return;
+	}
+
+	close(hd->file_fd);
+	hd->file_fd = -1;
+	connection_setselect_write(cptr, NULL);
+	finish_file(cptr);
+}
+#endif
+
+static void serve_file(connection_t *cptr, bool is_get)
 {
-	char buf[BUFSIZE * 2];
 	char outbuf[BUFSIZE * 2];
-	int count;
+	char fname[BUFSIZE];
+	char etag[64];
 	struct httpddata *hd;
-	char *p;
-	int in;
 	struct stat sb;
+	cached_file_t *cf;
+	char *data;
+	ssize_t count;
 	off_t count1;
-	mowgli_node_t *n;
-	path_handler_t *ph = NULL;
-	bool is_get, is_post, handling_done = false;
+	int in;
 
 	hd = cptr->userdata;
 
-	MOWGLI_ITER_FOREACH(n, httpd_path_handlers.head)
+	if (!file_path(hd->filename, fname, sizeof fname) || stat(fname, &sb) == -1 || !S_ISREG(sb.st_mode))
+	{
+		slog(LG_DEBUG, "httpd_recvqhandler(): 404 for \2%s\2", hd->filename);
+		send_error(cptr, 404, "Not Found", is_get);
+		check_close(cptr);
+		clear_httpddata(hd);
+		return;
+	}
+
+	snprintf(etag, sizeof etag, "\"%lx-%lx-%lx\"", (unsigned long)sb.st_ino,
+			(unsigned long)sb.st_size, (unsigned long)sb.st_mtime);
+
+	if (hd->if_none_match[0] != '\0' && (strstr(hd->if_none_match, etag) || !strcmp(hd->if_none_match, "*")))
+	{
+		slog(LG_DEBUG, "httpd_recvqhandler(): 304 for %s", hd->filename);
+		snprintf(outbuf, sizeof outbuf,
+				"HTTP/1.1 304 Not Modified\r\nServer: Atheme/%s\r\nETag: %s\r\n\r\n",
+				PACKAGE_VERSION, etag);
+		sendq_add(cptr, outbuf, strlen(outbuf));
+		check_close(cptr);
+		clear_httpddata(hd);
+		return;
+	}
+
+	slog(LG_INFO, "httpd_recvqhandler(): 200 for %s", hd->filename);
+	snprintf(outbuf, sizeof outbuf,
+			"HTTP/1.1 200 OK\r\nServer: Atheme/%s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nETag: %s\r\n\r\n",
+			PACKAGE_VERSION,
+			content_type(hd->filename),
+			(unsigned long)sb.st_size, etag);
+
+	cf = mowgli_patricia_retrieve(file_cache, fname);
+	if (cf != NULL && strcmp(cf->etag, etag))
+	{
+		cache_drop(cf);
+		cf = NULL;
+	}
+
+	if (cf == NULL && sb.st_size <= CACHE_FILE_MAX)
+	{
+		if ((in = open(fname, O_RDONLY)) == -1)
+		{
+			send_error(cptr, 404, "Not Found", is_get);
+			check_close(cptr);
+			clear_httpddata(hd);
+			return;
+		}
+		data = smalloc(sb.st_size + 1);
+		count = read(in, data, sb.st_size);
+		close(in);
+		if (count == sb.st_size)
+			cf = cache_add(fname, etag, data, sb.st_size);
+		else
+			free(data);
+	}
+
+	if (cf != NULL)
+	{
+		mowgli_node_delete(&cf->node, &file_cache_lru);
+		mowgli_node_add_head(cf, &cf->node, &file_cache_lru);
+		sendq_add(cptr, outbuf, strlen(outbuf));
+		if (is_get)
+			sendq_add(cptr, cf->data, cf->len);
+		check_close(cptr);
+		clear_httpddata(hd);
+		return;
+	}
+
+	if ((in = open(fname, O_RDONLY)) == -1)
+	{
+		send_error(cptr, 404, "Not Found", is_get);
+		check_close(cptr);
+		clear_httpddata(hd);
+		return;
+	}
+	sendq_add(cptr, outbuf, strlen(outbuf));
+	count1 = is_get ? sb.st_size : 0;
+
+#ifdef __linux__
+	if (count1 > 0)
 	{
-		ph = (path_handler_t *)n->data;
-		handling_done = !strcmp(hd->filename, ph->path);
+		/* the rest happens from the write handler */
+		hd->file_fd = in;
+		hd->file_offset = 0;
+		hd->file_left = count1;
+		connection_setselect_write(cptr, send_file);
+		return;
+	}
+#endif
 
-		if (handling_done)
+	while (count1 > 0)
+	{
+		count = sizeof outbuf;
+		if (count > count1)
+			count = count1;
+		count = read(in, outbuf, count);
+		if (count <= 0)
 			break;
+		sendq_add(cptr, outbuf, count);
+		count1 -= count;
 	}
+	close(in);
+	if (count1 > 0)
+	{
+		slog(LG_INFO, "httpd_recvqhandler(): disconnecting fd %d (%s), read failed on %s", cptr->fd, cptr->hbuf, hd->filename);
+		cptr->flags |= CF_DEAD;
+	}
+	else
+		check_close(cptr);
+
+	/* a pipelined request must not inherit our headers */
+	clear_httpddata(hd);
+}
+
+static void httpd_recvqhandler(connection_t *cptr)
+{
+	char buf[BUFSIZE * 2];
+	char outbuf[BUFSIZE * 2];
+	int count;
+	struct httpddata *hd;
+	char *p;
+	path_handler_t *ph;
+	bool is_get, is_post;
 
-	if (handling_done)
+	hd = cptr->userdata;
+
+	/* leave further requests queued until the file is out */
+	if (hd->file_fd != -1)
+		return;
+
+	ph = mowgli_patricia_retrieve(httpd_paths, hd->filename);
+
+	if (ph != NULL)
 	{
 		if (hd->requestbuf != NULL)
 		{
@@ -232,6 +561,7 @@ static void httpd_recvqhandler(connection_t *cptr)
 			return;
 		mowgli_strlcpy(hd->filename, p, sizeof hd->filename);
 		p = strtok(NULL, "");
+		hd->http11 = p != NULL && !strcmp(p, "HTTP/1.1");
 		if (p == NULL || !strcmp(p, "HTTP/1.0"))
 			hd->connection_close = true;
 		slog(LG_DEBUG, "httpd_recvqhandler(): request %s for %s", hd->method, hd->filename);
@@ -250,45 +580,12 @@ static void httpd_recvqhandler(connection_t *cptr)
 
 		hd->method[0] = '\0';
 
-		if (!handling_done)
+		if (ph == NULL)
+			serve_file(cptr, is_get);
+		else if (is_get && ph->allow_get)
 		{
-			in = open_file(hd->filename);
-			if (in == -1 || fstat(in, &sb) == -1 || !S_ISREG(sb.st_mode))
-			{
-				if (in != -1)
-					close(in);
-				slog(LG_DEBUG, "httpd_recvqhandler(): 404 for \2%s\2", hd->filename);
-				send_error(cptr, 404, "Not Found", is_get);
-				check_close(cptr);
-				return;
-			}
-			slog(LG_INFO, "httpd_recvqhandler(): 200 for %s", hd->filename);
-			snprintf(outbuf, sizeof outbuf,
-					"HTTP/1.1 200 OK\r\nServer: Atheme/%s\r\nContent-Type: %s\r\nContent-Length: %lu\r\n\r\n",
-					PACKAGE_VERSION,
-					content_type(hd->filename),
-					(unsigned long)sb.st_size);
-			sendq_add(cptr, outbuf, strlen(outbuf));
-			count1 = is_get ? sb.st_size : 0;
-			while (count1 > 0)
-			{
-				count = sizeof outbuf;
-				if (count > count1)
-					count = count1;
-				count = read(in, outbuf, count);
-				if (count <= 0)
-					break;
-				sendq_add(cptr, outbuf, count);
-				count1 -= count;
-			}
-			close(in);
-			if (count1 > 0)
-			{
-				slog(LG_INFO, "httpd_recvqhandler(): disconnecting fd %d (%s), read failed on %s", cptr->fd, cptr->hbuf, hd->filename);
-				cptr->flags |= CF_DEAD;
-			}
-			else
-				check_close(cptr);
+			ph->handler(cptr, NULL);
+			clear_httpddata(hd);
 		}
 		else
 		{
@@ -332,7 +629,10 @@ static void httpd_closehandler(connection_t *cptr)
 	hd = cptr->userdata;
 	if (hd != NULL)
 	{
+		if (hd->file_fd != -1)
+			close(hd->file_fd);
 		free(hd->requestbuf);
+		free(hd->replybuf);
 		free(hd);
 	}
 	cptr->userdata = NULL;
@@ -349,6 +649,7 @@ static void do_listen(connection_t *cptr)
 	hd->requestbuf = NULL;
 	hd->replybuf = NULL;
 	hd->connection_close = false;
+	hd->file_fd = -1;
 	clear_httpddata(hd);
 	newptr->userdata = hd;
 	newptr->recvq_handler = httpd_recvqhandler;
@@ -368,7 +669,7 @@ static void httpd_checkidle(void *arg)
 		cptr = n->data;
 		if (cptr->listener == listener && cptr->last_recv + 300 < CURRTIME)
 		{
-			if (sendq_nonempty(cptr))
+			if (sendq_nonempty(cptr) || ((struct httpddata *)cptr->userdata)->file_fd != -1)
 				cptr->last_recv = CURRTIME;
 			else
 				/* from a timeout function,
@@ -382,6 +683,9 @@ static void httpd_checkidle(void *arg)
 
 static void httpd_config_ready(void *vptr)
 {
+	/* www_root may have changed */
+	cache_clear();
+
 	if (httpd_config.host != NULL && httpd_config.port != 0)
 	{
 		/* Some code depends on connection_t.listener == listener. */
@@ -400,6 +704,9 @@ static mowgli_eventloop_timer_t *httpd_checkidle_timer = NULL;
 
 void _modinit(module_t *m)
 {
+	httpd_paths = mowgli_patricia_create(noopcanon);
+	file_cache = mowgli_patricia_create(noopcanon);
+
 	httpd_checkidle_timer = mowgli_timer_add(base_eventloop, "httpd_checkidle", httpd_checkidle, NULL, 60);
 
 	/* This module needs a rehash to initialize fully if loaded
@@ -419,6 +726,9 @@ void _moddeinit(module_unload_intent_t intent)
 
 	hook_del_config_ready(httpd_config_ready);
 	connection_close_soon_children(listener);
+	cache_clear();
+	mowgli_patricia_destroy(file_cache, NULL, NULL);
+	mowgli_patricia_destroy(httpd_paths, NULL, NULL);
 	del_conf_item("HOST", &conf_httpd_table);
 	del_conf_item("WWW_ROOT", &conf_httpd_table);
 	del_conf_item("PORT", &conf_httpd_table);
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Exports the core metrics registry over the httpd, in the text
+ * exposition format understood by Prometheus.
+ */
+
+#include "atheme.h"
+#include "httpd.h"
+#include "datastream.h"
+
+DECLARE_MODULE_V1
+(
+	"misc/metrics", false, _modinit, _moddeinit,
+	PACKAGE_STRING,
+	"Atheme Development Group <http://www.atheme.org>"
+);
+
+static void handle_request(connection_t *cptr, void *requestbuf);
+
+mowgli_patricia_t **httpd_paths;
+
+static path_handler_t handle_metrics = { "/metrics", handle_request, true };
+
+static void handle_request(connection_t *cptr, void *requestbuf)
+{
+	mowgli_string_t *out;
+
+	out = mowgli_string_create();
+	metrics_render(out);
+
+	httpd_reply_start(cptr, "text/plain; version=0.0.4", out->pos);
+	sendq_add(cptr, out->str, out->pos);
+	httpd_reply_end(cptr, false);
+
+	out->destroy(out);
+}
+
+void _modinit(module_t *m)
+{
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_paths, "misc/httpd", "httpd_paths");
+	use_httpd_symbols(m);
+
+	mowgli_patricia_add(*httpd_paths, handle_metrics.path, &handle_metrics);
+}
+
+void _moddeinit(module_unload_intent_t intent)
+{
+	mowgli_patricia_delete(*httpd_paths, handle_metrics.path);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -7,7 +7,11 @@
 
 #include "atheme.h"
 #include "conf.h"
+#include "uplink.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
 #include <crack.h>
 
 DECLARE_MODULE_V1
@@ -17,8 +21,138 @@ DECLARE_MODULE_V1
         "Atheme Development Group <http://www.atheme.org>"
 );
 
+/*
+ * FascistCheck() opens the dictionary and reads its index on every call,
+ * then does a few dozen binary searches through it, so the checks run on
+ * a worker thread.  The dictionary files are also mapped and prefetched
+ * for as long as they are configured, so those reads hit the page cache
+ * rather than the disk.
+ *
+ * The user_can_register hook cannot wait for an answer.  For IRC users
+ * it refuses the first attempt with a note that the password is being
+ * checked, and once the worker is done REGISTER is run again on the
+ * user's behalf.  Verdicts are remembered for a minute under a salted
+ * hash of the password, which is what lets the second run through.
+ * Each user has at most one check pending, so a REGISTER sent again
+ * before the answer is refused rather than replayed a second time.
+ * Other sources (XML-RPC and such) are checked right away.
+ */
+
+#define CRACKLIB_VERDICT_TTL	60
+#define CRACKLIB_MAX_PENDING	256
+
+typedef struct {
+	char *password;
+	char *dict;
+	char key[33];
+
+	/* where to run REGISTER again */
+	char *uid;
+	char *service;
+	char *account;
+	char *email;
+
+	bool weak;
+	char reason[BUFSIZE];		/* written by the worker */
+	uint64_t queued, started, finished;
+} cracklib_job_t;
+
+typedef struct {
+	char key[33];
+	char *reason;			/* NULL if the password is fine */
+	time_t expires;
+} cracklib_verdict_t;
+
 bool cracklib_warn;
 
+static char *cracklib_dict;		/* NULL: the library's default */
+static struct {
+	void *addr;
+	size_t len;
+} cracklib_maps[3];
+
+static mowgli_patricia_t *cracklib_verdicts;
+static mowgli_patricia_t *cracklib_waiting;	/* uid -> pending job */
+static unsigned char cracklib_salt[16];
+static mowgli_eventloop_timer_t *cracklib_expire_timer;
+
+static pthread_t cracklib_thread;
+static pthread_mutex_t cracklib_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool cracklib_running;
+static int cracklib_jobs[2] = { -1, -1 };
+static int cracklib_results[2] = { -1, -1 };
+static mowgli_eventloop_pollable_t *cracklib_pollable;
+static unsigned int cracklib_pending;
+
+static metric_t *cracklib_check_time, *cracklib_queue_time;
+
+/* the dictionary */
+
+static void cracklib_unmap(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cracklib_maps); i++)
+	{
+		if (cracklib_maps[i].addr != NULL)
+			munmap(cracklib_maps[i].addr, cracklib_maps[i].len);
+		cracklib_maps[i].addr = NULL;
+	}
+
+	free(cracklib_dict);
+	cracklib_dict = NULL;
+}
+
+static bool cracklib_map(const char *prefix)
+{
+	static const char *suffixes[] = { ".pwd", ".pwi", ".hwm" };
+	char path[BUFSIZE];
+	struct stat sb;
+	unsigned int i;
+	void *addr;
+	int fd;
+
+	for (i = 0; i < ARRAY_SIZE(suffixes); i++)
+	{
+		snprintf(path, sizeof path, "%s%s", prefix, suffixes[i]);
+
+		if ((fd = open(path, O_RDONLY)) < 0)
+		{
+			/* the .hwm file is optional */
+			if (i == 0)
+				return false;
+			continue;
+		}
+
+		if (fstat(fd, &sb) == 0 && sb.st_size > 0)
+		{
+			addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (addr != MAP_FAILED)
+			{
+#ifdef MADV_WILLNEED
+				madvise(addr, sb.st_size, MADV_WILLNEED);
+#endif
+				cracklib_maps[i].addr = addr;
+				cracklib_maps[i].len = sb.st_size;
+			}
+		}
+
+		close(fd);
+	}
+
+	return true;
+}
+
+static void cracklib_load(void)
+{
+	cracklib_unmap();
+
+	if (!cracklib_map(nicksvs.cracklib_dict))
+		slog(LG_ERROR, "No cracklib dictionary found, falling back to not using a dictionary.");
+	else
+		cracklib_dict = sstrdup(nicksvs.cracklib_dict);
+}
+
 static void cracklib_config_ready(void *unused)
 {
 	module_t *m;
@@ -31,45 +165,334 @@ static void cracklib_config_ready(void *unused)
 		return;
 	}
 
-	hook_del_config_ready(cracklib_config_ready);
+	/* queued jobs carry their own copy of the path */
+	if (cracklib_dict == NULL || strcmp(cracklib_dict, nicksvs.cracklib_dict))
+		cracklib_load();
 }
 
-static int check_dict (char *filename)
+/* verdicts */
+
+static void cracklib_key(const char *password, char *key)
 {
-	struct stat sb;
+	static const char hex[] = "0123456789abcdef";
+	unsigned char digest[16];
+	md5_state_t ctx;
+	unsigned int i;
+
+	md5_init(&ctx);
+	md5_append(&ctx, cracklib_salt, sizeof cracklib_salt);
+	md5_append(&ctx, (const unsigned char *)password, strlen(password));
+	md5_finish(&ctx, digest);
 
-	if (stat(filename, &sb) == -1)
+	for (i = 0; i < sizeof digest; i++)
 	{
-		slog(LG_ERROR, "No cracklib dictionary found, falling back to not using a dictionary.");
-		return 0;
+		key[2 * i] = hex[digest[i] >> 4];
+		key[2 * i + 1] = hex[digest[i] & 15];
+	}
+	key[32] = '\0';
+}
+
+static void cracklib_verdict_free(cracklib_verdict_t *v)
+{
+	free(v->reason);
+	free(v);
+}
+
+static void cracklib_verdict_add(const char *key, const char *reason)
+{
+	cracklib_verdict_t *v;
+
+	v = mowgli_patricia_retrieve(cracklib_verdicts, key);
+	if (v == NULL)
+	{
+		v = scalloc(1, sizeof *v);
+		mowgli_strlcpy(v->key, key, sizeof v->key);
+		mowgli_patricia_add(cracklib_verdicts, v->key, v);
+	}
+
+	free(v->reason);
+	v->reason = reason != NULL ? sstrdup(reason) : NULL;
+	v->expires = CURRTIME + CRACKLIB_VERDICT_TTL;
+}
+
+static void cracklib_verdict_expire(void *unused)
+{
+	mowgli_patricia_iteration_state_t state;
+	cracklib_verdict_t *v;
+
+	MOWGLI_PATRICIA_FOREACH(v, &state, cracklib_verdicts)
+	{
+		if (v->expires > CURRTIME)
+			continue;
+
+		mowgli_patricia_delete(cracklib_verdicts, v->key);
+		cracklib_verdict_free(v);
+	}
+}
+
+static void cracklib_verdict_destroy(const char *key, void *data, void *privdata)
+{
+	cracklib_verdict_free(data);
+}
+
+static void cracklib_apply(hook_user_register_check_t *hdata, const char *reason)
+{
+	if (reason == NULL)
+		return;
+
+	if (cracklib_warn)
+		command_fail(hdata->si, fault_badparams, _("The password provided is insecure because %s. You may want to set a different password with /msg %s set password <password> ."), reason, nicksvs.nick);
+	else
+	{
+		command_fail(hdata->si, fault_badparams, _("The password provided is insecure: %s"), reason);
+		hdata->approved++;
+	}
+}
+
+/* the worker */
+
+static void *cracklib_worker(void *unused)
+{
+	cracklib_job_t *job;
+	const char *reason;
+	ssize_t len;
+
+	for (;;)
+	{
+		len = read(cracklib_jobs[0], &job, sizeof job);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len != sizeof job || job == NULL)
+			break;
+
+		job->started = profile_now();
+		pthread_mutex_lock(&cracklib_lock);
+		reason = FascistCheck(job->password, job->dict);
+		job->weak = reason != NULL;
+		if (reason != NULL)
+			mowgli_strlcpy(job->reason, reason, sizeof job->reason);
+		pthread_mutex_unlock(&cracklib_lock);
+		job->finished = profile_now();
+
+		while ((len = write(cracklib_results[1], &job, sizeof job)) < 0 && errno == EINTR)
+			;
+		if (len != sizeof job)
+			break;
+	}
+
+	return NULL;
+}
+
+static void cracklib_job_free(cracklib_job_t *job)
+{
+	memset(job->password, 0, strlen(job->password));
+	free(job->password);
+	free(job->dict);
+	free(job->uid);
+	free(job->service);
+	free(job->account);
+	free(job->email);
+	free(job);
+}
+
+/* run REGISTER again for the user who asked, now that the verdict is known */
+static void cracklib_replay(cracklib_job_t *job)
+{
+	sourceinfo_t *si;
+	service_t *svs;
+	user_t *u;
+	char text[BUFSIZE];
+
+	if ((u = user_find(job->uid)) == NULL || (svs = service_find(job->service)) == NULL)
+		return;
+
+	/* the account is their nick, and they have changed it */
+	if (!nicksvs.no_nick_ownership && irccasecmp(u->nick, job->account))
+		return;
+
+	if (nicksvs.no_nick_ownership)
+		snprintf(text, sizeof text, "%s %s %s", job->account, job->password, job->email);
+	else
+		snprintf(text, sizeof text, "%s %s", job->password, job->email);
+
+	si = sourceinfo_create();
+	si->su = u;
+	si->smu = u->myuser;
+	si->service = svs;
+	si->connection = curr_uplink != NULL ? curr_uplink->conn : NULL;
+	si->output_limit = MAX_IRC_OUTPUT_LINES;
+
+	command_exec_split(svs, si, "REGISTER", text, svs->commands);
+
+	object_unref(si);
+	memset(text, 0, sizeof text);
+}
+
+static void cracklib_readable(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata)
+{
+	cracklib_job_t *job;
+
+	while (read(cracklib_results[0], &job, sizeof job) == sizeof job)
+	{
+		cracklib_pending--;
+		mowgli_patricia_delete(cracklib_waiting, job->uid);
+
+		metric_observe(cracklib_queue_time, (job->started - job->queued) / 1000000.0);
+		metric_observe(cracklib_check_time, (job->finished - job->started) / 1000000.0);
+
+		cracklib_verdict_add(job->key, job->weak ? job->reason : NULL);
+		cracklib_replay(job);
+		cracklib_job_free(job);
+	}
+}
+
+static bool cracklib_start(void)
+{
+	sigset_t all, old;
+
+	if (pipe(cracklib_jobs) < 0)
+		return false;
+	if (pipe(cracklib_results) < 0)
+	{
+		close(cracklib_jobs[0]);
+		close(cracklib_jobs[1]);
+		return false;
+	}
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	cracklib_running = pthread_create(&cracklib_thread, NULL, cracklib_worker, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!cracklib_running)
+	{
+		close(cracklib_jobs[0]);
+		close(cracklib_jobs[1]);
+		close(cracklib_results[0]);
+		close(cracklib_results[1]);
+		return false;
 	}
+
+	cracklib_pollable = mowgli_pollable_create(base_eventloop, cracklib_results[0], NULL);
+	mowgli_pollable_set_nonblocking(cracklib_pollable, true);
+	mowgli_pollable_setselect(base_eventloop, cracklib_pollable, MOWGLI_EVENTLOOP_IO_READ, cracklib_readable);
+
+	return true;
+}
+
+static void cracklib_stop(void)
+{
+	cracklib_job_t *job = NULL;
+
+	if (!cracklib_running)
+		return;
+
+	/* the worker finishes what is queued, then sees the NULL */
+	if (write(cracklib_jobs[1], &job, sizeof job) == sizeof job)
+		pthread_join(cracklib_thread, NULL);
 	else
-		return 1;
+		pthread_detach(cracklib_thread);
+	cracklib_running = false;
+
+	mowgli_pollable_destroy(base_eventloop, cracklib_pollable);
+
+	while (read(cracklib_results[0], &job, sizeof job) == sizeof job)
+	{
+		mowgli_patricia_delete(cracklib_waiting, job->uid);
+		cracklib_job_free(job);
+	}
+	cracklib_pending = 0;
+
+	close(cracklib_jobs[0]);
+	close(cracklib_jobs[1]);
+	close(cracklib_results[0]);
+	close(cracklib_results[1]);
+}
+
+static bool cracklib_queue(hook_user_register_check_t *hdata, const char *key)
+{
+	cracklib_job_t *job;
+
+	if (!cracklib_running || cracklib_pending >= CRACKLIB_MAX_PENDING)
+		return false;
+
+	/* only IRC users can have REGISTER run again for them */
+	if (hdata->si->su == NULL || hdata->si->v != NULL || hdata->si->service == NULL)
+		return false;
+
+	job = scalloc(1, sizeof *job);
+	job->password = sstrdup(hdata->password);
+	job->dict = cracklib_dict != NULL ? sstrdup(cracklib_dict) : NULL;
+	mowgli_strlcpy(job->key, key, sizeof job->key);
+	job->uid = sstrdup(CLIENT_NAME(hdata->si->su));
+	job->service = sstrdup(hdata->si->service->internal_name);
+	job->account = sstrdup(hdata->account);
+	job->email = sstrdup(hdata->email);
+	job->queued = profile_now();
+
+	if (write(cracklib_jobs[1], &job, sizeof job) != sizeof job)
+	{
+		cracklib_job_free(job);
+		return false;
+	}
+
+	cracklib_pending++;
+	mowgli_patricia_add(cracklib_waiting, job->uid, job);
+
+	return true;
 }
 
 static void
 cracklib_hook(hook_user_register_check_t *hdata)
 {
-	const char *cracklib_reason;
-	char dict[BUFSIZE];
-
-	mowgli_strlcpy(dict, nicksvs.cracklib_dict, BUFSIZE);
-	mowgli_strlcat(dict, ".pwd", BUFSIZE);
+	cracklib_verdict_t *v;
+	const char *reason;
+	char key[33];
+	uint64_t start;
 
 	return_if_fail(hdata != NULL);
 	return_if_fail(hdata->si != NULL);
 	return_if_fail(hdata->password != NULL);
 
-	if ((cracklib_reason = FascistCheck(hdata->password, check_dict(dict) ? nicksvs.cracklib_dict : NULL)) != NULL)
+	/* refused already, no need to check */
+	if (hdata->approved != 0)
+		return;
+
+	/* one check per user at a time; the pending one decides */
+	if (hdata->si->su != NULL &&
+			mowgli_patricia_retrieve(cracklib_waiting, CLIENT_NAME(hdata->si->su)) != NULL)
 	{
-		if (cracklib_warn)
-			command_fail(hdata->si, fault_badparams, _("The password provided is insecure because %s. You may want to set a different password with /msg %s set password <password> ."), cracklib_reason, nicksvs.nick);
-		else
-		{
-			command_fail(hdata->si, fault_badparams, _("The password provided is insecure: %s"), cracklib_reason);
-			hdata->approved++;
-		}
+		command_fail(hdata->si, fault_toomany, _("Your password is still being checked, please wait."));
+		hdata->approved++;
+		return;
+	}
+
+	cracklib_key(hdata->password, key);
+
+	v = mowgli_patricia_retrieve(cracklib_verdicts, key);
+	if (v != NULL && v->expires > CURRTIME)
+	{
+		cracklib_apply(hdata, v->reason);
+		return;
 	}
+
+	if (cracklib_queue(hdata, key))
+	{
+		command_success_nodata(hdata->si, _("Checking your password, please wait..."));
+		hdata->approved++;
+		return;
+	}
+
+	start = profile_now();
+	pthread_mutex_lock(&cracklib_lock);
+	reason = FascistCheck(hdata->password, cracklib_dict);
+	cracklib_verdict_add(key, reason);
+	pthread_mutex_unlock(&cracklib_lock);
+	metric_observe(cracklib_check_time, (profile_now() - start) / 1000000.0);
+
+	cracklib_apply(hdata, reason);
 }
 
 static void osinfo_hook(sourceinfo_t *si)
@@ -77,11 +500,33 @@ static void osinfo_hook(sourceinfo_t *si)
 	return_if_fail(si != NULL);
 
 	command_success_nodata(si, "Registrations will fail with bad passwords: %s", cracklib_warn ? "No" : "Yes");
+	command_success_nodata(si, "Password checks waiting for the cracklib thread: %u", cracklib_pending);
 }
 
 void
 _modinit(module_t *m)
 {
+	unsigned int i;
+
+	for (i = 0; i < sizeof cracklib_salt; i += sizeof(unsigned int))
+	{
+		unsigned int r = arc4random();
+
+		memcpy(cracklib_salt + i, &r, sizeof r);
+	}
+
+	cracklib_verdicts = mowgli_patricia_create(noopcanon);
+	cracklib_waiting = mowgli_patricia_create(irccasecanon);
+	cracklib_expire_timer = mowgli_timer_add(base_eventloop, "cracklib_verdict_expire", cracklib_verdict_expire, NULL, CRACKLIB_VERDICT_TTL);
+
+	cracklib_check_time = metric_histogram("atheme_cracklib_check_seconds", "Time taken to check a password against the cracklib dictionary.", NULL);
+	cracklib_queue_time = metric_histogram("atheme_cracklib_queue_seconds", "Time a password waited for the cracklib thread.", NULL);
+
+	if (nicksvs.cracklib_dict != NULL)
+		cracklib_load();
+
+	if (!cracklib_start())
+		slog(LG_ERROR, "nickserv/cracklib: cannot start the worker thread, checking passwords synchronously");
 
 	hook_add_event("user_can_register");
 	hook_add_user_can_register(cracklib_hook);
@@ -103,4 +548,14 @@ _moddeinit(module_unload_intent_t intent)
 	hook_del_operserv_info(osinfo_hook);
 
 	del_conf_item("CRACKLIB_WARN", &nicksvs.me->conf_table);
+
+	cracklib_stop();
+	cracklib_unmap();
+
+	mowgli_timer_destroy(base_eventloop, cracklib_expire_timer);
+	mowgli_patricia_destroy(cracklib_verdicts, cracklib_verdict_destroy, NULL);
+	mowgli_patricia_destroy(cracklib_waiting, NULL, NULL);
+
+	metric_delete(cracklib_check_time);
+	metric_delete(cracklib_queue_time);
 }
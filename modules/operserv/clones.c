@@ -15,11 +15,29 @@ DECLARE_MODULE_V1
 	"Atheme Development Group <http://www.atheme.org>"
 );
 
-#define CLONESDB_VERSION	3
+#define CLONESDB_VERSION	4
 #define CLONES_GRACE_TIMEPERIOD	180
 
+/*
+ * Clients are counted in a binary prefix tree keyed by address.  IPv4
+ * addresses are stored as IPv4-mapped IPv6 ones (::ffff:a.b.c.d), so
+ * an IPv4 /24 sits at depth 120.  The tree is path compressed: besides
+ * the nodes for hosts (depth 128), the prefixes being counted and the
+ * exemptions, it only holds the nodes where those branch apart, so
+ * every lookup visits at most one node per bit.  A node's ancestors are
+ * exactly the prefixes covering it, which is how exemptions and the
+ * counts for a client are found.
+ */
+#define CLONES_HOSTLEN		128
+#define CLONES_V4_OFFSET	96
+#define CLONES_MAX_PREFIXES	8
+
+#define CLONES_IPV4		0
+#define CLONES_IPV6		1
+
 static void clones_newuser(hook_user_nick_t *data);
 static void clones_userquit(user_t *u);
+static void clones_split(hook_server_split_t *data);
 static void clones_configready(void *unused);
 
 static void os_cmd_clones(sourceinfo_t *si, int parc, char *parv[]);
@@ -30,6 +48,7 @@ static void os_cmd_clones_delexempt(sourceinfo_t *si, int parc, char *parv[]);
 static void os_cmd_clones_setexempt(sourceinfo_t *si, int parc, char *parv[]);
 static void os_cmd_clones_listexempt(sourceinfo_t *si, int parc, char *parv[]);
 static void os_cmd_clones_duration(sourceinfo_t *si, int parc, char *parv[]);
+static void os_cmd_clones_prefix(sourceinfo_t *si, int parc, char *parv[]);
 
 static void write_exemptdb(database_handle_t *db);
 
@@ -38,6 +57,7 @@ static void db_h_ck(database_handle_t *db, const char *type);
 static void db_h_cd(database_handle_t *db, const char *type);
 static void db_h_gr(database_handle_t *db, const char *type);
 static void db_h_ex(database_handle_t *db, const char *type);
+static void db_h_pf(database_handle_t *db, const char *type);
 static void db_h_clonesdbv(database_handle_t *db, const char *type);
 
 mowgli_patricia_t *os_clones_cmds;
@@ -47,13 +67,13 @@ service_t *serviceinfo;
 static mowgli_list_t clone_exempts;
 bool kline_enabled;
 unsigned int grace_count;
-mowgli_patricia_t *hostlist;
-mowgli_heap_t *hostentry_heap;
 static long kline_duration;
 static int clones_allowed, clones_warn;
 static unsigned int clones_dbversion = 1;
 
 typedef struct cexcept_ cexcept_t;
+typedef struct clonenode_ clonenode_t;
+
 struct cexcept_
 {
 	char *ip;
@@ -61,17 +81,39 @@ struct cexcept_
 	int warn;
 	char *reason;
 	long expires;
+	clonenode_t *node;		/* NULL if ip does not parse */
 };
 
-typedef struct hostentry_ hostentry_t;
-struct hostentry_
+struct clonenode_
 {
-	char ip[HOSTIPLEN];
-	mowgli_list_t clients;
+	unsigned char addr[16];		/* masked to plen bits */
+	unsigned int plen;
+	clonenode_t *parent, *child[2];
+
+	unsigned int count;		/* clients, if this is a host or counted prefix */
+	mowgli_list_t clients;		/* hosts only */
+	cexcept_t *exempt;
 	time_t firstkill;
 	unsigned int gracekills;
+	unsigned int split_serial;	/* last split that pruned this host */
 };
 
+typedef struct {
+	unsigned int plen;		/* in tree terms, see above */
+	unsigned int allowed;
+	unsigned int warn;
+} cprefix_t;
+
+static clonenode_t *clones_root;
+static mowgli_heap_t *clonenode_heap;
+
+/* prefix lengths counted per address family, shortest first */
+static cprefix_t clone_prefixes[2][CLONES_MAX_PREFIXES];
+static unsigned int clone_nprefixes[2];
+
+static const unsigned char clones_v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+static const char *clones_familyname[2] = { "IPv4", "IPv6" };
+
 static inline bool cexempt_expired(cexcept_t *c)
 {
 	if (c && c->expires && CURRTIME > c->expires)
@@ -80,6 +122,387 @@ static inline bool cexempt_expired(cexcept_t *c)
 	return false;
 }
 
+static inline unsigned int clones_bit(const unsigned char *addr, unsigned int i)
+{
+	return (addr[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+/* how many leading bits a and b have in common, looking at no more than len */
+static unsigned int clones_common(const unsigned char *a, const unsigned char *b, unsigned int len)
+{
+	unsigned int bits = 0, i;
+	unsigned char x;
+
+	for (i = 0; bits < len; i++, bits += 8)
+	{
+		x = a[i] ^ b[i];
+		if (x == 0)
+			continue;
+
+		while (!(x & 0x80))
+		{
+			x <<= 1;
+			bits++;
+		}
+		break;
+	}
+
+	return bits < len ? bits : len;
+}
+
+static void clones_mask(unsigned char *addr, unsigned int plen)
+{
+	unsigned int i;
+
+	for (i = plen; i < CLONES_HOSTLEN; i++)
+		addr[i >> 3] &= ~(0x80 >> (i & 7));
+}
+
+static unsigned int clones_family(const unsigned char *addr)
+{
+	return memcmp(addr, clones_v4mapped, sizeof clones_v4mapped) ? CLONES_IPV6 : CLONES_IPV4;
+}
+
+/* parse an address or CIDR mask into tree form */
+static bool clones_parse(const char *s, unsigned char *addr, unsigned int *plen, unsigned int *family)
+{
+	char buf[HOSTIPLEN + 5], *mask, *end;
+	unsigned long len, max;
+
+	if (mowgli_strlcpy(buf, s, sizeof buf) >= sizeof buf)
+		return false;
+
+	if ((mask = strchr(buf, '/')) != NULL)
+		*mask++ = '\0';
+
+	if (inet_pton(AF_INET6, buf, addr) == 1)
+		max = CLONES_HOSTLEN;
+	else if (inet_pton(AF_INET, buf, addr + sizeof clones_v4mapped) == 1)
+	{
+		memcpy(addr, clones_v4mapped, sizeof clones_v4mapped);
+		max = CLONES_HOSTLEN - CLONES_V4_OFFSET;
+	}
+	else
+		return false;
+
+	len = max;
+	if (mask != NULL)
+	{
+		if (!isdigit((unsigned char)*mask))
+			return false;
+		len = strtoul(mask, &end, 10);
+		if (*end != '\0' || len > max)
+			return false;
+	}
+
+	*family = clones_family(addr);
+	*plen = CLONES_HOSTLEN - max + len;
+	clones_mask(addr, *plen);
+
+	return true;
+}
+
+/* format a node as an address, or as a CIDR mask if it is not a host */
+static const char *clones_node_name(clonenode_t *n)
+{
+	static char buf[HOSTIPLEN + 5];
+	char addr[HOSTIPLEN];
+
+	unsigned int plen = n->plen;
+
+	if (plen >= CLONES_V4_OFFSET && clones_family(n->addr) == CLONES_IPV4)
+	{
+		inet_ntop(AF_INET, n->addr + sizeof clones_v4mapped, addr, sizeof addr);
+		plen -= CLONES_V4_OFFSET;
+	}
+	else
+		inet_ntop(AF_INET6, n->addr, addr, sizeof addr);
+
+	if (n->plen == CLONES_HOSTLEN)
+		mowgli_strlcpy(buf, addr, sizeof buf);
+	else
+		snprintf(buf, sizeof buf, "%s/%u", addr, plen);
+
+	return buf;
+}
+
+static clonenode_t *clones_node_find(const unsigned char *addr, unsigned int plen)
+{
+	clonenode_t *n = clones_root;
+
+	while (n != NULL && n->plen <= plen)
+	{
+		if (clones_common(n->addr, addr, n->plen) < n->plen)
+			return NULL;
+		if (n->plen == plen)
+			return n;
+		n = n->child[clones_bit(addr, n->plen)];
+	}
+
+	return NULL;
+}
+
+static clonenode_t *clones_node_new(const unsigned char *addr, unsigned int plen, clonenode_t *parent)
+{
+	clonenode_t *n;
+
+	n = mowgli_heap_alloc(clonenode_heap);
+	memset(n, 0, sizeof *n);
+	memcpy(n->addr, addr, sizeof n->addr);
+	clones_mask(n->addr, plen);
+	n->plen = plen;
+	n->parent = parent;
+
+	return n;
+}
+
+static clonenode_t *clones_node_get(const unsigned char *addr, unsigned int plen)
+{
+	clonenode_t **link = &clones_root, *parent = NULL, *n, *node, *glue;
+	unsigned int common = 0;
+
+	while ((n = *link) != NULL)
+	{
+		common = clones_common(n->addr, addr, n->plen < plen ? n->plen : plen);
+		if (common < n->plen)
+			break;
+		if (n->plen == plen)
+			return n;
+
+		parent = n;
+		link = &n->child[clones_bit(addr, n->plen)];
+	}
+
+	node = clones_node_new(addr, plen, parent);
+
+	if (n == NULL)
+		*link = node;
+	else if (common == plen)
+	{
+		/* the new node covers n */
+		*link = node;
+		node->child[clones_bit(n->addr, plen)] = n;
+		n->parent = node;
+	}
+	else
+	{
+		/* they part ways at bit common, so hang both off a new branch */
+		glue = clones_node_new(addr, common, parent);
+		*link = glue;
+		glue->child[clones_bit(addr, common)] = node;
+		glue->child[clones_bit(n->addr, common)] = n;
+		node->parent = glue;
+		n->parent = glue;
+	}
+
+	return node;
+}
+
+/* free n, and then its ancestors, for as long as they are neither
+ * counting anything nor needed to join two subtrees */
+static void clones_node_prune(clonenode_t *n)
+{
+	clonenode_t *parent, *child;
+
+	while (n != NULL && n->count == 0 && n->exempt == NULL && MOWGLI_LIST_LENGTH(&n->clients) == 0 &&
+			(n->child[0] == NULL || n->child[1] == NULL))
+	{
+		parent = n->parent;
+		child = n->child[0] != NULL ? n->child[0] : n->child[1];
+
+		if (parent == NULL)
+			clones_root = child;
+		else
+			parent->child[parent->child[1] == n] = child;
+		if (child != NULL)
+			child->parent = parent;
+
+		mowgli_heap_free(clonenode_heap, n);
+		n = parent;
+	}
+}
+
+static void clones_node_destroy(clonenode_t *n)
+{
+	mowgli_node_t *mn, *tn;
+
+	if (n == NULL)
+		return;
+
+	clones_node_destroy(n->child[0]);
+	clones_node_destroy(n->child[1]);
+
+	MOWGLI_ITER_FOREACH_SAFE(mn, tn, n->clients.head)
+	{
+		mowgli_node_delete(mn, &n->clients);
+		mowgli_node_free(mn);
+	}
+
+	mowgli_heap_free(clonenode_heap, n);
+}
+
+/* add delta clients to the host at addr and to every prefix counted above it */
+static void clones_count(const unsigned char *addr, unsigned int family, int delta)
+{
+	clonenode_t *n;
+	unsigned int i;
+
+	for (i = 0; i <= clone_nprefixes[family]; i++)
+	{
+		unsigned int plen = i < clone_nprefixes[family] ? clone_prefixes[family][i].plen : CLONES_HOSTLEN;
+
+		if (delta > 0)
+			n = clones_node_get(addr, plen);
+		else if ((n = clones_node_find(addr, plen)) == NULL)
+			continue;
+
+		n->count += delta;
+		if (delta < 0)
+			clones_node_prune(n);
+	}
+}
+
+static cprefix_t *clones_prefix_find(unsigned int family, unsigned int plen)
+{
+	unsigned int i;
+
+	for (i = 0; i < clone_nprefixes[family]; i++)
+		if (clone_prefixes[family][i].plen == plen)
+			return &clone_prefixes[family][i];
+
+	return NULL;
+}
+
+/* start counting a prefix length, keeping the list sorted */
+static cprefix_t *clones_prefix_add(unsigned int family, unsigned int plen)
+{
+	cprefix_t *p;
+	unsigned int i;
+
+	if ((p = clones_prefix_find(family, plen)) != NULL)
+		return p;
+
+	if (clone_nprefixes[family] == CLONES_MAX_PREFIXES)
+		return NULL;
+
+	for (i = clone_nprefixes[family]; i > 0 && clone_prefixes[family][i - 1].plen > plen; i--)
+		clone_prefixes[family][i] = clone_prefixes[family][i - 1];
+
+	clone_nprefixes[family]++;
+	p = &clone_prefixes[family][i];
+	p->plen = plen;
+	p->allowed = 0;
+	p->warn = 0;
+
+	return p;
+}
+
+static void clones_prefix_del(unsigned int family, cprefix_t *p)
+{
+	cprefix_t *end = &clone_prefixes[family][--clone_nprefixes[family]];
+
+	for (; p < end; p++)
+		*p = *(p + 1);
+}
+
+/* the /24, /48 and /64 are counted but not limited until set otherwise */
+static void clones_prefix_defaults(void)
+{
+	clone_nprefixes[CLONES_IPV4] = clone_nprefixes[CLONES_IPV6] = 0;
+
+	clones_prefix_add(CLONES_IPV4, CLONES_V4_OFFSET + 24);
+	clones_prefix_add(CLONES_IPV6, 48);
+	clones_prefix_add(CLONES_IPV6, 64);
+}
+
+static void clones_exempt_link(cexcept_t *c)
+{
+	unsigned char addr[16];
+	unsigned int plen, family;
+	clonenode_t *n;
+
+	c->node = NULL;
+
+	if (!clones_parse(c->ip, addr, &plen, &family))
+		return;
+
+	/* another spelling of the same mask got there first */
+	n = clones_node_get(addr, plen);
+	if (n->exempt != NULL)
+		return;
+
+	n->exempt = c;
+	c->node = n;
+}
+
+static void cexempt_free(cexcept_t *c, mowgli_node_t *n)
+{
+	if (c->node != NULL)
+	{
+		c->node->exempt = NULL;
+		clones_node_prune(c->node);
+	}
+
+	free(c->ip);
+	free(c->reason);
+	free(c);
+	mowgli_node_delete(n, &clone_exempts);
+	mowgli_node_free(n);
+}
+
+/* the most specific live exemption covering n */
+static clonenode_t *clones_node_exempt(clonenode_t *n)
+{
+	for (; n != NULL; n = n->parent)
+		if (n->exempt != NULL && !cexempt_expired(n->exempt))
+			return n;
+
+	return NULL;
+}
+
+static void clones_collect(clonenode_t *n, mowgli_list_t *hosts)
+{
+	if (n == NULL)
+		return;
+
+	clones_collect(n->child[0], hosts);
+	clones_collect(n->child[1], hosts);
+
+	if (n->plen == CLONES_HOSTLEN && MOWGLI_LIST_LENGTH(&n->clients) != 0)
+		mowgli_node_add(n, mowgli_node_create(), hosts);
+	else
+		mowgli_heap_free(clonenode_heap, n);
+}
+
+/* rebuild the tree after the counted prefix lengths changed */
+static void clones_recount(void)
+{
+	mowgli_list_t hosts = { NULL, NULL, 0 };
+	mowgli_node_t *n, *tn;
+	clonenode_t *old, *host;
+
+	clones_collect(clones_root, &hosts);
+	clones_root = NULL;
+
+	MOWGLI_ITER_FOREACH(n, clone_exempts.head)
+		clones_exempt_link(n->data);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, hosts.head)
+	{
+		old = n->data;
+
+		host = clones_node_get(old->addr, CLONES_HOSTLEN);
+		host->clients = old->clients;
+		host->firstkill = old->firstkill;
+		host->gracekills = old->gracekills;
+		clones_count(old->addr, clones_family(old->addr), MOWGLI_LIST_LENGTH(&old->clients));
+
+		mowgli_heap_free(clonenode_heap, old);
+		mowgli_node_delete(n, &hosts);
+		mowgli_node_free(n);
+	}
+}
+
 command_t os_clones = { "CLONES", N_("Manages network wide clones."), PRIV_AKILL, 5, os_cmd_clones, { .path = "oservice/clones" } };
 
 command_t os_clones_kline = { "KLINE", N_("Enables/disables klines for excessive clones."), AC_NONE, 1, os_cmd_clones_kline, { .path = "" } };
@@ -89,6 +512,7 @@ command_t os_clones_delexempt = { "DELEXEMPT", N_("Deletes a clones exemption.")
 command_t os_clones_setexempt = { "SETEXEMPT", N_("Sets a clone exemption details."), AC_NONE, 1, os_cmd_clones_setexempt, { .path = "" } };
 command_t os_clones_listexempt = { "LISTEXEMPT", N_("Lists clones exemptions."), AC_NONE, 0, os_cmd_clones_listexempt, { .path = "" } };
 command_t os_clones_duration = { "DURATION", N_("Sets a custom duration to ban clones for."), AC_NONE, 1, os_cmd_clones_duration, { .path = "" } };
+command_t os_clones_prefix = { "PREFIX", N_("Sets clone limits for address prefixes."), AC_NONE, 3, os_cmd_clones_prefix, { .path = "" } };
 
 static void clones_configready(void *unused)
 {
@@ -119,6 +543,7 @@ void _modinit(module_t *m)
 	command_add(&os_clones_setexempt, os_clones_cmds);
 	command_add(&os_clones_listexempt, os_clones_cmds);
 	command_add(&os_clones_duration, os_clones_cmds);
+	command_add(&os_clones_prefix, os_clones_cmds);
 
 	hook_add_event("config_ready");
 	hook_add_config_ready(clones_configready);
@@ -127,6 +552,8 @@ void _modinit(module_t *m)
 	hook_add_user_add(clones_newuser);
 	hook_add_event("user_delete");
 	hook_add_user_delete(clones_userquit);
+	hook_add_event("server_split");
+	hook_add_server_split(clones_split);
 	hook_add_db_write(write_exemptdb);
 
 	db_register_type_handler("CLONES-DBV", db_h_clonesdbv);
@@ -134,54 +561,33 @@ void _modinit(module_t *m)
 	db_register_type_handler("CLONES-CD", db_h_cd);
 	db_register_type_handler("CLONES-GR", db_h_gr);
 	db_register_type_handler("CLONES-EX", db_h_ex);
+	db_register_type_handler("CLONES-PF", db_h_pf);
 
-	hostlist = mowgli_patricia_create(noopcanon);
-	hostentry_heap = mowgli_heap_create(sizeof(hostentry_t), HEAP_USER, BH_NOW);
+	clonenode_heap = mowgli_heap_create(sizeof(clonenode_t), HEAP_USER, BH_NOW);
+	clones_prefix_defaults();
 
 	kline_duration = 3600; /* set a default */
 
 	serviceinfo = service_find("operserv");
 
 
-	/* add everyone to host hash */
+	/* add everyone to the tree */
 	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
 	{
 		clones_newuser(&(hook_user_nick_t){ .u = u });
 	}
 }
 
-static void free_hostentry(const char *key, void *data, void *privdata)
-{
-	mowgli_node_t *n, *tn;
-	hostentry_t *he = data;
-
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, he->clients.head)
-	{
-		mowgli_node_delete(n, &he->clients);
-		mowgli_node_free(n);
-	}
-
-	mowgli_heap_free(hostentry_heap, he);
-}
-
 void _moddeinit(module_unload_intent_t intent)
 {
 	mowgli_node_t *n, *tn;
 
-	mowgli_patricia_destroy(hostlist, free_hostentry, NULL);
-	mowgli_heap_destroy(hostentry_heap);
-
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, clone_exempts.head)
-	{
-		cexcept_t *c = n->data;
-
-		free(c->ip);
-		free(c->reason);
-		free(c);
+		cexempt_free(n->data, n);
 
-		mowgli_node_delete(n, &clone_exempts);
-		mowgli_node_free(n);
-	}
+	clones_node_destroy(clones_root);
+	clones_root = NULL;
+	mowgli_heap_destroy(clonenode_heap);
 
 	service_named_unbind_command("operserv", &os_clones);
 
@@ -193,9 +599,11 @@ void _moddeinit(module_unload_intent_t intent)
 	command_delete(&os_clones_listexempt, os_clones_cmds);
 
 	command_delete(&os_clones_duration, os_clones_cmds);
+	command_delete(&os_clones_prefix, os_clones_cmds);
 
 	hook_del_user_add(clones_newuser);
 	hook_del_user_delete(clones_userquit);
+	hook_del_server_split(clones_split);
 	hook_del_db_write(write_exemptdb);
 	hook_del_config_ready(clones_configready);
 
@@ -203,6 +611,7 @@ void _moddeinit(module_unload_intent_t intent)
 	db_unregister_type_handler("CLONES-CK");
 	db_unregister_type_handler("CLONES-CD");
 	db_unregister_type_handler("CLONES-EX");
+	db_unregister_type_handler("CLONES-PF");
 
 	mowgli_patricia_destroy(os_clones_cmds, NULL, NULL);
 }
@@ -210,6 +619,7 @@ void _moddeinit(module_unload_intent_t intent)
 static void write_exemptdb(database_handle_t *db)
 {
 	mowgli_node_t *n, *tn;
+	unsigned int family, i;
 
 	db_start_row(db,"CLONES-DBV");
 	db_write_uint(db, CLONESDB_VERSION);
@@ -225,17 +635,24 @@ static void write_exemptdb(database_handle_t *db)
 	db_write_uint(db, grace_count);
 	db_commit_row(db);
 
+	for (family = CLONES_IPV4; family <= CLONES_IPV6; family++)
+		for (i = 0; i < clone_nprefixes[family]; i++)
+		{
+			cprefix_t *p = &clone_prefixes[family][i];
+
+			db_start_row(db, "CLONES-PF");
+			db_write_word(db, clones_familyname[family]);
+			db_write_uint(db, family == CLONES_IPV4 ? p->plen - CLONES_V4_OFFSET : p->plen);
+			db_write_uint(db, p->allowed);
+			db_write_uint(db, p->warn);
+			db_commit_row(db);
+		}
+
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, clone_exempts.head)
 	{
 		cexcept_t *c = n->data;
 		if (cexempt_expired(c))
-		{
-			free(c->ip);
-			free(c->reason);
-			free(c);
-			mowgli_node_delete(n, &clone_exempts);
-			mowgli_node_free(n);
-		}
+			cexempt_free(c, n);
 		else
 		{
 			db_start_row(db, "CLONES-EX");
@@ -252,7 +669,12 @@ static void write_exemptdb(database_handle_t *db)
 static void db_h_clonesdbv(database_handle_t *db, const char *type)
 {
 	clones_dbversion = db_sread_uint(db);
+
+	/* from version 4 on, the counted prefixes are all in CLONES-PF */
+	if (clones_dbversion >= 4)
+		clone_nprefixes[CLONES_IPV4] = clone_nprefixes[CLONES_IPV6] = 0;
 }
+
 static void db_h_ck(database_handle_t *db, const char *type)
 {
 	kline_enabled = db_sread_int(db) != 0;
@@ -275,7 +697,7 @@ static void db_h_ex(database_handle_t *db, const char *type)
 	const char *ip = db_sread_word(db);
 	allowed = db_sread_uint(db);
 
-	if (clones_dbversion == 3)
+	if (clones_dbversion >= 3)
 	{
 		warn = db_sread_uint(db);
 	}
@@ -299,31 +721,32 @@ static void db_h_ex(database_handle_t *db, const char *type)
 	c->expires = expires;
 	c->reason = sstrdup(reason);
 	mowgli_node_add(c, mowgli_node_create(), &clone_exempts);
+	clones_exempt_link(c);
 }
 
-static cexcept_t * find_exempt(const char *ip)
+static void db_h_pf(database_handle_t *db, const char *type)
 {
-	mowgli_node_t *n;
-
-	/* first check for an exact match */
-	MOWGLI_ITER_FOREACH(n, clone_exempts.head)
-	{
-		cexcept_t *c = n->data;
-
-		if (!strcmp(ip, c->ip))
-			return c;
-	}
+	const char *familyname = db_sread_word(db);
+	unsigned int len = db_sread_uint(db);
+	unsigned int allowed = db_sread_uint(db);
+	unsigned int warn = db_sread_uint(db);
+	unsigned int family = strcasecmp(familyname, "IPv4") ? CLONES_IPV6 : CLONES_IPV4;
+	cprefix_t *p;
+
+	if (family == CLONES_IPV4)
+		len += CLONES_V4_OFFSET;
+	if (len == 0 || len >= CLONES_HOSTLEN)
+		return;
 
-	/* then look for cidr */
-	MOWGLI_ITER_FOREACH(n, clone_exempts.head)
+	if ((p = clones_prefix_add(family, len)) == NULL)
 	{
-		cexcept_t *c = n->data;
-
-		if (!match_ips(c->ip, ip))
-			return c;
+		slog(LG_INFO, "db_h_pf(): too many %s prefix lengths, ignoring /%u", familyname,
+				family == CLONES_IPV4 ? len - CLONES_V4_OFFSET : len);
+		return;
 	}
 
-	return 0;
+	p->allowed = allowed;
+	p->warn = warn;
 }
 
 static void os_cmd_clones(sourceinfo_t *si, int parc, char *parv[])
@@ -335,7 +758,7 @@ static void os_cmd_clones(sourceinfo_t *si, int parc, char *parv[])
 	if (!cmd)
 	{
 		command_fail(si, fault_needmoreparams, STR_INSUFFICIENT_PARAMS, "CLONES");
-		command_fail(si, fault_needmoreparams, _("Syntax: CLONES KLINE|LIST|ADDEXEMPT|DELEXEMPT|LISTEXEMPT|SETEXEMPT|DURATION [parameters]"));
+		command_fail(si, fault_needmoreparams, _("Syntax: CLONES KLINE|LIST|ADDEXEMPT|DELEXEMPT|LISTEXEMPT|SETEXEMPT|DURATION|PREFIX [parameters]"));
 		return;
 	}
 
@@ -408,25 +831,30 @@ static void os_cmd_clones_kline(sourceinfo_t *si, int parc, char *parv[])
 	}
 }
 
-static void os_cmd_clones_list(sourceinfo_t *si, int parc, char *parv[])
+static void clones_list(sourceinfo_t *si, clonenode_t *n)
 {
-	hostentry_t *he;
-	int k = 0;
-	mowgli_patricia_iteration_state_t state;
+	clonenode_t *e;
+	unsigned int family;
 
-	MOWGLI_PATRICIA_FOREACH(he, &state, hostlist)
-	{
-		k = MOWGLI_LIST_LENGTH(&he->clients);
+	if (n == NULL)
+		return;
 
-		if (k > 3)
-		{
-			cexcept_t *c = find_exempt(he->ip);
-			if (c)
-				command_success_nodata(si, _("%d from %s (\2EXEMPT\2; allowed %d)"), k, he->ip, c->allowed);
-			else
-				command_success_nodata(si, _("%d from %s"), k, he->ip);
-		}
+	family = clones_family(n->addr);
+	if (n->count > 3 && (n->plen == CLONES_HOSTLEN || clones_prefix_find(family, n->plen) != NULL))
+	{
+		if ((e = clones_node_exempt(n)) != NULL)
+			command_success_nodata(si, _("%d from %s (\2EXEMPT\2; allowed %d)"), n->count, clones_node_name(n), e->exempt->allowed);
+		else
+			command_success_nodata(si, _("%d from %s"), n->count, clones_node_name(n));
 	}
+
+	clones_list(si, n->child[0]);
+	clones_list(si, n->child[1]);
+}
+
+static void os_cmd_clones_list(sourceinfo_t *si, int parc, char *parv[])
+{
+	clones_list(si, clones_root);
 	command_success_nodata(si, _("End of CLONES LIST"));
 	logcommand(si, CMDLOG_ADMIN, "CLONES:LIST");
 }
@@ -442,6 +870,9 @@ static void os_cmd_clones_addexempt(sourceinfo_t *si, int parc, char *parv[])
 	char rreason[BUFSIZE];
 	cexcept_t *c = NULL;
 	long duration;
+	unsigned char addr[16];
+	unsigned int plen, family;
+	clonenode_t *node;
 
 	if (!ip || !clonesstr || !expiry)
 	{
@@ -541,6 +972,10 @@ static void os_cmd_clones_addexempt(sourceinfo_t *si, int parc, char *parv[])
 			c = t;
 	}
 
+	/* the same mask written differently */
+	if (c == NULL && clones_parse(ip, addr, &plen, &family) && (node = clones_node_find(addr, plen)) != NULL)
+		c = node->exempt;
+
 	if (c == NULL)
 	{
 		if (!*rreason)
@@ -554,6 +989,7 @@ static void os_cmd_clones_addexempt(sourceinfo_t *si, int parc, char *parv[])
 		c->ip = sstrdup(ip);
 		c->reason = sstrdup(rreason);
 		mowgli_node_add(c, mowgli_node_create(), &clone_exempts);
+		clones_exempt_link(c);
 		command_success_nodata(si, _("Added \2%s\2 to clone exempt list."), ip);
 	}
 	else
@@ -591,20 +1027,10 @@ static void os_cmd_clones_delexempt(sourceinfo_t *si, int parc, char *parv[])
 		cexcept_t *c = n->data;
 
 		if (cexempt_expired(c))
-		{
-			free(c->ip);
-			free(c->reason);
-			free(c);
-			mowgli_node_delete(n, &clone_exempts);
-			mowgli_node_free(n);
-		}
+			cexempt_free(c, n);
 		else if (!strcmp(c->ip, arg))
 		{
-			free(c->ip);
-			free(c->reason);
-			free(c);
-			mowgli_node_delete(n, &clone_exempts);
-			mowgli_node_free(n);
+			cexempt_free(c, n);
 			command_success_nodata(si, _("Removed \2%s\2 from clone exempt list."), arg);
 			logcommand(si, CMDLOG_ADMIN, "CLONES:DELEXEMPT: \2%s\2", arg);
 			return;
@@ -672,13 +1098,7 @@ static void os_cmd_clones_setexempt(sourceinfo_t *si, int parc, char *parv[])
 			cexcept_t *c = n->data;
 
 			if (cexempt_expired(c))
-			{
-				free(c->ip);
-				free(c->reason);
-				free(c);
-				mowgli_node_delete(n, &clone_exempts);
-				mowgli_node_free(n);
-			}
+				cexempt_free(c, n);
 			else if (!strcmp(c->ip, ip))
 			{
 				if (!strcasecmp(subcmd, "ALLOWED"))
@@ -821,13 +1241,7 @@ static void os_cmd_clones_listexempt(sourceinfo_t *si, int parc, char *parv[])
 		cexcept_t *c = n->data;
 
 		if (cexempt_expired(c))
-		{
-			free(c->ip);
-			free(c->reason);
-			free(c);
-			mowgli_node_delete(n, &clone_exempts);
-			mowgli_node_free(n);
-		}
+			cexempt_free(c, n);
 		else if (c->expires)
 			command_success_nodata(si, _("%s - allowed limit %d, warn on %d - expires in %s - \2%s\2"), c->ip, c->allowed, c->warn, timediff(c->expires > CURRTIME ? c->expires - CURRTIME : 0), c->reason);
 		else
@@ -837,134 +1251,339 @@ static void os_cmd_clones_listexempt(sourceinfo_t *si, int parc, char *parv[])
 	logcommand(si, CMDLOG_ADMIN, "CLONES:LISTEXEMPT");
 }
 
-static void clones_newuser(hook_user_nick_t *data)
+/* parse IPV4/<length> or IPV6/<length> */
+static bool clones_prefix_parse(const char *s, unsigned int *family, unsigned int *plen)
 {
-	user_t *u = data->u;
-	unsigned int i;
-	hostentry_t *he;
-	unsigned int allowed, warn;
-	mowgli_node_t *n;
+	char *end;
+	unsigned long len;
 
-	/* If the user has been killed, don't do anything. */
-	if (!u)
+	if (!strncasecmp(s, "IPV4/", 5))
+		*family = CLONES_IPV4;
+	else if (!strncasecmp(s, "IPV6/", 5))
+		*family = CLONES_IPV6;
+	else
+		return false;
+
+	if (!isdigit((unsigned char)s[5]))
+		return false;
+
+	len = strtoul(s + 5, &end, 10);
+	if (*end != '\0' || len == 0 || len >= (*family == CLONES_IPV4 ? 32 : 128))
+		return false;
+
+	*plen = (*family == CLONES_IPV4 ? CLONES_V4_OFFSET : 0) + len;
+
+	return true;
+}
+
+static void os_cmd_clones_prefix(sourceinfo_t *si, int parc, char *parv[])
+{
+	char *spec = parv[0];
+	char *allowedstr = parv[1];
+	char *warnstr = parv[2];
+	unsigned int family, plen, len, i, allowed, warn;
+	cprefix_t *p;
+
+	if (!spec)
+	{
+		command_success_nodata(si, _("IPv4 /32, IPv6 /128 - allowed limit %d, warn on %d (see SETEXEMPT DEFAULT)"), clones_allowed, clones_warn);
+
+		for (family = CLONES_IPV4; family <= CLONES_IPV6; family++)
+			for (i = 0; i < clone_nprefixes[family]; i++)
+			{
+				p = &clone_prefixes[family][i];
+				len = family == CLONES_IPV4 ? p->plen - CLONES_V4_OFFSET : p->plen;
+
+				if (p->allowed != 0 || p->warn != 0)
+					command_success_nodata(si, _("%s /%u - allowed limit %u, warn on %u"), clones_familyname[family], len, p->allowed, p->warn);
+				else
+					command_success_nodata(si, _("%s /%u - counted only"), clones_familyname[family], len);
+			}
+
+		command_success_nodata(si, _("End of CLONES PREFIX"));
+		logcommand(si, CMDLOG_ADMIN, "CLONES:PREFIX");
 		return;
+	}
 
-	/* User has no IP, ignore them */
-	if (is_internal_client(u) || u->ip == NULL)
+	if (!allowedstr)
+	{
+		command_fail(si, fault_needmoreparams, STR_INSUFFICIENT_PARAMS, "CLONES PREFIX");
+		command_fail(si, fault_needmoreparams, _("Syntax: CLONES PREFIX <IPV4|IPV6>/<length> <allowed> [<warn>]|DEL"));
 		return;
+	}
+
+	if (!clones_prefix_parse(spec, &family, &plen))
+	{
+		command_fail(si, fault_badparams, _("Invalid prefix given."));
+		command_fail(si, fault_badparams, _("Syntax: CLONES PREFIX <IPV4|IPV6>/<length> <allowed> [<warn>]|DEL"));
+		return;
+	}
+
+	len = family == CLONES_IPV4 ? plen - CLONES_V4_OFFSET : plen;
+
+	if (!strcasecmp(allowedstr, "DEL"))
+	{
+		if ((p = clones_prefix_find(family, plen)) == NULL)
+		{
+			command_fail(si, fault_nochange, _("Clients per %s /%u are not being counted."), clones_familyname[family], len);
+			return;
+		}
 
-	he = mowgli_patricia_retrieve(hostlist, u->ip);
-	if (he == NULL)
+		clones_prefix_del(family, p);
+		clones_recount();
+		command_success_nodata(si, _("Stopped counting clients per %s /%u."), clones_familyname[family], len);
+		logcommand(si, CMDLOG_ADMIN, "CLONES:PREFIX:DEL: \2%s\2", spec);
+		return;
+	}
+
+	allowed = atoi(allowedstr);
+	warn = warnstr ? (unsigned int)atoi(warnstr) : allowed;
+
+	if (allowed != 0 && warn > allowed)
 	{
-		he = mowgli_heap_alloc(hostentry_heap);
-		mowgli_strlcpy(he->ip, u->ip, sizeof he->ip);
-		mowgli_patricia_add(hostlist, he->ip, he);
+		command_fail(si, fault_badparams, _("Warned clones limit must be lower than or equal to the allowed limit of %u"), allowed);
+		return;
+	}
+
+	if ((p = clones_prefix_find(family, plen)) == NULL)
+	{
+		if ((p = clones_prefix_add(family, plen)) == NULL)
+		{
+			command_fail(si, fault_toomany, _("At most %d %s prefix lengths can be counted."), CLONES_MAX_PREFIXES, clones_familyname[family]);
+			return;
+		}
+
+		clones_recount();
 	}
-	mowgli_node_add(u, mowgli_node_create(), &he->clients);
-	i = MOWGLI_LIST_LENGTH(&he->clients);
 
-	cexcept_t *c = find_exempt(u->ip);
-	if (c == 0)
+	p->allowed = allowed;
+	p->warn = warn;
+
+	if (allowed != 0 || warn != 0)
+		command_success_nodata(si, _("Clients per %s /%u are now limited to \2%u\2 (warn on \2%u\2)."), clones_familyname[family], len, allowed, warn);
+	else
+		command_success_nodata(si, _("Clients per %s /%u are now counted but not limited."), clones_familyname[family], len);
+	logcommand(si, CMDLOG_ADMIN, "CLONES:PREFIX: \2%s\2 \2%u\2 allowed, \2%u\2 warn", spec, allowed, warn);
+}
+
+/* decide the limits applying to node n for a client whose closest
+ * exemption is e; false if n is not checked at all */
+static bool clones_limits(clonenode_t *n, clonenode_t *host, clonenode_t *e, unsigned int family, unsigned int *allowed, unsigned int *warn)
+{
+	mowgli_node_t *mn;
+	cprefix_t *p;
+
+	if (e != NULL)
 	{
-		allowed = clones_allowed;
-		warn = clones_warn;
+		/* an exemption replaces the limits for its own mask and
+		 * everything inside it; wider prefixes are not checked */
+		if (e->plen > n->plen)
+			return false;
+
+		*allowed = e->exempt->allowed;
+		*warn = e->exempt->warn;
+	}
+	else if (n == host)
+	{
+		*allowed = clones_allowed;
+		*warn = clones_warn;
 	}
 	else
 	{
-		allowed = c->allowed;
-		warn = c->warn;
+		p = clones_prefix_find(family, n->plen);
+		*allowed = p->allowed;
+		*warn = p->warn;
 	}
 
-	if (config_options.clone_increase)
+	if (n == host && config_options.clone_increase)
 	{
-		unsigned int real_allowed = allowed;
-		unsigned int real_warn = warn;
+		unsigned int real_allowed = *allowed;
+		unsigned int real_warn = *warn;
 
-		MOWGLI_ITER_FOREACH(n, he->clients.head)
+		MOWGLI_ITER_FOREACH(mn, host->clients.head)
 		{
-			user_t *tu = n->data;
+			user_t *tu = mn->data;
 
 			if (tu->myuser == NULL)
 				continue;
-			if (allowed != 0)
-				allowed++;
-			if (warn != 0)
-				warn++;
+			if (*allowed != 0)
+				(*allowed)++;
+			if (*warn != 0)
+				(*warn)++;
 		}
 
 		/* A hard limit of 2x the "real" limit sounds good IMO --jdhore */
-		if (allowed > (real_allowed * 2))
-			allowed = real_allowed * 2;
-		if (warn > (real_warn * 2))
-			warn = real_warn * 2;
+		if (*allowed > (real_allowed * 2))
+			*allowed = real_allowed * 2;
+		if (*warn > (real_warn * 2))
+			*warn = real_warn * 2;
 	}
 
-	if (i > allowed && allowed != 0)
+	return true;
+}
+
+static void clones_newuser(hook_user_nick_t *data)
+{
+	user_t *u = data->u;
+	unsigned char addr[16];
+	unsigned int plen, family, i, count;
+	unsigned int allowed, warn, warn_allowed = 0;
+	clonenode_t *host, *n, *e, *warned = NULL;
+	clonenode_t *path[CLONES_MAX_PREFIXES + 1];
+	unsigned int depth = 0;
+	const char *name;
+
+	/* If the user has been killed, don't do anything. */
+	if (!u)
+		return;
+
+	/* User has no IP, ignore them */
+	if (is_internal_client(u) || u->ip == NULL)
+		return;
+
+	if (!clones_parse(u->ip, addr, &plen, &family))
+		return;
+
+	host = clones_node_get(addr, CLONES_HOSTLEN);
+	mowgli_node_add(u, mowgli_node_create(), &host->clients);
+	clones_count(addr, family, 1);
+
+	/* the ancestors of the host are the prefixes covering it; collect
+	 * the counted ones, widest first */
+	for (n = host; n != NULL; n = n->parent)
+		if (n == host || clones_prefix_find(family, n->plen) != NULL)
+			path[depth++] = n;
+	e = clones_node_exempt(host);
+
+	while (depth > 0)
 	{
-		/* User has exceeded the maximum number of allowed clones. */
-		if (is_autokline_exempt(u))
-			slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (user is autokline exempt)", i, u->ip, u->nick, u->user, u->host);
-		else if (!kline_enabled || he->gracekills < grace_count || (grace_count > 0 && he->firstkill < time(NULL) - CLONES_GRACE_TIMEPERIOD))
+		n = path[--depth];
+		count = n->count;
+
+		if (!clones_limits(n, host, e, family, &allowed, &warn))
+			continue;
+
+		if (count > allowed && allowed != 0)
 		{
-			if (he->firstkill < time(NULL) - CLONES_GRACE_TIMEPERIOD)
+			name = n == host ? u->ip : clones_node_name(n);
+
+			/* User has exceeded the maximum number of allowed clones. */
+			if (is_autokline_exempt(u))
+				slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (user is autokline exempt)", count, name, u->nick, u->user, u->host);
+			else if (!kline_enabled || n->gracekills < grace_count || (grace_count > 0 && n->firstkill < time(NULL) - CLONES_GRACE_TIMEPERIOD))
 			{
-				he->firstkill = time(NULL);
-				he->gracekills = 1;
+				if (n->firstkill < time(NULL) - CLONES_GRACE_TIMEPERIOD)
+				{
+					n->firstkill = time(NULL);
+					n->gracekills = 1;
+				}
+				else
+				{
+					n->gracekills++;
+				}
+
+				if (!kline_enabled)
+					slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (TKLINE disabled, killing user)", count, name, u->nick, u->user, u->host);
+				else
+					slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (grace period, killing user, %d grace kills remaining)", count, name, u->nick,
+						u->user, u->host, grace_count - n->gracekills);
+
+				kill_user(serviceinfo->me, u, n == host ? "Too many connections from this host." : "Too many connections from this network.");
+				data->u = NULL; /* Required due to kill_user being called during user_add hook. --mr_flea */
 			}
 			else
 			{
-				he->gracekills++;
+				slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (TKLINE due to excess clones)", count, name, u->nick, u->user, u->host);
+				kline_sts("*", "*", name, kline_duration, "Excessive clones");
 			}
 
-			if (!kline_enabled)
-				slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (TKLINE disabled, killing user)", i, u->ip, u->nick, u->user, u->host);
-			else
-				slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (grace period, killing user, %d grace kills remaining)", i, u->ip, u->nick,
-					u->user, u->host, grace_count - he->gracekills);
-
-			kill_user(serviceinfo->me, u, "Too many connections from this host.");
-			data->u = NULL; /* Required due to kill_user being called during user_add hook. --mr_flea */
+			return;
 		}
-		else
+		else if (count >= warn && warn != 0 && warned == NULL)
 		{
-			slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (TKLINE due to excess clones)", i, u->ip, u->nick, u->user, u->host);
-			kline_sts("*", "*", u->ip, kline_duration, "Excessive clones");
+			warned = n;
+			warn_allowed = allowed;
 		}
-
 	}
-	else if (i >= warn && warn != 0)
+
+	if (warned != NULL)
 	{
-		slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (\2%d\2 allowed)", i, u->ip, u->nick, u->user, u->host, allowed);
-		msg(serviceinfo->nick, u->nick, _("\2WARNING\2: You may not have more than \2%d\2 clients connected to the network at once. Any further connections risks being removed."), allowed);
+		slog(LG_INFO, "CLONES: \2%d\2 clones on \2%s\2 (%s!%s@%s) (\2%d\2 allowed)", warned->count,
+				warned == host ? u->ip : clones_node_name(warned), u->nick, u->user, u->host, warn_allowed);
+		msg(serviceinfo->nick, u->nick, _("\2WARNING\2: You may not have more than \2%d\2 clients connected to the network at once. Any further connections risks being removed."), warn_allowed);
 	}
 }
 
 static void clones_userquit(user_t *u)
 {
 	mowgli_node_t *n;
-	hostentry_t *he;
+	clonenode_t *host;
+	unsigned char addr[16];
+	unsigned int plen, family;
 
-	/* User has no IP, ignore them */
-	if (is_internal_client(u) || u->ip == NULL)
+	/* User has no IP, ignore them; split users went in clones_split() */
+	if (is_internal_client(u) || u->ip == NULL || u->flags & UF_SPLIT)
 		return;
 
-	he = mowgli_patricia_retrieve(hostlist, u->ip);
-	if (he == NULL)
+	if (!clones_parse(u->ip, addr, &plen, &family))
+		return;
+
+	host = clones_node_find(addr, CLONES_HOSTLEN);
+	if (host == NULL)
 	{
-		slog(LG_DEBUG, "clones_userquit(): hostentry for %s not found??", u->ip);
+		slog(LG_DEBUG, "clones_userquit(): host node for %s not found??", u->ip);
 		return;
 	}
-	n = mowgli_node_find(u, &he->clients);
+	n = mowgli_node_find(u, &host->clients);
 	if (n)
 	{
-		mowgli_node_delete(n, &he->clients);
+		mowgli_node_delete(n, &host->clients);
 		mowgli_node_free(n);
-		if (MOWGLI_LIST_LENGTH(&he->clients) == 0)
+		/* TODO: keep the host around if host->firstkill > time(NULL) - CLONES_GRACE_TIMEPERIOD. */
+		clones_count(addr, family, -1);
+	}
+}
+
+/* drop every split user from the tree, pruning each host once
+ * rather than searching its client list for every user */
+static void clones_split(hook_server_split_t *data)
+{
+	static unsigned int serial;
+	mowgli_node_t *n, *tn;
+	clonenode_t *host;
+	unsigned char addr[16];
+	unsigned int plen, family;
+	user_t *u;
+	unsigned int i;
+	int removed;
+
+	serial++;
+
+	for (i = 0; i < data->count; i++)
+	{
+		u = data->users[i];
+		if (is_internal_client(u) || u->ip == NULL)
+			continue;
+
+		if (!clones_parse(u->ip, addr, &plen, &family))
+			continue;
+
+		host = clones_node_find(addr, CLONES_HOSTLEN);
+		if (host == NULL || host->split_serial == serial)
+			continue;
+		host->split_serial = serial;
+
+		removed = 0;
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, host->clients.head)
 		{
-			/* TODO: free later if he->firstkill > time(NULL) - CLONES_GRACE_TIMEPERIOD. */
-			mowgli_patricia_delete(hostlist, he->ip);
-			mowgli_heap_free(hostentry_heap, he);
+			if (!(((user_t *)n->data)->flags & UF_SPLIT))
+				continue;
+			mowgli_node_delete(n, &host->clients);
+			mowgli_node_free(n);
+			removed++;
 		}
+
+		clones_count(addr, family, -removed);
 	}
 }
 
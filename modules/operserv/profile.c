@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * This file contains functionality implementing OperServ PROFILE.
+ *
+ */
+
+#include "atheme.h"
+
+DECLARE_MODULE_V1
+(
+	"operserv/profile", false, _modinit, _moddeinit,
+	PACKAGE_STRING,
+	"Atheme Development Group <http://www.atheme.org>"
+);
+
+static void os_cmd_profile(sourceinfo_t *si, int parc, char *parv[]);
+
+command_t os_profile = { "PROFILE", N_("Shows where services spend their time."), PRIV_SERVER_AUSPEX, 2, os_cmd_profile, { .path = "oservice/profile" } };
+
+void _modinit(module_t *m)
+{
+	service_named_bind_command("operserv", &os_profile);
+}
+
+void _moddeinit(module_unload_intent_t intent)
+{
+	service_named_unbind_command("operserv", &os_profile);
+}
+
+static int profile_cmp_total(const void *a, const void *b)
+{
+	const profile_entry_t *pa = *(const profile_entry_t * const *)a;
+	const profile_entry_t *pb = *(const profile_entry_t * const *)b;
+
+	if (pa->total_us != pb->total_us)
+		return pa->total_us < pb->total_us ? 1 : -1;
+	return strcmp(pa->path, pb->path);
+}
+
+static void os_cmd_profile(sourceinfo_t *si, int parc, char *parv[])
+{
+	mowgli_patricia_iteration_state_t state;
+	profile_entry_t *pe, **entries;
+	const char *mask = NULL;
+	unsigned int i, n = 0, count = 20;
+
+	if (parc >= 1 && !strcasecmp(parv[0], "RESET"))
+	{
+		if (!has_priv(si, PRIV_ADMIN))
+		{
+			command_fail(si, fault_noprivs, STR_NO_PRIVILEGE, PRIV_ADMIN);
+			return;
+		}
+
+		profile_reset();
+		logcommand(si, CMDLOG_ADMIN, "PROFILE:RESET");
+		command_success_nodata(si, _("Profiling counters have been reset."));
+		return;
+	}
+
+	if (parc >= 1)
+	{
+		if (isdigit((unsigned char)*parv[0]))
+		{
+			count = atoi(parv[0]);
+			if (parc >= 2)
+				mask = parv[1];
+		}
+		else
+			mask = parv[0];
+	}
+
+	entries = smalloc(sizeof *entries * (mowgli_patricia_size(profile_entries) + 1));
+
+	MOWGLI_PATRICIA_FOREACH(pe, &state, profile_entries)
+	{
+		if (pe->count == 0)
+			continue;
+		if (mask != NULL && match(mask, pe->path))
+			continue;
+		entries[n++] = pe;
+	}
+
+	qsort(entries, n, sizeof *entries, profile_cmp_total);
+
+	command_success_nodata(si, _("%-32s %9s %11s %9s %9s %9s"), _("Path"), _("Calls"),
+			_("Total ms"), _("p50 ms"), _("p99 ms"), _("Max ms"));
+
+	for (i = 0; i < n && i < count; i++)
+	{
+		pe = entries[i];
+		command_success_nodata(si, "%-32s %9lu %11.1f %9.3f %9.3f %9.3f", pe->path, pe->count,
+				pe->total_us / 1000.0,
+				profile_percentile(pe, 50) / 1000.0,
+				profile_percentile(pe, 99) / 1000.0,
+				pe->max_us / 1000.0);
+	}
+
+	command_success_nodata(si, ngettext(N_("End of profile, %u of %u path shown."),
+				N_("End of profile, %u of %u paths shown."), n), i, n);
+
+	free(entries);
+
+	logcommand(si, CMDLOG_GET, "PROFILE: \2%s\2", mask != NULL ? mask : "*");
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -395,6 +395,35 @@ static void inspircd_join_sts(channel_t *c, user_t *u, bool isnew, char *modes)
 	inspircd_send_fjoin(c, u, modes);
 }
 
+/* join a channel with several services, packing them into FJOIN lines */
+static void inspircd_join_burst_sts(channel_t *c, user_t **users, size_t count, bool isnew, char *modes)
+{
+	char prefix[BUFSIZE];
+	char uids[BUFSIZE];
+	size_t i, prefixlen, len = 0;
+
+	if (!isnew || !modes[0])
+		modes = "+";
+
+	prefixlen = snprintf(prefix, sizeof prefix, ":%s FJOIN %s %lu %s :",
+			me.numeric, c->name, (unsigned long)c->ts, modes);
+
+	for (i = 0; i < count; i++)
+	{
+		if (len != 0 && prefixlen + len + strlen(users[i]->uid) + 3 > 510)
+		{
+			sts("%s%s", prefix, uids);
+			len = 0;
+		}
+
+		len += snprintf(uids + len, sizeof uids - len, "%so,%s",
+				len != 0 ? " " : "", users[i]->uid);
+	}
+
+	if (len != 0)
+		sts("%s%s", prefix, uids);
+}
+
 static void inspircd_chan_lowerts(channel_t *c, user_t *u)
 {
 	slog(LG_DEBUG, "inspircd_chan_lowerts(): lowering TS for %s to %lu",
@@ -1636,6 +1665,7 @@ void _modinit(module_t * m)
 	quit_sts = &inspircd_quit_sts;
 	wallops_sts = &inspircd_wallops_sts;
 	join_sts = &inspircd_join_sts;
+	join_burst_sts = &inspircd_join_burst_sts;
 	chan_lowerts = &inspircd_chan_lowerts;
 	kick = &inspircd_kick;
 	msg = &inspircd_msg;
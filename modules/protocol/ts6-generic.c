@@ -136,6 +136,34 @@ static void ts6_join_sts(channel_t *c, user_t *u, bool isnew, char *modes)
 				c->name, CLIENT_NAME(u));
 }
 
+/* join a channel with several services, packing them into SJOIN lines */
+static void ts6_join_burst_sts(channel_t *c, user_t **users, size_t count, bool isnew, char *modes)
+{
+	char prefix[BUFSIZE];
+	char nicks[BUFSIZE];
+	size_t i, prefixlen, len = 0;
+
+	prefixlen = snprintf(prefix, sizeof prefix, ":%s SJOIN %lu %s %s :",
+			ME, (unsigned long)c->ts, c->name, isnew ? modes : "+");
+
+	for (i = 0; i < count; i++)
+	{
+		const char *name = CLIENT_NAME(users[i]);
+
+		if (len != 0 && prefixlen + len + strlen(name) + 2 > 510)
+		{
+			sts("%s%s", prefix, nicks);
+			len = 0;
+		}
+
+		len += snprintf(nicks + len, sizeof nicks - len, "%s@%s",
+				len != 0 ? " " : "", name);
+	}
+
+	if (len != 0)
+		sts("%s%s", prefix, nicks);
+}
+
 static void ts6_chan_lowerts(channel_t *c, user_t *u)
 {
 	slog(LG_DEBUG, "ts6_chan_lowerts(): lowering TS for %s to %lu",
@@ -1444,6 +1472,7 @@ void _modinit(module_t * m)
 	quit_sts = &ts6_quit_sts;
 	wallops_sts = &ts6_wallops_sts;
 	join_sts = &ts6_join_sts;
+	join_burst_sts = &ts6_join_burst_sts;
 	chan_lowerts = &ts6_chan_lowerts;
 	kick = &ts6_kick;
 	msg = &ts6_msg;
@@ -20,7 +20,7 @@ static void rs_cmd_list(sourceinfo_t *si, int parc, char *parv[])
 	mowgli_patricia_iteration_state_t state;
 	mychan_t *mc;
 	unsigned int listed = 0;
-	char *desc;
+	const char *desc;
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
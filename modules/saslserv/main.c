@@ -16,10 +16,30 @@ DECLARE_MODULE_V1
 	"Atheme Development Group <http://www.atheme.org>"
 );
 
-mowgli_list_t sessions;
+/* Sessions are looked up by UID and expire by deadline.  The wheel has
+ * one slot per second, and since it is longer than the timeout, a slot
+ * only ever holds sessions expiring in that very second.
+ */
+#define SASL_SESSION_TIMEOUT	60
+#define SASL_WHEEL_SLOTS	64
+
+static mowgli_patricia_t *sessions;
+static mowgli_list_t session_wheel[SASL_WHEEL_SLOTS];
+static time_t session_wheel_time;
 static mowgli_list_t sasl_mechanisms;
 static char mechlist_string[400];
 
+struct sasl_mechstats {
+	char name[60];
+	unsigned int success;
+	unsigned int failure;
+	unsigned long latency_ms;	/* total over all completed sessions */
+	unsigned int latency_max_ms;
+};
+
+static mowgli_patricia_t *sasl_mechstats;
+static unsigned int sessions_peak, sessions_timedout, sessions_aborted, sessions_badmech;
+
 sasl_session_t *find_session(const char *uid);
 sasl_session_t *make_session(const char *uid);
 void destroy_session(sasl_session_t *p);
@@ -31,7 +51,9 @@ static bool may_impersonate(myuser_t *source_mu, myuser_t *target_mu);
 static myuser_t *login_user(sasl_session_t *p);
 static void sasl_newuser(hook_user_nick_t *data);
 static void sasl_server_eob(server_t *s);
-static void delete_stale(void *vptr);
+static void sasl_server_split(hook_server_split_t *data);
+static void session_expire(void *vptr);
+static void sasl_osinfo(sourceinfo_t *si);
 static void sasl_mech_register(sasl_mechanism_t *mech);
 static void sasl_mech_unregister(sasl_mechanism_t *mech);
 static void mechlist_build_string(char *ptr, size_t buflen);
@@ -78,7 +100,7 @@ static void saslserv(sourceinfo_t *si, int parc, char *parv[])
 }
 
 service_t *saslsvs = NULL;
-mowgli_eventloop_timer_t *delete_stale_timer = NULL;
+mowgli_eventloop_timer_t *session_expire_timer = NULL;
 
 static void sasl_mech_register(sasl_mechanism_t *mech)
 {
@@ -96,16 +118,20 @@ static void sasl_mech_unregister(sasl_mechanism_t *mech)
 {
 	mowgli_node_t *n, *tn;
 	sasl_session_t *session;
+	int i;
 
 	slog(LG_DEBUG, "sasl_mech_unregister(): unregistering %s", mech->name);
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	for (i = 0; i < SASL_WHEEL_SLOTS; i++)
 	{
-		session = n->data;
-		if (session->mechptr == mech)
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, session_wheel[i].head)
 		{
-			slog(LG_DEBUG, "sasl_mech_unregister(): destroying session %s", session->uid);
-			destroy_session(session);
+			session = n->data;
+			if (session->mechptr == mech)
+			{
+				slog(LG_DEBUG, "sasl_mech_unregister(): destroying session %s", session->uid);
+				destroy_session(session);
+			}
 		}
 	}
 
@@ -130,36 +156,57 @@ void _modinit(module_t *m)
 	hook_add_user_add(sasl_newuser);
 	hook_add_event("server_eob");
 	hook_add_server_eob(sasl_server_eob);
+	hook_add_event("server_split");
+	hook_add_server_split(sasl_server_split);
 	hook_add_event("sasl_may_impersonate");
+	hook_add_event("operserv_info");
+	hook_add_operserv_info(sasl_osinfo);
 
-	delete_stale_timer = mowgli_timer_add(base_eventloop, "sasl_delete_stale", delete_stale, NULL, 30);
+	sessions = mowgli_patricia_create(noopcanon);
+	sasl_mechstats = mowgli_patricia_create(noopcanon);
+	session_wheel_time = CURRTIME;
+	session_expire_timer = mowgli_timer_add(base_eventloop, "sasl_session_expire", session_expire, NULL, 1);
 
 	saslsvs = service_add("saslserv", saslserv);
 	authservice_loaded++;
 }
 
+static void mechstats_free(const char *key, void *data, void *privdata)
+{
+	free(data);
+}
+
 void _moddeinit(module_unload_intent_t intent)
 {
 	mowgli_node_t *n, *tn;
+	int i;
 
 	hook_del_sasl_input(sasl_input);
 	hook_del_user_add(sasl_newuser);
 	hook_del_server_eob(sasl_server_eob);
+	hook_del_server_split(sasl_server_split);
+	hook_del_operserv_info(sasl_osinfo);
 
-	mowgli_timer_destroy(base_eventloop, delete_stale_timer);
+	mowgli_timer_destroy(base_eventloop, session_expire_timer);
 
         if (saslsvs != NULL)
 		service_delete(saslsvs);
 
 	authservice_loaded--;
 
-	if (sessions.head != NULL)
+	if (mowgli_patricia_size(sessions) != 0)
 		slog(LG_DEBUG, "saslserv/main: shutting down with a non-empty session list, a mech did not unregister itself!");
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	for (i = 0; i < SASL_WHEEL_SLOTS; i++)
 	{
-		destroy_session(n->data);
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, session_wheel[i].head)
+		{
+			destroy_session(n->data);
+		}
 	}
+
+	mowgli_patricia_destroy(sessions, NULL, NULL);
+	mowgli_patricia_destroy(sasl_mechstats, mechstats_free, NULL);
 }
 
 /*
@@ -169,27 +216,26 @@ void _moddeinit(module_unload_intent_t intent)
 /* find an existing session by uid */
 sasl_session_t *find_session(const char *uid)
 {
-	sasl_session_t *p;
-	mowgli_node_t *n;
-
 	if (uid == NULL)
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, sessions.head)
-	{
-		p = n->data;
-		if(p->uid != NULL && !strcmp(p->uid, uid))
-			return p;
-	}
+	return mowgli_patricia_retrieve(sessions, uid);
+}
 
-	return NULL;
+/* (re)arm the timeout of a session */
+static void session_schedule(sasl_session_t *p)
+{
+	if (p->deadline != 0)
+		mowgli_node_delete(&p->wnode, &session_wheel[p->deadline % SASL_WHEEL_SLOTS]);
+
+	p->deadline = CURRTIME + SASL_SESSION_TIMEOUT;
+	mowgli_node_add(p, &p->wnode, &session_wheel[p->deadline % SASL_WHEEL_SLOTS]);
 }
 
 /* create a new session if it does not already exist */
 sasl_session_t *make_session(const char *uid)
 {
 	sasl_session_t *p = find_session(uid);
-	mowgli_node_t *n;
 
 	if(p)
 		return p;
@@ -197,13 +243,75 @@ sasl_session_t *make_session(const char *uid)
 	p = malloc(sizeof(sasl_session_t));
 	memset(p, 0, sizeof(sasl_session_t));
 	p->uid = strdup(uid);
+#ifdef HAVE_GETTIMEOFDAY
+	s_time(&p->started);
+#endif
 
-	n = mowgli_node_create();
-	mowgli_node_add(p, n, &sessions);
+	mowgli_patricia_add(sessions, p->uid, p);
+	session_schedule(p);
+
+	if (mowgli_patricia_size(sessions) > sessions_peak)
+		sessions_peak = mowgli_patricia_size(sessions);
 
 	return p;
 }
 
+/* count a finished session in the exported metrics */
+static void session_metric(sasl_session_t *p, const char *outcome)
+{
+	char labels[BUFSIZE];
+
+	snprintf(labels, sizeof labels, "mechanism=\"%s\",outcome=\"%s\"",
+			p->mechptr != NULL ? p->mechptr->name : "none", outcome);
+	metric_inc(metric_counter("atheme_sasl_sessions_total",
+				"SASL sessions, by mechanism and outcome.", labels));
+}
+
+/* account the outcome of a session to its mechanism */
+static void session_result(sasl_session_t *p, bool success)
+{
+	struct sasl_mechstats *ms;
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+	unsigned int ms_taken;
+	char labels[BUFSIZE];
+#endif
+
+	if (p->mechptr == NULL)
+		return;
+
+	session_metric(p, success ? "success" : "failure");
+
+	ms = mowgli_patricia_retrieve(sasl_mechstats, p->mechptr->name);
+	if (ms == NULL)
+	{
+		ms = scalloc(1, sizeof *ms);
+		mowgli_strlcpy(ms->name, p->mechptr->name, sizeof ms->name);
+		mowgli_patricia_add(sasl_mechstats, ms->name, ms);
+	}
+
+	if (!success)
+	{
+		ms->failure++;
+		return;
+	}
+
+	ms->success++;
+
+#ifdef HAVE_GETTIMEOFDAY
+	e_time(p->started, &tv);
+	ms_taken = tv2ms(&tv);
+	ms->latency_ms += ms_taken;
+	if (ms_taken > ms->latency_max_ms)
+		ms->latency_max_ms = ms_taken;
+
+	snprintf(labels, sizeof labels, "mechanism=\"%s\"", ms->name);
+	metric_observe(metric_histogram("atheme_sasl_login_duration_seconds",
+				"Time from the first AUTHENTICATE to a successful login.", labels),
+			ms_taken / 1000.0);
+#endif
+}
+
 /* free a session and all its contents */
 void destroy_session(sasl_session_t *p)
 {
@@ -217,14 +325,8 @@ void destroy_session(sasl_session_t *p)
 			sasl_logcommand(p, mu, CMDLOG_LOGIN, "LOGIN (session timed out)");
 	}
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
-	{
-		if(n->data == p)
-		{
-			mowgli_node_delete(n, &sessions);
-			mowgli_node_free(n);
-		}
-	}
+	mowgli_patricia_delete(sessions, p->uid);
+	mowgli_node_delete(&p->wnode, &session_wheel[p->deadline % SASL_WHEEL_SLOTS]);
 
 	free(p->uid);
 	free(p->buf);
@@ -250,6 +352,11 @@ static void sasl_input(sasl_message_t *smsg)
 	/* Abort packets, or maybe some other kind of (D)one */
 	if(smsg->mode == 'D')
 	{
+		if (p->mechptr != NULL)
+		{
+			sessions_aborted++;
+			session_metric(p, "aborted");
+		}
 		destroy_session(p);
 		return;
 	}
@@ -323,6 +430,36 @@ static void sasl_server_eob(server_t *s)
 	sasl_mechlist_sts(mechlist_string);
 }
 
+/* sessions of clients on a split server can never finish; drop them
+ * now instead of waiting for them to time out */
+static void sasl_split_sessions(server_t *s)
+{
+	mowgli_patricia_iteration_state_t state;
+	mowgli_node_t *n;
+	sasl_session_t *p;
+	size_t len;
+
+	if (s->sid != NULL && (len = strlen(s->sid)) != 0)
+	{
+		MOWGLI_PATRICIA_FOREACH(p, &state, sessions)
+		{
+			if (strncmp(p->uid, s->sid, len))
+				continue;
+			session_metric(p, "split");
+			destroy_session(p);
+		}
+	}
+
+	MOWGLI_ITER_FOREACH(n, s->children.head)
+		sasl_split_sessions(n->data);
+}
+
+static void sasl_server_split(hook_server_split_t *data)
+{
+	if (mowgli_patricia_size(sessions) != 0)
+		sasl_split_sessions(data->s);
+}
+
 static void mechlist_do_rebuild()
 {
 	mechlist_build_string(mechlist_string, sizeof(mechlist_string));
@@ -383,6 +520,8 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 
 		if(!(p->mechptr = find_mechanism(mech)))
 		{
+			sessions_badmech++;
+			session_metric(p, "badmech");
 			sasl_sts(p->uid, 'M', mechlist_string);
 
 			sasl_sts(p->uid, 'D', "F");
@@ -403,7 +542,7 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 	}
 
 	/* Some progress has been made, reset timeout. */
-	p->flags &= ~ASASL_MARKED_FOR_DELETION;
+	session_schedule(p);
 
 	if(rc == ASASL_DONE)
 	{
@@ -418,10 +557,12 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 			if (!(mu->flags & MU_WAITAUTH))
 				svslogin_sts(p->uid, "*", "*", cloak, mu);
 			sasl_sts(p->uid, 'D', "S");
+			session_result(p, true);
 			/* Will destroy session on introduction of user to net. */
 		}
 		else
 		{
+			session_result(p, false);
 			sasl_sts(p->uid, 'D', "F");
 			destroy_session(p);
 		}
@@ -468,6 +609,7 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 	}
 
 	free(out);
+	session_result(p, false);
 	sasl_sts(p->uid, 'D', "F");
 	destroy_session(p);
 }
@@ -660,26 +802,48 @@ static void sasl_newuser(hook_user_nick_t *data)
 	logcommand_user(saslsvs, u, CMDLOG_LOGIN, "LOGIN");
 }
 
-/* This function is run approximately once every 30 seconds.
- * It looks for flagged sessions, and deletes them, while
- * flagging all the others. This way stale sessions are deleted
- * after no more than 60 seconds.
+/* This function is run once a second.  It expires the sessions in the
+ * wheel slots that came due since the last run; sessions that made
+ * progress have been moved to a later slot by session_schedule().
  */
-static void delete_stale(void *vptr)
+static void session_expire(void *vptr)
 {
 	sasl_session_t *p;
 	mowgli_node_t *n, *tn;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	if (session_wheel_time < CURRTIME - SASL_WHEEL_SLOTS)
+		session_wheel_time = CURRTIME - SASL_WHEEL_SLOTS;
+
+	while (session_wheel_time < CURRTIME)
 	{
-		p = n->data;
-		if(p->flags & ASASL_MARKED_FOR_DELETION)
+		session_wheel_time++;
+
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, session_wheel[session_wheel_time % SASL_WHEEL_SLOTS].head)
 		{
-			mowgli_node_delete(n, &sessions);
+			p = n->data;
+			if (p->deadline > CURRTIME)
+				continue;
+
+			sessions_timedout++;
+			session_metric(p, "timeout");
 			destroy_session(p);
-			mowgli_node_free(n);
-		} else
-			p->flags |= ASASL_MARKED_FOR_DELETION;
+		}
+	}
+}
+
+static void sasl_osinfo(sourceinfo_t *si)
+{
+	mowgli_patricia_iteration_state_t state;
+	struct sasl_mechstats *ms;
+
+	command_success_nodata(si, "SASL sessions: %u current, %u peak, %u timed out, %u aborted, %u unknown mechanism",
+			mowgli_patricia_size(sessions), sessions_peak, sessions_timedout, sessions_aborted, sessions_badmech);
+
+	MOWGLI_PATRICIA_FOREACH(ms, &state, sasl_mechstats)
+	{
+		command_success_nodata(si, "SASL %s: %u succeeded (average %lu ms, max %u ms), %u failed",
+				ms->name, ms->success, ms->success ? ms->latency_ms / ms->success : 0,
+				ms->latency_max_ms, ms->failure);
 	}
 }
 
@@ -9,35 +9,18 @@
 #include "atheme.h"
 #include "jsonrpclib.h"
 
-void jsonrpc_process(char *buffer, void *userdata)
+static void jsonrpc_process_call(mowgli_json_t *parsed, void *userdata, bool notification)
 {
-	if (!buffer)
-	{
-		return;
-	}
-
-	mowgli_json_t *parsed = mowgli_json_parse_string(buffer);
-
-	if (parsed == NULL) {
-		return;
-	}
-
-	mowgli_json_tag_t tag = MOWGLI_JSON_TAG(parsed);
-
 	//JSON RPC works with JSON objects only, anything else can't be correct.
 
-	if (tag != MOWGLI_JSON_TAG_OBJECT)
+	if (MOWGLI_JSON_TAG(parsed) != MOWGLI_JSON_TAG_OBJECT)
 	{
+		jsonrpc_failure_string(userdata, fault_badparams, "Invalid request", NULL);
 		return;
 	}
 
 	mowgli_patricia_t *obj = MOWGLI_JSON_OBJECT(parsed);
 
-	if (parsed == NULL)
-	{
-		return;
-	}
-
 	mowgli_json_t *method = mowgli_patricia_retrieve(obj, "method");
 	mowgli_json_t *params = mowgli_patricia_retrieve(obj, "params");
 	mowgli_json_t *id = mowgli_patricia_retrieve(obj, "id");
@@ -45,35 +28,39 @@ void jsonrpc_process(char *buffer, void *userdata)
 	char *method_str, *id_str;
 	mowgli_list_t *params_list;
 
-	if (id == NULL || params == NULL || method == NULL)
-	{
-		return;
-	}
-
-	if (MOWGLI_JSON_TAG(method) != MOWGLI_JSON_TAG_STRING ||
-			MOWGLI_JSON_TAG(id) != MOWGLI_JSON_TAG_STRING ||
+	if ((id == NULL && !notification) || params == NULL || method == NULL ||
+			MOWGLI_JSON_TAG(method) != MOWGLI_JSON_TAG_STRING ||
+			(id != NULL && MOWGLI_JSON_TAG(id) != MOWGLI_JSON_TAG_STRING) ||
 			MOWGLI_JSON_TAG(params) != MOWGLI_JSON_TAG_ARRAY)
 	{
+		jsonrpc_failure_string(userdata, fault_badparams, "Invalid request", NULL);
 		return;
 	}
 
 	method_str = MOWGLI_JSON_STRING_STR(method);
-	id_str = MOWGLI_JSON_STRING_STR(id);
+	/* methods expect an id; nobody sees it for a notification */
+	id_str = id != NULL ? MOWGLI_JSON_STRING_STR(id) : "";
 	params_list = MOWGLI_JSON_ARRAY(params);
 
 	mowgli_json_t *param;
-	mowgli_node_t *n;
+	mowgli_node_t *n, *tn;
 
 	jsonrpc_method_t call_method = get_json_method(method_str);
 
+	if (call_method == NULL)
+	{
+		jsonrpc_failure_string(userdata, fault_badparams, "Invalid command", id_str);
+		return;
+	}
+
 	MOWGLI_LIST_FOREACH(n, params_list->head)
 	{
 		param = n->data;
 
 		if (MOWGLI_JSON_TAG(param) != MOWGLI_JSON_TAG_STRING) {
-			continue;
+			jsonrpc_failure_string(userdata, fault_badparams, "Invalid parameters", id_str);
+			return;
 		}
-
 	}
 
 	mowgli_list_t *params_str = mowgli_list_create();
@@ -86,13 +73,80 @@ void jsonrpc_process(char *buffer, void *userdata)
 		mowgli_node_add(param_str, mowgli_node_create(), params_str);
 	}
 
-	if (call_method != NULL) {
-		call_method(userdata, params_str, id_str);
-	} else {
-		jsonrpc_failure_string(userdata, fault_badparams, "Invalid command", id_str);
+	call_method(userdata, params_str, id_str);
+
+	MOWGLI_LIST_FOREACH_SAFE(n, tn, params_str->head)
+	{
+		mowgli_node_delete(n, params_str);
+		mowgli_node_free(n);
+	}
+	mowgli_list_free(params_str);
+}
+
+/*
+ * A request object with a method but no id member is a notification.
+ * It runs like any other call, but nothing it produces is sent, not even
+ * an error.  Returns true if a response was (or may have been) sent.
+ */
+static bool jsonrpc_process_one(mowgli_json_t *parsed, void *userdata)
+{
+	mowgli_json_t *method;
+	bool notification = false;
+
+	if (MOWGLI_JSON_TAG(parsed) == MOWGLI_JSON_TAG_OBJECT)
+	{
+		method = mowgli_patricia_retrieve(MOWGLI_JSON_OBJECT(parsed), "method");
+		notification = mowgli_patricia_retrieve(MOWGLI_JSON_OBJECT(parsed), "id") == NULL &&
+			method != NULL && MOWGLI_JSON_TAG(method) == MOWGLI_JSON_TAG_STRING;
+	}
+
+	if (!notification)
+	{
+		jsonrpc_process_call(parsed, userdata, false);
+		return true;
+	}
+
+	jsonrpc_mute(userdata, true);
+	jsonrpc_process_call(parsed, userdata, true);
+	jsonrpc_mute(userdata, false);
+
+	return false;
+}
+
+void jsonrpc_process(char *buffer, void *userdata)
+{
+	mowgli_json_t *parsed;
+	mowgli_node_t *n;
+
+	if (!buffer)
+	{
+		return;
+	}
+
+	parsed = mowgli_json_parse_string(buffer);
+
+	if (parsed == NULL) {
+		jsonrpc_failure_string(userdata, fault_badparams, "Parse error", NULL);
 		return;
 	}
 
+	/* A batch runs its calls in order and answers with one array,
+	 * each response going out as soon as the call has produced it.
+	 */
+	if (MOWGLI_JSON_TAG(parsed) == MOWGLI_JSON_TAG_ARRAY &&
+			MOWGLI_LIST_LENGTH(MOWGLI_JSON_ARRAY(parsed)) != 0)
+	{
+		jsonrpc_batch_begin(userdata);
+
+		MOWGLI_LIST_FOREACH(n, MOWGLI_JSON_ARRAY(parsed)->head)
+			jsonrpc_process_one(n->data, userdata);
+
+		jsonrpc_batch_end(userdata);
+	}
+	else if (!jsonrpc_process_one(parsed, userdata))
+		jsonrpc_send_nothing(userdata);
+
+	mowgli_json_decref(parsed);
 }
 
 void jsonrpc_success_string(void *conn, const char *result, const char *id)
@@ -102,7 +156,7 @@ void jsonrpc_success_string(void *conn, const char *result, const char *id)
 	mowgli_patricia_t *patricia = MOWGLI_JSON_OBJECT(obj);
 
 	mowgli_json_t *resultobj = mowgli_json_create_string(result);
-	mowgli_json_t *idobj = mowgli_json_create_string(id);
+	mowgli_json_t *idobj = id != NULL ? mowgli_json_create_string(id) : mowgli_json_null;
 
 	mowgli_patricia_add(patricia, "result", resultobj);
 	mowgli_patricia_add(patricia, "id", idobj);
@@ -113,6 +167,9 @@ void jsonrpc_success_string(void *conn, const char *result, const char *id)
 	mowgli_json_serialize_to_string(obj, str, 0);
 
 	jsonrpc_send_data(conn, str->str);
+
+	mowgli_string_destroy(str);
+	mowgli_json_decref(obj);
 }
 
 void jsonrpc_failure_string(void *conn, int code, const char *error, const char *id)
@@ -127,7 +184,7 @@ void jsonrpc_failure_string(void *conn, int code, const char *error, const char
 
 	patricia = MOWGLI_JSON_OBJECT(obj);
 
-	mowgli_json_t *idobj = mowgli_json_create_string(id);
+	mowgli_json_t *idobj = id != NULL ? mowgli_json_create_string(id) : mowgli_json_null;
 
 	mowgli_patricia_add(patricia, "result", mowgli_json_null);
 	mowgli_patricia_add(patricia, "id", idobj);
@@ -138,6 +195,9 @@ void jsonrpc_failure_string(void *conn, int code, const char *error, const char
 	mowgli_json_serialize_to_string(obj, str, 0);
 
 	jsonrpc_send_data(conn, str->str);
+
+	mowgli_string_destroy(str);
+	mowgli_json_decref(obj);
 }
 
 char *jsonrpc_normalizeBuffer(const char *buf)
@@ -25,6 +25,10 @@ E void jsonrpc_process(char *buffer, void *userdata);
 E void jsonrpc_register_method(const char *method_name, bool (*method)(void *conn, mowgli_list_t *params, char *id));
 E void jsonrpc_unregister_method(const char *method_name);
 E void jsonrpc_send_data(void *conn, char *str);
+E void jsonrpc_batch_begin(void *conn);
+E void jsonrpc_batch_end(void *conn);
+E void jsonrpc_mute(void *conn, bool mute);
+E void jsonrpc_send_nothing(void *conn);
 E void jsonrpc_success_string(void *conn, const char *str, const char *id);
 E void jsonrpc_failure_string(void *conn, int code, const char *str, const char *id);
 
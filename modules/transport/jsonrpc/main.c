@@ -21,7 +21,7 @@ DECLARE_MODULE_V1
 
 static void handle_request(connection_t *cptr, void *requestbuf);
 
-mowgli_list_t *httpd_path_handlers;
+mowgli_patricia_t **httpd_paths;
 static mowgli_patricia_t *json_methods;
 
 static bool jsonrpcmethod_login(void *conn, mowgli_list_t *params, char *id);
@@ -45,20 +45,50 @@ struct sourceinfo_vtable jsonrpc_vtable = {
 
 path_handler_t handle_jsonrpc = { NULL, handle_request };
 
+/* While a batch request runs, each response goes out as one element of
+ * a JSON array streamed in chunks rather than as its own HTTP reply.  The
+ * reply is only started with the first response, since a batch of
+ * notifications gets none at all.  Responses are collected in out and
+ * sent once JSONRPC_CHUNK_MIN bytes are pending, or at the end.
+ */
+#define JSONRPC_CHUNK_MIN	4096
+
+typedef struct {
+	bool batch;
+	bool muted;		/* running a notification */
+	unsigned int responses;
+	mowgli_string_t *out;
+} jsonrpc_request_t;
+
 static void handle_request(connection_t *cptr, void *requestbuf)
 {
+	struct httpddata *hd = cptr->userdata;
+	jsonrpc_request_t req;
+
+	memset(&req, 0, sizeof req);
+	hd->reqdata = &req;
 
 	jsonrpc_process(requestbuf, cptr);
 
-	return;
+	hd->reqdata = NULL;
+	if (req.out != NULL)
+		req.out->destroy(req.out);
+}
+
+static jsonrpc_request_t *jsonrpc_request(void *conn)
+{
+	struct httpddata *hd = ((connection_t *)conn)->userdata;
+
+	return hd->reqdata;
 }
 
 void _modinit(module_t *m)
 {
-	MODULE_TRY_REQUEST_SYMBOL(m, httpd_path_handlers, "misc/httpd", "httpd_path_handlers");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_paths, "misc/httpd", "httpd_paths");
+	use_httpd_symbols(m);
 
 	handle_jsonrpc.path = "/jsonrpc";
-	mowgli_node_add(&handle_jsonrpc, mowgli_node_create(), httpd_path_handlers);
+	mowgli_patricia_add(*httpd_paths, handle_jsonrpc.path, &handle_jsonrpc);
 
 	json_methods = mowgli_patricia_create(strcasecanon);
 
@@ -74,8 +104,6 @@ void _modinit(module_t *m)
 
 void _moddeinit(module_unload_intent_t intent)
 {
-	mowgli_node_t *n;
-
 	jsonrpc_unregister_method("atheme.login");
 	jsonrpc_unregister_method("atheme.logout");
 	jsonrpc_unregister_method("atheme.command");
@@ -84,11 +112,7 @@ void _moddeinit(module_unload_intent_t intent)
 	jsonrpc_unregister_method("atheme.ison");
 	jsonrpc_unregister_method("atheme.metadata");
 
-	if ((n = mowgli_node_find(&handle_jsonrpc, httpd_path_handlers)) != NULL)
-	{
-		mowgli_node_delete(n, httpd_path_handlers);
-		mowgli_node_free(n);
-	}
+	mowgli_patricia_delete(*httpd_paths, handle_jsonrpc.path);
 }
 
 void jsonrpc_register_method(const char *method_name, jsonrpc_method_t method) {
@@ -411,6 +435,11 @@ static bool jsonrpcmethod_command(void *conn, mowgli_list_t *params, char *id)
 		newparv[i-5] = mowgli_node_nth_data(params, i);
 	}
 
+	/* a batch may run several commands for one HTTP request */
+	hd->sent_reply = false;
+	free(hd->replybuf);
+	hd->replybuf = NULL;
+
 	si = sourceinfo_create();
 
 	jsonrpc_sourceinfo_t *jsi = (jsonrpc_sourceinfo_t *)si;
@@ -682,25 +711,71 @@ static bool jsonrpcmethod_metadata(void *conn, mowgli_list_t *params, char *id)
 	return 0;
 }
 
-void jsonrpc_send_data(void *conn, char *str) {
-	struct httpddata *hd = ((connection_t *) conn)->userdata;
+static void jsonrpc_flush(void *conn, jsonrpc_request_t *req)
+{
+	httpd_reply_chunk(conn, req->out->str, req->out->pos);
+	req->out->reset(req->out);
+}
 
-	char buf[300];
+void jsonrpc_batch_begin(void *conn)
+{
+	jsonrpc_request_t *req = jsonrpc_request(conn);
 
-	size_t len = strlen(str);
+	req->batch = true;
+	req->responses = 0;
+}
 
-	snprintf(buf, sizeof buf, "HTTP/1.1 200 OK\r\n"
-			"%s"
-			"Server: Atheme/%s\r\n"
-			"Content-Type: application/json\r\n"
-			"Content-Length: %lu\r\n\r\n",
-			hd->connection_close ? "Connection: close\r\n" : "",
-			PACKAGE_VERSION, (unsigned long)len);
+void jsonrpc_batch_end(void *conn)
+{
+	jsonrpc_request_t *req = jsonrpc_request(conn);
 
-	sendq_add((connection_t *)conn, buf, strlen(buf));
-	sendq_add((connection_t *)conn, str, len);
+	req->batch = false;
+	if (req->responses == 0)
+	{
+		httpd_reply_no_content(conn);
+		return;
+	}
+	req->out->append_char(req->out, ']');
+	jsonrpc_flush(conn, req);
+	httpd_reply_end(conn, true);
+}
 
-	if (hd->connection_close) {
-		sendq_add_eof((connection_t *) conn);
+/* notifications run with their responses thrown away */
+void jsonrpc_mute(void *conn, bool mute)
+{
+	jsonrpc_request(conn)->muted = mute;
+}
+
+void jsonrpc_send_nothing(void *conn)
+{
+	httpd_reply_no_content(conn);
+}
+
+void jsonrpc_send_data(void *conn, char *str) {
+	jsonrpc_request_t *req = jsonrpc_request(conn);
+	size_t len = strlen(str);
+
+	/* replies may also come from outside handle_request() */
+	if (req != NULL && req->muted)
+		return;
+
+	if (req != NULL && req->batch) {
+		if (req->responses++ == 0)
+		{
+			httpd_reply_start(conn, "application/json", -1);
+			if (req->out == NULL)
+				req->out = mowgli_string_create();
+			req->out->append_char(req->out, '[');
+		}
+		else
+			req->out->append_char(req->out, ',');
+		req->out->append(req->out, str, len);
+		if (req->out->pos >= JSONRPC_CHUNK_MIN)
+			jsonrpc_flush(conn, req);
+		return;
 	}
+
+	httpd_reply_start(conn, "application/json", len);
+	sendq_add((connection_t *)conn, str, len);
+	httpd_reply_end(conn, false);
 }
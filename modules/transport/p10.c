@@ -45,6 +45,7 @@ static void p10_parse(char *line)
 	int parc = 0;
 	unsigned int i;
 	pcommand_t *pcmd;
+	uint64_t start;
 
 	/* clear the parv */
 	for (i = 0; i <= MAXPARC; i++)
@@ -182,7 +183,9 @@ static void p10_parse(char *line)
 			}
 			if (pcmd->handler)
 			{
+				start = profile_now();
 				pcmd->handler(si, parc, parv);
+				profile_record(pcmd->profile, profile_now() - start);
 			}
 		}
 	}
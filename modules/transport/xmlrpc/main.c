@@ -29,8 +29,10 @@ struct
 } xmlrpc_config;
 
 connection_t *current_cptr; /* XXX: Hack: src/xmlrpc.c requires us to do this */
+static bool reply_lines; /* atheme.command has started a string result */
 
-mowgli_list_t *httpd_path_handlers;
+mowgli_patricia_t **httpd_paths;
+static char *registered_path;
 
 static void xmlrpc_command_fail(sourceinfo_t *si, cmd_faultcode_t code, const char *message);
 static void xmlrpc_command_success_nodata(sourceinfo_t *si, const char *message);
@@ -53,23 +55,16 @@ struct sourceinfo_vtable xmlrpc_vtable = {
 	.cmd_success_string = xmlrpc_command_success_string
 };
 
+static size_t write_header(char *buf, size_t size, size_t length)
+{
+	return httpd_reply_header(current_cptr, buf, size, "text/xml", length);
+}
+
+/* buf already starts with the header from write_header() */
 static char *dump_buffer(char *buf, int length)
 {
-	struct httpddata *hd;
-	char buf1[300];
-
-	hd = current_cptr->userdata;
-	snprintf(buf1, sizeof buf1, "HTTP/1.1 200 OK\r\n"
-			"%s"
-			"Server: Atheme/%s\r\n"
-			"Content-Type: text/xml\r\n"
-			"Content-Length: %d\r\n\r\n",
-			hd->connection_close ? "Connection: close\r\n" : "",
-			PACKAGE_VERSION, length);
-	sendq_add(current_cptr, buf1, strlen(buf1));
 	sendq_add(current_cptr, buf, length);
-	if (hd->connection_close)
-		sendq_add_eof(current_cptr);
+	httpd_reply_end(current_cptr, false);
 	return buf;
 }
 
@@ -84,25 +79,32 @@ static void handle_request(connection_t *cptr, void *requestbuf)
 
 static void xmlrpc_config_ready(void *vptr)
 {
-	/* Note: handle_xmlrpc.path may point to freed memory between
-	 * reading the config and here.
+	/* The handler is hashed under a copy of the path, as
+	 * xmlrpc_config.path is freed and reallocated on rehash.
 	 */
-	handle_xmlrpc.path = xmlrpc_config.path;
+	if (xmlrpc_config.path == NULL)
+	{
+		slog(LG_ERROR, "xmlrpc_config_ready(): xmlrpc {} block missing or invalid");
+		return;
+	}
 
-	if (handle_xmlrpc.handler != NULL)
+	if (registered_path != NULL)
 	{
-		if (mowgli_node_find(&handle_xmlrpc, httpd_path_handlers))
+		if (!strcmp(registered_path, xmlrpc_config.path))
 			return;
-
-		mowgli_node_add(&handle_xmlrpc, mowgli_node_create(), httpd_path_handlers);
+		mowgli_patricia_delete(*httpd_paths, registered_path);
+		free(registered_path);
 	}
-	else
-		slog(LG_ERROR, "xmlrpc_config_ready(): xmlrpc {} block missing or invalid");
+
+	registered_path = sstrdup(xmlrpc_config.path);
+	handle_xmlrpc.path = registered_path;
+	mowgli_patricia_add(*httpd_paths, registered_path, &handle_xmlrpc);
 }
 
 void _modinit(module_t *m)
 {
-	MODULE_TRY_REQUEST_SYMBOL(m, httpd_path_handlers, "misc/httpd", "httpd_path_handlers");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_paths, "misc/httpd", "httpd_paths");
+	use_httpd_symbols(m);
 
 	hook_add_event("config_ready");
 	hook_add_config_ready(xmlrpc_config_ready);
@@ -113,7 +115,8 @@ void _modinit(module_t *m)
 	add_dupstr_conf_item("PATH", &conf_xmlrpc_table, 0, &xmlrpc_config.path, NULL);
 
 	xmlrpc_set_buffer(dump_buffer);
-	xmlrpc_set_options(XMLRPC_HTTP_HEADER, XMLRPC_OFF);
+	xmlrpc_set_header(write_header);
+	xmlrpc_set_options(XMLRPC_HTTP_HEADER, XMLRPC_ON);
 	xmlrpc_register_method("atheme.login", xmlrpcmethod_login);
 	xmlrpc_register_method("atheme.logout", xmlrpcmethod_logout);
 	xmlrpc_register_method("atheme.command", xmlrpcmethod_command);
@@ -124,8 +127,6 @@ void _modinit(module_t *m)
 
 void _moddeinit(module_unload_intent_t intent)
 {
-	mowgli_node_t *n;
-
 	xmlrpc_unregister_method("atheme.login");
 	xmlrpc_unregister_method("atheme.logout");
 	xmlrpc_unregister_method("atheme.command");
@@ -133,10 +134,10 @@ void _moddeinit(module_unload_intent_t intent)
 	xmlrpc_unregister_method("atheme.ison");
 	xmlrpc_unregister_method("atheme.metadata");
 
-	if ((n = mowgli_node_find(&handle_xmlrpc, httpd_path_handlers)) != NULL)
+	if (registered_path != NULL)
 	{
-		mowgli_node_delete(n, httpd_path_handlers);
-		mowgli_node_free(n);
+		mowgli_patricia_delete(*httpd_paths, registered_path);
+		free(registered_path);
 	}
 
 	del_conf_item("PATH", &conf_xmlrpc_table);
@@ -168,29 +169,24 @@ static void xmlrpc_command_success_nodata(sourceinfo_t *si, const char *message)
 	connection_t *cptr;
 	struct httpddata *hd;
 	char *newmessage;
-	char *p;
-
-	newmessage = xmlrpc_normalizeBuffer(message);
 
 	cptr = si->connection;
 	hd = cptr->userdata;
 	if (hd->sent_reply)
-	{
-		free(newmessage);
 		return;
-	}
-	if (hd->replybuf != NULL)
-	{
-		hd->replybuf = srealloc(hd->replybuf, strlen(hd->replybuf) + strlen(newmessage) + 2);
-		p = hd->replybuf + strlen(hd->replybuf);
-		*p++ = '\n';
-	}
+
+	/* lines go straight into the response; a later result or fault
+	 * simply replaces them */
+	if (reply_lines)
+		xmlrpc_param_string_append("\n");
 	else
 	{
-		hd->replybuf = smalloc(strlen(newmessage) + 1);
-		p = hd->replybuf;
+		xmlrpc_response_begin();
+		xmlrpc_param_string_begin();
+		reply_lines = true;
 	}
-        strcpy(p, newmessage);
+	newmessage = xmlrpc_normalizeBuffer(message);
+	xmlrpc_param_string_append(newmessage);
 	free(newmessage);
 }
 
@@ -410,6 +406,10 @@ static int xmlrpcmethod_command(void *conn, int parc, char *parv[])
 	if (newparc > 0)
 		memcpy(newparv, parv + 5, newparc * sizeof(parv[0]));
 
+	/* a multicall may run several commands for one HTTP request */
+	hd->sent_reply = false;
+	reply_lines = false;
+
 	si = sourceinfo_create();
 	si->smu = mu;
 	si->service = svs;
@@ -422,8 +422,11 @@ static int xmlrpcmethod_command(void *conn, int parc, char *parv[])
 	/* XXX: needs to be fixed up for restartable commands... */
 	if (!hd->sent_reply)
 	{
-		if (hd->replybuf != NULL)
-			xmlrpc_send_string(hd->replybuf);
+		if (reply_lines)
+		{
+			xmlrpc_param_string_end();
+			xmlrpc_response_end();
+		}
 		else
 			xmlrpc_generic_error(fault_unimplemented, "Command did not return a result.");
 	}
@@ -508,7 +511,6 @@ static int xmlrpcmethod_ison(void *conn, int parc, char *parv[])
 {
 	user_t *u;
 	int i;
-	char buf[XMLRPC_BUFSIZE], buf2[XMLRPC_BUFSIZE];
 
 	for (i = 0; i < parc; i++)
 	{
@@ -526,17 +528,11 @@ static int xmlrpcmethod_ison(void *conn, int parc, char *parv[])
 	}
 
 	u = user_find(parv[0]);
-	if (u == NULL)
-	{
-		xmlrpc_boolean(buf, false);
-		xmlrpc_string(buf2, "*");
-		xmlrpc_send(2, buf, buf2);
-		return 0;
-	}
 
-	xmlrpc_boolean(buf, true);
-	xmlrpc_string(buf2, u->myuser != NULL ? entity(u->myuser)->name : "*");
-	xmlrpc_send(2, buf, buf2);
+	xmlrpc_response_begin();
+	xmlrpc_param_boolean(u != NULL);
+	xmlrpc_param_string(u != NULL && u->myuser != NULL ? entity(u->myuser)->name : "*");
+	xmlrpc_response_end();
 
 	return 0;
 }
@@ -556,7 +552,6 @@ static int xmlrpcmethod_metadata(void *conn, int parc, char *parv[])
 {
 	metadata_t *md;
 	int i;
-	char buf[XMLRPC_BUFSIZE];
 
 	for (i = 0; i < parc; i++)
 	{
@@ -609,8 +604,7 @@ static int xmlrpcmethod_metadata(void *conn, int parc, char *parv[])
 		return 0;
 	}
 
-	xmlrpc_string(buf, md->value);
-	xmlrpc_send(1, buf);
+	xmlrpc_send_string(md->value);
 
 	return 0;
 }
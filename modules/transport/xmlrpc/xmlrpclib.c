@@ -14,6 +14,10 @@
 #include "atheme.h"
 #include "xmlrpclib.h"
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 static int xmlrpc_error_code;
 
 typedef struct XMLRPCCmd_ XMLRPCCmd;
@@ -30,6 +34,7 @@ mowgli_patricia_t *XMLRPCCMD = NULL;
 
 struct xmlrpc_settings {
 	char *(*setbuffer)(char *buffer, int len);
+	size_t (*setheader)(char *buffer, size_t size, size_t length);
 	char *encode;
 	int httpheader;
 	char *inttagstart;
@@ -39,11 +44,29 @@ struct xmlrpc_settings {
 static char *xmlrpc_parse(char *buffer);
 static char *xmlrpc_method(char *buffer);
 static int xmlrpc_split_buf(char *buffer, char ***argv);
-static void xmlrpc_append_char_encode(mowgli_string_t *s, const char *s1);
+static void xmlrpc_multicall(char *buffer, void *userdata);
+static void xmlrpc_out_puts(const char *s);
+static void xmlrpc_out_prolog(void);
+static void xmlrpc_out_flush(void);
 
 static XMLRPCCmd *createXMLCommand(const char *name, XMLRPCMethodFunc func);
 static int addXMLCommand(XMLRPCCmd * xml);
-static char *xmlrpc_write_header(int length);
+static size_t xmlrpc_write_header(char *buf, size_t size, size_t length);
+
+/* Every response is built in this one buffer, which is kept between
+ * requests.  Its first XMLRPC_HEADROOM bytes are left free for the HTTP
+ * header, which is only written once the body and so its length are
+ * complete; the whole reply then goes out in one piece.
+ */
+static struct
+{
+	char *buf;
+	size_t len;		/* document bytes after the headroom */
+	size_t size;		/* room for the document after the headroom */
+	size_t mark;		/* where the current call's response starts */
+	enum { XMLRPC_REPLY_NONE, XMLRPC_REPLY_OPEN, XMLRPC_REPLY_DONE } state;
+	bool multicall;
+} xmlrpc_out;
 
 /*************************************************************************/
 
@@ -54,17 +77,63 @@ int xmlrpc_getlast_error(void)
 
 /*************************************************************************/
 
-void xmlrpc_process(char *buffer, void *userdata)
+static void xmlrpc_call(const char *name, char *buffer, void *userdata)
 {
 	int retVal = 0;
 	XMLRPCCmd *current = NULL;
 	XMLRPCCmd *xml;
-	char *tmp;
 	int ac;
 	char **av = NULL;
+
+	/* a call answers once, further results are dropped */
+	xmlrpc_out.state = XMLRPC_REPLY_NONE;
+
+	xml = mowgli_patricia_retrieve(XMLRPCCMD, name);
+	if (xml)
+	{
+		ac = xmlrpc_split_buf(buffer, &av);
+		if (xml->func)
+		{
+			retVal = xml->func(userdata, ac, av);
+			if (retVal == XMLRPC_CONT)
+			{
+				current = xml->next;
+				while (current && current->func && retVal == XMLRPC_CONT)
+				{
+					retVal = current->func(userdata, ac, av);
+					current = current->next;
+				}
+			}
+			else
+			{	/* we assume that XMLRPC_STOP means the handler has given no output */
+				xmlrpc_error_code = -7;
+				xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: First eligible function returned XMLRPC_STOP");
+			}
+		}
+		else
+		{
+			xmlrpc_error_code = -6;
+			xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: Method has no registered function");
+		}
+	}
+	else
+	{
+		xmlrpc_error_code = -4;
+		xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: Unknown routine called");
+	}
+	free(av);
+}
+
+/*************************************************************************/
+
+void xmlrpc_process(char *buffer, void *userdata)
+{
+	char *tmp;
 	char *name = NULL;
 
 	xmlrpc_error_code = 0;
+	xmlrpc_out.len = 0;
+	xmlrpc_out.state = XMLRPC_REPLY_NONE;
 
 	if (!buffer)
 	{
@@ -78,39 +147,10 @@ void xmlrpc_process(char *buffer, void *userdata)
 		name = xmlrpc_method(tmp);
 		if (name)
 		{
-			xml = mowgli_patricia_retrieve(XMLRPCCMD, name);
-			if (xml)
-			{
-				ac = xmlrpc_split_buf(tmp, &av);
-				if (xml->func)
-				{
-					retVal = xml->func(userdata, ac, av);
-					if (retVal == XMLRPC_CONT)
-					{
-						current = xml->next;
-						while (current && current->func && retVal == XMLRPC_CONT)
-						{
-							retVal = current->func(userdata, ac, av);
-							current = current->next;
-						}
-					}
-					else
-					{	/* we assume that XMLRPC_STOP means the handler has given no output */
-						xmlrpc_error_code = -7;
-						xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: First eligible function returned XMLRPC_STOP");
-					}
-				}
-				else
-				{
-					xmlrpc_error_code = -6;
-					xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: Method has no registered function");
-				}
-			}
+			if (!stricmp(name, "system.multicall"))
+				xmlrpc_multicall(tmp, userdata);
 			else
-			{
-				xmlrpc_error_code = -4;
-				xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: Unknown routine called");
-			}
+				xmlrpc_call(name, tmp, userdata);
 		}
 		else
 		{
@@ -123,13 +163,150 @@ void xmlrpc_process(char *buffer, void *userdata)
 		xmlrpc_error_code = -2;
 		xmlrpc_generic_error(xmlrpc_error_code, "XMLRPC error: Invalid document end at line 1");
 	}
-	free(av);
 	free(tmp);
 	free(name);
 }
 
 /*************************************************************************/
 
+/* Returns the close tag matching an open tag just before p, skipping
+ * over any nested pairs of the same tags, or NULL. */
+static char *xmlrpc_find_close(char *p, const char *open, const char *close)
+{
+	size_t openlen = strlen(open), closelen = strlen(close);
+	unsigned int depth = 0;
+	char *o = NULL, *c;
+
+	while ((c = strstr(p, close)) != NULL)
+	{
+		if (o != NULL && o < p)
+			o = NULL;
+		if (o == NULL)
+			o = strstr(p, open);
+
+		if (o != NULL && o < c)
+		{
+			depth++;
+			p = o + openlen;
+			continue;
+		}
+		if (depth-- == 0)
+			return c;
+		p = c + closelen;
+	}
+
+	return NULL;
+}
+
+/* Returns the start of the value of the named member of the struct whose
+ * contents are at p, ignoring members of nested structs, and sets *endp
+ * to the end of that member; or returns NULL. */
+static char *xmlrpc_member_value(char *p, const char *member, char **endp)
+{
+	char key[64];
+	char *end, *value;
+
+	snprintf(key, sizeof key, "<name>%s</name>", member);
+
+	while ((p = strstr(p, "<member>")) != NULL)
+	{
+		p += 8;
+		if ((end = xmlrpc_find_close(p, "<member>", "</member>")) == NULL)
+			return NULL;
+
+		while (*p == ' ')
+			p++;
+		if (!strncmp(p, key, strlen(key)) && (value = strstr(p, "<value>")) != NULL && value < end)
+		{
+			*endp = end;
+			return value + 7;
+		}
+
+		p = end + 9;
+	}
+
+	return NULL;
+}
+
+/* Returns the decoded string value of the named struct member, or NULL. */
+static char *xmlrpc_member_string(char *buffer, const char *member)
+{
+	const char *p, *q;
+	char *value, *end;
+
+	if ((p = xmlrpc_member_value(buffer, member, &end)) == NULL)
+		return NULL;
+	while (*p == ' ')
+		p++;
+	if (!strncasecmp(p, "<string>", 8))
+		p += 8;
+	if ((q = strchr(p, '<')) == NULL)
+		return NULL;
+
+	value = smalloc(q - p + 1);
+	memcpy(value, p, q - p);
+	value[q - p] = '\0';
+	return xmlrpc_decode_string(value);
+}
+
+/* system.multicall: every struct in the parameter array names a method
+ * and its params; the calls run in order and each result is wrapped in
+ * a one element array (or replaced by a fault struct) in the reply.
+ * Structs and arrays in the params may nest, so the ends of the call
+ * structs and of their params arrays are found by matching tags.
+ */
+static void xmlrpc_multicall(char *buffer, void *userdata)
+{
+	char *p, *end, *params, *pend, *data, *name;
+
+	xmlrpc_out_prolog();
+	xmlrpc_out_puts("<params>\r\n <param>\r\n  <value>\r\n   <array>\r\n    <data>\r\n");
+	xmlrpc_out.multicall = true;
+
+	p = buffer;
+	while ((p = strstr(p, "<struct>")) != NULL)
+	{
+		p += 8;
+		if ((end = xmlrpc_find_close(p, "<struct>", "</struct>")) == NULL)
+			break;
+		*end = '\0';
+
+		xmlrpc_out.state = XMLRPC_REPLY_NONE;
+		name = xmlrpc_member_string(p, "methodName");
+		data = NULL;
+		if ((params = xmlrpc_member_value(p, "params", &pend)) != NULL &&
+				(data = strstr(params, "<data>")) != NULL && data < pend)
+		{
+			data += 6;
+			if ((params = xmlrpc_find_close(data, "<data>", "</data>")) != NULL && params < pend)
+				*params = '\0';
+			else
+				data = NULL;
+		}
+		else
+			data = NULL;
+
+		if (name == NULL)
+			xmlrpc_generic_error(-3, "XMLRPC error: Missing methodName.");
+		else if (!stricmp(name, "system.multicall"))
+			xmlrpc_generic_error(-5, "XMLRPC error: Recursive system.multicall forbidden.");
+		else
+			xmlrpc_call(name, data != NULL ? data : end, userdata);
+		if (xmlrpc_out.state != XMLRPC_REPLY_DONE)
+			xmlrpc_generic_error(-6, "XMLRPC error: Method returned no result.");
+		free(name);
+
+		p = end + 1;
+	}
+
+	xmlrpc_out.multicall = false;
+	xmlrpc_out_puts("    </data>\r\n   </array>\r\n  </value>\r\n </param>\r\n</params>\r\n</methodResponse>");
+	xmlrpc_out_flush();
+	xmlrpc_out.state = XMLRPC_REPLY_DONE;
+}
+
+/*************************************************************************/
+
 void xmlrpc_set_buffer(char *(*func) (char *buffer, int len))
 {
 	return_if_fail(func != NULL);
@@ -138,6 +315,13 @@ void xmlrpc_set_buffer(char *(*func) (char *buffer, int len))
 
 /*************************************************************************/
 
+void xmlrpc_set_header(size_t (*func) (char *buffer, size_t size, size_t length))
+{
+	xmlrpc.setheader = func;
+}
+
+/*************************************************************************/
+
 int xmlrpc_register_method(const char *name, XMLRPCMethodFunc func)
 {
 	XMLRPCCmd *xml;
@@ -188,21 +372,18 @@ int xmlrpc_unregister_method(const char *method)
 
 /*************************************************************************/
 
-static char *xmlrpc_write_header(int length)
+static size_t xmlrpc_write_header(char *buf, size_t size, size_t length)
 {
-	char buf[512];
 	time_t ts;
 	char timebuf[64];
 	struct tm tm;
 
-	*buf = '\0';
-
 	ts = time(NULL);
 	tm = *localtime(&ts);
 	strftime(timebuf, sizeof timebuf, "%Y-%m-%d %H:%M:%S", &tm);
 
-	snprintf(buf, sizeof buf, "HTTP/1.1 200 OK\r\nConnection: close\r\n" "Content-Length: %d\r\n" "Content-Type: text/xml\r\n" "Date: %s\r\n" "Server: Atheme/%s\r\n\r\n", length, timebuf, PACKAGE_VERSION);
-	return sstrdup(buf);
+	snprintf(buf, size, "HTTP/1.1 200 OK\r\nConnection: close\r\n" "Content-Length: %lu\r\n" "Content-Type: text/xml\r\n" "Date: %s\r\n" "Server: Atheme/%s\r\n\r\n", (unsigned long)length, timebuf, PACKAGE_VERSION);
+	return strlen(buf);
 }
 
 /*************************************************************************/
@@ -311,192 +492,377 @@ static char *xmlrpc_method(char *buffer)
 
 /*************************************************************************/
 
-void xmlrpc_generic_error(int code, const char *string)
+static inline bool xmlrpc_special(unsigned char c)
 {
-	char buf[1024];
-	const char *ss;
-	mowgli_string_t *s = mowgli_string_create();
-	char *s2;
-	int len;
+	return c > 127 || c == '&' || c == '<' || c == '>' || c == '"';
+}
 
-	if (xmlrpc.encode)
+/* Returns how many leading bytes of s need no escaping. */
+static size_t xmlrpc_plain_span(const unsigned char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<');
+	const __m128i gt = _mm_set1_epi8('>'), quot = _mm_set1_epi8('"');
+	__m128i v, m;
+	int mask;
+
+	for (; i + 16 <= len; i += 16)
 	{
-		snprintf(buf, sizeof buf, "<?xml version=\"1.0\" encoding=\"%s\" ?>\r\n<methodResponse>\r\n", xmlrpc.encode);
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot)));
+		/* the sign bits of v itself flag bytes above 127 */
+		mask = _mm_movemask_epi8(_mm_or_si128(m, v));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
 	}
-	else
+#else
+# define ONES UINT64_C(0x0101010101010101)
+# define HIGH UINT64_C(0x8080808080808080)
+# define HASZERO(x) (((x) - ONES) & ~(x) & HIGH)
+	uint64_t w;
+
+	/* eight bytes at a time; a hit only means "look closer" */
+	for (; i + 8 <= len; i += 8)
 	{
-		snprintf(buf, sizeof buf, "<?xml version=\"1.0\"?>\r\n<methodResponse>\r\n");
+		memcpy(&w, s + i, sizeof w);
+		if ((w & HIGH) || HASZERO(w ^ (ONES * '&')) || HASZERO(w ^ (ONES * '<')) ||
+				HASZERO(w ^ (ONES * '>')) || HASZERO(w ^ (ONES * '"')))
+			break;
 	}
-	s->append(s, buf, strlen(buf));
-
-	ss = " <fault>\r\n  <value>\r\n   <struct>\r\n    <member>\r\n     <name>faultCode</name>\r\n     <value><int>";
-	s->append(s, ss, strlen(ss));
-	snprintf(buf, sizeof buf, "%d", code);
-	s->append(s, buf, strlen(buf));
-	ss = "</int></value>\r\n    </member>\r\n    <member>\r\n     <name>faultString</name>\r\n     <value><string>";
-	s->append(s, ss, strlen(ss));
-	xmlrpc_append_char_encode(s, string);
-	ss = "</string></value>\r\n    </member>\r\n   </struct>\r\n  </value>\r\n </fault>\r\n</methodResponse>",
-	s->append(s, ss, strlen(ss));
-
-	len = s->pos;
+# undef HASZERO
+# undef HIGH
+# undef ONES
+#endif
+
+	while (i < len && !xmlrpc_special(s[i]))
+		i++;
+	return i;
+}
 
-	if (xmlrpc.httpheader)
+static size_t xmlrpc_entity(unsigned char c, char *out)
+{
+	switch (c)
 	{
-		char *header = xmlrpc_write_header(len);
-		s2 = smalloc(strlen(header) + len + 1);
-		strcpy(s2, header);
-		memcpy(s2 + strlen(header), s->str, len);
-		xmlrpc.setbuffer(s2, len + strlen(header));
-		free(header);
-		free(s2);
+	  case '&':
+		  memcpy(out, "&amp;", 5);
+		  return 5;
+	  case '<':
+		  memcpy(out, "&lt;", 4);
+		  return 4;
+	  case '>':
+		  memcpy(out, "&gt;", 4);
+		  return 4;
+	  case '"':
+		  memcpy(out, "&quot;", 6);
+		  return 6;
+	  default:
+		  return snprintf(out, 8, "&#%d;", c);
 	}
-	else
-		xmlrpc.setbuffer(s->str, len);
+}
 
-	s->destroy(s);
+/* Escapes value into out, stopping short rather than splitting an entity;
+ * returns the length written, not counting the terminating NUL.
+ */
+static size_t xmlrpc_escape_to(char *out, size_t size, const char *value)
+{
+	const unsigned char *s = (const unsigned char *)value;
+	size_t len, n, pos = 0;
+	char ent[8];
+
+	if (size == 0)
+		return 0;
+	len = value != NULL ? strlen(value) : 0;
+	while (len > 0)
+	{
+		n = xmlrpc_plain_span(s, len);
+		if (n > size - 1 - pos)
+			n = size - 1 - pos;
+		memcpy(out + pos, s, n);
+		pos += n, s += n, len -= n;
+		if (len == 0)
+			break;
+		n = xmlrpc_entity(*s, ent);
+		if (n > size - 1 - pos)
+			break;
+		memcpy(out + pos, ent, n);
+		pos += n, s++, len--;
+	}
+	out[pos] = '\0';
+	return pos;
 }
 
 /*************************************************************************/
 
-int xmlrpc_about(void *userdata, int ac, char **av)
+static void xmlrpc_out_append(const char *s, size_t len)
 {
-	char buf[XMLRPC_BUFSIZE];
-	char buf2[XMLRPC_BUFSIZE];
-	char buf3[XMLRPC_BUFSIZE];
-	char buf4[XMLRPC_BUFSIZE];
-	char *arraydata;
-
-	(void)userdata;
-	xmlrpc_integer(buf3, ac);
-	xmlrpc_string(buf4, av[0]);
-	xmlrpc_string(buf, (char *)XMLLIB_VERSION);
-	xmlrpc_string(buf2, (char *)XMLLIB_AUTHOR);
-	arraydata = xmlrpc_array(4, buf, buf2, buf3, buf4);
+	size_t size;
 
-	xmlrpc_send(1, arraydata);
-	free(arraydata);
-	return XMLRPC_CONT;
+	if (xmlrpc_out.len + len > xmlrpc_out.size)
+	{
+		size = xmlrpc_out.size != 0 ? xmlrpc_out.size : XMLRPC_BUFSIZE;
+		while (size < xmlrpc_out.len + len)
+			size *= 2;
+		xmlrpc_out.buf = srealloc(xmlrpc_out.buf, XMLRPC_HEADROOM + size);
+		xmlrpc_out.size = size;
+	}
+	memcpy(xmlrpc_out.buf + XMLRPC_HEADROOM + xmlrpc_out.len, s, len);
+	xmlrpc_out.len += len;
 }
 
-/*************************************************************************/
+static void xmlrpc_out_puts(const char *s)
+{
+	xmlrpc_out_append(s, strlen(s));
+}
 
-void xmlrpc_send(int argc, ...)
+static void xmlrpc_out_escape(const char *value)
 {
-	va_list va;
-	int idx = 0;
-	int len;
-	char buf[1024];
-	const char *ss;
-	mowgli_string_t *s = mowgli_string_create();
-	char *s2;
-	char *header;
+	const unsigned char *s = (const unsigned char *)value;
+	size_t len, n;
+	char ent[8];
 
-	if (xmlrpc.encode)
-	{
-		snprintf(buf, sizeof buf, "<?xml version=\"1.0\" encoding=\"%s\" ?>\r\n<methodResponse>\r\n<params>\r\n", xmlrpc.encode);
-	}
-	else
+	if (value == NULL)
+		return;
+	len = strlen(value);
+	while (len > 0)
 	{
-		snprintf(buf, sizeof buf, "<?xml version=\"1.0\"?>\r\n<methodResponse>\r\n<params>\r\n");
+		n = xmlrpc_plain_span(s, len);
+		xmlrpc_out_append((const char *)s, n);
+		s += n, len -= n;
+		if (len == 0)
+			break;
+		xmlrpc_out_append(ent, xmlrpc_entity(*s, ent));
+		s++, len--;
 	}
-	s->append(s, buf, strlen(buf));
+}
 
-	va_start(va, argc);
-	for (idx = 0; idx < argc; idx++)
+static void xmlrpc_out_prolog(void)
+{
+	xmlrpc_out_puts("<?xml version=\"1.0\"");
+	if (xmlrpc.encode)
 	{
-		ss = " <param>\r\n  <value>\r\n   ";
-		s->append(s, ss, strlen(ss));
-		ss = va_arg(va, const char *);
-		s->append(s, ss, strlen(ss));
-		ss = "\r\n  </value>\r\n </param>\r\n";
-		s->append(s, ss, strlen(ss));
+		xmlrpc_out_puts(" encoding=\"");
+		xmlrpc_out_puts(xmlrpc.encode);
+		xmlrpc_out_puts("\" ");
 	}
-	va_end(va);
+	xmlrpc_out_puts("?>\r\n<methodResponse>\r\n");
+}
 
-	ss = "</params>\r\n</methodResponse>";
-	s->append(s, ss, strlen(ss));
+static void xmlrpc_out_flush(void)
+{
+	char header[XMLRPC_HEADROOM];
+	char *doc;
+	size_t hlen = 0;
 
-	len = s->pos;
+	if (xmlrpc_out.buf == NULL)
+		return;
+	doc = xmlrpc_out.buf + XMLRPC_HEADROOM;
 
 	if (xmlrpc.httpheader)
 	{
-		header = xmlrpc_write_header(len);
-		s2 = smalloc(strlen(header) + len + 1);
-		strcpy(s2, header);
-		memcpy(s2 + strlen(header), s->str, len);
-		xmlrpc.setbuffer(s2, len + strlen(header));
-		free(header);
-		free(s2);
-		xmlrpc.httpheader = 1;
-	}
-	else
-	{
-		xmlrpc.setbuffer(s->str, len);
+		if (xmlrpc.setheader != NULL)
+			hlen = xmlrpc.setheader(header, sizeof header, xmlrpc_out.len);
+		else
+			hlen = xmlrpc_write_header(header, sizeof header, xmlrpc_out.len);
+		memcpy(doc - hlen, header, hlen);
 	}
+	xmlrpc.setbuffer(doc - hlen, hlen + xmlrpc_out.len);
+	xmlrpc_out.len = 0;
+
 	if (xmlrpc.encode)
 	{
 		free(xmlrpc.encode);
 		xmlrpc.encode = NULL;
 	}
 
-	s->destroy(s);
+	/* don't hold on to the memory of one huge reply */
+	if (xmlrpc_out.size > XMLRPC_OUTBUF_KEEP)
+	{
+		free(xmlrpc_out.buf);
+		xmlrpc_out.buf = NULL;
+		xmlrpc_out.size = 0;
+	}
 }
 
 /*************************************************************************/
 
-void xmlrpc_send_string(const char *value)
+void xmlrpc_response_begin(void)
 {
-	int len;
-	char buf[1024];
-	const char *ss;
-	mowgli_string_t *s = mowgli_string_create();
-	char *s2;
-	char *header;
+	if (xmlrpc_out.state == XMLRPC_REPLY_DONE)
+		return;
 
-	if (xmlrpc.encode)
+	/* a result replaces whatever this call had started to say */
+	if (xmlrpc_out.state == XMLRPC_REPLY_OPEN)
+		xmlrpc_out.len = xmlrpc_out.mark;
+	xmlrpc_out.mark = xmlrpc_out.len;
+	xmlrpc_out.state = XMLRPC_REPLY_OPEN;
+
+	if (xmlrpc_out.multicall)
+		xmlrpc_out_puts("     <value><array><data>");
+	else
 	{
-		snprintf(buf, sizeof buf, "<?xml version=\"1.0\" encoding=\"%s\" ?>\r\n<methodResponse>\r\n<params>\r\n", xmlrpc.encode);
+		xmlrpc_out_prolog();
+		xmlrpc_out_puts("<params>\r\n");
 	}
+}
+
+void xmlrpc_response_end(void)
+{
+	if (xmlrpc_out.state != XMLRPC_REPLY_OPEN)
+		return;
+
+	xmlrpc_out.state = XMLRPC_REPLY_DONE;
+	if (xmlrpc_out.multicall)
+		xmlrpc_out_puts("</data></array></value>\r\n");
 	else
 	{
-		snprintf(buf, sizeof buf, "<?xml version=\"1.0\"?>\r\n<methodResponse>\r\n<params>\r\n");
+		xmlrpc_out_puts("</params>\r\n</methodResponse>");
+		xmlrpc_out_flush();
 	}
-	s->append(s, buf, strlen(buf));
+}
 
-	ss = " <param>\r\n  <value>\r\n   <string>";
-	s->append(s, ss, strlen(ss));
-	xmlrpc_append_char_encode(s, value);
-	ss = "</string>\r\n  </value>\r\n </param>\r\n";
-	s->append(s, ss, strlen(ss));
+static void xmlrpc_param_open(void)
+{
+	if (xmlrpc_out.multicall)
+		xmlrpc_out_puts("<value>");
+	else
+		xmlrpc_out_puts(" <param>\r\n  <value>\r\n   ");
+}
 
-	ss = "</params>\r\n</methodResponse>";
-	s->append(s, ss, strlen(ss));
+static void xmlrpc_param_close(void)
+{
+	if (xmlrpc_out.multicall)
+		xmlrpc_out_puts("</value>");
+	else
+		xmlrpc_out_puts("\r\n  </value>\r\n </param>\r\n");
+}
 
-	len = s->pos;
+void xmlrpc_param(const char *value)
+{
+	if (xmlrpc_out.state != XMLRPC_REPLY_OPEN)
+		return;
+	xmlrpc_param_open();
+	xmlrpc_out_puts(value);
+	xmlrpc_param_close();
+}
 
-	if (xmlrpc.httpheader)
-	{
-		header = xmlrpc_write_header(len);
-		s2 = smalloc(strlen(header) + len + 1);
-		strcpy(s2, header);
-		memcpy(s2 + strlen(header), s->str, len);
-		xmlrpc.setbuffer(s2, len + strlen(header));
-		free(header);
-		free(s2);
-		xmlrpc.httpheader = 1;
-	}
+void xmlrpc_param_boolean(bool value)
+{
+	xmlrpc_param(value ? "<boolean>1</boolean>" : "<boolean>0</boolean>");
+}
+
+void xmlrpc_param_string_begin(void)
+{
+	if (xmlrpc_out.state != XMLRPC_REPLY_OPEN)
+		return;
+	xmlrpc_param_open();
+	xmlrpc_out_puts("<string>");
+}
+
+void xmlrpc_param_string_append(const char *value)
+{
+	if (xmlrpc_out.state != XMLRPC_REPLY_OPEN)
+		return;
+	xmlrpc_out_escape(value);
+}
+
+void xmlrpc_param_string_end(void)
+{
+	if (xmlrpc_out.state != XMLRPC_REPLY_OPEN)
+		return;
+	xmlrpc_out_puts("</string>");
+	xmlrpc_param_close();
+}
+
+void xmlrpc_param_string(const char *value)
+{
+	xmlrpc_param_string_begin();
+	xmlrpc_param_string_append(value);
+	xmlrpc_param_string_end();
+}
+
+/*************************************************************************/
+
+void xmlrpc_generic_error(int code, const char *string)
+{
+	char buf[32];
+
+	if (xmlrpc_out.state == XMLRPC_REPLY_DONE)
+		return;
+	if (xmlrpc_out.state == XMLRPC_REPLY_OPEN)
+		xmlrpc_out.len = xmlrpc_out.mark;
+	xmlrpc_out.state = XMLRPC_REPLY_DONE;
+
+	if (xmlrpc_out.multicall)
+		xmlrpc_out_puts("     ");
 	else
 	{
-		xmlrpc.setbuffer(s->str, len);
+		xmlrpc_out_prolog();
+		xmlrpc_out_puts(" <fault>\r\n  ");
 	}
-	if (xmlrpc.encode)
+
+	xmlrpc_out_puts("<value>\r\n   <struct>\r\n    <member>\r\n     <name>faultCode</name>\r\n     <value><int>");
+	snprintf(buf, sizeof buf, "%d", code);
+	xmlrpc_out_puts(buf);
+	xmlrpc_out_puts("</int></value>\r\n    </member>\r\n    <member>\r\n     <name>faultString</name>\r\n     <value><string>");
+	xmlrpc_out_escape(string);
+	xmlrpc_out_puts("</string></value>\r\n    </member>\r\n   </struct>\r\n  </value>");
+
+	if (xmlrpc_out.multicall)
+		xmlrpc_out_puts("\r\n");
+	else
 	{
-		free(xmlrpc.encode);
-		xmlrpc.encode = NULL;
+		xmlrpc_out_puts("\r\n </fault>\r\n</methodResponse>");
+		xmlrpc_out_flush();
 	}
+}
 
-	s->destroy(s);
+/*************************************************************************/
+
+int xmlrpc_about(void *userdata, int ac, char **av)
+{
+	char buf[XMLRPC_BUFSIZE];
+	char buf2[XMLRPC_BUFSIZE];
+	char buf3[XMLRPC_BUFSIZE];
+	char buf4[XMLRPC_BUFSIZE];
+	char *arraydata;
+
+	(void)userdata;
+	xmlrpc_integer(buf3, ac);
+	xmlrpc_string(buf4, av[0]);
+	xmlrpc_string(buf, (char *)XMLLIB_VERSION);
+	xmlrpc_string(buf2, (char *)XMLLIB_AUTHOR);
+	arraydata = xmlrpc_array(4, buf, buf2, buf3, buf4);
+
+	xmlrpc_send(1, arraydata);
+	free(arraydata);
+	return XMLRPC_CONT;
+}
+
+/*************************************************************************/
+
+void xmlrpc_send(int argc, ...)
+{
+	va_list va;
+	int idx;
+
+	xmlrpc_response_begin();
+	va_start(va, argc);
+	for (idx = 0; idx < argc; idx++)
+		xmlrpc_param(va_arg(va, const char *));
+	va_end(va);
+	xmlrpc_response_end();
+}
+
+/*************************************************************************/
+
+void xmlrpc_send_string(const char *value)
+{
+	xmlrpc_response_begin();
+	xmlrpc_param_string(value);
+	xmlrpc_response_end();
 }
 
 /*************************************************************************/
@@ -542,11 +908,11 @@ char *xmlrpc_integer(char *buf, int value)
 
 char *xmlrpc_string(char *buf, const char *value)
 {
-	char encoded[XMLRPC_BUFSIZE];
-	*buf = '\0';
+	size_t len;
 
-	xmlrpc_char_encode(encoded, value);
-	snprintf(buf, XMLRPC_BUFSIZE, "<string>%s</string>", encoded);
+	memcpy(buf, "<string>", 8);
+	len = 8 + xmlrpc_escape_to(buf + 8, XMLRPC_BUFSIZE - 8 - 9, value);
+	memcpy(buf + len, "</string>", 10);
 	return buf;
 }
 
@@ -573,34 +939,30 @@ char *xmlrpc_double(char *buf, double value)
 char *xmlrpc_array(int argc, ...)
 {
 	va_list va;
-	char *a;
+	const char *a, *ss;
 	int idx = 0;
-	char *s = NULL;
-	int len;
-	char buf[XMLRPC_BUFSIZE];
+	mowgli_string_t *s = mowgli_string_create();
+	char *result;
 
+	ss = "<array>\r\n    <data>\r\n  ";
+	s->append(s, ss, strlen(ss));
 	va_start(va, argc);
 	for (idx = 0; idx < argc; idx++)
 	{
-		a = va_arg(va, char *);
-		if (!s)
-		{
-			snprintf(buf, XMLRPC_BUFSIZE, "   <value>%s</value>", a);
-			s = sstrdup(buf);
-		}
-		else
-		{
-			snprintf(buf, XMLRPC_BUFSIZE, "%s\r\n     <value>%s</value>", s, a);
-			free(s);
-			s = sstrdup(buf);
-		}
+		a = va_arg(va, const char *);
+		ss = idx == 0 ? "   <value>" : "\r\n     <value>";
+		s->append(s, ss, strlen(ss));
+		s->append(s, a, strlen(a));
+		ss = "</value>";
+		s->append(s, ss, strlen(ss));
 	}
 	va_end(va);
+	ss = "\r\n    </data>\r\n   </array>";
+	s->append(s, ss, strlen(ss));
 
-	snprintf(buf, XMLRPC_BUFSIZE, "<array>\r\n    <data>\r\n  %s\r\n    </data>\r\n   </array>", s);
-	len = strlen(buf);
-	free(s);
-	return sstrdup(buf);
+	result = sstrdup(s->str);
+	s->destroy(s);
+	return result;
 }
 
 /*************************************************************************/
@@ -736,91 +1098,7 @@ int xmlrpc_set_options(int type, const char *value)
 
 void xmlrpc_char_encode(char *outbuffer, const char *s1)
 {
-	long unsigned int i;
-	unsigned char c;
-	char buf2[15];
-	mowgli_string_t *s = mowgli_string_create();
-	*buf2 = '\0';
-	*outbuffer = '\0';
-
-	if ((!(s1) || (*(s1) == '\0')))
-	{
-		return;
-	}
-
-	for (i = 0; s1[i] != '\0'; i++)
-	{
-		c = s1[i];
-		if (c > 127)
-		{
-			snprintf(buf2, sizeof buf2, "&#%d;", c);
-			s->append(s, buf2, strlen(buf2));
-		}
-		else if (c == '&')
-		{
-			s->append(s, "&amp;", 5);
-		}
-		else if (c == '<')
-		{
-			s->append(s, "&lt;", 4);
-		}
-		else if (c == '>')
-		{
-			s->append(s, "&gt;", 4);
-		}
-		else if (c == '"')
-		{
-			s->append(s, "&quot;", 6);
-		}
-		else
-		{
-			s->append_char(s, c);
-		}
-	}
-
-	memcpy(outbuffer, s->str, XMLRPC_BUFSIZE);
-}
-
-static void xmlrpc_append_char_encode(mowgli_string_t *s, const char *s1)
-{
-	long unsigned int i;
-	unsigned char c;
-	char buf2[15];
-
-	if ((!(s1) || (*(s1) == '\0')))
-	{
-		return;
-	}
-
-	for (i = 0; s1[i] != '\0'; i++)
-	{
-		c = s1[i];
-		if (c > 127)
-		{
-			snprintf(buf2, sizeof buf2, "&#%d;", c);
-			s->append(s, buf2, strlen(buf2));
-		}
-		else if (c == '&')
-		{
-			s->append(s, "&amp;", 5);
-		}
-		else if (c == '<')
-		{
-			s->append(s, "&lt;", 4);
-		}
-		else if (c == '>')
-		{
-			s->append(s, "&gt;", 4);
-		}
-		else if (c == '"')
-		{
-			s->append(s, "&quot;", 6);
-		}
-		else
-		{
-			s->append_char(s, c);
-		}
-	}
+	xmlrpc_escape_to(outbuffer, XMLRPC_BUFSIZE, s1);
 }
 
 /* In-place decode of some entities
@@ -35,6 +35,8 @@
  */
 
 #define XMLRPC_BUFSIZE         4096
+#define XMLRPC_HEADROOM        512	/* reserved for the HTTP header */
+#define XMLRPC_OUTBUF_KEEP     65536	/* larger output buffers are freed */
 #define XMLLIB_VERSION		 "1.0.0"
 #define XMLLIB_AUTHOR		 "Trystan Scott Lee <trystan@nomadirc.net>"
 
@@ -68,9 +70,20 @@ E char *xmlrpc_time2date(char *buf, time_t t);
 
 E int xmlrpc_set_options(int type, const char *value);
 E void xmlrpc_set_buffer(char *(*func)(char *buffer, int len));
+E void xmlrpc_set_header(size_t (*func)(char *buffer, size_t size, size_t length));
 E void xmlrpc_generic_error(int code, const char *string);
 E void xmlrpc_send(int argc, ...);
 E void xmlrpc_send_string(const char *value);
+
+E void xmlrpc_response_begin(void);
+E void xmlrpc_response_end(void);
+E void xmlrpc_param(const char *value);
+E void xmlrpc_param_boolean(bool value);
+E void xmlrpc_param_string(const char *value);
+E void xmlrpc_param_string_begin(void);
+E void xmlrpc_param_string_append(const char *value);
+E void xmlrpc_param_string_end(void);
+
 E int xmlrpc_about(void *userdata, int ac, char **av);
 E void xmlrpc_char_encode(char *outbuffer, const char *s1);
 E char *xmlrpc_decode_string(char *buf);
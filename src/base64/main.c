@@ -1,12 +1,70 @@
 #include "atheme.h"
 
-int main(int argc, const char *argv)
+/* compare the base64 codecs on SASL-sized (one 400 byte AUTHENTICATE
+ * chunk) and 4 KB inputs */
+static void bench(void)
+{
+	static const size_t sizes[] = { 300, 4096 };
+	const struct base64_codec *c;
+	char src[4096], enc[8192], dec[8192];
+	struct timeval start, tv;
+	size_t i, j, iterations;
+	int ms;
+
+	for (i = 0; i < sizeof src; i++)
+		src[i] = (char)arc4random();
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++)
+	{
+		iterations = (64 * 1024 * 1024) / sizes[i];
+
+		for (c = base64_codecs; c->name != NULL; c++)
+		{
+			if (base64_codec_select(c->name) == NULL)
+			{
+				printf("%-8s %5zu bytes: not supported\n", c->name, sizes[i]);
+				continue;
+			}
+
+			s_time(&start);
+			for (j = 0; j < iterations; j++)
+				base64_encode(src, sizes[i], enc, sizeof enc);
+			e_time(start, &tv);
+			ms = tv2ms(&tv);
+
+			printf("%-8s %5zu bytes: encode %6.1f MB/s", c->name, sizes[i],
+				ms ? (double)(sizes[i] * iterations) / 1048576.0 / (ms / 1000.0) : 0.0);
+
+			s_time(&start);
+			for (j = 0; j < iterations; j++)
+				base64_decode(enc, dec, sizeof dec);
+			e_time(start, &tv);
+			ms = tv2ms(&tv);
+
+			printf(", decode %6.1f MB/s\n",
+				ms ? (double)(sizes[i] * iterations) / 1048576.0 / (ms / 1000.0) : 0.0);
+
+			if (memcmp(src, dec, sizes[i]))
+				printf("%-8s %5zu bytes: round trip FAILED\n", c->name, sizes[i]);
+		}
+	}
+
+	base64_codec_select(NULL);
+}
+
+int main(int argc, char *argv[])
 {
 	char b64[] = "Q2hyaXNUZXN0AENocmlzVGVzdABwbXpqZ3VseGF5ZWJjcGJ3cXFkaA==";
 	char b64out[BUFSIZE];
 	char b64pristine[] = "ChrisTest\0ChrisTest\0pmzjgulxayebcpbwqqdh";
 	int rc;
 
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+	{
+		bench();
+		return 0;
+	}
+
 	rc = base64_decode(b64, b64out, BUFSIZE);
 
 	printf("decode: %d sz: %zu\n", rc, sizeof(b64pristine));
@@ -0,0 +1,628 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * bench: microbenchmarks for libathemecore primitives.
+ *
+ * A synthetic network is built from the dataset size (-n): that many
+ * users, a tenth as many channels (all registered, with access lists),
+ * half as many accounts carrying metadata, and a twentieth as many
+ * K-lines.  Each benchmark then repeats one operation until it has run
+ * for at least -t milliseconds, or over a fixed number of rows for the
+ * db_process benchmarks, and prints one tab-separated line:
+ *
+ *	name	size	ops	ns_per_op
+ *
+ * Lines starting with '#' describe the build and the dataset, so the
+ * output of two builds can be compared with diff, join or a spreadsheet.
+ * Arguments after the options restrict the run to benchmarks whose names
+ * start with one of them.
+ */
+
+#include "atheme.h"
+#include "libathemecore.h"
+#include "conf.h"
+#include "datastream.h"
+#include "serno.h"
+
+#define BENCH_METADATA	8
+#define BENCH_JOINS	5
+#define BENCH_CHANACS	16
+#define BENCH_HOSTACS	4
+
+static unsigned int dataset = 10000;
+static unsigned int mintime = 500;
+static char **filters;
+static int nfilters;
+
+/* results go here so the compiler cannot drop the calls */
+static volatile unsigned long bench_sink;
+
+static unsigned int nusers, nchans, naccts, nklines;
+static user_t **users;
+static char **nuhs, **foldnicks, **fresh;
+static channel_t **chans;
+static mychan_t **mychans;
+static myuser_t **accts;
+static char metakeys[BENCH_METADATA][32];
+static char b64src[400];
+static connection_t *sendq_conn;
+static int sendq_drain = -1;
+
+/*
+ * Plumbing.
+ */
+
+static bool bench_wanted(const char *name)
+{
+	int i;
+
+	if (nfilters == 0)
+		return true;
+
+	for (i = 0; i < nfilters; i++)
+		if (!strncmp(name, filters[i], strlen(filters[i])))
+			return true;
+
+	return false;
+}
+
+static void bench_report(const char *name, unsigned long ops, uint64_t us)
+{
+	printf("%s\t%u\t%lu\t%.1f\n", name, dataset, ops, ops ? (double)us * 1000.0 / ops : 0.0);
+	fflush(stdout);
+}
+
+/*
+ * Run fn(0), fn(1), ... in doubling batches until mintime has passed, or
+ * exactly maxops times if exact is set.  The indirect call costs a
+ * nanosecond or two and is included in every result alike.
+ */
+static void bench_time(const char *name, void (*fn)(unsigned long i), unsigned long maxops, bool exact)
+{
+	unsigned long ops = 0, batch = 64, j;
+	uint64_t start, elapsed;
+
+	start = profile_now();
+	do
+	{
+		for (j = 0; j < batch && ops < maxops; j++)
+			fn(ops++);
+		batch *= 2;
+		elapsed = profile_now() - start;
+	} while (ops < maxops && (exact || elapsed < (uint64_t)mintime * 1000));
+
+	bench_report(name, ops, elapsed);
+}
+
+static void bench_run(const char *name, void (*fn)(unsigned long i))
+{
+	if (bench_wanted(name))
+		bench_time(name, fn, ULONG_MAX, false);
+}
+
+static void flipcase(char *dst, const char *src)
+{
+	for (; *src != '\0'; src++, dst++)
+		*dst = arc4random() % 2 ? ToLower(*src) : ToUpper(*src);
+	*dst = '\0';
+}
+
+/*
+ * The synthetic network.
+ */
+
+static void build_dataset(void)
+{
+	server_t *s;
+	char nick[NICKLEN], user[USERLEN], host[HOSTLEN], ip[HOSTIPLEN], buf[BUFSIZE];
+	unsigned int i, k;
+
+	nusers = dataset;
+	nchans = dataset >= 10 ? dataset / 10 : 1;
+	naccts = dataset >= 2 ? dataset / 2 : 1;
+	nklines = dataset >= 20 ? dataset / 20 : 1;
+
+	users = smalloc(nusers * sizeof *users);
+	nuhs = smalloc(nusers * sizeof *nuhs);
+	foldnicks = smalloc(nusers * sizeof *foldnicks);
+	fresh = smalloc(nusers * sizeof *fresh);
+	chans = smalloc(nchans * sizeof *chans);
+	mychans = smalloc(nchans * sizeof *mychans);
+	accts = smalloc(naccts * sizeof *accts);
+
+	s = server_add("bench.example.net", 1, me.me, ircd->uses_uid ? "1BN" : NULL, "benchmark clients");
+
+	for (i = 0; i < nusers; i++)
+	{
+		snprintf(nick, sizeof nick, "Bench%u", i);
+		snprintf(user, sizeof user, "~b%u", i);
+		snprintf(host, sizeof host, "h%u.isp%u.example.net", i, i % 50);
+		snprintf(ip, sizeof ip, "10.%u.%u.%u", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+		users[i] = user_add(nick, user, host, NULL, ip, ircd->uses_uid ? uid_get() : NULL, "benchmark client", s, CURRTIME);
+
+		snprintf(buf, sizeof buf, "%s!%s@%s", nick, user, host);
+		nuhs[i] = sstrdup(buf);
+		foldnicks[i] = sstrdup(nick);
+		flipcase(foldnicks[i], nick);
+		snprintf(buf, sizeof buf, "Fresh%u", i);
+		fresh[i] = sstrdup(buf);
+	}
+
+	for (i = 0; i < BENCH_METADATA; i++)
+		snprintf(metakeys[i], sizeof metakeys[i], "private:bench:key%u", i);
+
+	for (i = 0; i < naccts; i++)
+	{
+		snprintf(buf, sizeof buf, "bacct%u", i);
+		accts[i] = myuser_add(buf, "*", "bench@example.net", 0);
+
+		for (k = 0; k < BENCH_METADATA; k++)
+			metadata_add(accts[i], metakeys[k], "benchmark value");
+	}
+
+	/* every other user is logged in */
+	for (i = 0; i < nusers; i += 2)
+	{
+		users[i]->myuser = accts[i / 2];
+		mowgli_node_add(users[i], mowgli_node_create(), &accts[i / 2]->logins);
+	}
+
+	for (i = 0; i < nchans; i++)
+	{
+		snprintf(buf, sizeof buf, "#bench%u", i);
+		chans[i] = channel_add(buf, CURRTIME, s);
+		mychans[i] = mychan_add(buf);
+
+		for (k = 0; k < BENCH_CHANACS; k++)
+			chanacs_add(mychans[i], entity(accts[(i * BENCH_CHANACS + k) % naccts]), CA_AOP_DEF, CURRTIME, NULL);
+
+		for (k = 0; k < BENCH_HOSTACS; k++)
+		{
+			snprintf(buf, sizeof buf, "*!*@h%u.isp%u.example.net", i * BENCH_HOSTACS + k, (i * BENCH_HOSTACS + k) % 50);
+			chanacs_add_host(mychans[i], buf, CA_VOICE, CURRTIME, NULL);
+		}
+	}
+
+	/* the first of each user's channels is the one chanuser_find looks at */
+	for (i = 0; i < nusers; i++)
+		for (k = 0; k < BENCH_JOINS; k++)
+			chanuser_add(chans[(i + k * 7) % nchans], CLIENT_NAME(users[i]));
+
+	/* half match one user's host exactly, half are wildcards that miss */
+	for (i = 0; i < nklines; i++)
+	{
+		if (i % 2)
+			snprintf(host, sizeof host, "h%u.isp%u.example.net", i * 20, (i * 20) % 50);
+		else
+			snprintf(host, sizeof host, "*.bad%u.example.org", i);
+		kline_add("*", host, "benchmark", 0, "bench");
+	}
+
+	for (i = 0; i < sizeof b64src; i++)
+		b64src[i] = (char)arc4random();
+}
+
+/*
+ * Matching and casemapping.
+ */
+
+static const char *banmasks[] = { "*!*@*.isp7.example.net", "*spam*!*@*", "Bench1*!*@*", "*!~b4?@*" };
+static const char *cidrmasks[] = { "10.0.0.0/8", "10.0.1.0/24", "192.168.0.0/16", "10.0.0.128/25" };
+
+static void b_match(unsigned long i)
+{
+	bench_sink += match(banmasks[i % ARRAY_SIZE(banmasks)], nuhs[i % nusers]);
+}
+
+static void b_match_cidr(unsigned long i)
+{
+	bench_sink += match_cidr(cidrmasks[i % ARRAY_SIZE(cidrmasks)], users[i % nusers]->ip);
+}
+
+static void b_irccasecmp(unsigned long i)
+{
+	bench_sink += irccasecmp(users[i % nusers]->nick, foldnicks[i % nusers]);
+}
+
+/*
+ * Lookups.
+ */
+
+static void b_user_find_hit(unsigned long i)
+{
+	bench_sink += user_find(foldnicks[i % nusers]) != NULL;
+}
+
+static void b_user_find_miss(unsigned long i)
+{
+	bench_sink += user_find(fresh[i % nusers]) != NULL;
+}
+
+static void b_chanuser_find(unsigned long i)
+{
+	bench_sink += chanuser_find(chans[i % nusers % nchans], users[i % nusers]) != NULL;
+}
+
+static void b_chanacs_user_flags(unsigned long i)
+{
+	bench_sink += chanacs_user_flags(mychans[i % nusers % nchans], users[i % nusers]);
+}
+
+static void b_chanacs_user_flags_uncached(unsigned long i)
+{
+	mychan_t *mc = mychans[i % nusers % nchans];
+
+	chanacs_cache_invalidate(mc);
+	bench_sink += chanacs_user_flags(mc, users[i % nusers]);
+}
+
+static void b_kline_find_user(unsigned long i)
+{
+	bench_sink += kline_find_user(users[i % nusers]) != NULL;
+}
+
+static void b_metadata_find(unsigned long i)
+{
+	bench_sink += metadata_find(accts[i % naccts], metakeys[i % BENCH_METADATA]) != NULL;
+}
+
+static void b_strshare_hit(unsigned long i)
+{
+	strshare_unref(strshare_get(users[i % nusers]->host));
+}
+
+static void b_strshare_new(unsigned long i)
+{
+	strshare_unref(strshare_get(fresh[i % nusers]));
+}
+
+/*
+ * Encoding, output and hooks.
+ */
+
+static char b64enc[800];
+
+static void b_base64_decode(unsigned long i)
+{
+	char out[400];
+
+	bench_sink += base64_decode(b64enc, out, sizeof out);
+}
+
+#define SENDQ_LINE ":services.bench.example.net NOTICE Bench1 :This is a line of typical length for a services reply.\r\n"
+#define SENDQ_BATCH 32
+
+static void b_sendq(unsigned long i)
+{
+	char buf[4096];
+
+	sendq_add(sendq_conn, SENDQ_LINE, sizeof SENDQ_LINE - 1);
+	if (i % SENDQ_BATCH != SENDQ_BATCH - 1)
+		return;
+
+	sendq_flush(sendq_conn);
+	while (read(sendq_drain, buf, sizeof buf) > 0)
+		;
+}
+
+static void bench_hook_fn(void *data)
+{
+	(*(unsigned long *)data)++;
+}
+
+static void b_hook_empty(unsigned long i)
+{
+	hook_call_event("bench_empty", &i);
+}
+
+static void b_hook_one(unsigned long i)
+{
+	hook_call_event("bench_one", &i);
+}
+
+static void b_hook_eight(unsigned long i)
+{
+	hook_call_event("bench_eight", &i);
+}
+
+static void setup_io_and_hooks(void)
+{
+	int fds[2], i;
+
+	if (base64_encode(b64src, 300, b64enc, sizeof b64enc) == (size_t)-1)
+		b64enc[0] = '\0';
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
+	{
+		fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		sendq_conn = connection_add("bench sendq", fds[0], 0, NULL, NULL);
+		sendq_drain = fds[1];
+	}
+
+	hook_add_event("bench_empty");
+	hook_add_hook("bench_one", bench_hook_fn);
+	for (i = 0; i < 8; i++)
+		hook_add_hook("bench_eight", bench_hook_fn);
+}
+
+/*
+ * db_process: rows are fed from memory through a minimal read-only
+ * backend, so only the row handlers and the objects they create are
+ * timed, not opensex's file reading.
+ */
+
+typedef struct {
+	char line[BUFSIZE];
+	char *token;
+} bench_db_t;
+
+static const char *bench_db_read_word(database_handle_t *db)
+{
+	bench_db_t *bd = db->priv;
+	char *res = bd->token, *p;
+
+	if (res == NULL)
+		return NULL;
+
+	if ((p = strchr(res, ' ')) != NULL)
+	{
+		*p++ = '\0';
+		bd->token = p;
+	}
+	else
+		bd->token = NULL;
+
+	db->token++;
+	return res;
+}
+
+static const char *bench_db_read_str(database_handle_t *db)
+{
+	bench_db_t *bd = db->priv;
+	char *res = bd->token;
+
+	bd->token = NULL;
+	db->token++;
+	return res;
+}
+
+static bool bench_db_read_int(database_handle_t *db, int *res)
+{
+	const char *s = bench_db_read_word(db);
+	char *end;
+
+	if (s == NULL)
+		return false;
+	*res = strtol(s, &end, 10);
+	return *end == '\0';
+}
+
+static bool bench_db_read_uint(database_handle_t *db, unsigned int *res)
+{
+	const char *s = bench_db_read_word(db);
+	char *end;
+
+	if (s == NULL)
+		return false;
+	*res = strtoul(s, &end, 10);
+	return *end == '\0';
+}
+
+static bool bench_db_read_time(database_handle_t *db, time_t *res)
+{
+	const char *s = bench_db_read_word(db);
+	char *end;
+
+	if (s == NULL)
+		return false;
+	*res = strtoul(s, &end, 10);
+	return *end == '\0';
+}
+
+static database_vtable_t bench_db_vt = {
+	.name = "bench",
+	.read_word = bench_db_read_word,
+	.read_str = bench_db_read_str,
+	.read_int = bench_db_read_int,
+	.read_uint = bench_db_read_uint,
+	.read_time = bench_db_read_time,
+};
+
+static bench_db_t bench_db_priv;
+static database_handle_t bench_db = {
+	.priv = &bench_db_priv,
+	.vt = &bench_db_vt,
+	.txn = DB_READ,
+	.file = "<bench>",
+};
+
+static const char *db_rowtype;
+
+static void bench_db_row(const char *type, const char *fmt, ...) PRINTFLIKE(2, 3);
+
+static void bench_db_row(const char *type, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(bench_db_priv.line, sizeof bench_db_priv.line, fmt, args);
+	va_end(args);
+
+	bench_db_priv.token = bench_db_priv.line;
+	bench_db.line++;
+	bench_db.token = 0;
+	db_process(&bench_db, type);
+}
+
+/*
+ * Each row type refers to the objects made by the ones before it, so
+ * they run in this order and over the same count.  Formatting the row
+ * is included in the time; it is small next to what the handlers do.
+ */
+static void b_db_row(unsigned long i)
+{
+	unsigned long ts = (unsigned long)CURRTIME;
+
+	if (!strcmp(db_rowtype, "MU"))
+		bench_db_row("MU", "9B%07lu dbacct%lu * bench@example.net %lu %lu + en", i, i, ts, ts);
+	else if (!strcmp(db_rowtype, "MDU"))
+		bench_db_row("MDU", "dbacct%lu private:bench:key%lu benchmark value", i, i % BENCH_METADATA);
+	else if (!strcmp(db_rowtype, "MN"))
+		bench_db_row("MN", "dbacct%lu dbacct%lu %lu %lu", i, i, ts, ts);
+	else if (!strcmp(db_rowtype, "MC"))
+		bench_db_row("MC", "#dbchan%lu %lu %lu +kt 0 0 0", i, ts, ts);
+	else if (!strcmp(db_rowtype, "CA"))
+		bench_db_row("CA", "#dbchan%lu dbacct%lu +AOiortv %lu dbacct0", i, i, ts);
+	else if (!strcmp(db_rowtype, "MDC"))
+		bench_db_row("MDC", "#dbchan%lu private:topic:text a typical channel topic", i);
+	else if (!strcmp(db_rowtype, "KL"))
+		bench_db_row("KL", "%lu * db%lu.bad.example.org 0 %lu bench a typical kline reason", 100000 + i, i, ts);
+}
+
+static void bench_db_rows(void)
+{
+	static const char *types[] = { "MU", "MDU", "MN", "MC", "CA", "MDC", "KL" };
+	char name[64];
+	size_t i;
+	bool wanted = false;
+
+	if (module_find_published("backend/corestorage") == NULL)
+	{
+		printf("# db_process: backend/corestorage is not loaded; skipped\n");
+		return;
+	}
+
+	bench_db_row("DBV", "12");
+
+	/* a row type left out would leave the later ones dangling, so
+	 * asking for any of them runs them all */
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+	{
+		snprintf(name, sizeof name, "db_process/%s", types[i]);
+		wanted |= bench_wanted(name);
+	}
+	if (!wanted)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+	{
+		db_rowtype = types[i];
+		snprintf(name, sizeof name, "db_process/%s", types[i]);
+		bench_time(name, b_db_row, dataset, true);
+	}
+}
+
+/*
+ * main
+ */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-c config] [-n size] [-t msec] [benchmark-prefix...]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	char *config_file = "./bench.conf";
+	mowgli_getopt_option_t long_opts[] = {
+		{ NULL, 0, NULL, 0, 0 },
+	};
+	int r;
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/bench.log");
+	atheme_setup();
+
+	while ((r = mowgli_getopt_long(argc, argv, "c:n:t:", long_opts, NULL)) != -1)
+	{
+		switch (r)
+		{
+		  case 'c':
+			  config_file = mowgli_optarg;
+			  break;
+		  case 'n':
+			  dataset = atoi(mowgli_optarg);
+			  break;
+		  case 't':
+			  mintime = atoi(mowgli_optarg);
+			  break;
+		  default:
+			  usage(argv[0]);
+		}
+	}
+	if (dataset == 0)
+		usage(argv[0]);
+	filters = argv + mowgli_optind;
+	nfilters = argc - mowgli_optind;
+
+	runflags = RF_LIVE;
+	datadir = DATADIR;
+	strict_mode = false;
+	offline_mode = true;
+	cold_start = true;
+
+	conf_init();
+	if (!conf_parse(config_file) || ircd == NULL)
+	{
+		fprintf(stderr, "%s: could not load %s\n", argv[0], config_file);
+		return EXIT_FAILURE;
+	}
+	servtree_update(NULL);
+
+	mowgli_eventloop_synchronize(base_eventloop);
+	CURRTIME = mowgli_eventloop_get_time(base_eventloop);
+
+	build_dataset();
+	setup_io_and_hooks();
+
+	printf("# atheme %s (%s) bench\n", PACKAGE_VERSION, SERNO);
+	printf("# protocol %s, casemap kernel %s, base64 codec %s\n", ircd->ircdname,
+			match_kernel_select(NULL)->name, base64_codec_select(NULL)->name);
+	printf("# %u users, %u channels, %u accounts, %u klines\n", nusers, nchans, naccts, nklines);
+	printf("# name\tsize\tops\tns_per_op\n");
+
+	bench_run("match", b_match);
+	bench_run("match_cidr", b_match_cidr);
+	bench_run("irccasecmp", b_irccasecmp);
+	bench_run("user_find/hit", b_user_find_hit);
+	bench_run("user_find/miss", b_user_find_miss);
+	bench_run("chanuser_find", b_chanuser_find);
+	bench_run("chanacs_user_flags/cached", b_chanacs_user_flags);
+	bench_run("chanacs_user_flags/uncached", b_chanacs_user_flags_uncached);
+	bench_run("kline_find_user", b_kline_find_user);
+	bench_run("metadata_find", b_metadata_find);
+	bench_run("strshare_get/hit", b_strshare_hit);
+	bench_run("strshare_get/new", b_strshare_new);
+	bench_run("base64_decode/300", b_base64_decode);
+	if (sendq_conn != NULL)
+		bench_run("sendq_add+flush", b_sendq);
+	bench_run("hook/none", b_hook_empty);
+	bench_run("hook/one", b_hook_one);
+	bench_run("hook/eight", b_hook_eight);
+	bench_db_rows();
+
+	if (bench_sink == 42)
+		printf("# %lu\n", bench_sink);
+
+	return EXIT_SUCCESS;
+}
@@ -26,6 +26,8 @@
 
 static struct timeval burstbegin;
 static bool bursting = false;
+static bool chanbursting = false;
+static mowgli_eventloop_timer_t *chanburst_timer = NULL;
 
 void bootstrap(void)
 {
@@ -75,6 +77,37 @@ void burst_world(void)
 	bursting = true;
 }
 
+static void chanburst_check(void *unused)
+{
+	if (join_burst_pending() != 0)
+		return;
+
+	mowgli_timer_destroy(base_eventloop, chanburst_timer);
+	chanburst_timer = NULL;
+
+	ping_sts();
+}
+
+void burst_channels(void)
+{
+	int i;
+	char chanbuf[BUFSIZE];
+
+	slog(LG_INFO, "user burst complete, starting channel burst");
+
+	s_time(&burstbegin);
+
+	for (i = 50000; i > 0; i--)
+	{
+		snprintf(chanbuf, sizeof chanbuf, "#dragon%d", i);
+		join_burst(chanbuf, "User1", NULL);
+		join_burst(chanbuf, "User2", NULL);
+	}
+
+	chanburst_timer = mowgli_timer_add(base_eventloop, "chanburst_check", chanburst_check, NULL, 1);
+	chanbursting = true;
+}
+
 void phase_buildworld(void)
 {
 	struct timeval ts, te;
@@ -88,6 +121,119 @@ void phase_buildworld(void)
 	slog(LG_INFO, "world created in %d msec", tv2ms(&te));
 }
 
+#define CHURN_COUNT	50000
+
+/* every client interns its nick, user, host, ip and gecos on connect and
+ * drops them again on quit */
+void phase_connectquit(void)
+{
+	struct timeval ts, te;
+	user_t **churn;
+	char nick[NICKLEN], user[USERLEN], host[HOSTLEN], ip[HOSTIPLEN], gecos[GECOSLEN];
+	int i;
+
+	churn = smalloc(CHURN_COUNT * sizeof *churn);
+
+	s_time(&ts);
+	for (i = 0; i < CHURN_COUNT; i++)
+	{
+		snprintf(nick, sizeof nick, "Churn%d", i);
+		snprintf(user, sizeof user, "churn%d", i % 1000);
+		snprintf(host, sizeof host, "host%d.example.net", i);
+		snprintf(ip, sizeof ip, "10.%d.%d.%d", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+		snprintf(gecos, sizeof gecos, "Churning user %d", i % 100);
+		churn[i] = user_add(nick, user, host, NULL, ip, ircd->uses_uid ? uid_get() : NULL, gecos, me.me, CURRTIME);
+	}
+	e_time(ts, &te);
+
+	slog(LG_INFO, "%d connects in %d msec", CHURN_COUNT, tv2ms(&te));
+
+	s_time(&ts);
+	for (i = 0; i < CHURN_COUNT; i++)
+		if (churn[i] != NULL)
+			user_delete(churn[i], "dragon");
+	e_time(ts, &te);
+
+	slog(LG_INFO, "%d quits in %d msec", CHURN_COUNT, tv2ms(&te));
+
+	free(churn);
+}
+
+#define LINE_COUNT	20000
+#define LINEAR_SAMPLE	200
+
+/* what xline_find_user() and qline_find_user() used to do */
+static bool linear_lines_match(user_t *u)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, xlnlist.head)
+		if (!match(((xline_t *)n->data)->realname, u->gecos))
+			return true;
+
+	MOWGLI_ITER_FOREACH(n, qlnlist.head)
+	{
+		qline_t *q = n->data;
+
+		if (q->mask[0] != '#' && q->mask[0] != '&' && !match(q->mask, u->nick))
+			return true;
+	}
+
+	return false;
+}
+
+void phase_lines(void)
+{
+	struct timeval ts, te;
+	mowgli_patricia_iteration_state_t state;
+	user_t *u;
+	char buf[BUFSIZE];
+	unsigned int i, users = 0, hits = 0;
+
+	slog(LG_INFO, "adding %d SGLINEs and SQLINEs", LINE_COUNT);
+
+	for (i = 0; i < LINE_COUNT; i++)
+	{
+		switch (i % 5)
+		{
+		case 0: snprintf(buf, sizeof buf, "spambot%u*", i); break;
+		case 1: snprintf(buf, sizeof buf, "*drone%u", i); break;
+		case 2: snprintf(buf, sizeof buf, "*flood?%u*", i); break;
+		case 3: snprintf(buf, sizeof buf, "Evil%u", i); break;
+		default: snprintf(buf, sizeof buf, "User%u", i * 7); break;
+		}
+
+		xline_add(buf, "dragon", 0, "dragon");
+		qline_add(buf, "dragon", 0, "dragon");
+	}
+
+	s_time(&ts);
+	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
+	{
+		users++;
+		if (xline_find_user(u) != NULL || qline_find_user(u) != NULL)
+			hits++;
+	}
+	e_time(ts, &te);
+
+	slog(LG_INFO, "compiled: checked %u users against %d lines each in %d msec (%u hits)",
+			users, LINE_COUNT * 2, tv2ms(&te), hits);
+
+	users = hits = 0;
+	s_time(&ts);
+	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
+	{
+		if (users++ == LINEAR_SAMPLE)
+			break;
+		if (linear_lines_match(u))
+			hits++;
+	}
+	e_time(ts, &te);
+
+	slog(LG_INFO, "linear: checked %d users against %d lines each in %d msec (%u hits)",
+			LINEAR_SAMPLE, LINE_COUNT * 2, tv2ms(&te), hits);
+}
+
 static void m_pong(sourceinfo_t *si, int parc, char *parv[])
 {
 	struct timeval te;
@@ -100,7 +246,14 @@ static void m_pong(sourceinfo_t *si, int parc, char *parv[])
 
 	e_time(burstbegin, &te);
 
-	slog(LG_INFO, "burst took %d msec", tv2ms(&te));
+	if (!chanbursting)
+	{
+		slog(LG_INFO, "burst took %d msec", tv2ms(&te));
+		burst_channels();
+		return;
+	}
+
+	slog(LG_INFO, "channel burst took %d msec (%u bytes sent)", tv2ms(&te), cnt.bout);
 
 	runflags |= RF_SHUTDOWN;
 }
@@ -139,6 +292,8 @@ int main(int argc, char *argv[])
 	CURRTIME = mowgli_eventloop_get_time(base_eventloop);
 
 	phase_buildworld();
+	phase_connectquit();
+	phase_lines();
 	uplink_connect();
 
 	slog(LG_INFO, "uplink: %s @%p", curr_uplink->name, curr_uplink);
@@ -0,0 +1,185 @@
+#include "atheme.h"
+
+#define CHECK_ROUNDS	100000
+#define BENCH_CALLS	(4 * 1024 * 1024)
+
+static const char nickchars[] = "abcxyzABCXYZ[]{}\\|^~-_`0129";
+
+static void randstr(char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = nickchars[arc4random() % (sizeof nickchars - 1)];
+	buf[len] = '\0';
+}
+
+/* the same string with random letters' case flipped */
+static void flipcase(char *dst, const char *src)
+{
+	for (; *src != '\0'; src++, dst++)
+		*dst = arc4random() % 2 ? ToLower(*src) : ToUpper(*src);
+	*dst = '\0';
+}
+
+static int sign(int x)
+{
+	return x < 0 ? -1 : x > 0;
+}
+
+/* compare every kernel with the scalar one on random strings */
+static bool check(void)
+{
+	const struct match_kernel *k, *scalar = &match_kernels[0];
+	char a[300], b[300], ca[300], cb[300];
+	const char *fa, *fb;
+	size_t len, n, at;
+	unsigned int i;
+	bool ok = true;
+
+	for (k = match_kernels; k->name != NULL; k++)
+	{
+		if (match_kernel_select(k->name) == NULL)
+		{
+			printf("%-8s not supported\n", k->name);
+			continue;
+		}
+
+		for (i = 0; i < CHECK_ROUNDS; i++)
+		{
+			len = arc4random() % (i % 8 ? 24 : 256);
+			randstr(a, len);
+			flipcase(b, a);
+			if (len != 0 && arc4random() % 2)
+				b[arc4random() % len] = nickchars[arc4random() % (sizeof nickchars - 1)];
+			n = 1 + arc4random() % (len + 4);
+
+			if (sign(k->cmp(a, b)) != sign(scalar->cmp(a, b)) ||
+					(len != 0 && sign(k->ncmp(a, b, n)) != sign(scalar->ncmp(a, b, n))))
+			{
+				printf("%-8s compare FAILED: \"%s\" \"%s\" (n %zu)\n", k->name, a, b, n);
+				ok = false;
+				break;
+			}
+
+			mowgli_strlcpy(ca, a, sizeof ca);
+			mowgli_strlcpy(cb, a, sizeof cb);
+			k->canon(ca);
+			scalar->canon(cb);
+			if (strcmp(ca, cb))
+			{
+				printf("%-8s canon FAILED: \"%s\"\n", k->name, a);
+				ok = false;
+				break;
+			}
+
+			if (len == 0)
+				continue;
+			at = arc4random() % len;
+			n = 1 + arc4random() % (len - at);
+			fa = k->find(b, len, a + at, n);
+			fb = scalar->find(b, len, a + at, n);
+			if (fa != fb)
+			{
+				printf("%-8s find FAILED: \"%.*s\" in \"%s\"\n", k->name, (int)n, a + at, b);
+				ok = false;
+				break;
+			}
+		}
+
+		if (i == CHECK_ROUNDS)
+			printf("%-8s ok\n", k->name);
+	}
+
+	match_kernel_select(NULL);
+
+	return ok;
+}
+
+static double bench_rate(struct timeval *start, unsigned long calls)
+{
+	struct timeval tv;
+	int ms;
+
+	e_time(*start, &tv);
+	ms = tv2ms(&tv);
+
+	return ms ? (double)calls / 1000000.0 / (ms / 1000.0) : 0.0;
+}
+
+/* nickname-sized and gecos-sized compares and canonicalizations, and
+ * ban-style masks against hostnames, in millions of calls per second */
+static void bench(void)
+{
+	static const size_t sizes[] = { 9, 30, 200 };
+	static const char *masks[] = { "*!*@*.example.net", "*spambot*", "*!*@192.168.*", "Guest*!*@*" };
+	const struct match_kernel *k;
+	char a[256], b[256], c[256], names[64][128];
+	struct timeval start;
+	size_t i, j;
+	int hits = 0;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+	{
+		randstr(a, 8);
+		randstr(b, 20 + i);
+		snprintf(names[i], sizeof names[i], "%s!~%s@%s.%s", a, a, b, i % 4 ? "example.net" : "168.192.in-addr.arpa");
+	}
+
+	for (k = match_kernels; k->name != NULL; k++)
+	{
+		if (match_kernel_select(k->name) == NULL)
+		{
+			printf("%-8s not supported\n", k->name);
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_SIZE(sizes); i++)
+		{
+			randstr(a, sizes[i]);
+			flipcase(b, a);
+
+			s_time(&start);
+			for (j = 0; j < BENCH_CALLS; j++)
+				hits += !irccasecmp(a, b);
+			printf("%-8s %3zu bytes: irccasecmp %7.1f M/s", k->name, sizes[i], bench_rate(&start, BENCH_CALLS));
+
+			s_time(&start);
+			for (j = 0; j < BENCH_CALLS; j++)
+			{
+				memcpy(c, a, sizes[i] + 1);
+				irccasecanon(c);
+			}
+			printf(", irccasecanon %7.1f M/s\n", bench_rate(&start, BENCH_CALLS));
+		}
+
+		s_time(&start);
+		for (j = 0; j < BENCH_CALLS; j++)
+			hits += !match(masks[j % ARRAY_SIZE(masks)], names[j % ARRAY_SIZE(names)]);
+		printf("%-8s match %7.1f M/s\n", k->name, bench_rate(&start, BENCH_CALLS));
+	}
+
+	match_kernel_select(NULL);
+
+	/* keep the calls from being optimized away */
+	if (hits < 0)
+		printf("%d\n", hits);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+	{
+		bench();
+		return 0;
+	}
+
+	if (!check())
+	{
+		printf("FAIL.\n");
+		return 1;
+	}
+
+	printf("PASS.\n");
+	return 0;
+}
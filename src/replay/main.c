@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * replay: feed a captured uplink stream to services.
+ *
+ * Services started with general::uplink_capture set write every line
+ * they receive from their uplink, with its arrival time, to a capture
+ * file.  This loads the configuration and database given (nothing is
+ * saved), links to a fake uplink over a socketpair and sends it the
+ * lines of one connection from the capture, either at the recorded pace
+ * (optionally sped up) or as fast as services will take them.  Whatever
+ * services send back is read and thrown away.
+ *
+ * The configuration should be a copy of the one the capture was taken
+ * with: the server name, numeric and protocol module must match for the
+ * uplink's messages to make sense, and the first uplink block must have
+ * the receive password the captured uplink sent.
+ *
+ * At the end it prints the number of lines, the time taken, lines per
+ * second and peak RSS, then one tab-separated line per profiled path
+ * (irc/<command>, hook/<event>, ...) that ran during the replay:
+ *
+ *	path	count	total_ms	mean_us	p50_us	p99_us	max_us
+ */
+
+#include "atheme.h"
+#include "libathemecore.h"
+#include "uplink.h"
+#include "conf.h"
+#include "datastream.h"
+#include "serno.h"
+
+#include <sys/resource.h>
+
+static FILE *capture;
+static const char *capture_name;
+static unsigned int want_session = 1, session;
+static bool maxspeed;
+static double speed = 1.0;
+
+static int uplink_fd = -1;
+static char line[BUFSIZE * 2];
+static size_t line_len, line_off;
+static uint64_t line_ts;
+static bool have_line, capture_done;
+
+static uint64_t first_ts, start_us;
+static unsigned long lines_sent, bytes_sent, bytes_recv;
+static unsigned int bin_start;
+
+/*
+ * Reading the capture.
+ */
+
+static void check_header(const char *hdr)
+{
+	char uplink[BUFSIZE], name[BUFSIZE], proto[BUFSIZE];
+
+	if (sscanf(hdr, "# connect %511s %511s %511s", uplink, name, proto) != 3)
+		return;
+
+	if (irccasecmp(name, me.name))
+		fprintf(stderr, "replay: warning: capture was taken as %s, replaying as %s\n", name, me.name);
+	if (strcmp(proto, ircd->ircdname))
+		fprintf(stderr, "replay: warning: capture was taken with %s, replaying with %s\n", proto, ircd->ircdname);
+}
+
+/* read the next line of the wanted session into line[] */
+static bool next_line(void)
+{
+	char buf[BUFSIZE * 2 + 32];
+	char *p, *end;
+	unsigned long sec, usec;
+	size_t len;
+
+	while (fgets(buf, sizeof buf, capture) != NULL)
+	{
+		if (!strncmp(buf, "# connect ", 10))
+		{
+			if (session++ == want_session)
+				return false;
+			if (session == want_session)
+				check_header(buf);
+			continue;
+		}
+		if (*buf == '#')
+			continue;
+
+		/* lines before the first header count as the first session */
+		if (session == 0)
+			session = 1;
+		if (session != want_session)
+			continue;
+
+		sec = strtoul(buf, &end, 10);
+		if (*end != '.')
+			continue;
+		usec = strtoul(end + 1, &p, 10);
+		if (*p != ' ')
+			continue;
+		p++;
+
+		len = strcspn(p, "\r\n");
+		if (len > sizeof line - 2)
+			len = sizeof line - 2;
+		memcpy(line, p, len);
+		line[len++] = '\r';
+		line[len++] = '\n';
+
+		line_len = len;
+		line_off = 0;
+		line_ts = (uint64_t)sec * 1000000 + usec;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Feeding services.
+ */
+
+/* microseconds until the pending line is due, 0 if it is */
+static uint64_t line_wait(void)
+{
+	uint64_t due, now;
+
+	if (maxspeed || line_ts <= first_ts)
+		return 0;
+
+	due = start_us + (uint64_t)((line_ts - first_ts) / speed);
+	now = profile_now();
+
+	return due > now ? due - now : 0;
+}
+
+/* write whatever is due, until the socket buffer fills up */
+static void feed(void)
+{
+	ssize_t n;
+
+	while (!capture_done)
+	{
+		if (!have_line)
+		{
+			if (!next_line())
+			{
+				capture_done = true;
+				break;
+			}
+			if (lines_sent == 0)
+				first_ts = line_ts;
+			have_line = true;
+		}
+
+		if (line_off == 0 && line_wait() != 0)
+			break;
+
+		n = write(uplink_fd, line + line_off, line_len - line_off);
+		if (n <= 0)
+			break;
+
+		line_off += n;
+		bytes_sent += n;
+		if (line_off < line_len)
+			break;
+
+		lines_sent++;
+		have_line = false;
+	}
+}
+
+/* throw away what services sent; returns false once they hung up */
+static bool drain(void)
+{
+	char buf[16384];
+	ssize_t n;
+
+	while ((n = read(uplink_fd, buf, sizeof buf)) > 0)
+		bytes_recv += n;
+
+	return n != 0;
+}
+
+static void connect_fake_uplink(void)
+{
+	connection_t *cptr;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+	{
+		perror("replay: socketpair");
+		exit(EXIT_FAILURE);
+	}
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	uplink_fd = fds[1];
+
+	if (uplinks.head == NULL)
+		uplink_add("replay.uplink", "127.0.0.1", "replay", "replay", NULL, 6667);
+	curr_uplink = uplinks.head->data;
+
+	cptr = connection_add("replay uplink", fds[0], 0, NULL, NULL);
+	if (cptr == NULL)
+	{
+		fprintf(stderr, "replay: could not register the fake uplink\n");
+		exit(EXIT_FAILURE);
+	}
+	curr_uplink->conn = cptr;
+	sendq_set_limit(cptr, config_options.uplink_sendq_limit);
+
+	irc_handle_connect(cptr);
+}
+
+static void run(void)
+{
+	uint64_t wait;
+	bool alive = true;
+
+	start_us = profile_now();
+	bin_start = cnt.bin;
+
+	while (!(runflags & (RF_SHUTDOWN | RF_RESTART)))
+	{
+		CURRTIME = mowgli_eventloop_get_time(base_eventloop);
+
+		feed();
+
+		if (capture_done && cnt.bin - bin_start == (unsigned int)bytes_sent)
+			break;
+
+		/* sleep until the next line is due, but keep reading */
+		wait = have_line && line_off == 0 ? line_wait() : 0;
+		if (wait > 100000)
+			wait = 100000;
+		mowgli_eventloop_timeout_once(base_eventloop, wait / 1000);
+
+		if (!(alive = drain()))
+			break;
+	}
+
+	if (!alive)
+		fprintf(stderr, "replay: services closed the uplink connection after %lu lines\n", lines_sent);
+}
+
+/*
+ * Reporting.
+ */
+
+static long peak_rss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return -1;
+
+	return ru.ru_maxrss;
+}
+
+static int profile_cmp_total(const void *a, const void *b)
+{
+	const profile_entry_t *pa = *(const profile_entry_t * const *)a;
+	const profile_entry_t *pb = *(const profile_entry_t * const *)b;
+
+	if (pa->total_us != pb->total_us)
+		return pa->total_us < pb->total_us ? 1 : -1;
+	return strcmp(pa->path, pb->path);
+}
+
+static void report(long rss_before)
+{
+	mowgli_patricia_iteration_state_t state;
+	profile_entry_t *pe, **entries;
+	size_t i, n = 0;
+	double secs;
+
+	secs = (profile_now() - start_us) / 1000000.0;
+
+	printf("# atheme %s (%s) replay of %s, session %u\n", PACKAGE_VERSION, SERNO, capture_name, want_session);
+	printf("# protocol %s, %s\n", ircd->ircdname, maxspeed ? "maximum speed" : "recorded pace");
+	if (!maxspeed && speed != 1.0)
+		printf("# sped up %.2fx\n", speed);
+	printf("# %lu lines (%lu bytes) in %.3f s, %.0f lines/s, %lu bytes sent back\n",
+			lines_sent, bytes_sent, secs, secs > 0 ? lines_sent / secs : 0.0, bytes_recv);
+	printf("# peak RSS %ld KiB (%ld KiB before the replay)\n", peak_rss(), rss_before);
+
+	entries = smalloc(sizeof *entries * (mowgli_patricia_size(profile_entries) + 1));
+	MOWGLI_PATRICIA_FOREACH(pe, &state, profile_entries)
+		if (pe->count != 0)
+			entries[n++] = pe;
+	qsort(entries, n, sizeof *entries, profile_cmp_total);
+
+	printf("# path\tcount\ttotal_ms\tmean_us\tp50_us\tp99_us\tmax_us\n");
+	for (i = 0; i < n; i++)
+	{
+		pe = entries[i];
+		printf("%s\t%lu\t%.3f\t%.1f\t%lu\t%lu\t%lu\n", pe->path, pe->count,
+				pe->total_us / 1000.0, (double)pe->total_us / pe->count,
+				(unsigned long)profile_percentile(pe, 50),
+				(unsigned long)profile_percentile(pe, 99),
+				(unsigned long)pe->max_us);
+	}
+
+	free(entries);
+}
+
+/*
+ * main
+ */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-c config] [-m] [-x factor] [-s session] capture\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	char *config_file = SYSCONFDIR "/atheme.conf";
+	mowgli_getopt_option_t long_opts[] = {
+		{ NULL, 0, NULL, 0, 0 },
+	};
+	long rss_before;
+	int r;
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/replay.log");
+	atheme_setup();
+
+	while ((r = mowgli_getopt_long(argc, argv, "c:mx:s:", long_opts, NULL)) != -1)
+	{
+		switch (r)
+		{
+		  case 'c':
+			  config_file = mowgli_optarg;
+			  break;
+		  case 'm':
+			  maxspeed = true;
+			  break;
+		  case 'x':
+			  speed = atof(mowgli_optarg);
+			  break;
+		  case 's':
+			  want_session = atoi(mowgli_optarg);
+			  break;
+		  default:
+			  usage(argv[0]);
+		}
+	}
+	if (mowgli_optind != argc - 1 || speed <= 0 || want_session == 0)
+		usage(argv[0]);
+
+	capture_name = argv[mowgli_optind];
+	capture = fopen(capture_name, "r");
+	if (capture == NULL)
+	{
+		perror(capture_name);
+		return EXIT_FAILURE;
+	}
+
+#ifdef SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	runflags = RF_LIVE;
+	datadir = DATADIR;
+	strict_mode = false;
+	readonly = true;
+	cold_start = true;
+
+	conf_init();
+	if (!conf_parse(config_file) || ircd == NULL)
+	{
+		fprintf(stderr, "%s: could not load %s\n", argv[0], config_file);
+		return EXIT_FAILURE;
+	}
+	servtree_update(NULL);
+
+	/* don't capture the replay */
+	free(config_options.uplink_capture);
+	config_options.uplink_capture = NULL;
+
+	cold_start = false;
+
+	mowgli_eventloop_synchronize(base_eventloop);
+	CURRTIME = mowgli_eventloop_get_time(base_eventloop);
+
+	if (db_load)
+		db_load(NULL);
+	db_check();
+
+	rss_before = peak_rss();
+	profile_reset();
+
+	connect_fake_uplink();
+	run();
+	report(rss_before);
+
+	return EXIT_SUCCESS;
+}